@@ -0,0 +1,368 @@
+#include "clipmap.h"
+#include "../common/shader.h"
+#include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// Spans a ring is split into along one axis at most: 2 patches, the hole of 4 patches and 2 patches,
+// and the 2 quads left over
+static const int MAX_SPANS = 10;
+
+// Vertices only have an index into the patch, the piece they belong to comes from the instance.
+// Everything is in samples of the map until the position is scaled by tileSize.
+static const char* VERTEX_SRC = "#version 330 core\n"
+                                "layout(location=0) in ivec3 piece;"    // First row and column in samples, and the level
+                                "uniform mat4 model;"
+                                "uniform mat4 view;"
+                                "uniform mat4 projection;"
+                                "uniform sampler2D heights;"
+                                "uniform vec2 heightRange;"             // Lowest height and the highest minus the lowest
+                                "uniform ivec2 size;"                   // Rows and columns of the map
+                                "uniform float tileSize;"
+                                "uniform int patchVertices;"
+                                "uniform vec2 center;"                  // Where the rings are centered, in samples
+                                "uniform vec2 morphRange;"              // Quads from the center at which morphing starts and 1 / its length
+                                "uniform int coarsestLevel;"
+                                "out vec2 texCoord;"
+                                "float fetch(ivec2 point)"
+                                "{"
+                                "    return texelFetch(heights, clamp(point, ivec2(0), size - 1).yx, 0).r;"
+                                "}"
+                                "void main()"
+                                "{"
+                                "    int step = 1 << piece.z;"
+                                "    ivec2 point = piece.xy + ivec2(gl_VertexID / patchVertices, gl_VertexID % patchVertices) * step;"
+                                "    vec2 distance = abs(vec2(point) - center) / float(step);"
+                                "    float morph = piece.z < coarsestLevel ? clamp((max(distance.x, distance.y) - morphRange.x) * morphRange.y, 0.0, 1.0) : 0.0;"
+                                // Odd vertices slide onto their even neighbour, which turns the grid into that of the next ring
+                                "    ivec2 odd = (point >> piece.z) & 1;"
+                                "    vec2 position = clamp(vec2(point) - vec2(odd * step) * morph, vec2(0.0), vec2(size - 1));"
+                                "    float height = heightRange.x + mix(fetch(point), fetch(point - odd * step), morph) * heightRange.y;"
+                                "    texCoord = (position.yx + 0.5) / vec2(size.yx);"
+                                "    gl_Position = projection * view * model * vec4(position.x * tileSize, height, position.y * tileSize, 1.0);"
+                                "}";
+
+static const char* FRAGMENT_SRC = "#version 330 core\n"
+                                  "in vec2 texCoord;"
+                                  "uniform sampler2D normals;"
+                                  "uniform bool lit;"
+                                  "out vec4 outputColor;"
+                                  "void main()"
+                                  "{"
+                                  "    if(!lit)"
+                                  "    {"
+                                  "        outputColor = vec4(1.0f, 1.0f, 1.0f, 1.0f);"
+                                  "        return;"
+                                  "    }"
+                                  "    vec3 normal = normalize(texture(normals, texCoord).xyz * 2.0 - 1.0);"
+                                  "    float diffuse = max(dot(normal, normalize(vec3(0.4, 1.0, 0.3))), 0.0);"
+                                  "    outputColor = vec4(vec3(0.2 + 0.8 * diffuse), 1.0);"
+                                  "}";
+
+Clipmap::Clipmap(const HeightMap& map, float tileSize, int patchSize)
+    : tileSize(tileSize), width(map.getWidth()), height(map.getHeight()), patchSize(patchSize), numLevels(0),
+    minHeight(0.0f), maxHeight(0.0f), heightTexture(0), normalTexture(0), vao(0), ebo(0), program(0), stream(NULL)
+{
+    memset(&stats, 0, sizeof(stats));
+    memset(shapeOffsets, 0, sizeof(shapeOffsets));
+    memset(shapeCounts, 0, sizeof(shapeCounts));
+    GLint maxTextureSize;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+    if(width < 2 || height < 2 || std::max(width, height) > maxTextureSize)
+    {
+        std::cerr << "Heightmap of " << width << "x" << height << " does not fit in a texture" << std::endl;
+        return;
+    }
+    if(patchSize < 2 || (patchSize + 1) * (patchSize + 1) > 65536)
+    {
+        std::cerr << "Clipmap patches cannot be " << patchSize << " quads wide" << std::endl;
+        return;
+    }
+
+    // The outermost ring reaches every edge of the map from anywhere on it
+    numLevels = 1;
+    while((4 * patchSize) << (numLevels - 1) < std::max(width, height) - 1)
+    {
+        numLevels++;
+    }
+
+    // Heights are stored as 16 bit fractions of the range from the lowest to the highest
+    const std::vector<float>& data = map.getData();
+    minHeight = *std::min_element(data.begin(), data.end());
+    maxHeight = *std::max_element(data.begin(), data.end());
+    float scale = maxHeight > minHeight ? 65535.0f / (maxHeight - minHeight) : 0.0f;
+    std::vector<GLushort> samples(data.size());
+    for(size_t i = 0; i < data.size(); ++i)
+    {
+        samples[i] = (GLushort)((data[i] - minHeight) * scale + 0.5f);
+    }
+    glGenTextures(1, &heightTexture);
+    glBindTexture(GL_TEXTURE_2D, heightTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    // Rows of an odd width are not 4 byte aligned
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R16, width, height, 0, GL_RED, GL_UNSIGNED_SHORT, &samples[0]);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    // The patch row by row, then its first column again. Its first row is a row strip,
+    // and its first quad a corner.
+    int patchVertices = patchSize + 1;
+    std::vector<GLushort> indices;
+    for(int i = 0; i < patchSize; ++i)
+    {
+        for(int j = 0; j < patchSize; ++j)
+        {
+            indices.push_back(i * patchVertices + j);
+            indices.push_back((i + 1) * patchVertices + j);
+            indices.push_back(i * patchVertices + j + 1);
+            indices.push_back(i * patchVertices + j + 1);
+            indices.push_back((i + 1) * patchVertices + j);
+            indices.push_back((i + 1) * patchVertices + j + 1);
+        }
+    }
+    for(int i = 0; i < patchSize; ++i)
+    {
+        indices.push_back(i * patchVertices);
+        indices.push_back((i + 1) * patchVertices);
+        indices.push_back(i * patchVertices + 1);
+        indices.push_back(i * patchVertices + 1);
+        indices.push_back((i + 1) * patchVertices);
+        indices.push_back((i + 1) * patchVertices + 1);
+    }
+    shapeCounts[SHAPE_BLOCK] = patchSize * patchSize * 6;
+    shapeCounts[SHAPE_ROW] = patchSize * 6;
+    shapeOffsets[SHAPE_COLUMN] = patchSize * patchSize * 6;
+    shapeCounts[SHAPE_COLUMN] = patchSize * 6;
+    shapeCounts[SHAPE_CORNER] = 6;
+
+    // There are no vertices, only the pieces of the rings
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
+    glGenBuffers(1, &ebo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLushort) * indices.size(), &indices[0], GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribDivisor(0, 1);
+    glBindVertexArray(0);
+    // Room for a few frames of every piece of every ring
+    stream = new StreamBuffer(3 * numLevels * MAX_SPANS * MAX_SPANS * sizeof(Piece));
+
+    GLuint vertex = createShader(VERTEX_SRC, GL_VERTEX_SHADER);
+    GLuint fragment = createShader(FRAGMENT_SRC, GL_FRAGMENT_SHADER);
+    program = createShaderProgram(vertex, fragment);
+    linkShader(program);
+    validateShader(program);
+    glDetachShader(program, vertex);
+    glDeleteShader(vertex);
+    glDetachShader(program, fragment);
+    glDeleteShader(fragment);
+
+    // A ring reaches at least 4 patches from the center, its vertices morph over the last patch of that
+    glUseProgram(program);
+    glUniform1i(glGetUniformLocation(program, "heights"), 0);
+    glUniform1i(glGetUniformLocation(program, "normals"), 1);
+    glUniform2f(glGetUniformLocation(program, "heightRange"), minHeight, maxHeight - minHeight);
+    glUniform2i(glGetUniformLocation(program, "size"), height, width);
+    glUniform1f(glGetUniformLocation(program, "tileSize"), tileSize);
+    glUniform1i(glGetUniformLocation(program, "patchVertices"), patchVertices);
+    glUniform2f(glGetUniformLocation(program, "morphRange"), 3.0f * patchSize, 1.0f / patchSize);
+    glUniform1i(glGetUniformLocation(program, "coarsestLevel"), numLevels - 1);
+    glUseProgram(0);
+}
+
+Clipmap::~Clipmap()
+{
+    delete stream;
+    glDeleteBuffers(1, &ebo);
+    glDeleteTextures(1, &heightTexture);
+    if(vao)
+    {
+        glDeleteVertexArrays(1, &vao);
+    }
+    if(program)
+    {
+        glDeleteProgram(program);
+    }
+}
+
+void Clipmap::split(int holeStart, bool hole, std::vector<Span>* spans) const
+{
+    // A ring is 8 * patchSize + 2 quads wide, the ring inside it takes up 4 * patchSize + 1 of them
+    // starting at holeStart, which is 2 * patchSize or one more
+    int bounds[4] = { 0, holeStart, holeStart + 4 * patchSize + 1, 8 * patchSize + 2 };
+    if(!hole)
+    {
+        bounds[1] = bounds[2] = bounds[3];
+    }
+    spans->clear();
+    for(int section = 0; section < 3; ++section)
+    {
+        int start = bounds[section], end = bounds[section + 1];
+        // Whole patches, then strips of one quad for what is left
+        for(; end - start >= patchSize; start += patchSize)
+        {
+            Span span = { start, patchSize, hole && section == 1 };
+            spans->push_back(span);
+        }
+        for(; start < end; ++start)
+        {
+            Span span = { start, 1, hole && section == 1 };
+            spans->push_back(span);
+        }
+    }
+}
+
+void Clipmap::render(Camera* camera, const glm::mat4& model)
+{
+    memset(&stats, 0, sizeof(stats));
+    if(numLevels == 0)
+    {
+        return;
+    }
+
+    // Rings are centered on the point of the map closest to the camera, in samples
+    glm::vec3 eye = glm::vec3(glm::inverse(model) * glm::vec4(camera->getPosition(), 1.0f));
+    Frustum frustum(camera->getViewProjection() * model);
+    glm::vec2 center = glm::clamp(glm::vec2(eye.x, eye.z) / tileSize, glm::vec2(0.0f), glm::vec2(height - 1, width - 1));
+    // Rings that are small compared to the height of the camera above the terrain are left out,
+    // the finest ring that is left has no hole
+    int finest = 0;
+    while(finest < numLevels - 1 && ((4 * patchSize) << finest) * tileSize < eye.y - maxHeight)
+    {
+        finest++;
+    }
+
+    for(int shape = 0; shape < SHAPES; ++shape)
+    {
+        pieces[shape].clear();
+    }
+    std::vector<Span> rows, columns;
+    int innerRow = 0, innerColumn = 0;
+    for(int level = finest; level < numLevels; ++level)
+    {
+        // The first row and column of the ring, on every other quad of its level. The same rounding
+        // on every level puts the ring inside 2 * patchSize or 2 * patchSize + 1 quads from its edge.
+        int step = 1 << level;
+        int row = 2 * step * (int)std::floor((center.x / step - 4 * patchSize) * 0.5f);
+        int column = 2 * step * (int)std::floor((center.y / step - 4 * patchSize) * 0.5f);
+        split((innerRow - row) / step, level > finest, &rows);
+        split((innerColumn - column) / step, level > finest, &columns);
+        innerRow = row;
+        innerColumn = column;
+
+        for(size_t i = 0; i < rows.size(); ++i)
+        {
+            int firstRow = row + rows[i].start * step, lastRow = firstRow + rows[i].size * step;
+            if(lastRow <= 0 || firstRow >= height - 1)
+            {
+                continue;
+            }
+            for(size_t j = 0; j < columns.size(); ++j)
+            {
+                int firstColumn = column + columns[j].start * step, lastColumn = firstColumn + columns[j].size * step;
+                if((rows[i].inner && columns[j].inner) || lastColumn <= 0 || firstColumn >= width - 1)
+                {
+                    continue;
+                }
+                glm::vec3 min(std::max(firstRow, 0) * tileSize, minHeight, std::max(firstColumn, 0) * tileSize);
+                glm::vec3 max(std::min(lastRow, height - 1) * tileSize, maxHeight, std::min(lastColumn, width - 1) * tileSize);
+                if(!frustum.containsBox(min, max))
+                {
+                    continue;
+                }
+                Shape shape = rows[i].size > 1 ? (columns[j].size > 1 ? SHAPE_BLOCK : SHAPE_COLUMN)
+                    : (columns[j].size > 1 ? SHAPE_ROW : SHAPE_CORNER);
+                Piece piece = { firstRow, firstColumn, level };
+                pieces[shape].push_back(piece);
+            }
+        }
+    }
+
+    size_t numPieces = 0;
+    for(int shape = 0; shape < SHAPES; ++shape)
+    {
+        numPieces += pieces[shape].size();
+    }
+    if(numPieces == 0)
+    {
+        return;
+    }
+    GLsizeiptr offset;
+    Piece* target = (Piece*)stream->map(numPieces * sizeof(Piece), &offset);
+    if(!target)
+    {
+        return;
+    }
+    for(int shape = 0; shape < SHAPES; ++shape)
+    {
+        if(!pieces[shape].empty())
+        {
+            memcpy(target, &pieces[shape][0], pieces[shape].size() * sizeof(Piece));
+            target += pieces[shape].size();
+        }
+    }
+    stream->unmap(numPieces * sizeof(Piece));
+
+    glUseProgram(program);
+    glUniformMatrix4fv(glGetUniformLocation(program, "model"), 1, GL_FALSE, glm::value_ptr(model));
+    glUniformMatrix4fv(glGetUniformLocation(program, "view"), 1, GL_FALSE, glm::value_ptr(camera->getView()));
+    glUniformMatrix4fv(glGetUniformLocation(program, "projection"), 1, GL_FALSE, glm::value_ptr(camera->getProjection()));
+    glUniform2fv(glGetUniformLocation(program, "center"), 1, glm::value_ptr(center));
+    glUniform1i(glGetUniformLocation(program, "lit"), normalTexture != 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, heightTexture);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, normalTexture);
+    glActiveTexture(GL_TEXTURE0);
+
+    // One instanced draw per shape
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, stream->getBuffer());
+    for(int shape = 0; shape < SHAPES; ++shape)
+    {
+        GLsizei count = pieces[shape].size();
+        if(count > 0)
+        {
+            glVertexAttribIPointer(0, 3, GL_INT, sizeof(Piece), (void*)offset);
+            glDrawElementsInstanced(GL_TRIANGLES, shapeCounts[shape], GL_UNSIGNED_SHORT,
+                    (void*)(shapeOffsets[shape] * sizeof(GLushort)), count);
+            stats.draws++;
+            stats.triangles += count * shapeCounts[shape] / 3;
+        }
+        offset += count * sizeof(Piece);
+    }
+    glBindVertexArray(0);
+
+    // The pieces of this frame can be written over once the GPU has drawn them
+    stream->fence();
+}
+
+void Clipmap::setNormalTexture(GLuint texture)
+{
+    normalTexture = texture;
+}
+
+int Clipmap::getNumLevels() const
+{
+    return numLevels;
+}
+
+size_t Clipmap::getGpuBytes() const
+{
+    if(numLevels == 0)
+    {
+        return 0;
+    }
+    return (size_t)width * height * sizeof(GLushort) + (shapeCounts[SHAPE_BLOCK] + shapeCounts[SHAPE_COLUMN]) * sizeof(GLushort)
+        + 3 * numLevels * MAX_SPANS * MAX_SPANS * sizeof(Piece);
+}
+
+const TerrainStats& Clipmap::getStats() const
+{
+    return stats;
+}
@@ -0,0 +1,87 @@
+#ifndef CLIPMAP_HEADER
+#define CLIPMAP_HEADER
+
+#include "heightmap.h"
+#include "terrain.h"
+#include "../common/camera.h"
+#include "../common/streambuffer.h"
+#include "../common/util.h"
+#include <glm/glm.hpp>
+#include <vector>
+
+/**
+ * Draws a heightmap as geometry clipmaps: square rings of grids around the camera, each ring with
+ * quads twice as large as the one inside it. The heights are uploaded once into a 16 bit texture and
+ * the vertex shader displaces a single grid patch, drawn instanced over every ring, so the only memory
+ * it needs is about the size of that texture.
+ * Every ring is 8 * patchSize + 2 quads wide and snapped to every other quad of its level, so it moves
+ * with the camera in steps. Towards its outer edge the vertices morph into those of the ring around it,
+ * so rings meet without cracks and move without popping.
+ */
+class Clipmap
+{
+public:
+    /**
+     * @param tileSize Distance between two heights of the map
+     * @param patchSize Quads per side of the patch, a ring is 4 patches from its middle to its edge
+     */
+    Clipmap(const HeightMap& map, float tileSize, int patchSize = 16);
+    ~Clipmap();
+
+    /**
+     * Cull and draw the rings, model places the terrain in the world
+     */
+    void render(Camera* camera, const glm::mat4& model);
+    /**
+     * Light the terrain with the normals of a texture made by HeightMap::createNormalTexture,
+     * 0 draws it plain white again
+     */
+    void setNormalTexture(GLuint texture);
+
+    int getNumLevels() const;
+    /**
+     * Bytes of the height texture, the patch and the stream of pieces together
+     */
+    size_t getGpuBytes() const;
+    const TerrainStats& getStats() const;
+private:
+    // A part of a ring, drawn as one instance of a block, a strip or a corner of the patch
+    struct Piece
+    {
+        // First row and column of the piece in samples, and the level of its ring
+        GLint row, column, level;
+    };
+    // Block, row strip, column strip and corner
+    enum Shape
+    {
+        SHAPE_BLOCK,
+        SHAPE_ROW,
+        SHAPE_COLUMN,
+        SHAPE_CORNER,
+        SHAPES
+    };
+    // Where a ring is split along one axis, in quads of its level
+    struct Span
+    {
+        int start, size;
+        bool inner;
+    };
+
+    void split(int holeStart, bool hole, std::vector<Span>* spans) const;
+
+    float tileSize;
+    int width, height;
+    int patchSize;
+    int numLevels;
+    float minHeight, maxHeight;
+    GLuint heightTexture, normalTexture;
+    GLuint vao, ebo;
+    GLuint program;
+    StreamBuffer* stream;
+    // Offset and number of the indices of each shape in the index buffer
+    GLsizei shapeOffsets[SHAPES], shapeCounts[SHAPES];
+    std::vector<Piece> pieces[SHAPES];
+    TerrainStats stats;
+};
+
+#endif
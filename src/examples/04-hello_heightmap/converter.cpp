@@ -0,0 +1,51 @@
+#include "heightmapfile.h"
+#include <SOIL/SOIL.h>
+#include <cstdlib>
+#include <vector>
+
+/**
+ * Turns an image into a tiled heightmap file that 04-hello_heightmap.out can stream.
+ * The image is decoded once here, so the example never has to hold all of it in memory.
+ */
+int main(int argc, char** argv)
+{
+    if(argc < 3)
+    {
+        std::cerr << "Usage: " << argv[0] << " input.bmp output.hmap [heightScale=20] [tileSize=128]" << std::endl;
+        return -1;
+    }
+    float heightScale = argc > 3 ? atof(argv[3]) : 20.0f;
+    int tileSize = argc > 4 ? atoi(argv[4]) : 128;
+
+    int w, h, channels;
+    unsigned char* img = SOIL_load_image(argv[1], &w, &h, &channels, SOIL_LOAD_AUTO);
+    if(!img)
+    {
+        std::cerr << "Could not load heightmap " << argv[1] << std::endl;
+        return -1;
+    }
+    // The same heights as HeightMap::setSamples gives the image: the grey channel, or the average
+    // of red, green and blue. Averages are kept as 16 bit samples so no fraction is lost.
+    std::vector<unsigned short> samples((size_t)w * h);
+    for(size_t i = 0; i < samples.size(); ++i)
+    {
+        const unsigned char* p = img + i * channels;
+        samples[i] = channels < 3 ? p[0] * 257 : ((p[0] + p[1] + p[2]) * 65535 + 382) / 765;
+    }
+    SOIL_free_image_data(img);
+    bool result = writeHeightMapFile(argv[2], &samples[0], 16, w, h, heightScale, tileSize);
+    if(!result)
+    {
+        return -1;
+    }
+
+    HeightMapFile file;
+    if(!file.open(argv[2]))
+    {
+        std::cerr << "Could not open " << argv[2] << " again" << std::endl;
+        return -1;
+    }
+    std::cout << "Wrote " << argv[2] << ": " << w << "x" << h << " heights in " << file.getNumLevels()
+        << " levels of " << tileSize << "x" << tileSize << " tiles" << std::endl;
+    return 0;
+}
@@ -1,5 +1,182 @@
 #include "heightmap.h"
-#include "../common/util.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Rows handed to a thread at a time
+static const int ROWS_PER_CHUNK = 64;
+
+// Run rows(first, end) over all rows in blocks, on the threads of the pool if there is one
+static void forRows(int height, JobPool* pool, const std::function<void(int, int)>& rows)
+{
+    int numChunks = (height + ROWS_PER_CHUNK - 1) / ROWS_PER_CHUNK;
+    std::function<void(int)> job = [height, &rows](int chunk)
+    {
+        rows(chunk * ROWS_PER_CHUNK, std::min((chunk + 1) * ROWS_PER_CHUNK, height));
+    };
+    if(pool)
+    {
+        pool->start(job, numChunks);
+        pool->wait();
+        return;
+    }
+    for(int chunk = 0; chunk < numChunks; ++chunk)
+    {
+        job(chunk);
+    }
+}
+
+// Convert count samples of 8 bits to heights, scale includes the division by the number of channels summed
+static void convertRow8(const unsigned char* in, int channels, int count, float scale, float* out)
+{
+    int i = 0;
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 s = _mm_set1_ps(scale);
+    if(channels == 1)
+    {
+        for(; i + 16 <= count; i += 16)
+        {
+            __m128i bytes = _mm_loadu_si128((const __m128i*)(in + i));
+            __m128i low = _mm_unpacklo_epi8(bytes, zero), high = _mm_unpackhi_epi8(bytes, zero);
+            _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(low, zero)), s));
+            _mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(low, zero)), s));
+            _mm_storeu_ps(out + i + 8, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(high, zero)), s));
+            _mm_storeu_ps(out + i + 12, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(high, zero)), s));
+        }
+    }
+    else if(channels == 2)
+    {
+        // Keep the grey byte of every grey and alpha pair
+        const __m128i grey = _mm_set1_epi16(0xff);
+        for(; i + 8 <= count; i += 8)
+        {
+            __m128i samples = _mm_and_si128(_mm_loadu_si128((const __m128i*)(in + i * 2)), grey);
+            _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(samples, zero)), s));
+            _mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(samples, zero)), s));
+        }
+    }
+    else
+    {
+        // One pixel per 32 bit lane, then the R, G and B bytes of every lane are added up.
+        // A pixel of 3 channels is read as 4 bytes, so stop one pixel before the end.
+        const __m128i mask = _mm_set1_epi32(0xff);
+        for(; i + 4 + (channels == 3) <= count; i += 4)
+        {
+            __m128i pixels;
+            if(channels == 4)
+            {
+                pixels = _mm_loadu_si128((const __m128i*)(in + i * 4));
+            }
+            else
+            {
+                int p[4];
+                memcpy(&p[0], in + i * 3, 4);
+                memcpy(&p[1], in + i * 3 + 3, 4);
+                memcpy(&p[2], in + i * 3 + 6, 4);
+                memcpy(&p[3], in + i * 3 + 9, 4);
+                pixels = _mm_loadu_si128((const __m128i*)p);
+            }
+            __m128i sum = _mm_add_epi32(_mm_add_epi32(_mm_and_si128(pixels, mask),
+                        _mm_and_si128(_mm_srli_epi32(pixels, 8), mask)), _mm_and_si128(_mm_srli_epi32(pixels, 16), mask));
+            _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(sum), s));
+        }
+    }
+#endif
+    for(; i < count; ++i)
+    {
+        const unsigned char* p = in + i * channels;
+        out[i] = (channels < 3 ? p[0] : p[0] + p[1] + p[2]) * scale;
+    }
+}
+
+// Convert count samples of 16 bits to heights
+static void convertRow16(const unsigned short* in, int channels, int count, float scale, float* out)
+{
+    int i = 0;
+#ifdef __SSE2__
+    if(channels == 1)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128 s = _mm_set1_ps(scale);
+        for(; i + 8 <= count; i += 8)
+        {
+            __m128i samples = _mm_loadu_si128((const __m128i*)(in + i));
+            _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(samples, zero)), s));
+            _mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(samples, zero)), s));
+        }
+    }
+#endif
+    for(; i < count; ++i)
+    {
+        const unsigned short* p = in + i * channels;
+        out[i] = (channels < 3 ? p[0] : p[0] + p[1] + p[2]) * scale;
+    }
+}
+
+// Pack the normal of a point with slopes gx along x and gz along z, and the y of its tangent along x
+static GLuint packNormal(float gx, float gz)
+{
+    float invLength = 1.0f / std::sqrt(gx * gx + 1.0f + gz * gz);
+    float tangentY = gx / std::sqrt(gx * gx + 1.0f);
+    // From -1..1 to 0..255
+    GLuint r = (GLuint)(-gx * invLength * 127.5f + 128.0f), g = (GLuint)(invLength * 127.5f + 128.0f);
+    GLuint b = (GLuint)(-gz * invLength * 127.5f + 128.0f), a = (GLuint)(tangentY * 127.5f + 128.0f);
+    return r | g << 8 | b << 16 | a << 24;
+}
+
+// The normals of a row from central differences, one sided on the edges of the map
+static void computeNormalRow(const float* data, int w, int h, int row, float tileSize, GLuint* out)
+{
+    int up = std::max(row - 1, 0), down = std::min(row + 1, h - 1);
+    const float* above = data + (size_t)up * w;
+    const float* center = data + (size_t)row * w;
+    const float* below = data + (size_t)down * w;
+    float rowScale = down > up ? 1.0f / ((down - up) * tileSize) : 0.0f;
+    float columnScale = 1.0f / (2.0f * tileSize);
+
+    int j = 1;
+#ifdef __SSE2__
+    const __m128 rs = _mm_set1_ps(rowScale), cs = _mm_set1_ps(columnScale);
+    const __m128 one = _mm_set1_ps(1.0f), half = _mm_set1_ps(127.5f), offset = _mm_set1_ps(128.0f);
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    for(; j + 4 <= w - 1; j += 4)
+    {
+        __m128 gx = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(below + j), _mm_loadu_ps(above + j)), rs);
+        __m128 gz = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(center + j + 1), _mm_loadu_ps(center + j - 1)), cs);
+        __m128 gx2 = _mm_mul_ps(gx, gx);
+        __m128 invLength = _mm_div_ps(one, _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(gx2, one), _mm_mul_ps(gz, gz))));
+        __m128 tangentY = _mm_div_ps(gx, _mm_sqrt_ps(_mm_add_ps(gx2, one)));
+        // Scaled by -127.5 for x and z, the normal points away from the slope
+        __m128 scale = _mm_mul_ps(invLength, half);
+        __m128i r = _mm_cvttps_epi32(_mm_add_ps(_mm_xor_ps(_mm_mul_ps(gx, scale), sign), offset));
+        __m128i g = _mm_cvttps_epi32(_mm_add_ps(scale, offset));
+        __m128i b = _mm_cvttps_epi32(_mm_add_ps(_mm_xor_ps(_mm_mul_ps(gz, scale), sign), offset));
+        __m128i a = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(tangentY, half), offset));
+        __m128i packed = _mm_or_si128(_mm_or_si128(r, _mm_slli_epi32(g, 8)),
+                _mm_or_si128(_mm_slli_epi32(b, 16), _mm_slli_epi32(a, 24)));
+        _mm_storeu_si128((__m128i*)(out + j), packed);
+    }
+#endif
+    for(; j < w - 1; ++j)
+    {
+        out[j] = packNormal((below[j] - above[j]) * rowScale, (center[j + 1] - center[j - 1]) * columnScale);
+    }
+    // The first and last column
+    int edges[2] = { 0, w - 1 };
+    for(int k = 0; k < 2; ++k)
+    {
+        int column = edges[k];
+        int left = std::max(column - 1, 0), right = std::min(column + 1, w - 1);
+        float gz = right > left ? (center[right] - center[left]) / ((right - left) * tileSize) : 0.0f;
+        out[column] = packNormal((below[column] - above[column]) * rowScale, gz);
+    }
+}
 
 HeightMap::HeightMap(float heightScale)
     : heightScale(heightScale), w(0), h(0)
@@ -25,26 +202,112 @@ const std::vector<float>& HeightMap::getData() const
     return data;
 }
 
-bool HeightMap::load(const char* fileName)
+const std::vector<GLuint>& HeightMap::getNormals() const
+{
+    return normals;
+}
+
+bool HeightMap::load(const char* fileName, JobPool* pool)
 {
-    unsigned char* img = SOIL_load_image(fileName, &w, &h, NULL, SOIL_LOAD_RGB);
+    size_t length = strlen(fileName);
+    if(length > 4 && (strcmp(fileName + length - 4, ".r16") == 0 || strcmp(fileName + length - 4, ".raw") == 0))
+    {
+        // Raw files have no header, they are assumed to be square
+        FILE* f = fopen(fileName, "rb");
+        if(!f)
+        {
+            std::cerr << "Error loading heightmap " << fileName << std::endl;
+            return false;
+        }
+        fseek(f, 0, SEEK_END);
+        long size = ftell(f);
+        fseek(f, 0, SEEK_SET);
+        int side = (int)std::sqrt(size / 2.0);
+        std::vector<unsigned short> samples((size_t)side * side);
+        bool read = (long)samples.size() * 2 == size && fread(&samples[0], 2, samples.size(), f) == samples.size();
+        fclose(f);
+        if(!read)
+        {
+            std::cerr << "Heightmap " << fileName << " is not a square of 16 bit samples" << std::endl;
+            return false;
+        }
+        return setSamples(&samples[0], 16, 1, side, side, pool);
+    }
+
+    int width, height, channels;
+    unsigned char* img = SOIL_load_image(fileName, &width, &height, &channels, SOIL_LOAD_AUTO);
     if(!img)
     {
         std::cerr << "Error loading heightmap " << fileName << ": " << SOIL_last_result() << std::endl;
         return false;
     }
+    bool result = setSamples(img, 8, channels, width, height, pool);
+    SOIL_free_image_data(img);
 
-    data.resize(w * h);
+    return result;
+}
 
-    for(int i = 0; i < w * h; i += 3)
+bool HeightMap::setSamples(const void* samples, int bitsPerSample, int channels, int width, int height, JobPool* pool)
+{
+    if((bitsPerSample != 8 && bitsPerSample != 16) || channels < 1 || channels > 4 || width < 1 || height < 1)
     {
-        // Average the R, G and B channels
-        int tile = img[i] + img[i + 1] + img[i + 3];
-        unsigned char greyTile = tile / 3;
-        data[i] = (float)greyTile / 255.0f * heightScale;
+        std::cerr << "Cannot make a heightmap of " << width << "x" << height << " with " << channels
+            << " channels of " << bitsPerSample << " bits" << std::endl;
+        return false;
     }
+    w = width;
+    h = height;
+    data.resize((size_t)w * h);
+    normals.clear();
 
-    SOIL_free_image_data(img);
+    // Averaging the channels is folded into the scale
+    float scale = heightScale / ((bitsPerSample == 8 ? 255.0f : 65535.0f) * (channels < 3 ? 1 : 3));
+    forRows(h, pool, [this, samples, bitsPerSample, channels, scale](int first, int end)
+    {
+        for(int row = first; row < end; ++row)
+        {
+            size_t offset = (size_t)row * w;
+            if(bitsPerSample == 8)
+            {
+                convertRow8((const unsigned char*)samples + offset * channels, channels, w, scale, &data[offset]);
+            }
+            else
+            {
+                convertRow16((const unsigned short*)samples + offset * channels, channels, w, scale, &data[offset]);
+            }
+        }
+    });
 
     return true;
 }
+
+void HeightMap::computeNormals(float tileSize, JobPool* pool)
+{
+    normals.resize(data.size());
+    forRows(h, pool, [this, tileSize](int first, int end)
+    {
+        for(int row = first; row < end; ++row)
+        {
+            computeNormalRow(&data[0], w, h, row, tileSize, &normals[(size_t)row * w]);
+        }
+    });
+}
+
+GLuint HeightMap::createNormalTexture() const
+{
+    if(normals.empty())
+    {
+        return 0;
+    }
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    // Columns along s, rows along t. The red byte is the lowest of every packed normal.
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, w, h, 0, GL_RGBA, GL_UNSIGNED_INT_8_8_8_8_REV, &normals[0]);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    return texture;
+}
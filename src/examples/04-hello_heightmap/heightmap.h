@@ -1,6 +1,8 @@
 #ifndef HEIGHTMAP_HEADER
 #define HEIGHTMAP_HEADER
 
+#include "../common/util.h"
+#include "../common/jobpool.h"
 #include <vector>
 
 class HeightMap
@@ -16,12 +18,39 @@ public:
     int getWidth() const;
     int getHeight() const;
     const std::vector<float>& getData() const;
+    /**
+     * The normal and tangent of every height, packed as RGBA8, empty until computeNormals
+     */
+    const std::vector<GLuint>& getNormals() const;
 
-    bool load(const char* fileName);
+    /**
+     * Load an image, or a square 16 bit little endian grey file if the name ends in .r16 or .raw
+     */
+    bool load(const char* fileName, JobPool* pool = NULL);
+    /**
+     * Take the heights from samples in memory, row by row. The R, G and B channels are averaged,
+     * alpha is ignored.
+     * @param bitsPerSample 8 or 16
+     * @param channels 1 for grey, 2 for grey and alpha, 3 for RGB or 4 for RGBA
+     * @param pool Splits the rows over its threads when given
+     */
+    bool setSamples(const void* samples, int bitsPerSample, int channels, int width, int height, JobPool* pool = NULL);
+    /**
+     * Compute the normal of every height from the differences of its neighbours.
+     * The normal is packed in RGB, the alpha holds the y of the tangent along the rows (x),
+     * its x follows from its length and its z is 0.
+     * @param tileSize Distance between two heights
+     */
+    void computeNormals(float tileSize, JobPool* pool = NULL);
+    /**
+     * Upload the normals into a new RGBA8 texture, one texel per height
+     */
+    GLuint createNormalTexture() const;
 private:
     float heightScale;
     int w, h;
     std::vector<float> data;
+    std::vector<GLuint> normals;
 };
 
 #endif
@@ -0,0 +1,298 @@
+#include "heightmapfile.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Bump the version whenever the layout of the file changes
+static const char HEIGHTMAP_FILE_MAGIC[4] = { 'G', 'L', 'X', 'H' };
+static const uint32_t HEIGHTMAP_FILE_VERSION = 1;
+// Tiles start on a page, so they can be released on their own
+static const uint64_t HEIGHTMAP_FILE_ALIGNMENT = 4096;
+
+struct HeightMapFileHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t width, height;
+    uint32_t tileSize;
+    uint32_t numLevels;
+    float heightScale;
+    uint32_t padding;
+    struct
+    {
+        uint32_t tileRows, tileColumns;
+        // Index of the first tile of the level in the tile table
+        uint32_t firstTile;
+        uint32_t padding;
+    } levels[MAX_HEIGHTMAP_LEVELS];
+};
+
+struct HeightMapFileTile
+{
+    uint64_t offset;
+    float minHeight, maxHeight;
+};
+
+static uint64_t align(uint64_t offset)
+{
+    return (offset + HEIGHTMAP_FILE_ALIGNMENT - 1) & ~(HEIGHTMAP_FILE_ALIGNMENT - 1);
+}
+
+bool writeHeightMapFile(const char* fileName, const void* samples, int bitsPerSample, int width, int height,
+        float heightScale, int tileSize)
+{
+    if((bitsPerSample != 8 && bitsPerSample != 16) || width < 2 || height < 2 || tileSize < 1)
+    {
+        std::cerr << "Cannot write a heightmap file of " << width << "x" << height << " with "
+            << bitsPerSample << " bit samples" << std::endl;
+        return false;
+    }
+
+    HeightMapFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, HEIGHTMAP_FILE_MAGIC, sizeof(header.magic));
+    header.version = HEIGHTMAP_FILE_VERSION;
+    header.width = width;
+    header.height = height;
+    header.tileSize = tileSize;
+    header.heightScale = heightScale;
+
+    // A level has (size - 1) / 2^level + 1 samples per side, rounded up
+    int numTiles = 0;
+    for(int level = 0; level < MAX_HEIGHTMAP_LEVELS; ++level)
+    {
+        int rows = ((height - 2) >> level) + 2, columns = ((width - 2) >> level) + 2;
+        header.levels[level].tileRows = (rows - 2) / tileSize + 1;
+        header.levels[level].tileColumns = (columns - 2) / tileSize + 1;
+        header.levels[level].firstTile = numTiles;
+        numTiles += header.levels[level].tileRows * header.levels[level].tileColumns;
+        header.numLevels = level + 1;
+        if(rows <= 2 && columns <= 2)
+        {
+            break;
+        }
+    }
+
+    uint64_t tileBytes = (uint64_t)(tileSize + 1) * (tileSize + 1) * sizeof(uint16_t);
+    std::vector<HeightMapFileTile> tiles(numTiles);
+    uint64_t offset = align(sizeof(header) + sizeof(HeightMapFileTile) * numTiles);
+    for(int i = 0; i < numTiles; ++i)
+    {
+        tiles[i].offset = offset;
+        offset = align(offset + tileBytes);
+    }
+
+    // Write to a temporary file first, so a crash never leaves a half written heightmap file behind
+    std::string tmpName = std::string(fileName) + ".tmp";
+    FILE* f = fopen(tmpName.c_str(), "wb");
+    if(!f)
+    {
+        std::cerr << "Could not write heightmap file " << fileName << std::endl;
+        return false;
+    }
+    // The table is written again once the bounds of the tiles are known
+    fwrite(&header, sizeof(header), 1, f);
+    fwrite(&tiles[0], sizeof(HeightMapFileTile), numTiles, f);
+
+    const uint8_t* samples8 = (const uint8_t*)samples;
+    const uint16_t* samples16 = (const uint16_t*)samples;
+    std::vector<uint16_t> tile((tileSize + 1) * (tileSize + 1));
+    std::vector<char> zeros(HEIGHTMAP_FILE_ALIGNMENT, 0);
+    float scale = heightScale / 65535.0f;
+    for(uint32_t level = 0; level < header.numLevels; ++level)
+    {
+        for(uint32_t tileRow = 0; tileRow < header.levels[level].tileRows; ++tileRow)
+        {
+            for(uint32_t tileColumn = 0; tileColumn < header.levels[level].tileColumns; ++tileColumn)
+            {
+                HeightMapFileTile& entry = tiles[header.levels[level].firstTile
+                    + tileRow * header.levels[level].tileColumns + tileColumn];
+                uint16_t minSample = 65535, maxSample = 0;
+                for(int i = 0; i <= tileSize; ++i)
+                {
+                    int row = std::min((int)(((uint64_t)tileRow * tileSize + i) << level), height - 1);
+                    for(int j = 0; j <= tileSize; ++j)
+                    {
+                        int column = std::min((int)(((uint64_t)tileColumn * tileSize + j) << level), width - 1);
+                        size_t index = (size_t)row * width + column;
+                        uint16_t sample = bitsPerSample == 8 ? samples8[index] * 257 : samples16[index];
+                        tile[i * (tileSize + 1) + j] = sample;
+                        minSample = std::min(minSample, sample);
+                        maxSample = std::max(maxSample, sample);
+                    }
+                }
+                entry.minHeight = minSample * scale;
+                entry.maxHeight = maxSample * scale;
+
+                // The tiles of the level below cover every sample, not only every other one
+                if(level > 0)
+                {
+                    for(uint32_t child = 0; child < 4; ++child)
+                    {
+                        uint32_t childRow = tileRow * 2 + (child >> 1), childColumn = tileColumn * 2 + (child & 1);
+                        if(childRow < header.levels[level - 1].tileRows && childColumn < header.levels[level - 1].tileColumns)
+                        {
+                            const HeightMapFileTile& below = tiles[header.levels[level - 1].firstTile
+                                + childRow * header.levels[level - 1].tileColumns + childColumn];
+                            entry.minHeight = std::min(entry.minHeight, below.minHeight);
+                            entry.maxHeight = std::max(entry.maxHeight, below.maxHeight);
+                        }
+                    }
+                }
+
+                fseek(f, entry.offset, SEEK_SET);
+                fwrite(&tile[0], 1, tileBytes, f);
+            }
+        }
+    }
+    // Pad the last tile to a whole page, so it can be mapped
+    fwrite(&zeros[0], 1, align(tiles.back().offset + tileBytes) - tiles.back().offset - tileBytes, f);
+    fseek(f, sizeof(header), SEEK_SET);
+    fwrite(&tiles[0], sizeof(HeightMapFileTile), numTiles, f);
+    bool result = !ferror(f);
+    fclose(f);
+
+    if(!result || rename(tmpName.c_str(), fileName) != 0)
+    {
+        std::cerr << "Could not write heightmap file " << fileName << std::endl;
+        remove(tmpName.c_str());
+        return false;
+    }
+    return true;
+}
+
+HeightMapFile::HeightMapFile()
+    : data(NULL), size(0)
+{
+}
+
+HeightMapFile::~HeightMapFile()
+{
+    close();
+}
+
+bool HeightMapFile::open(const char* fileName)
+{
+    close();
+
+    int fd = ::open(fileName, O_RDONLY);
+    if(fd == -1)
+    {
+        return false;
+    }
+    struct stat s;
+    if(fstat(fd, &s) != 0 || (size_t)s.st_size < sizeof(HeightMapFileHeader))
+    {
+        ::close(fd);
+        return false;
+    }
+    size = s.st_size;
+    data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping stays valid after closing the file descriptor
+    ::close(fd);
+    if(data == MAP_FAILED)
+    {
+        data = NULL;
+        size = 0;
+        return false;
+    }
+
+    const HeightMapFileHeader* header = (const HeightMapFileHeader*)data;
+    bool valid = memcmp(header->magic, HEIGHTMAP_FILE_MAGIC, sizeof(header->magic)) == 0
+        && header->version == HEIGHTMAP_FILE_VERSION
+        && header->numLevels > 0 && header->numLevels <= MAX_HEIGHTMAP_LEVELS;
+    uint64_t numTiles = 0;
+    if(valid)
+    {
+        const HeightMapFileTile* tiles = (const HeightMapFileTile*)(header + 1);
+        uint32_t lastLevel = header->numLevels - 1;
+        numTiles = header->levels[lastLevel].firstTile
+            + (uint64_t)header->levels[lastLevel].tileRows * header->levels[lastLevel].tileColumns;
+        uint64_t tileBytes = (uint64_t)(header->tileSize + 1) * (header->tileSize + 1) * sizeof(uint16_t);
+        valid = sizeof(HeightMapFileHeader) + numTiles * sizeof(HeightMapFileTile) <= size
+            && tiles[numTiles - 1].offset + tileBytes <= size;
+    }
+
+    if(!valid)
+    {
+        close();
+    }
+    return valid;
+}
+
+void HeightMapFile::close()
+{
+    if(data)
+    {
+        munmap(data, size);
+        data = NULL;
+        size = 0;
+    }
+}
+
+int HeightMapFile::getWidth() const
+{
+    return ((const HeightMapFileHeader*)data)->width;
+}
+
+int HeightMapFile::getHeight() const
+{
+    return ((const HeightMapFileHeader*)data)->height;
+}
+
+int HeightMapFile::getTileSize() const
+{
+    return ((const HeightMapFileHeader*)data)->tileSize;
+}
+
+int HeightMapFile::getNumLevels() const
+{
+    return ((const HeightMapFileHeader*)data)->numLevels;
+}
+
+float HeightMapFile::getHeightScale() const
+{
+    return ((const HeightMapFileHeader*)data)->heightScale;
+}
+
+int HeightMapFile::getNumTileRows(int level) const
+{
+    return ((const HeightMapFileHeader*)data)->levels[level].tileRows;
+}
+
+int HeightMapFile::getNumTileColumns(int level) const
+{
+    return ((const HeightMapFileHeader*)data)->levels[level].tileColumns;
+}
+
+static const HeightMapFileTile* getEntry(const void* data, int level, int row, int column)
+{
+    const HeightMapFileHeader* header = (const HeightMapFileHeader*)data;
+    const HeightMapFileTile* tiles = (const HeightMapFileTile*)(header + 1);
+    return &tiles[header->levels[level].firstTile + row * header->levels[level].tileColumns + column];
+}
+
+const unsigned short* HeightMapFile::getTile(int level, int row, int column) const
+{
+    return (const unsigned short*)((const char*)data + getEntry(data, level, row, column)->offset);
+}
+
+void HeightMapFile::getTileBounds(int level, int row, int column, float* minHeight, float* maxHeight) const
+{
+    const HeightMapFileTile* entry = getEntry(data, level, row, column);
+    *minHeight = entry->minHeight;
+    *maxHeight = entry->maxHeight;
+}
+
+void HeightMapFile::releaseTile(int level, int row, int column) const
+{
+    size_t tileBytes = (size_t)(getTileSize() + 1) * (getTileSize() + 1) * sizeof(uint16_t);
+    madvise((char*)data + getEntry(data, level, row, column)->offset, align(tileBytes), MADV_DONTNEED);
+}
@@ -0,0 +1,64 @@
+#ifndef HEIGHTMAP_FILE_HEADER
+#define HEIGHTMAP_FILE_HEADER
+
+#include "../common/util.h"
+#include <cstddef>
+
+#define MAX_HEIGHTMAP_LEVELS 32
+
+/**
+ * Write a heightmap to a tiled binary file, which can later be opened with HeightMapFile.
+ * Heights are stored as 16 bit values in square tiles of tileSize + 1 samples, the last row and
+ * column repeat the first of the next tile. Every level after the first keeps every other sample
+ * of the level before it, until the whole map fits in one sample. Every tile is aligned to a page,
+ * so a tile can be mapped and dropped on its own.
+ * @param samples Row by row, 8 or 16 bit, bitsPerSample says which
+ * @param heightScale The height of the largest sample
+ */
+bool writeHeightMapFile(const char* fileName, const void* samples, int bitsPerSample, int width, int height,
+        float heightScale, int tileSize = 128);
+
+/**
+ * A memory mapped tiled heightmap file.
+ * The file can be much larger than memory: only the pages of the tiles that are read are loaded,
+ * and releaseTile lets the OS drop them again.
+ */
+class HeightMapFile
+{
+public:
+    HeightMapFile();
+    ~HeightMapFile();
+
+    /**
+     * Map a file written by writeHeightMapFile.
+     * This fails if the file does not exist or was written by another version.
+     */
+    bool open(const char* fileName);
+    void close();
+
+    int getWidth() const;
+    int getHeight() const;
+    int getTileSize() const;
+    int getNumLevels() const;
+    float getHeightScale() const;
+    int getNumTileRows(int level) const;
+    int getNumTileColumns(int level) const;
+    /**
+     * The samples of a tile, (tileSize + 1) * (tileSize + 1) of them row by row.
+     * Samples of a level are clamped to the edge of the map.
+     */
+    const unsigned short* getTile(int level, int row, int column) const;
+    /**
+     * Lowest and highest height under a tile, in all of the samples of the first level it covers
+     */
+    void getTileBounds(int level, int row, int column, float* minHeight, float* maxHeight) const;
+    /**
+     * Let the OS drop the pages of a tile, they are read from the file again when needed
+     */
+    void releaseTile(int level, int row, int column) const;
+private:
+    void* data;
+    size_t size;
+};
+
+#endif
@@ -2,15 +2,24 @@
 #include "../common/shader.h"
 #include "../common/camera.h"
 #include "heightmap.h"
+#include "heightmapfile.h"
+#include "tilecache.h"
+#include "terrain.h"
+#include "clipmap.h"
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <vector>
 #include <cmath>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
 
 static glm::mat4 model;
 
 static const int SIZE = 10.0f; // Size of a single tile in the heightmap
+// Memory for the heights of a streamed heightmap
+static const size_t TILE_CACHE_BUDGET = 64 * 1024 * 1024;
 
 const char* VERTEX_SRC = "#version 330 core\n"
                           "layout(location=0) in vec3 position;"          // Vertex position (x, y, z)
@@ -30,8 +39,69 @@ const char* FRAGMENT_SRC = "#version 330 core\n"
                            "    outputColor = vec4(1.0f, 1.0f, 1.0f, 1.0f);"
                            "}";
 
-int main(void)
+// Milliseconds since start
+static double elapsed(const std::chrono::steady_clock::time_point& start)
 {
+    std::chrono::duration<double, std::milli> duration = std::chrono::steady_clock::now() - start;
+    return duration.count();
+}
+
+// Time turning samples into heights and computing their normals for large maps, on one thread and on all of them
+static void benchmark()
+{
+#ifdef __SSE2__
+    std::cout << "Heightmap benchmark with SSE2" << std::endl;
+#else
+    std::cout << "Heightmap benchmark without SIMD" << std::endl;
+#endif
+    JobPool pool;
+    const int sizes[2] = { 4096, 16384 };
+    for(int i = 0; i < 2; ++i)
+    {
+        int size = sizes[i];
+        size_t count = (size_t)size * size;
+        HeightMap map(20.0f);
+        for(int sampleType = 0; sampleType < 2; ++sampleType)
+        {
+            // 8 bit RGB like a picture, or 16 bit grey like a raw heightmap
+            int bits = sampleType == 0 ? 8 : 16, channels = sampleType == 0 ? 3 : 1;
+            std::vector<unsigned char> samples(count * channels * bits / 8);
+            for(size_t j = 0; j < samples.size(); ++j)
+            {
+                samples[j] = (unsigned char)(j * 7 + (j >> 13));
+            }
+            // The first run also pays for touching the memory of the heights, so it is not timed
+            map.setSamples(&samples[0], bits, channels, size, size, &pool);
+            for(int threads = 0; threads < 2; ++threads)
+            {
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                map.setSamples(&samples[0], bits, channels, size, size, threads ? &pool : NULL);
+                double time = elapsed(start);
+                std::cout << size << "x" << size << " " << bits << " bit " << (channels == 3 ? "RGB" : "grey")
+                    << " to heights, " << (threads ? pool.getNumThreads() : 1) << " thread(s): " << time << " ms, "
+                    << count / time / 1000.0 << " M heights/s" << std::endl;
+            }
+        }
+        map.computeNormals(SIZE, &pool);
+        for(int threads = 0; threads < 2; ++threads)
+        {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            map.computeNormals(SIZE, threads ? &pool : NULL);
+            double time = elapsed(start);
+            std::cout << size << "x" << size << " normals, " << (threads ? pool.getNumThreads() : 1) << " thread(s): "
+                << time << " ms, " << count / time / 1000.0 << " M normals/s" << std::endl;
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if(argc > 1 && strcmp(argv[1], "bench") == 0)
+    {
+        benchmark();
+        return 0;
+    }
+
     GLFWwindow* window;
 
     // The OpenGL context creation code is in
@@ -67,16 +137,32 @@ int main(void)
     camera.setPosition(0.0f, 0.0f, -3.0f);
     setCamera(&camera); // The camera updating is handled in ../common/util.cpp
 
-    // Load the heightmap
+    // Load the heightmap, another one can be given on the command line. Options can follow it:
+    // full draws every tile of it from one buffer, instead of the quadtree of the Terrain class,
+    // clipmap draws it with the Clipmap class from a height texture instead,
+    // lit lights the terrain with normals computed from the heights.
+    // A tiled heightmap file (made by 04-heightmap_converter.out) is streamed instead of loaded,
+    // so it can be larger than memory
+    JobPool pool;
     HeightMap map(20.0f);
-    if(!map.load("heightmap.bmp"))
+    HeightMapFile file;
+    bool streaming = argc > 1 && file.open(argv[1]);
+    if(!streaming && !map.load(argc > 1 ? argv[1] : "heightmap.bmp", &pool))
     {
         return -1;
     }
+    bool full = false, clipmapped = false, lit = false;
+    for(int i = 2; i < argc && !streaming; ++i)
+    {
+        full = full || strcmp(argv[i], "full") == 0;
+        clipmapped = clipmapped || strcmp(argv[i], "clipmap") == 0;
+        lit = lit || strcmp(argv[i], "lit") == 0;
+    }
     const std::vector<float>& data = map.getData();
-    int w = map.getWidth(), h = map.getHeight();
+    int w = streaming ? file.getWidth() : map.getWidth(), h = streaming ? file.getHeight() : map.getHeight();
+    camera.setZfar(std::max(1000.0f, 2.0f * SIZE * std::max(w, h)));
     std::vector<float> vertices;
-    for(int i = 0; i < h; ++i)
+    for(int i = 0; i < h && full; ++i)
     {
         for(int j = 0; j < w; ++j)
         {
@@ -94,7 +180,7 @@ int main(void)
         }
     }
     std::vector<GLuint> indices;
-    for(int i = 0; i < (h - 1); ++i)
+    for(int i = 0; i < (h - 1) && full; ++i)
     {
         for(int j = 0; j < (w - 1); ++j)
         {
@@ -158,14 +244,14 @@ int main(void)
 
     // Upload the vertices to the buffer
     glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * vertices.size(), &vertices[0], GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * vertices.size(), vertices.data(), GL_STATIC_DRAW);
 
     GLuint ebo;
     glGenBuffers(1, &ebo);
 
     // Upload the indices to the buffer
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * indices.size(), &indices[0], GL_STATIC_DRAW);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * indices.size(), indices.data(), GL_STATIC_DRAW);
 
     // Enable the vertex attributes and upload their data (see: layout(location=x))
     glEnableVertexAttribArray(0); // position
@@ -173,9 +259,40 @@ int main(void)
 
     // We have now successfully created a drawable Vertex Array Object
 
+    // The terrain splits the heightmap into chunks and draws the far away ones with less detail,
+    // so that a quad is at most a few pixels wide. The clipmap does the same in rings around the camera.
+    TileCache* cache = streaming ? new TileCache(file, TILE_CACHE_BUDGET) : NULL;
+    Terrain* terrain = NULL;
+    Clipmap* clipmap = NULL;
+    if(clipmapped)
+    {
+        clipmap = new Clipmap(map, SIZE);
+    }
+    else
+    {
+        terrain = streaming ? new Terrain(cache, SIZE) : new Terrain(map, SIZE);
+        terrain->setLodError(4.0f, 480.0f);
+    }
+    GLuint normals = 0;
+    if(lit && !full)
+    {
+        map.computeNormals(SIZE, &pool);
+        normals = map.createNormalTexture();
+        if(clipmap)
+        {
+            clipmap->setNormalTexture(normals);
+        }
+        else
+        {
+            terrain->setNormalTexture(normals);
+        }
+        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    }
+
     // Set the clear color to a light grey
     glClearColor(0.75f, 0.75f, 0.75f, 1.0f);
 
+    long long frames = 0, triangles = 0, draws = 0;
     while(!glfwWindowShouldClose(window))
     {
         if(glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
@@ -188,17 +305,39 @@ int main(void)
         // Clear (note the addition of GL_DEPTH_BUFFER_BIT)
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        // Upload the MVP matrices
-        GLint modelUL = glGetUniformLocation(program, "model");
-        glUniformMatrix4fv(modelUL, 1, GL_FALSE, glm::value_ptr(model));
-        GLint viewUL = glGetUniformLocation(program, "view");
-        glUniformMatrix4fv(viewUL, 1, GL_FALSE, glm::value_ptr(camera.getView()));
-        // This can be moved out of the loop because it rarely changes
-        GLint projUL = glGetUniformLocation(program, "projection");
-        glUniformMatrix4fv(projUL, 1, GL_FALSE, glm::value_ptr(camera.getProjection()));
-
-        // The VAO is still bound so just draw the vertices
-        glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
+        if(full)
+        {
+            // Upload the MVP matrices
+            glUseProgram(program);
+            GLint modelUL = glGetUniformLocation(program, "model");
+            glUniformMatrix4fv(modelUL, 1, GL_FALSE, glm::value_ptr(model));
+            GLint viewUL = glGetUniformLocation(program, "view");
+            glUniformMatrix4fv(viewUL, 1, GL_FALSE, glm::value_ptr(camera.getView()));
+            // This can be moved out of the loop because it rarely changes
+            GLint projUL = glGetUniformLocation(program, "projection");
+            glUniformMatrix4fv(projUL, 1, GL_FALSE, glm::value_ptr(camera.getProjection()));
+
+            // Bind the VAO again, the terrain unbinds its own
+            glBindVertexArray(vao);
+            glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
+            triangles += indices.size() / 3;
+            draws++;
+        }
+        else if(clipmap)
+        {
+            // The clipmap displaces its patches with the heights from its texture
+            clipmap->render(&camera, model);
+            triangles += clipmap->getStats().triangles;
+            draws += clipmap->getStats().draws;
+        }
+        else
+        {
+            // The terrain uses its own shader, which morphs between the levels of detail
+            terrain->render(&camera, model);
+            triangles += terrain->getStats().triangles;
+            draws += terrain->getStats().draws;
+        }
+        frames++;
 
         // Tip: if nothing is drawn, check the return value of glGetError and google it
 
@@ -207,10 +346,41 @@ int main(void)
         glfwPollEvents();
     }
 
+    if(frames > 0)
+    {
+        std::cout << "Drew " << triangles / frames << " of " << 2 * (w - 1) * (h - 1) << " triangles in "
+            << draws / frames << " draws per frame" << std::endl;
+    }
+    // What the heights take on the GPU, without the normals
+    if(full)
+    {
+        std::cout << "The mesh takes " << (vertices.size() + indices.size()) * 4 / 1024 << " KB" << std::endl;
+    }
+    else if(clipmap)
+    {
+        std::cout << "The clipmap has " << clipmap->getNumLevels() << " levels and takes "
+            << clipmap->getGpuBytes() / 1024 << " KB" << std::endl;
+    }
+    else
+    {
+        std::cout << "The terrain has " << terrain->getNumNodes() << " nodes in " << terrain->getNumLevels()
+            << " levels and takes " << terrain->getGpuBytes() / 1024 << " KB" << std::endl;
+    }
+    if(cache)
+    {
+        const TileCacheStats& stats = cache->getStats();
+        std::cout << "Streamed " << stats.loads << " tiles, dropped " << stats.evictions << ", "
+            << stats.residentBytes / 1024 / 1024 << " MB of heights in memory" << std::endl;
+    }
+
     // Clean up
     glDeleteBuffers(1, &vbo);
     glDeleteBuffers(1, &ebo);
     glDeleteVertexArrays(1, &vao);
+    glDeleteTextures(1, &normals);
+    delete terrain;
+    delete clipmap;
+    delete cache;
 
     glfwTerminate();
     return 0;
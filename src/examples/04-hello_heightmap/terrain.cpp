@@ -0,0 +1,544 @@
+#include "terrain.h"
+#include "../common/shader.h"
+#include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+// Vertices per row of a node
+static const int PATCH_VERTICES = Terrain::PATCH_SIZE + 1;
+// Indices of a quarter of a node
+static const int QUARTER_INDICES = Terrain::PATCH_SIZE * Terrain::PATCH_SIZE / 4 * 6;
+// Tiles uploaded per frame at most when streaming
+static const int MAX_TILE_UPLOADS = 8;
+// Children are asked for from this many times their range, so their tiles are there when they are needed
+static const float PREFETCH_RANGE = 1.5f;
+
+// The grid position of a vertex follows from its index, so the vertices only store
+// their height and the height of the vertex of the parent level they morph into
+static const char* VERTEX_SRC = "#version 330 core\n"
+                                "layout(location=0) in vec2 heights;"
+                                "uniform mat4 model;"
+                                "uniform mat4 view;"
+                                "uniform mat4 projection;"
+                                "uniform vec3 eye;"                 // Camera position in the space of the terrain
+                                "uniform vec2 extent;"              // Largest x and z of the map
+                                "uniform float cellSize;"           // Distance between two vertices of this level
+                                "uniform vec2 morphRange;"          // Distance at which morphing starts and 1 / its length
+                                "uniform vec2 origin;"
+                                "uniform int baseVertex;"
+                                "uniform int patchVertices;"        // Vertices per row of a node
+                                "uniform vec2 normalScale;"         // From x and z to the texture coordinates of the normals
+                                "uniform vec2 normalOffset;"
+                                "out vec2 texCoord;"
+                                "void main()"
+                                "{"
+                                "    int index = gl_VertexID - baseVertex;"
+                                "    vec2 grid = vec2(index / patchVertices, index % patchVertices);"
+                                "    vec2 position = origin + grid * cellSize;"
+                                "    float morph = clamp((distance(eye, vec3(min(position, extent), heights.x).xzy) - morphRange.x) * morphRange.y, 0.0, 1.0);"
+                                // Odd vertices slide onto their even neighbour, which turns the grid into that of the parent
+                                "    position = min(position - mod(grid, 2.0) * cellSize * morph, extent);"
+                                "    texCoord = position.yx * normalScale + normalOffset;"
+                                "    gl_Position = projection * view * model * vec4(position.x, mix(heights.x, heights.y, morph), position.y, 1.0);"
+                                "}";
+
+// Without normals the terrain is plain white, with them it is lit by a sun in the space of the terrain
+static const char* FRAGMENT_SRC = "#version 330 core\n"
+                                  "in vec2 texCoord;"
+                                  "uniform sampler2D normals;"
+                                  "uniform bool lit;"
+                                  "out vec4 outputColor;"
+                                  "void main()"
+                                  "{"
+                                  "    if(!lit)"
+                                  "    {"
+                                  "        outputColor = vec4(1.0f, 1.0f, 1.0f, 1.0f);"
+                                  "        return;"
+                                  "    }"
+                                  "    vec3 normal = normalize(texture(normals, texCoord).xyz * 2.0 - 1.0);"
+                                  "    float diffuse = max(dot(normal, normalize(vec3(0.4, 1.0, 0.3))), 0.0);"
+                                  "    outputColor = vec4(vec3(0.2 + 0.8 * diffuse), 1.0);"
+                                  "}";
+
+// Squared distance from a point to an axis aligned box
+static float boxDistance2(const glm::vec3& min, const glm::vec3& max, const glm::vec3& point)
+{
+    glm::vec3 d = glm::max(glm::max(min - point, point - max), glm::vec3(0.0f));
+    return glm::dot(d, d);
+}
+
+// Write the vertices of a node: its heights, every step-th one starting at heights, and the heights they
+// morph into. Heights past lastRow and lastColumn repeat the edge, the shader moves those vertices onto it.
+static void writeNode(const float* heights, size_t pitch, int step, int lastRow, int lastColumn, GLfloat* out)
+{
+    for(int i = 0; i < PATCH_VERTICES; ++i)
+    {
+        int sampleRow = std::min(i * step, lastRow), morphRow = std::min((i & ~1) * step, lastRow);
+        for(int j = 0; j < PATCH_VERTICES; ++j)
+        {
+            int sampleColumn = std::min(j * step, lastColumn), morphColumn = std::min((j & ~1) * step, lastColumn);
+            *out++ = heights[sampleRow * pitch + sampleColumn];
+            *out++ = heights[morphRow * pitch + morphColumn];
+        }
+    }
+}
+
+// Diagonal of the box of a node of size samples wide, with heights from minHeight to maxHeight
+static float nodeDiagonal(float size, float minHeight, float maxHeight)
+{
+    return std::sqrt(2.0f * size * size + (maxHeight - minHeight) * (maxHeight - minHeight));
+}
+
+Terrain::Terrain(const HeightMap& map, float tileSize)
+    : tileSize(tileSize), width(map.getWidth()), height(map.getHeight()), numLevels(0), numNodes(0),
+    vao(0), vbo(0), ebo(0), program(0), lodError(1.0f), lodViewportHeight(480.0f),
+    cache(NULL), tileNodes(0), maxTiles(0), frame(0), normalTexture(0)
+{
+    memset(&stats, 0, sizeof(stats));
+    if(width < 2 || height < 2)
+    {
+        std::cerr << "Heightmap of " << width << "x" << height << " is too small for a terrain" << std::endl;
+        return;
+    }
+    init();
+
+    // Every level is stored row by row, the bounds of a node hold all the heights below it, not only its own
+    const std::vector<float>& data = map.getData();
+    std::vector<GLfloat> vertices((size_t)numNodes * PATCH_VERTICES * PATCH_VERTICES * 2);
+    levels.resize(numLevels);
+    int firstNode = 0;
+    for(int level = 0; level < numLevels; ++level)
+    {
+        Level& l = levels[level];
+        int size = PATCH_SIZE << level;
+        l.rows = (height - 2) / size + 1;
+        l.columns = (width - 2) / size + 1;
+        l.firstNode = firstNode;
+        l.minHeights.resize(l.rows * l.columns);
+        l.maxHeights.resize(l.rows * l.columns);
+        for(int row = 0; row < l.rows; ++row)
+        {
+            for(int column = 0; column < l.columns; ++column)
+            {
+                int node = row * l.columns + column;
+                GLfloat* out = &vertices[(size_t)(firstNode + node) * PATCH_VERTICES * PATCH_VERTICES * 2];
+                writeNode(&data[(size_t)row * size * width + column * size], width, 1 << level,
+                        height - 1 - row * size, width - 1 - column * size, out);
+
+                float minHeight = FLT_MAX, maxHeight = -FLT_MAX;
+                if(level == 0)
+                {
+                    for(int i = 0; i < PATCH_VERTICES * PATCH_VERTICES; ++i)
+                    {
+                        minHeight = std::min(minHeight, out[i * 2]);
+                        maxHeight = std::max(maxHeight, out[i * 2]);
+                    }
+                }
+                for(int quarter = 0; quarter < 4 && level > 0; ++quarter)
+                {
+                    const Level& below = levels[level - 1];
+                    int childRow = row * 2 + (quarter >> 1), childColumn = column * 2 + (quarter & 1);
+                    if(childRow < below.rows && childColumn < below.columns)
+                    {
+                        minHeight = std::min(minHeight, below.minHeights[childRow * below.columns + childColumn]);
+                        maxHeight = std::max(maxHeight, below.maxHeights[childRow * below.columns + childColumn]);
+                    }
+                }
+                l.minHeights[node] = minHeight;
+                l.maxHeights[node] = maxHeight;
+
+                // A level has to reach at least twice as far as its nodes are large, see updateRanges
+                minRanges[level] = std::max(minRanges[level], 2.0f * nodeDiagonal(size * tileSize, minHeight, maxHeight));
+            }
+        }
+        firstNode += l.rows * l.columns;
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(GLfloat) * vertices.size(), &vertices[0]);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+Terrain::Terrain(TileCache* cache, float tileSize, int maxTiles)
+    : tileSize(tileSize), width(cache->getFile().getWidth()), height(cache->getFile().getHeight()),
+    numLevels(0), numNodes(0), vao(0), vbo(0), ebo(0), program(0), lodError(1.0f), lodViewportHeight(480.0f),
+    cache(cache), tileNodes(0), maxTiles(maxTiles), frame(0), normalTexture(0)
+{
+    memset(&stats, 0, sizeof(stats));
+    const HeightMapFile& file = cache->getFile();
+    if(file.getTileSize() % (2 * PATCH_SIZE) != 0)
+    {
+        // Then the children of a node are always in the same tile
+        std::cerr << "Tiles of " << file.getTileSize() << " samples cannot be split into nodes of "
+            << PATCH_SIZE << std::endl;
+        return;
+    }
+    tileNodes = file.getTileSize() / PATCH_SIZE;
+    init();
+
+    // The bounds of the nodes come from the tiles, which is coarser but needs no heights
+    for(int level = 0; level < numLevels; ++level)
+    {
+        int size = PATCH_SIZE << level;
+        for(int row = 0; row < file.getNumTileRows(level); ++row)
+        {
+            for(int column = 0; column < file.getNumTileColumns(level); ++column)
+            {
+                float minHeight, maxHeight;
+                file.getTileBounds(level, row, column, &minHeight, &maxHeight);
+                minRanges[level] = std::max(minRanges[level], 2.0f * nodeDiagonal(size * tileSize, minHeight, maxHeight));
+            }
+        }
+    }
+
+    int tileVertexCount = tileNodes * tileNodes * PATCH_VERTICES * PATCH_VERTICES;
+    tileVertices.resize(tileVertexCount * 2);
+    for(int i = maxTiles - 1; i >= 0; --i)
+    {
+        freeTiles.push_back(i * tileVertexCount);
+    }
+}
+
+void Terrain::init()
+{
+    extent = glm::vec2((height - 1) * tileSize, (width - 1) * tileSize);
+
+    // The root covers the whole map with the smallest power of two of patches
+    numLevels = 1;
+    while(PATCH_SIZE << (numLevels - 1) < std::max(width, height) - 1)
+    {
+        numLevels++;
+    }
+    for(int level = 0; level < numLevels; ++level)
+    {
+        int size = PATCH_SIZE << level;
+        numNodes += ((height - 2) / size + 1) * ((width - 2) / size + 1);
+    }
+    minRanges.assign(numLevels, 0.0f);
+    ranges.resize(numLevels);
+    selected.resize(numLevels);
+
+    // Every node draws its quarters from one index buffer, one after the other
+    std::vector<GLushort> indices;
+    for(int quarter = 0; quarter < 4; ++quarter)
+    {
+        int firstRow = (quarter >> 1) * PATCH_SIZE / 2, firstColumn = (quarter & 1) * PATCH_SIZE / 2;
+        for(int i = firstRow; i < firstRow + PATCH_SIZE / 2; ++i)
+        {
+            for(int j = firstColumn; j < firstColumn + PATCH_SIZE / 2; ++j)
+            {
+                indices.push_back(i * PATCH_VERTICES + j);
+                indices.push_back((i + 1) * PATCH_VERTICES + j);
+                indices.push_back(i * PATCH_VERTICES + j + 1);
+                indices.push_back(i * PATCH_VERTICES + j + 1);
+                indices.push_back((i + 1) * PATCH_VERTICES + j);
+                indices.push_back((i + 1) * PATCH_VERTICES + j + 1);
+            }
+        }
+    }
+
+    // Room for every node, or for maxTiles tiles of them when streaming
+    size_t numVertices = (size_t)(cache ? maxTiles * tileNodes * tileNodes : numNodes) * PATCH_VERTICES * PATCH_VERTICES;
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
+    glGenBuffers(1, &vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * 2 * numVertices, NULL, cache ? GL_DYNAMIC_DRAW : GL_STATIC_DRAW);
+    glGenBuffers(1, &ebo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLushort) * indices.size(), &indices[0], GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(GLfloat), 0);
+    glBindVertexArray(0);
+
+    GLuint vertex = createShader(VERTEX_SRC, GL_VERTEX_SHADER);
+    GLuint fragment = createShader(FRAGMENT_SRC, GL_FRAGMENT_SHADER);
+    program = createShaderProgram(vertex, fragment);
+    linkShader(program);
+    validateShader(program);
+    glDetachShader(program, vertex);
+    glDeleteShader(vertex);
+    glDetachShader(program, fragment);
+    glDeleteShader(fragment);
+    cellSizeLocation = glGetUniformLocation(program, "cellSize");
+    morphRangeLocation = glGetUniformLocation(program, "morphRange");
+    originLocation = glGetUniformLocation(program, "origin");
+    baseVertexLocation = glGetUniformLocation(program, "baseVertex");
+}
+
+Terrain::~Terrain()
+{
+    glDeleteBuffers(1, &vbo);
+    glDeleteBuffers(1, &ebo);
+    if(vao)
+    {
+        glDeleteVertexArrays(1, &vao);
+    }
+    if(program)
+    {
+        glDeleteProgram(program);
+    }
+}
+
+bool Terrain::getBounds(int level, int row, int column, glm::vec3* min, glm::vec3* max) const
+{
+    int size = PATCH_SIZE << level;
+    if(row * size >= height - 1 || column * size >= width - 1)
+    {
+        return false;
+    }
+    float minHeight, maxHeight;
+    if(cache)
+    {
+        cache->getFile().getTileBounds(level, row / tileNodes, column / tileNodes, &minHeight, &maxHeight);
+    }
+    else
+    {
+        const Level& l = levels[level];
+        minHeight = l.minHeights[row * l.columns + column];
+        maxHeight = l.maxHeights[row * l.columns + column];
+    }
+    *min = glm::vec3(row * size * tileSize, minHeight, column * size * tileSize);
+    *max = glm::vec3(std::min(row * size + size, height - 1) * tileSize, maxHeight,
+            std::min(column * size + size, width - 1) * tileSize);
+    return true;
+}
+
+bool Terrain::getVertices(int level, int row, int column, GLint* baseVertex)
+{
+    if(!cache)
+    {
+        const Level& l = levels[level];
+        *baseVertex = (l.firstNode + row * l.columns + column) * PATCH_VERTICES * PATCH_VERTICES;
+        return true;
+    }
+
+    int tileRow = row / tileNodes, tileColumn = column / tileNodes;
+    GLint nodeVertex = ((row % tileNodes) * tileNodes + column % tileNodes) * PATCH_VERTICES * PATCH_VERTICES;
+    unsigned long long key = (unsigned long long)level << 48 | (unsigned long long)tileRow << 24 | tileColumn;
+    std::unordered_map<unsigned long long, GpuTile>::iterator it = gpuTiles.find(key);
+    if(it != gpuTiles.end())
+    {
+        it->second.lastUsed = frame;
+        *baseVertex = it->second.baseVertex + nodeVertex;
+        return true;
+    }
+
+    // Ask the cache for the heights, it loads them in the background if it does not have them
+    const float* heights = cache->getTile(level, tileRow, tileColumn);
+    if(!heights || stats.uploads >= MAX_TILE_UPLOADS)
+    {
+        return false;
+    }
+
+    // Replace the tile that was drawn the longest ago, but never one that is drawn in this frame
+    GLint tileVertex;
+    if(!freeTiles.empty())
+    {
+        tileVertex = freeTiles.back();
+        freeTiles.pop_back();
+    }
+    else
+    {
+        std::unordered_map<unsigned long long, GpuTile>::iterator oldest = gpuTiles.end();
+        for(it = gpuTiles.begin(); it != gpuTiles.end(); ++it)
+        {
+            if(it->second.lastUsed < frame && (oldest == gpuTiles.end() || it->second.lastUsed < oldest->second.lastUsed))
+            {
+                oldest = it;
+            }
+        }
+        if(oldest == gpuTiles.end())
+        {
+            return false;
+        }
+        tileVertex = oldest->second.baseVertex;
+        gpuTiles.erase(oldest);
+    }
+
+    size_t pitch = cache->getFile().getTileSize() + 1;
+    for(int i = 0; i < tileNodes; ++i)
+    {
+        for(int j = 0; j < tileNodes; ++j)
+        {
+            writeNode(heights + i * PATCH_SIZE * pitch + j * PATCH_SIZE, pitch, 1, PATCH_SIZE, PATCH_SIZE,
+                    &tileVertices[(i * tileNodes + j) * PATCH_VERTICES * PATCH_VERTICES * 2]);
+        }
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferSubData(GL_ARRAY_BUFFER, tileVertex * 2 * sizeof(GLfloat), sizeof(GLfloat) * tileVertices.size(), &tileVertices[0]);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    GpuTile tile = { tileVertex, frame };
+    gpuTiles[key] = tile;
+    stats.uploads++;
+
+    *baseVertex = tileVertex + nodeVertex;
+    return true;
+}
+
+void Terrain::setLodError(float maxError, float viewportHeight)
+{
+    lodError = maxError;
+    lodViewportHeight = viewportHeight;
+}
+
+void Terrain::updateRanges(Camera* camera)
+{
+    // A quad of level l is at most lodError pixels wide beyond tileSize * 2^l * pixelsPerUnit / lodError,
+    // so the level below it reaches up to there. Each level at least doubles the range of the one below
+    // and is at least twice as large as its nodes: then a node always morphs completely into its parent
+    // before it meets it, and the parent has not started morphing yet.
+    float pixelsPerUnit = camera->getProjection()[1][1] * lodViewportHeight * 0.5f;
+    for(int level = 0; level < numLevels - 1; ++level)
+    {
+        float range = tileSize * (2 << level) * pixelsPerUnit / lodError;
+        range = std::max(range, minRanges[level]);
+        if(level > 0)
+        {
+            range = std::max(range, 2.0f * ranges[level - 1]);
+        }
+        ranges[level] = range;
+    }
+    ranges[numLevels - 1] = FLT_MAX;
+}
+
+void Terrain::select(int level, int row, int column, const Frustum& frustum, const glm::vec3& eye)
+{
+    glm::vec3 min, max;
+    GLint baseVertex;
+    if(!getBounds(level, row, column, &min, &max) || !frustum.containsBox(min, max)
+        || !getVertices(level, row, column, &baseVertex))
+    {
+        return;
+    }
+
+    // Refine when close enough, once the children can be drawn. When streaming, the children are
+    // asked for a bit before they are needed, which gives their tile time to load.
+    float distance2 = boxDistance2(min, max, eye);
+    float range2 = level > 0 ? ranges[level - 1] * ranges[level - 1] : 0.0f;
+    GLint childVertex;
+    bool refine = level > 0 && distance2 <= PREFETCH_RANGE * PREFETCH_RANGE * range2
+        && getVertices(level - 1, row * 2, column * 2, &childVertex) && distance2 <= range2;
+    if(!refine)
+    {
+        Draw draw = { glm::vec2(min.x, min.z), baseVertex, -1 };
+        selected[level].push_back(draw);
+        return;
+    }
+
+    // Refine the quarters that are close enough, and draw the others at this level
+    for(int quarter = 0; quarter < 4; ++quarter)
+    {
+        int childRow = row * 2 + (quarter >> 1), childColumn = column * 2 + (quarter & 1);
+        glm::vec3 childMin, childMax;
+        if(!getBounds(level - 1, childRow, childColumn, &childMin, &childMax))
+        {
+            continue;
+        }
+        if(boxDistance2(childMin, childMax, eye) <= range2)
+        {
+            select(level - 1, childRow, childColumn, frustum, eye);
+        }
+        else if(frustum.containsBox(childMin, childMax))
+        {
+            Draw draw = { glm::vec2(min.x, min.z), baseVertex, quarter };
+            selected[level].push_back(draw);
+        }
+    }
+}
+
+void Terrain::render(Camera* camera, const glm::mat4& model)
+{
+    memset(&stats, 0, sizeof(stats));
+    if(numNodes == 0)
+    {
+        return;
+    }
+    frame++;
+
+    // Select in the space of the terrain, the model matrix may rotate it
+    updateRanges(camera);
+    glm::vec3 eye = glm::vec3(glm::inverse(model) * glm::vec4(camera->getPosition(), 1.0f));
+    Frustum frustum(camera->getViewProjection() * model);
+    for(int level = 0; level < numLevels; ++level)
+    {
+        selected[level].clear();
+    }
+    select(numLevels - 1, 0, 0, frustum, eye);
+
+    glUseProgram(program);
+    glUniformMatrix4fv(glGetUniformLocation(program, "model"), 1, GL_FALSE, glm::value_ptr(model));
+    glUniformMatrix4fv(glGetUniformLocation(program, "view"), 1, GL_FALSE, glm::value_ptr(camera->getView()));
+    glUniformMatrix4fv(glGetUniformLocation(program, "projection"), 1, GL_FALSE, glm::value_ptr(camera->getProjection()));
+    glUniform3fv(glGetUniformLocation(program, "eye"), 1, glm::value_ptr(eye));
+    glUniform2fv(glGetUniformLocation(program, "extent"), 1, glm::value_ptr(extent));
+    // One texel per height, x runs along the rows of the texture and z along its columns
+    glUniform2f(glGetUniformLocation(program, "normalScale"), 1.0f / (tileSize * width), 1.0f / (tileSize * height));
+    glUniform2f(glGetUniformLocation(program, "normalOffset"), 0.5f / width, 0.5f / height);
+    glUniform1i(glGetUniformLocation(program, "normals"), 0);
+    glUniform1i(glGetUniformLocation(program, "lit"), normalTexture != 0);
+    glUniform1i(glGetUniformLocation(program, "patchVertices"), PATCH_VERTICES);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, normalTexture);
+
+    glBindVertexArray(vao);
+    for(int level = 0; level < numLevels; ++level)
+    {
+        if(selected[level].empty())
+        {
+            continue;
+        }
+
+        // Vertices morph over the second half of the range of their level, the root never does
+        float end = ranges[level], start = level > 0 ? ranges[level - 1] : 0.0f;
+        start += (end - start) * 0.5f;
+        glUniform1f(cellSizeLocation, tileSize * (1 << level));
+        glUniform2f(morphRangeLocation, start, level < numLevels - 1 ? 1.0f / (end - start) : 0.0f);
+
+        for(size_t i = 0; i < selected[level].size(); ++i)
+        {
+            const Draw& draw = selected[level][i];
+            int count = draw.quarter < 0 ? 4 * QUARTER_INDICES : QUARTER_INDICES;
+            size_t offset = draw.quarter < 0 ? 0 : draw.quarter * QUARTER_INDICES * sizeof(GLushort);
+            glUniform2fv(originLocation, 1, glm::value_ptr(draw.origin));
+            glUniform1i(baseVertexLocation, draw.baseVertex);
+            glDrawElementsBaseVertex(GL_TRIANGLES, count, GL_UNSIGNED_SHORT, (void*)offset, draw.baseVertex);
+            stats.draws++;
+            stats.triangles += count / 3;
+        }
+    }
+    glBindVertexArray(0);
+
+    // Hand the tiles that were missing to the loading thread
+    if(cache)
+    {
+        cache->update();
+    }
+}
+
+void Terrain::setNormalTexture(GLuint texture)
+{
+    normalTexture = texture;
+}
+
+int Terrain::getNumLevels() const
+{
+    return numLevels;
+}
+
+int Terrain::getNumNodes() const
+{
+    return numNodes;
+}
+
+size_t Terrain::getGpuBytes() const
+{
+    size_t numVertices = (size_t)(cache ? maxTiles * tileNodes * tileNodes : numNodes) * PATCH_VERTICES * PATCH_VERTICES;
+    return numVertices * 2 * sizeof(GLfloat) + 4 * QUARTER_INDICES * sizeof(GLushort);
+}
+
+const TerrainStats& Terrain::getStats() const
+{
+    return stats;
+}
@@ -0,0 +1,130 @@
+#ifndef TERRAIN_HEADER
+#define TERRAIN_HEADER
+
+#include "heightmap.h"
+#include "tilecache.h"
+#include "../common/camera.h"
+#include "../common/util.h"
+#include <glm/glm.hpp>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * What a Terrain drew in the last frame
+ */
+struct TerrainStats
+{
+    int draws, triangles;
+    // Tiles whose vertices were uploaded, when streaming
+    int uploads;
+};
+
+/**
+ * Draws a heightmap as a quadtree of chunks with continuous distance based levels of detail (CDLOD).
+ * Every node of the tree is a grid of PATCH_SIZE x PATCH_SIZE quads, the leaves sample every height
+ * and every level above them every other height of the level below. Close to the camera the tree
+ * is refined further, and the vertices of a node morph into those of its parent as they get to the end
+ * of its range, so neighbouring levels meet without cracks.
+ * All nodes are the same grid, so they share one index buffer and only store their heights.
+ */
+class Terrain
+{
+public:
+    static const int PATCH_SIZE = 32;
+
+    /**
+     * Upload every node of a heightmap in memory
+     * @param tileSize Distance between two heights of the map
+     */
+    Terrain(const HeightMap& map, float tileSize);
+    /**
+     * Stream the nodes from the tiles of a cache instead. Only the tiles that are drawn are uploaded,
+     * into room for maxTiles of them, the least recently drawn ones are replaced.
+     * A node is only refined once the tile of its children is there, so far away parts of the
+     * terrain show up first and get more detailed as their tiles come in.
+     * render updates the cache.
+     */
+    Terrain(TileCache* cache, float tileSize, int maxTiles = 256);
+    ~Terrain();
+
+    /**
+     * Pick the levels so a quad is at most maxError pixels wide on a viewport of viewportHeight pixels
+     */
+    void setLodError(float maxError, float viewportHeight);
+    /**
+     * Cull and draw the nodes, model places the terrain in the world
+     */
+    void render(Camera* camera, const glm::mat4& model);
+    /**
+     * Light the terrain with the normals of a texture made by HeightMap::createNormalTexture,
+     * 0 draws it plain white again
+     */
+    void setNormalTexture(GLuint texture);
+
+    int getNumLevels() const;
+    int getNumNodes() const;
+    /**
+     * Bytes of the vertices and indices of the nodes
+     */
+    size_t getGpuBytes() const;
+    const TerrainStats& getStats() const;
+private:
+    // A node, or one of its quarters when that child is too far away to be refined
+    struct Draw
+    {
+        glm::vec2 origin;
+        GLint baseVertex;
+        int quarter;
+    };
+    // The nodes of a level of a heightmap in memory, row by row
+    struct Level
+    {
+        int rows, columns;
+        int firstNode;
+        std::vector<float> minHeights, maxHeights;
+    };
+    // A tile of the cache on the GPU, with the vertices of all the nodes in it
+    struct GpuTile
+    {
+        GLint baseVertex;
+        unsigned long long lastUsed;
+    };
+
+    float tileSize;
+    int width, height;
+    glm::vec2 extent;
+    int numLevels, numNodes;
+    GLuint vao, vbo, ebo;
+    GLuint program;
+    GLint cellSizeLocation, morphRangeLocation, originLocation, baseVertexLocation;
+    float lodError, lodViewportHeight;
+    // Distance up to which each level is drawn, the root goes on forever
+    std::vector<float> ranges;
+    // The minimum range of every level that keeps neighbouring levels at most one apart
+    std::vector<float> minRanges;
+    std::vector<std::vector<Draw> > selected;
+    TerrainStats stats;
+
+    // A heightmap in memory
+    std::vector<Level> levels;
+
+    // Or streamed from a cache
+    TileCache* cache;
+    // Nodes per side of a tile
+    int tileNodes;
+    int maxTiles;
+    std::unordered_map<unsigned long long, GpuTile> gpuTiles;
+    std::vector<GLint> freeTiles;
+    std::vector<GLfloat> tileVertices;
+    unsigned long long frame;
+
+    GLuint normalTexture;
+
+    void init();
+    bool getBounds(int level, int row, int column, glm::vec3* min, glm::vec3* max) const;
+    bool getVertices(int level, int row, int column, GLint* baseVertex);
+    void updateRanges(Camera* camera);
+    void select(int level, int row, int column, const Frustum& frustum, const glm::vec3& eye);
+};
+
+#endif
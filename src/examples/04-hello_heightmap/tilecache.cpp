@@ -0,0 +1,179 @@
+#include "tilecache.h"
+#include <algorithm>
+#include <cstring>
+
+TileCache::TileCache(const HeightMapFile& file, size_t budget)
+    : file(file), budget(budget), frame(0), loadingKey(0), loading(false), stopping(false)
+{
+    memset(&stats, 0, sizeof(stats));
+    tileBytes = (size_t)(file.getTileSize() + 1) * (file.getTileSize() + 1) * sizeof(float);
+    thread = std::thread(&TileCache::work, this);
+}
+
+TileCache::~TileCache()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        jobs.clear();
+    }
+    jobAvailable.notify_all();
+    thread.join();
+    for(std::unordered_map<unsigned long long, Tile*>::iterator it = tiles.begin(); it != tiles.end(); ++it)
+    {
+        delete it->second;
+    }
+    for(size_t i = 0; i < loaded.size(); ++i)
+    {
+        delete loaded[i];
+    }
+}
+
+unsigned long long TileCache::makeKey(int level, int row, int column)
+{
+    return (unsigned long long)level << 48 | (unsigned long long)row << 24 | column;
+}
+
+const float* TileCache::getTile(int level, int row, int column)
+{
+    unsigned long long key = makeKey(level, row, column);
+    std::unordered_map<unsigned long long, Tile*>::iterator it = tiles.find(key);
+    if(it != tiles.end())
+    {
+        it->second->lastUsed = frame;
+        return &it->second->heights[0];
+    }
+    if(requestedSet.insert(key).second)
+    {
+        requested.push_back(key);
+        stats.requests++;
+    }
+    return NULL;
+}
+
+void TileCache::update()
+{
+    std::vector<Tile*> arrived;
+    std::unique_lock<std::mutex> lock(mutex);
+    arrived.swap(loaded);
+    // Tiles that are not loaded yet still count against the budget
+    size_t pending = jobs.size() + (loading ? 1 : 0);
+    lock.unlock();
+
+    for(size_t i = 0; i < arrived.size(); ++i)
+    {
+        Tile*& tile = tiles[arrived[i]->key];
+        if(tile)
+        {
+            delete arrived[i];
+            continue;
+        }
+        tile = arrived[i];
+        tile->lastUsed = frame;
+        stats.loads++;
+    }
+
+    // Make room for the new requests by dropping the tiles that were not used in this frame,
+    // the oldest first. Tiles that are in use are never dropped, even over the budget.
+    size_t capacity = std::max(budget / tileBytes, (size_t)1);
+    size_t wanted = tiles.size() + pending + requested.size();
+    if(wanted > capacity)
+    {
+        std::vector<Tile*> unused;
+        for(std::unordered_map<unsigned long long, Tile*>::iterator it = tiles.begin(); it != tiles.end(); ++it)
+        {
+            if(it->second->lastUsed < frame)
+            {
+                unused.push_back(it->second);
+            }
+        }
+        std::sort(unused.begin(), unused.end(), [](const Tile* a, const Tile* b) { return a->lastUsed < b->lastUsed; });
+        for(size_t i = 0; i < unused.size() && wanted > capacity; ++i, --wanted)
+        {
+            tiles.erase(unused[i]->key);
+            delete unused[i];
+            stats.evictions++;
+        }
+    }
+    stats.residentBytes = tiles.size() * tileBytes;
+
+    // The requests of this frame replace those of the last one, as many as fit
+    lock.lock();
+    size_t used = tiles.size() + loaded.size() + (loading ? 1 : 0);
+    size_t room = capacity > used ? capacity - used : 0;
+    jobs.clear();
+    for(size_t i = 0; i < requested.size() && jobs.size() < room; ++i)
+    {
+        if(!(loading && requested[i] == loadingKey))
+        {
+            jobs.push_back(requested[i]);
+        }
+    }
+    bool available = !jobs.empty();
+    lock.unlock();
+    if(available)
+    {
+        jobAvailable.notify_one();
+    }
+    requested.clear();
+    requestedSet.clear();
+    frame++;
+}
+
+void TileCache::finish()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    jobsDone.wait(lock, [this]() { return jobs.empty() && !loading; });
+}
+
+void TileCache::work()
+{
+    int tileSize = file.getTileSize();
+    float scale = file.getHeightScale() / 65535.0f;
+    while(true)
+    {
+        unsigned long long key;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            jobAvailable.wait(lock, [this]() { return stopping || !jobs.empty(); });
+            if(stopping)
+            {
+                return;
+            }
+            key = jobs.front();
+            jobs.pop_front();
+            loadingKey = key;
+            loading = true;
+        }
+
+        // Reading the samples faults the pages of the tile in, which is why this is not done on the render thread.
+        // The pages are dropped again right after, the floats are what is kept.
+        int level = key >> 48, row = (key >> 24) & 0xffffff, column = key & 0xffffff;
+        Tile* tile = new Tile;
+        tile->key = key;
+        tile->heights.resize((tileSize + 1) * (tileSize + 1));
+        const unsigned short* samples = file.getTile(level, row, column);
+        for(size_t i = 0; i < tile->heights.size(); ++i)
+        {
+            tile->heights[i] = samples[i] * scale;
+        }
+        file.releaseTile(level, row, column);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            loaded.push_back(tile);
+            loading = false;
+        }
+        jobsDone.notify_all();
+    }
+}
+
+const HeightMapFile& TileCache::getFile() const
+{
+    return file;
+}
+
+const TileCacheStats& TileCache::getStats() const
+{
+    return stats;
+}
@@ -0,0 +1,89 @@
+#ifndef TILE_CACHE_HEADER
+#define TILE_CACHE_HEADER
+
+#include "heightmapfile.h"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+/**
+ * Counters of a TileCache since it was created
+ */
+struct TileCacheStats
+{
+    long long requests, loads, evictions;
+    // Bytes of the tiles that are loaded right now
+    size_t residentBytes;
+};
+
+/**
+ * Keeps the heights of the tiles of a HeightMapFile that were used recently in memory.
+ * Tiles that are asked for but not loaded yet are read from the mapped file and converted
+ * to floats on a background thread, so the render thread never waits for the disk.
+ * Tiles that were not used for the longest time are dropped to stay under a memory budget.
+ * All public methods must be called from the same thread.
+ */
+class TileCache
+{
+public:
+    /**
+     * @param budget Bytes of heights to keep at most
+     */
+    TileCache(const HeightMapFile& file, size_t budget);
+    ~TileCache();
+
+    /**
+     * The heights of a tile, (tileSize + 1) * (tileSize + 1) of them row by row.
+     * If the tile is not loaded yet it is requested and this returns NULL.
+     * The heights stay valid until the next update.
+     */
+    const float* getTile(int level, int row, int column);
+    /**
+     * Take in the tiles that were loaded, drop old tiles to make room and hand the tiles
+     * that were requested since the last update to the loading thread, in the order
+     * they were requested. Requests that were not repeated are forgotten. Call this once per frame.
+     */
+    void update();
+    /**
+     * Block until the loading thread is done with the requests it has
+     */
+    void finish();
+
+    const HeightMapFile& getFile() const;
+    const TileCacheStats& getStats() const;
+private:
+    struct Tile
+    {
+        unsigned long long key;
+        std::vector<float> heights;
+        // Frame in which the tile was last used
+        unsigned long long lastUsed;
+    };
+
+    static unsigned long long makeKey(int level, int row, int column);
+    void work();
+
+    const HeightMapFile& file;
+    size_t tileBytes, budget;
+    unsigned long long frame;
+    std::unordered_map<unsigned long long, Tile*> tiles;
+    // Requests of this frame, without duplicates
+    std::vector<unsigned long long> requested;
+    std::unordered_set<unsigned long long> requestedSet;
+    TileCacheStats stats;
+
+    // Shared with the loading thread
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable jobAvailable, jobsDone;
+    std::deque<unsigned long long> jobs;
+    std::vector<Tile*> loaded;
+    unsigned long long loadingKey;
+    bool loading, stopping;
+};
+
+#endif
@@ -5,35 +5,53 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <cstring>
 
 const char* VERTEX_SRC = "#version 330 core\n"
-                          "layout(location=0) in vec3 position;"          // Vertex position (x, y, z)
-                          "layout(location=1) in vec3 color;"             // Vertex color (r, g, b)
+                          "layout(location=0) in vec3 position;"          // Quantized vertex position (x, y, z), 0 - 1 in the bounding box
                           "layout(location=2) in vec2 texcoord;"          // Texture coordinate (u, v)
+                          "uniform mat4 dequantize;"                      // Scales the position back to the bounding box of the mesh
                           "uniform mat4 model;"
                           "uniform mat4 view;"
                           "uniform mat4 projection;"
-                          "out vec3 fColor;"                              // Vertex shader has to pass color to fragment shader
                           "out vec2 fTexcoord;"                           // Pass to fragment shader
                           "void main()"
                           "{"
-                          "    fColor = color;"                           // Pass color to fragment shader
                           "    fTexcoord = texcoord;"                     // Pass texcoord to fragment shader
-                          "    gl_Position = projection * view * model * vec4(position, 1.0);"     // Place vertex at (x, y, z, 1) and then transform it according to the projection, view and model matrices
+                          "    gl_Position = projection * view * model * dequantize * vec4(position, 1.0);"     // Place vertex at (x, y, z, 1) and then transform it according to the projection, view and model matrices
                           "}";
 
 const char* FRAGMENT_SRC = "#version 330 core\n"
-                           "in vec3 fColor;"                              // From the vertex shader
                            "in vec2 fTexcoord;"                           // From the vertex shader
                            "uniform sampler2D diffuse;"                       // The texture
                            "out vec4 outputColor;"                        // The color of the resulting fragment
                            "void main()"
                            "{"
-                           "    outputColor = texture(diffuse, fTexcoord)"   // Color using the color and texutre
-                           "                  * vec4(fColor, 1.0);"
+                           "    outputColor = texture(diffuse, fTexcoord);"   // Color using the texture
                            "}";
 
-int main(void)
+// The meshes of the examples, converted with the vertex format of this one
+static const char* BENCH_MESHES[] = { "asteroid.obj", "test_mesh.obj", "monkey.obj" };
+
+// Compare the first load of every mesh, with Assimp, against the later ones from its mesh file
+static bool benchmarkLoad()
+{
+    const int runs = 5;
+    for(int i = 0; i < 3; ++i)
+    {
+        double convertTime, mapTime;
+        if(!Mesh::benchmarkLoad(BENCH_MESHES[i], runs, &convertTime, &mapTime))
+        {
+            std::cerr << "Could not load mesh " << BENCH_MESHES[i] << std::endl;
+            return false;
+        }
+        std::cout << BENCH_MESHES[i] << ": Assimp and convert " << convertTime << " ms, map and upload "
+            << mapTime << " ms (" << convertTime / mapTime << "x faster)" << std::endl;
+    }
+    return true;
+}
+
+int main(int argc, char** argv)
 {
     GLFWwindow* window;
 
@@ -49,6 +67,14 @@ int main(void)
     // vertices first
     glEnable(GL_DEPTH_TEST);
 
+    // The benchmark uploads the meshes, so it needs the context but not the render loop
+    if(argc > 1 && strcmp(argv[1], "bench") == 0)
+    {
+        bool passed = benchmarkLoad();
+        glfwTerminate();
+        return passed ? 0 : -1;
+    }
+
     // Create a perspective projection matrix
     glm::mat4 proj = glm::perspective(glm::radians(45.0f), (float)640/(float)480, 0.1f, 1000.0f);
     // vertex_clip = M_projection . M_view . M_model . vertex_local
@@ -104,6 +130,7 @@ int main(void)
         // Upload the MVP matrices
         mat.bind();
         mat.setUniform("model", model);
+        mat.setUniform("dequantize", mesh.getDequantizeMatrix());
         mat.setUniform("view", view);
         mat.setUniform("projection", proj);
 
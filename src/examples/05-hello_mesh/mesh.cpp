@@ -1,12 +1,18 @@
 #include "mesh.h"
+#include "../common/meshfile.h"
+#include "../common/meshoptimizer.h"
+#include "../common/vertexformat.h"
 #include <glm/gtc/matrix_transform.hpp>
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
+#include <chrono>
+#include <cstdio>
+#include <string>
 #include <vector>
 
 Mesh::Mesh()
-    : scale(1.0f, 1.0f, 1.0f)
+    : scale(1.0f, 1.0f, 1.0f), vao(0)
 {
 }
 
@@ -18,14 +24,23 @@ Mesh::~Mesh()
     }
 }
 
-bool Mesh::load(const char* fileName)
+// Positions are 16 bit relative to the bounding box of the mesh and
+// texture coordinates half floats: 12 bytes per vertex
+static const VertexFormat FORMAT =
 {
-    if(vao)
+    2,
     {
-        // Already loaded
-        return false;
+        { 0, 3, ENCODE_BOUNDS16 },  // position
+        { 2, 2, ENCODE_HALF }       // texture coordinates
     }
+};
+static const VertexLayout LAYOUT = getVertexLayout(FORMAT);
 
+/**
+ * Import a mesh with Assimp and write it to a binary mesh file
+ */
+static bool convert(const char* fileName, const char* meshFileName)
+{
     Assimp::Importer importer; 
     const aiScene* scene = importer.ReadFile(fileName,
             aiProcess_Triangulate |
@@ -38,10 +53,12 @@ bool Mesh::load(const char* fileName)
     }
 
     // We only load the first mesh from the Assimp scene here
+    const aiMesh* mesh = scene->mMeshes[0];
     std::vector<float> vertices;
     std::vector<GLuint> indices;
-    const aiMesh* mesh = scene->mMeshes[0];
-    for(int  i = 0; i < mesh->mNumVertices; ++i)
+    vertices.reserve(mesh->mNumVertices * 5);
+    indices.reserve(mesh->mNumFaces * 3);
+    for(unsigned int i = 0; i < mesh->mNumVertices; ++i)
     {
         const aiVector3D* pos = &(mesh->mVertices[i]);
         const aiVector3D* texCoord = &(mesh->mTextureCoords[0][i]);
@@ -49,58 +66,115 @@ bool Mesh::load(const char* fileName)
         vertices.push_back(pos->x);
         vertices.push_back(pos->y);
         vertices.push_back(pos->z);
-        vertices.push_back(1.0f); // r
-        vertices.push_back(1.0f); // g
-        vertices.push_back(1.0f); // b
         vertices.push_back(texCoord->x);
         vertices.push_back(texCoord->y);
     }
-    for(int i = 0; i < mesh->mNumFaces; ++i)
+    for(unsigned int i = 0; i < mesh->mNumFaces; ++i)
     {
         const aiFace* face = &(mesh->mFaces[i]);
         indices.push_back(face->mIndices[0]);
         indices.push_back(face->mIndices[1]);
         indices.push_back(face->mIndices[2]);
     }
-    numIndices = indices.size();
-
-    glGenVertexArrays(1, &vao);
-    glBindVertexArray(vao);
 
-    GLuint vbo;
-    glGenBuffers(1, &vbo);
+    // Reorder for the post-transform cache once, at conversion time
+    size_t numVertices = optimizeMesh(fileName, &vertices[0], 5 * sizeof(GLfloat), mesh->mNumVertices,
+            &indices[0], indices.size(), false);
 
-    GLuint ebo;
-    glGenBuffers(1, &ebo);
+    std::vector<unsigned char> packed;
+    MeshData data = { NULL, (GLuint)numVertices, &indices[0], (GLuint)indices.size() };
+    packVertices(FORMAT, &vertices[0], numVertices, packed, data.boundsMin, data.boundsSize);
+    printQuantizationError(fileName, FORMAT, &vertices[0], numVertices, packed, data.boundsMin, data.boundsSize);
+    data.vertices = &packed[0];
+    return writeMeshFile(meshFileName, fileName, LAYOUT, std::vector<MeshData>(1, data));
+}
 
-    // Upload the vertices to the buffer
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * vertices.size(), &vertices[0], GL_STATIC_DRAW);
+bool Mesh::load(const char* fileName)
+{
+    if(vao)
+    {
+        // Already loaded
+        return false;
+    }
 
-    // Upload the indices to the buffer
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * indices.size(), &indices[0], GL_STATIC_DRAW);
+    // Importing with Assimp is slow, so the first run converts the mesh to
+    // a binary mesh file that later runs map and upload directly (see ../common/meshfile.h)
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::string meshFileName = std::string(fileName) + ".mesh";
+    MeshFile file;
+    bool converted = false;
+    if(!file.open(meshFileName.c_str(), fileName, LAYOUT))
+    {
+        if(!convert(fileName, meshFileName.c_str()) || !file.open(meshFileName.c_str(), fileName, LAYOUT))
+        {
+            return false;
+        }
+        converted = true;
+    }
+    numIndices = file.getNumIndices(0);
+    indexType = file.getIndexType(0);
+    file.getBounds(0, &boundsMin, &boundsSize);
 
-    // Because it's a bit tedious, we won't be using indices here
-    // How to use them should be self-explanatory
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
 
-    // Enable the vertex attributes and upload their data (see: layout(location=x))
-    // NOTE: We have added a z coordinate so this code has again changed!
-    glEnableVertexAttribArray(0); // position
-    // 3 floats: x and y, but 8 floats in total per row
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat), 0);
-    glEnableVertexAttribArray(1); // color
-    // 3 floats: r, g and b, but 8 floats in total per row and start at the 4th one
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat), (void*)(3 * sizeof(GLfloat)));
-    glEnableVertexAttribArray(2); // texture coordinates
-    // 2 floats: u and v, but 8 floats in total per row and start at the 7th one
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat), (void*)(6 * sizeof(GLfloat)));
+    // Upload the vertices and indices to new buffers straight from the file,
+    // and enable the vertex attributes (see: layout(location=x))
+    GLuint vbo, ebo;
+    file.upload(0, &vbo, &ebo);
 
     // We have now successfully created a drawable Vertex Array Object
     glBindVertexArray(0);
     // We no longer need vbo and ebo
     glDeleteBuffers(1, &vbo);
     glDeleteBuffers(1, &ebo);
+
+    std::chrono::duration<double, std::milli> duration = std::chrono::steady_clock::now() - start;
+    std::cout << (converted ? "Converted " : "Mapped ") << fileName << " in " << duration.count() << " ms" << std::endl;
+    return true;
+}
+
+bool Mesh::benchmarkLoad(const char* fileName, int runs, double* convertTime, double* mapTime)
+{
+    std::string meshFileName = std::string(fileName) + ".bench.mesh";
+    *convertTime = 0.0;
+    *mapTime = 0.0;
+    for(int i = 0; i < runs; ++i)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        if(!convert(fileName, meshFileName.c_str()))
+        {
+            return false;
+        }
+        std::chrono::duration<double, std::milli> duration = std::chrono::steady_clock::now() - start;
+        *convertTime += duration.count();
+    }
+    for(int i = 0; i < runs; ++i)
+    {
+        // Wait for the upload too, the driver may only copy the data when it is first used
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        MeshFile file;
+        if(!file.open(meshFileName.c_str(), fileName, LAYOUT))
+        {
+            std::remove(meshFileName.c_str());
+            return false;
+        }
+        GLuint vao, vbo, ebo;
+        glGenVertexArrays(1, &vao);
+        glBindVertexArray(vao);
+        file.upload(0, &vbo, &ebo);
+        glBindVertexArray(0);
+        glFinish();
+        std::chrono::duration<double, std::milli> duration = std::chrono::steady_clock::now() - start;
+        *mapTime += duration.count();
+
+        glDeleteVertexArrays(1, &vao);
+        glDeleteBuffers(1, &vbo);
+        glDeleteBuffers(1, &ebo);
+    }
+    std::remove(meshFileName.c_str());
+    *convertTime /= runs;
+    *mapTime /= runs;
     return true;
 }
 
@@ -130,8 +204,16 @@ glm::mat4 Mesh::getModelMatrix()
     return m;
 }
 
+glm::mat4 Mesh::getDequantizeMatrix()
+{
+    glm::mat4 m;
+    m = glm::translate(m, boundsMin);
+    m = glm::scale(m, boundsSize);
+    return m;
+}
+
 void Mesh::render()
 {
     glBindVertexArray(vao);
-    glDrawElements(GL_TRIANGLES, numIndices, GL_UNSIGNED_INT, 0);
+    glDrawElements(GL_TRIANGLES, numIndices, indexType, 0);
 }
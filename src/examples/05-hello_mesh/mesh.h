@@ -11,6 +11,12 @@ public:
     ~Mesh();
 
     bool load(const char* fileName);
+    /**
+     * Time importing a mesh with Assimp and writing its mesh file against mapping the mesh file
+     * and uploading it, like the first and later runs of load() do. Both are averaged over runs.
+     * The mesh file of load() is left alone, this writes and removes <fileName>.bench.mesh.
+     */
+    static bool benchmarkLoad(const char* fileName, int runs, double* convertTime, double* mapTime);
 
     void setPosition(float x, float y, float z);
     void setScale(float x, float y, float z);
@@ -19,8 +25,14 @@ public:
     void render();
 
     glm::mat4 getModelMatrix();
+    /**
+     * Scales the quantized positions in the vertex buffer back to the mesh
+     */
+    glm::mat4 getDequantizeMatrix();
 private:
     int numIndices;
+    GLenum indexType;
+    glm::vec3 boundsMin, boundsSize;
     glm::vec3 position, scale, angle;
     GLuint vao;
 };
@@ -1,12 +1,16 @@
 #include "mesh.h"
+#include "../common/meshfile.h"
+#include "../common/meshoptimizer.h"
 #include <glm/gtc/matrix_transform.hpp>
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
+#include <chrono>
+#include <string>
 #include <vector>
 
 Mesh::Mesh()
-    : scale(1.0f, 1.0f, 1.0f)
+    : scale(1.0f, 1.0f, 1.0f), vao(0)
 {
 }
 
@@ -18,14 +22,22 @@ Mesh::~Mesh()
     }
 }
 
-bool Mesh::load(const char* fileName)
+// position (x, y, z), color (r, g, b) and texture coordinates (u, v): 8 floats per vertex
+static const VertexLayout LAYOUT =
 {
-    if(vao)
+    8 * sizeof(GLfloat), 3,
     {
-        // Already loaded
-        return false;
+        { 0, 3, GL_FLOAT, GL_FALSE, 0 },                    // position
+        { 1, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat) },  // color
+        { 2, 2, GL_FLOAT, GL_FALSE, 6 * sizeof(GLfloat) }   // texture coordinates
     }
+};
 
+/**
+ * Import a mesh with Assimp and write it to a binary mesh file
+ */
+static bool convert(const char* fileName, const char* meshFileName)
+{
     Assimp::Importer importer; 
     const aiScene* scene = importer.ReadFile(fileName,
             aiProcess_Triangulate |
@@ -38,10 +50,12 @@ bool Mesh::load(const char* fileName)
     }
 
     // We only load the first mesh from the Assimp scene here
+    const aiMesh* mesh = scene->mMeshes[0];
     std::vector<float> vertices;
     std::vector<GLuint> indices;
-    const aiMesh* mesh = scene->mMeshes[0];
-    for(int  i = 0; i < mesh->mNumVertices; ++i)
+    vertices.reserve(mesh->mNumVertices * 8);
+    indices.reserve(mesh->mNumFaces * 3);
+    for(unsigned int i = 0; i < mesh->mNumVertices; ++i)
     {
         const aiVector3D* pos = &(mesh->mVertices[i]);
         const aiVector3D* texCoord = &(mesh->mTextureCoords[0][i]);
@@ -55,52 +69,63 @@ bool Mesh::load(const char* fileName)
         vertices.push_back(texCoord->x);
         vertices.push_back(texCoord->y);
     }
-    for(int i = 0; i < mesh->mNumFaces; ++i)
+    for(unsigned int i = 0; i < mesh->mNumFaces; ++i)
     {
         const aiFace* face = &(mesh->mFaces[i]);
         indices.push_back(face->mIndices[0]);
         indices.push_back(face->mIndices[1]);
         indices.push_back(face->mIndices[2]);
     }
-    numIndices = indices.size();
-
-    glGenVertexArrays(1, &vao);
-    glBindVertexArray(vao);
 
-    GLuint vbo;
-    glGenBuffers(1, &vbo);
+    // Reorder for the post-transform cache once, at conversion time
+    size_t numVertices = optimizeMesh(fileName, &vertices[0], 8 * sizeof(GLfloat), mesh->mNumVertices,
+            &indices[0], indices.size(), false);
 
-    GLuint ebo;
-    glGenBuffers(1, &ebo);
+    MeshData data = { &vertices[0], (GLuint)numVertices, &indices[0], (GLuint)indices.size() };
+    return writeMeshFile(meshFileName, fileName, LAYOUT, std::vector<MeshData>(1, data));
+}
 
-    // Upload the vertices to the buffer
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * vertices.size(), &vertices[0], GL_STATIC_DRAW);
+bool Mesh::load(const char* fileName)
+{
+    if(vao)
+    {
+        // Already loaded
+        return false;
+    }
 
-    // Upload the indices to the buffer
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * indices.size(), &indices[0], GL_STATIC_DRAW);
+    // Importing with Assimp is slow, so the first run converts the mesh to
+    // a binary mesh file that later runs map and upload directly (see ../common/meshfile.h)
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::string meshFileName = std::string(fileName) + ".mesh";
+    MeshFile file;
+    bool converted = false;
+    if(!file.open(meshFileName.c_str(), fileName, LAYOUT))
+    {
+        if(!convert(fileName, meshFileName.c_str()) || !file.open(meshFileName.c_str(), fileName, LAYOUT))
+        {
+            return false;
+        }
+        converted = true;
+    }
+    numIndices = file.getNumIndices(0);
+    indexType = file.getIndexType(0);
 
-    // Because it's a bit tedious, we won't be using indices here
-    // How to use them should be self-explanatory
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
 
-    // Enable the vertex attributes and upload their data (see: layout(location=x))
-    // NOTE: We have added a z coordinate so this code has again changed!
-    glEnableVertexAttribArray(0); // position
-    // 3 floats: x and y, but 8 floats in total per row
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat), 0);
-    glEnableVertexAttribArray(1); // color
-    // 3 floats: r, g and b, but 8 floats in total per row and start at the 4th one
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat), (void*)(3 * sizeof(GLfloat)));
-    glEnableVertexAttribArray(2); // texture coordinates
-    // 2 floats: u and v, but 8 floats in total per row and start at the 7th one
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat), (void*)(6 * sizeof(GLfloat)));
+    // Upload the vertices and indices to new buffers straight from the file,
+    // and enable the vertex attributes (see: layout(location=x))
+    GLuint vbo, ebo;
+    file.upload(0, &vbo, &ebo);
 
     // We have now successfully created a drawable Vertex Array Object
     glBindVertexArray(0);
     // We no longer need vbo and ebo
     glDeleteBuffers(1, &vbo);
     glDeleteBuffers(1, &ebo);
+
+    std::chrono::duration<double, std::milli> duration = std::chrono::steady_clock::now() - start;
+    std::cout << (converted ? "Converted " : "Mapped ") << fileName << " in " << duration.count() << " ms" << std::endl;
     return true;
 }
 
@@ -133,6 +158,6 @@ glm::mat4 Mesh::getModelMatrix()
 void Mesh::render()
 {
     glBindVertexArray(vao);
-    glDrawElements(GL_TRIANGLES, numIndices, GL_UNSIGNED_INT, 0);
+    glDrawElements(GL_TRIANGLES, numIndices, indexType, 0);
     glBindVertexArray(0);
 }
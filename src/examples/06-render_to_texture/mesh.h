@@ -21,6 +21,7 @@ public:
     glm::mat4 getModelMatrix();
 private:
     int numIndices;
+    GLenum indexType;
     glm::vec3 position, scale, angle;
     GLuint vao;
 };
@@ -1,5 +1,6 @@
 #include "../common/util.h"
 #include "../common/shader.h"
+#include "../common/textureloader.h"
 #include "skybox.h"
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -22,13 +23,17 @@ int main(void)
     // vertices first
     glEnable(GL_DEPTH_TEST);
 
-    GLuint cubemap = loadCubeMap("cm_xp.png", "cm_xn.png", "cm_yp.png", "cm_yn.png", "cm_zp.png", "cm_zn.png");
-    if(!cubemap)
+    // The six faces are decoded in parallel on worker threads,
+    // this thread only uploads them (see ../common/textureloader.h)
+    TextureLoader loader;
+    const AsyncTexture* cubemap = loader.loadCubeMap("cm_xp.png", "cm_xn.png", "cm_yp.png", "cm_yn.png", "cm_zp.png", "cm_zn.png");
+    loader.finish();
+    if(cubemap->failed)
     {
         std::cerr << "Could not load cubemap" << std::endl;
         return -1;
     }
-    Skybox skybox(cubemap);
+    Skybox skybox(cubemap->texture);
 
     glClearColor(0.75f, 0.75f, 0.75f, 1.0f);
 
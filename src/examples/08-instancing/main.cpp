@@ -1,27 +1,42 @@
 #include "../common/util.h"
 #include "../common/shader.h"
 #include "../common/camera.h"
+#include "../common/textureloader.h"
+#include "../common/jobpool.h"
+#include "../common/instancetransform.h"
+#include "../common/streambuffer.h"
 #include "material.h"
 #include "mesh.h"
 #include "skybox.h"
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <chrono>
+#include <cmath>
+#include <cstring>
 
 #define NUM_ASTEROIDS 2000
 #define SEED 1993
+// Instances and frames for the instance format benchmark
+#define BENCH_INSTANCES 100000
+#define BENCH_FRAMES 20
+// Upload at most this many bytes of texture data per frame
+#define UPLOAD_BUDGET (4 * 1024 * 1024)
 
 const char* VERTEX_SRC = "#version 330 core\n"
                           "layout(location=0) in vec3 position;"          // Vertex position (x, y, z)
                           "layout(location=1) in vec2 texcoord;"          // Texture coordinate (u, v)
-                          "layout(location=2) in mat4 model_inst;"       // Model matrix for this instance
+                          "layout(location=2) in vec4 inst_position_scale;" // Position and scale of this instance
+                          "layout(location=3) in vec4 inst_rotation;"     // Rotation of this instance as a quaternion
                           "uniform mat4 view;"
                           "uniform mat4 projection;"
                           "out vec2 fTexcoord;"                           // Pass to fragment shader
+                          INSTANCE_TRANSFORM_GLSL                         // instanceTransform(), see ../common/instancetransform.h
                           "void main()"
                           "{"
                           "    fTexcoord = texcoord;"                     // Pass texcoord to fragment shader
-                          "    gl_Position = projection * view * model_inst * vec4(position, 1.0);"     // Place vertex at (x, y, z, 1) and then transform it according to the projection, view and model matrices
+                          "    vec3 worldPosition = instanceTransform(inst_position_scale, inst_rotation, position);" // Rotate, scale and move the vertex like a model matrix would
+                          "    gl_Position = projection * view * vec4(worldPosition, 1.0);"     // Then transform it according to the projection and view matrices
                           "}";
 
 const char* FRAGMENT_SRC = "#version 330 core\n"
@@ -33,8 +48,132 @@ const char* FRAGMENT_SRC = "#version 330 core\n"
                            "    outputColor = texture(diffuse, fTexcoord);"
                            "}";
 
-int main(void)
+// The vertex shader of the original version, which got a whole model matrix per instance
+const char* MATRIX_VERTEX_SRC = "#version 330 core\n"
+                                "layout(location=0) in vec3 position;"
+                                "layout(location=1) in vec2 texcoord;"
+                                "layout(location=2) in mat4 model_inst;"  // Locations 2 to 5
+                                "uniform mat4 view;"
+                                "uniform mat4 projection;"
+                                "out vec2 fTexcoord;"
+                                "void main()"
+                                "{"
+                                "    fTexcoord = texcoord;"
+                                "    gl_Position = projection * view * model_inst * vec4(position, 1.0);"
+                                "}";
+
+// Milliseconds since start
+static double elapsed(const std::chrono::steady_clock::time_point& start)
+{
+    std::chrono::duration<double, std::milli> duration = std::chrono::steady_clock::now() - start;
+    return duration.count();
+}
+
+// Stream and draw the transforms of all instances every frame, once as a mat4 per instance
+// and once as an InstanceTransform, and time the upload and the whole frame
+static bool benchmarkInstances(const Mesh& mesh)
 {
+    std::vector<InstanceTransform> instances(BENCH_INSTANCES);
+    std::vector<glm::mat4> matrices(BENCH_INSTANCES);
+    srand(SEED);
+    float field = std::cbrt((float)BENCH_INSTANCES / NUM_ASTEROIDS);
+    for(int i = 0; i < BENCH_INSTANCES; ++i)
+    {
+        glm::vec3 position(rand() % 100 - 50.0f, rand() % 100 - 50.0f, rand() % 100);
+        float scale = (rand() % 200) / 100.0f + 0.1f;
+        glm::quat rotation = glm::angleAxis(glm::radians((float)(rand() % 100)), glm::normalize(glm::vec3(1.0f, 1.0f, 1.0f)));
+        instances[i] = makeInstanceTransform(position * field, scale, rotation);
+        matrices[i] = glm::translate(glm::mat4(), position * field) * glm::scale(glm::mat4(), glm::vec3(scale)) *
+            glm::mat4_cast(rotation);
+    }
+
+    // Far enough back to see the whole field
+    Camera camera(CAMERA_PERSPECTIVE, 45.0f, 0.1f, 2000.0f, 640.0f, 480.0f);
+    camera.setPosition(0.0f, 0.0f, -500.0f * field);
+    const MeshLod& lod = mesh.getLod(0);
+
+    for(int format = 0; format < 2; ++format)
+    {
+        bool matrix = format == 0;
+        const char* name = matrix ? "mat4" : "InstanceTransform";
+        const void* data = matrix ? (const void*)&matrices[0] : (const void*)&instances[0];
+        GLsizeiptr bytes = BENCH_INSTANCES * (matrix ? sizeof(glm::mat4) : sizeof(InstanceTransform));
+
+        Material mat;
+        if(!mat.load(matrix ? MATRIX_VERTEX_SRC : VERTEX_SRC, FRAGMENT_SRC))
+        {
+            std::cerr << "Could not load the " << name << " shaders" << std::endl;
+            return false;
+        }
+        mat.use();
+        mat.setUniform("view", camera.getView());
+        mat.setUniform("projection", camera.getProjection());
+
+        StreamBuffer stream(3 * bytes);
+        glBindVertexArray(mesh.getVertexArray());
+        glBindBuffer(GL_ARRAY_BUFFER, stream.getBuffer());
+        double uploadTime = 0.0, frameTime = 0.0;
+        // The first few frames are not timed, they compile and allocate in the driver
+        for(int frame = -5; frame < BENCH_FRAMES; ++frame)
+        {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            std::chrono::steady_clock::time_point uploadStart = std::chrono::steady_clock::now();
+            GLsizeiptr offset = stream.write(data, bytes);
+            if(offset < 0)
+            {
+                std::cerr << "Could not stream the " << name << " transforms" << std::endl;
+                return false;
+            }
+            double upload = elapsed(uploadStart);
+
+            if(matrix)
+            {
+                // A mat4 takes 4 attributes of a vec4 each
+                for(GLuint i = 0; i < 4; ++i)
+                {
+                    glEnableVertexAttribArray(2 + i);
+                    glVertexAttribPointer(2 + i, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4),
+                            (void*)(offset + i * sizeof(glm::vec4)));
+                    glVertexAttribDivisor(2 + i, 1);
+                }
+            }
+            else
+            {
+                setInstanceTransformLayout(2, offset);
+            }
+            glDrawElementsInstanced(GL_TRIANGLES, lod.numIndices, mesh.getIndexType(), 0, BENCH_INSTANCES);
+            stream.fence();
+            // Wait for the GPU, so the time includes transforming all the vertices
+            glFinish();
+            if(frame >= 0)
+            {
+                uploadTime += upload;
+                frameTime += elapsed(start);
+            }
+        }
+        // Leave the vertex array like the mesh set it up
+        for(GLuint i = 2; i < 6; ++i)
+        {
+            glDisableVertexAttribArray(i);
+            glVertexAttribDivisor(i, 0);
+        }
+        glBindVertexArray(0);
+
+        double vertices = (double)lod.numIndices * BENCH_INSTANCES;
+        std::cout << BENCH_INSTANCES << " instances as " << name << ": " << bytes / 1024 << " KB uploaded per frame in "
+            << uploadTime / BENCH_FRAMES << " ms (" << bytes * BENCH_FRAMES / uploadTime / 1e6 << " GB/s), "
+            << frameTime / BENCH_FRAMES << " ms per frame, " << vertices * BENCH_FRAMES / frameTime / 1000.0
+            << " M vertices/s" << std::endl;
+    }
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    // The instance benchmark runs once the mesh is loaded
+    bool bench = argc > 1 && strcmp(argv[1], "bench") == 0;
+
     GLFWwindow* window;
 
     window = init("Instancing", 640, 480);
@@ -60,14 +199,13 @@ int main(void)
         return -1;
     }
     mat.use();
-    int w, h;
-    GLuint texture = loadImage("asteroid.png", &w, &h, 0, false);
-    if(!texture)
-    {
-        std::cerr << "Could not load texture" << std::endl;
-        return -1;
-    }
-    mat.setDiffuseTexture(texture);
+
+    // Images are decoded on worker threads while we load the mesh,
+    // and uploaded a few at a time in the render loop (see ../common/textureloader.h)
+    TextureLoader loader;
+    const AsyncTexture* texture = loader.loadImage("asteroid.png", 0, false);
+    const AsyncTexture* cubemap = loader.loadCubeMap("cm_xp.png", "cm_xn.png", "cm_yp.png", "cm_yn.png", "cm_zp.png", "cm_zn.png");
+    mat.setDiffuseTexture(texture->texture);
 
     // Load the mesh
     Mesh mesh;
@@ -76,43 +214,64 @@ int main(void)
         std::cerr << "Could not load mesh" << std::endl;
         return -1;
     }
+    // Pick a level of detail that is off by at most a pixel on a 480 pixel high window
+    mesh.setLodError(1.0f, 480.0f);
+    mesh.printLods();
 
-    // Set random positions for the asteroids
-    std::vector<glm::mat4> models;
-    models.resize(NUM_ASTEROIDS);
-    srand(SEED);
-    for(int i = 0; i < NUM_ASTEROIDS; ++i)
+    if(bench)
     {
-        glm::mat4 model;
+        bool passed = benchmarkInstances(mesh);
+        glfwTerminate();
+        return passed ? 0 : -1;
+    }
+
+    // The number of asteroids can be given on the command line, add static to draw them all
+    // from a static buffer instead of culling them every frame
+    int numAsteroids = NUM_ASTEROIDS;
+    if(argc > 1)
+    {
+        numAsteroids = std::max(atoi(argv[1]), 1);
+    }
+    bool dynamic = !(argc > 2 && strcmp(argv[2], "static") == 0);
 
+    // Set random positions for the asteroids, more asteroids fill a larger field
+    std::vector<InstanceTransform> instances;
+    instances.resize(numAsteroids);
+    srand(SEED);
+    float field = std::cbrt((float)numAsteroids / NUM_ASTEROIDS);
+    for(int i = 0; i < numAsteroids; ++i)
+    {
         // Translate
-        model = glm::translate(model, glm::vec3(rand() % 100 - 50.0f, rand() % 100 - 50.0f, rand() % 100));
+        glm::vec3 position(rand() % 100 - 50.0f, rand() % 100 - 50.0f, rand() % 100);
 
         // Scale
         float scale = (rand() % 200) / 100.0f + 0.1f;
-        model = glm::scale(model, glm::vec3(scale, scale, scale));
 
         // Rotate
-        model = glm::rotate(model, glm::radians((float)(rand() % 100)), glm::vec3(1.0f, 1.0f, 1.0f));
+        glm::quat rotation = glm::angleAxis(glm::radians((float)(rand() % 100)), glm::normalize(glm::vec3(1.0f, 1.0f, 1.0f)));
 
-        models[i] = model;
+        instances[i] = makeInstanceTransform(position * field, scale, rotation);
     }
 
-    mesh.setInstances(NUM_ASTEROIDS, models);
-
-    // Load a skybox
-    GLuint cubemap = loadCubeMap("cm_xp.png", "cm_xn.png", "cm_yp.png", "cm_yn.png", "cm_zp.png", "cm_zn.png");
-
-    if(!cubemap)
+    JobPool pool;
+    if(dynamic)
     {
-        std::cerr << "Could not load cubemap" << std::endl;
-        return -1;
+        mesh.setDynamicInstances(instances, &pool);
+    }
+    else
+    {
+        mesh.setInstances(numAsteroids, instances);
     }
-    Skybox skybox(cubemap);
+
+    // The skybox stays black until all the faces of the cubemap have been uploaded
+    Skybox skybox(cubemap->texture);
     
     // Set the clear color to a light grey
     glClearColor(0.75f, 0.75f, 0.75f, 1.0f);
 
+    double renderTime = 0.0;
+    long long frames = 0, drawn = 0;
+    long long drawnLods[Mesh::MAX_LODS] = {};
     while(!glfwWindowShouldClose(window))
     {
         if(glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
@@ -120,6 +279,13 @@ int main(void)
             break;
         }
 
+        loader.update(UPLOAD_BUDGET);
+        if(texture->failed || cubemap->failed)
+        {
+            std::cerr << "Could not load textures" << std::endl;
+            break;
+        }
+
         updateCamera(640, 480, window);
 
         // Clear (note the addition of GL_DEPTH_BUFFER_BIT)
@@ -130,7 +296,24 @@ int main(void)
         mat.setUniform("view", camera.getView());
         mat.setUniform("projection", camera.getProjection());
 
-        mesh.render();
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        if(dynamic)
+        {
+            mesh.render(&camera);
+            drawn += mesh.getNumVisible();
+            for(int i = 0; i < mesh.getNumLods(); ++i)
+            {
+                drawnLods[i] += mesh.getNumVisible(i);
+            }
+        }
+        else
+        {
+            mesh.render();
+            drawn += numAsteroids;
+        }
+        std::chrono::duration<double, std::milli> duration = std::chrono::steady_clock::now() - start;
+        renderTime += duration.count();
+        frames++;
 
         skybox.render(camera.getView(), camera.getProjection());
 
@@ -139,8 +322,23 @@ int main(void)
         glfwPollEvents();
     }
 
+    if(frames > 0)
+    {
+        std::cout << "Drew " << drawn / frames << " of " << numAsteroids << " asteroids per frame, "
+            << renderTime / frames << " ms to cull and submit them on " << pool.getNumThreads() << " threads, "
+            << (dynamic ? drawn / frames * sizeof(InstanceTransform) / 1024 : 0) << " KB of transforms streamed per frame" << std::endl;
+        if(dynamic)
+        {
+            for(int i = 0; i < mesh.getNumLods(); ++i)
+            {
+                std::cout << "LOD " << i << ": " << drawnLods[i] / frames << " asteroids per frame" << std::endl;
+            }
+        }
+    }
+
     // Clean up
-    glDeleteTextures(1, &texture);
+    glDeleteTextures(1, &texture->texture);
+    glDeleteTextures(1, &cubemap->texture);
 
     glfwTerminate();
     return 0;
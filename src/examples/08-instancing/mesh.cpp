@@ -1,31 +1,52 @@
 #include "mesh.h"
+#include "../common/meshfile.h"
+#include "../common/meshoptimizer.h"
+#include "../common/meshsimplifier.h"
 #include <glm/gtc/matrix_transform.hpp>
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cstring>
+#include <string>
 #include <vector>
 
+// Levels of detail are not simplified further than this, relative to the radius of the mesh
+static const float MAX_LOD_ERROR = 0.5f;
+
 Mesh::Mesh()
-    : numMeshes(1)
+    : numMeshes(1), vao(0), radius(0.0f), lodError(1.0f), lodViewportHeight(480.0f),
+    numVisible(0), pool(NULL), stream(NULL)
 {
+    memset(numLodVisible, 0, sizeof(numLodVisible));
 }
 
 Mesh::~Mesh()
 {
+    delete stream;
     if(vao)
     {
         glDeleteVertexArrays(1, &vao);
     }
 }
 
-bool Mesh::load(const char* fileName)
+// position (x, y, z) and texture coordinates (u, v): 5 floats per vertex
+static const VertexLayout LAYOUT =
 {
-    if(vao)
+    5 * sizeof(GLfloat), 2,
     {
-        // Already loaded
-        return false;
+        { 0, 3, GL_FLOAT, GL_FALSE, 0 },                    // position
+        { 1, 2, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat) }   // texture coordinates
     }
+};
 
+/**
+ * Import a mesh with Assimp and write it to a binary mesh file
+ */
+static bool convert(const char* fileName, const char* meshFileName)
+{
     Assimp::Importer importer; 
     const aiScene* scene = importer.ReadFile(fileName,
             aiProcess_Triangulate |
@@ -38,10 +59,12 @@ bool Mesh::load(const char* fileName)
     }
 
     // We only load the first mesh from the Assimp scene here
+    const aiMesh* mesh = scene->mMeshes[0];
     std::vector<float> vertices;
     std::vector<GLuint> indices;
-    const aiMesh* mesh = scene->mMeshes[0];
-    for(int  i = 0; i < mesh->mNumVertices; ++i)
+    vertices.reserve(mesh->mNumVertices * 5);
+    indices.reserve(mesh->mNumFaces * 3);
+    for(unsigned int i = 0; i < mesh->mNumVertices; ++i)
     {
         const aiVector3D* pos = &(mesh->mVertices[i]);
         const aiVector3D* texCoord = &(mesh->mTextureCoords[0][i]);
@@ -52,83 +75,353 @@ bool Mesh::load(const char* fileName)
         vertices.push_back(texCoord->x);
         vertices.push_back(texCoord->y);
     }
-    for(int i = 0; i < mesh->mNumFaces; ++i)
+    for(unsigned int i = 0; i < mesh->mNumFaces; ++i)
     {
         const aiFace* face = &(mesh->mFaces[i]);
         indices.push_back(face->mIndices[0]);
         indices.push_back(face->mIndices[1]);
         indices.push_back(face->mIndices[2]);
     }
-    numIndices = indices.size();
 
-    glGenVertexArrays(1, &vao);
-    glBindVertexArray(vao);
+    // Reorder for the post-transform cache once, at conversion time
+    size_t numVertices = optimizeMesh(fileName, &vertices[0], 5 * sizeof(GLfloat), mesh->mNumVertices,
+            &indices[0], indices.size(), false);
 
-    GLuint vbo;
-    glGenBuffers(1, &vbo);
+    MeshData data = { &vertices[0], (GLuint)numVertices, &indices[0], (GLuint)indices.size() };
+    return writeMeshFile(meshFileName, fileName, LAYOUT, std::vector<MeshData>(1, data));
+}
 
-    GLuint ebo;
-    glGenBuffers(1, &ebo);
+bool Mesh::load(const char* fileName)
+{
+    if(vao)
+    {
+        // Already loaded
+        return false;
+    }
+
+    // Importing with Assimp is slow, so the first run converts the mesh to
+    // a binary mesh file that later runs map and upload directly (see ../common/meshfile.h)
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::string meshFileName = std::string(fileName) + ".mesh";
+    MeshFile file;
+    bool converted = false;
+    if(!file.open(meshFileName.c_str(), fileName, LAYOUT))
+    {
+        if(!convert(fileName, meshFileName.c_str()) || !file.open(meshFileName.c_str(), fileName, LAYOUT))
+        {
+            return false;
+        }
+        converted = true;
+    }
+    indexType = file.getIndexType(0);
+    MeshLod full = { 0, (int)file.getNumIndices(0), 0.0f, FLT_MAX };
+    lods.assign(1, full);
 
-    // Upload the vertices to the buffer
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * vertices.size(), &vertices[0], GL_STATIC_DRAW);
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
 
-    // Upload the indices to the buffer
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * indices.size(), &indices[0], GL_STATIC_DRAW);
+    // Upload the vertices and indices to new buffers straight from the file,
+    // and enable the vertex attributes (see: layout(location=x))
+    GLuint vbo, ebo;
+    file.upload(0, &vbo, &ebo);
 
-    glEnableVertexAttribArray(0); // position
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), 0);
-    glEnableVertexAttribArray(1); // texture coordinates
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (void*)(3 * sizeof(GLfloat)));
+    // Find the bounding sphere for culling from the mapped vertices, the GPU copy is not read back
+    const GLfloat* vertices = (const GLfloat*)file.getVertices(0);
+    size_t numVertices = file.getNumVertices(0);
+    for(size_t i = 0; i < numVertices * 5; i += 5)
+    {
+        radius = std::max(radius, glm::length(glm::vec3(vertices[i], vertices[i + 1], vertices[i + 2])));
+    }
+    GLuint lodEbo = generateLods(vertices, numVertices, file.getIndices(0));
 
     // We have now successfully created a drawable Vertex Array Object
     glBindVertexArray(0);
-    // We no longer need the buffers
+    // We no longer need vbo and ebo
     glDeleteBuffers(1, &vbo);
     glDeleteBuffers(1, &ebo);
+    glDeleteBuffers(1, &lodEbo);
 
+    std::chrono::duration<double, std::milli> duration = std::chrono::steady_clock::now() - start;
+    std::cout << (converted ? "Converted " : "Mapped ") << fileName << " in " << duration.count() << " ms" << std::endl;
     return true;
 }
 
-void Mesh::setInstances(int numMeshes, std::vector<glm::mat4> models)
+GLuint Mesh::generateLods(const GLfloat* vertices, size_t numVertices, const void* mapped)
+{
+    // Widen the mapped indices, they are 16 bit if the mesh has few vertices
+    std::vector<GLuint> indices(lods[0].numIndices);
+    if(indexType == GL_UNSIGNED_SHORT)
+    {
+        const GLushort* shortIndices = (const GLushort*)mapped;
+        std::copy(shortIndices, shortIndices + indices.size(), indices.begin());
+    }
+    else
+    {
+        const GLuint* intIndices = (const GLuint*)mapped;
+        std::copy(intIndices, intIndices + indices.size(), indices.begin());
+    }
+
+    // Every level has about half the triangles of the one before it, simplified from the full mesh
+    // so the errors do not add up. They all use the vertices of the full mesh.
+    std::vector<GLuint> all(indices), simplified(indices.size());
+    size_t indexSize = indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+    while((int)lods.size() < MAX_LODS)
+    {
+        float error;
+        size_t count = simplifyMesh(&simplified[0], &indices[0], indices.size(), vertices, 5 * sizeof(GLfloat),
+                numVertices, lods.back().numIndices / 2, MAX_LOD_ERROR * radius, &error);
+        if(count == 0 || count > (size_t)lods.back().numIndices * 3 / 4)
+        {
+            // It does not get much simpler anymore
+            break;
+        }
+        optimizeVertexCache(&simplified[0], count, numVertices);
+
+        MeshLod lod = { (GLsizeiptr)(all.size() * indexSize), (int)count, error / radius, 0.0f };
+        lods.push_back(lod);
+        all.insert(all.end(), simplified.begin(), simplified.begin() + count);
+    }
+    updateLodThresholds();
+
+    // Replace the index buffer of the vertex array
+    GLuint ebo;
+    glGenBuffers(1, &ebo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+    if(indexType == GL_UNSIGNED_SHORT)
+    {
+        std::vector<GLushort> shortIndices(all.begin(), all.end());
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, shortIndices.size() * sizeof(GLushort), &shortIndices[0], GL_STATIC_DRAW);
+    }
+    else
+    {
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, all.size() * sizeof(GLuint), &all[0], GL_STATIC_DRAW);
+    }
+    return ebo;
+}
+
+void Mesh::setLodError(float maxError, float viewportHeight)
+{
+    lodError = maxError;
+    lodViewportHeight = viewportHeight;
+    updateLodThresholds();
+}
+
+void Mesh::updateLodThresholds()
+{
+    // An instance with a radius of r pixels on screen moves error * r pixels at a level,
+    // which has to stay below lodError. Simpler levels never get a larger threshold.
+    for(size_t i = 1; i < lods.size(); ++i)
+    {
+        float threshold = lods[i].error > 0.0f ? lodError / lods[i].error : FLT_MAX;
+        lods[i].maxScreenRadius = std::min(threshold, lods[i - 1].maxScreenRadius);
+    }
+}
+
+int Mesh::getNumLods() const
+{
+    return lods.size();
+}
+
+const MeshLod& Mesh::getLod(int lod) const
+{
+    return lods[lod];
+}
+
+GLuint Mesh::getVertexArray() const
+{
+    return vao;
+}
+
+GLenum Mesh::getIndexType() const
+{
+    return indexType;
+}
+
+void Mesh::printLods() const
+{
+    for(size_t i = 0; i < lods.size(); ++i)
+    {
+        std::cout << "LOD " << i << ": " << lods[i].numIndices / 3 << " triangles, error " << lods[i].error;
+        if(i > 0)
+        {
+            std::cout << ", below " << lods[i].maxScreenRadius << " pixels";
+        }
+        std::cout << std::endl;
+    }
+}
+
+void Mesh::setInstances(int numMeshes, std::vector<InstanceTransform> instances)
 {
     this->numMeshes = numMeshes;
 
     glBindVertexArray(vao);
 
-    // Create a buffer for the model matrices
+    // Create a buffer for the instance transforms
     GLuint mbo;
     glGenBuffers(1, &mbo);
     glBindBuffer(GL_ARRAY_BUFFER, mbo);
-    // Send all the model matrices to the GPU
-    glBufferData(GL_ARRAY_BUFFER, numMeshes * sizeof(glm::mat4), &models[0], GL_STATIC_DRAW);
-    // If you look at the shader, you will see "layout(locaiton=2) in mat4 model_inst"
-    // OpenGL only allows a maximum of vec4 passing through glVertexAttribPointer,
-    // so we have to pass 4 vec4s to pass a matrix
-    glEnableVertexAttribArray(2); 
-    glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)0);
-    glEnableVertexAttribArray(3); 
-    glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(sizeof(glm::vec4)));
-    glEnableVertexAttribArray(4); 
-    glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(2 * sizeof(glm::vec4)));
-    glEnableVertexAttribArray(5); 
-    glVertexAttribPointer(5, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(3 * sizeof(glm::vec4)));
-    
-    // Update the matrix (2, 3, 4, 5) for every 1 instance
-    glVertexAttribDivisor(2, 1);
-    glVertexAttribDivisor(3, 1);                                          
-    glVertexAttribDivisor(4, 1);
-    glVertexAttribDivisor(5, 1);
-    
+    // Send all the instance transforms to the GPU
+    glBufferData(GL_ARRAY_BUFFER, numMeshes * sizeof(InstanceTransform), &instances[0], GL_STATIC_DRAW);
+    // If you look at the shader, you will see "layout(location=2) in vec4 inst_position_scale"
+    // and "layout(location=3) in vec4 inst_rotation". A transform is half the size of a mat4
+    // and needs 2 attributes instead of 4, the shader turns it back into a position.
+    // The attributes (2, 3) are updated for every 1 instance
+    setInstanceTransformLayout(2, 0);
+
     glBindVertexArray(0);
     glDeleteBuffers(1, &mbo);
 }
 
+void Mesh::setDynamicInstances(const std::vector<InstanceTransform>& instances, JobPool* pool)
+{
+    this->numMeshes = instances.size();
+    this->instances = instances;
+    this->pool = pool;
+    x.resize(numMeshes);
+    y.resize(numMeshes);
+    z.resize(numMeshes);
+    radii.resize(numMeshes);
+    visible.resize(numMeshes);
+    visibleLods.resize(numMeshes);
+    chunkVisible.resize(pool->getNumThreads());
+    chunkLods.resize(chunkVisible.size() * MAX_LODS);
+    for(int i = 0; i < numMeshes; ++i)
+    {
+        setInstance(i, instances[i]);
+    }
+
+    // Room for a few frames of transforms, even if every instance is visible
+    delete stream;
+    stream = new StreamBuffer(3 * std::max(numMeshes, 1) * sizeof(InstanceTransform));
+}
+
+void Mesh::setInstance(int i, const InstanceTransform& instance)
+{
+    instances[i] = instance;
+    x[i] = instance.position.x;
+    y[i] = instance.position.y;
+    z[i] = instance.position.z;
+    radii[i] = radius * instance.scale;
+}
+
+void Mesh::render(Camera* camera)
+{
+    numVisible = 0;
+    memset(numLodVisible, 0, sizeof(numLodVisible));
+    if(!stream || numMeshes == 0)
+    {
+        return;
+    }
+
+    // Every chunk culls a range of the instances, keeps the indices of the visible ones
+    // and picks their level of detail from the radius they have on screen
+    const Frustum& frustum = camera->getFrustum();
+    glm::vec3 eye = camera->getPosition();
+    float pixelsPerUnit = camera->getProjection()[1][1] * lodViewportHeight * 0.5f;
+    int numLods = lods.size();
+    int numChunks = chunkVisible.size();
+    pool->start([&](int chunk)
+    {
+        size_t first = (size_t)numMeshes * chunk / numChunks;
+        size_t last = (size_t)numMeshes * (chunk + 1) / numChunks;
+        size_t count = frustum.cullSpheres(&x[first], &y[first], &z[first], &radii[first],
+                last - first, &visible[first]);
+        chunkVisible[chunk] = count;
+
+        size_t* lodCounts = &chunkLods[chunk * MAX_LODS];
+        std::fill(lodCounts, lodCounts + MAX_LODS, 0);
+        for(size_t i = first; i < first + count; ++i)
+        {
+            size_t instance = first + visible[i];
+            float distance = glm::length(glm::vec3(x[instance], y[instance], z[instance]) - eye);
+            float screenRadius = distance > radii[instance] ? radii[instance] * pixelsPerUnit / distance : FLT_MAX;
+            int lod = numLods - 1;
+            while(lod > 0 && screenRadius >= lods[lod].maxScreenRadius)
+            {
+                lod--;
+            }
+            visibleLods[i] = lod;
+            lodCounts[lod]++;
+        }
+    }, numChunks);
+    pool->wait();
+
+    // The instances of a level of detail go after each other, in the order of the chunks
+    size_t lodStarts[MAX_LODS];
+    for(int lod = 0; lod < numLods; ++lod)
+    {
+        lodStarts[lod] = numVisible;
+        for(int chunk = 0; chunk < numChunks; ++chunk)
+        {
+            numLodVisible[lod] += chunkLods[chunk * MAX_LODS + lod];
+        }
+        numVisible += numLodVisible[lod];
+    }
+    if(numVisible == 0)
+    {
+        return;
+    }
+
+    // Then they copy the transforms of the visible instances into the stream, sorted by level of detail
+    GLsizeiptr offset;
+    InstanceTransform* target = (InstanceTransform*)stream->map(numVisible * sizeof(InstanceTransform), &offset);
+    if(!target)
+    {
+        numVisible = 0;
+        memset(numLodVisible, 0, sizeof(numLodVisible));
+        return;
+    }
+    pool->start([&](int chunk)
+    {
+        size_t first = (size_t)numMeshes * chunk / numChunks;
+        InstanceTransform* out[MAX_LODS];
+        for(int lod = 0; lod < numLods; ++lod)
+        {
+            out[lod] = target + lodStarts[lod];
+            for(int c = 0; c < chunk; ++c)
+            {
+                out[lod] += chunkLods[c * MAX_LODS + lod];
+            }
+        }
+        for(size_t i = first; i < first + chunkVisible[chunk]; ++i)
+        {
+            *out[visibleLods[i]]++ = instances[first + visible[i]];
+        }
+    }, numChunks);
+    pool->wait();
+    stream->unmap(numVisible * sizeof(InstanceTransform));
+
+    // One draw per level of detail
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, stream->getBuffer());
+    for(int lod = 0; lod < numLods; ++lod)
+    {
+        if(numLodVisible[lod] > 0)
+        {
+            setInstanceTransformLayout(2, offset + lodStarts[lod] * sizeof(InstanceTransform));
+            glDrawElementsInstanced(GL_TRIANGLES, lods[lod].numIndices, indexType,
+                    (void*)lods[lod].indexOffset, numLodVisible[lod]);
+        }
+    }
+    glBindVertexArray(0);
+
+    // The transforms of this frame can be written over once the GPU has drawn them
+    stream->fence();
+}
+
+int Mesh::getNumVisible() const
+{
+    return numVisible;
+}
+
+int Mesh::getNumVisible(int lod) const
+{
+    return numLodVisible[lod];
+}
+
 void Mesh::render()
 {
     glBindVertexArray(vao);
-    glDrawElementsInstanced(GL_TRIANGLES, numIndices, GL_UNSIGNED_INT, 0, numMeshes);
+    glDrawElementsInstanced(GL_TRIANGLES, lods[0].numIndices, indexType, 0, numMeshes);
     glBindVertexArray(0);
 }
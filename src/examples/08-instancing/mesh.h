@@ -2,18 +2,38 @@
 #define MESH_HEADER
 
 #include "../common/util.h"
+#include "../common/camera.h"
+#include "../common/instancetransform.h"
+#include "../common/jobpool.h"
+#include "../common/streambuffer.h"
 #include <glm/glm.hpp>
 #include <vector>
 
 /*
  * The changes to this class include:
  * the render code will now use glDrawElementsInstanced;
- * there is a setInstances method that allows us to set the different model matrices;
+ * there is a setInstances method that allows us to set the different instance transforms;
  * we no longer need getModelMatrix(), so it has been removed;
  * there is a new field numMeshes that indicates the number of instances;
- * we no longer store the individual positions for this example, so that has been removed too
+ * we no longer store the individual positions for this example, so that has been removed too;
+ * setDynamicInstances keeps the matrices on the CPU instead, and render(camera) only draws the visible ones,
+ * each with the simplest of the levels of detail generated by load() that still looks the same
  */
 
+/**
+ * A level of detail of a mesh, a range of its index buffer
+ */
+struct MeshLod
+{
+    // Bytes into the index buffer
+    GLsizeiptr indexOffset;
+    int numIndices;
+    // How far the surface moved from the full mesh, relative to the radius of the mesh
+    float error;
+    // Instances are drawn with this level while their radius on screen is below this many pixels
+    float maxScreenRadius;
+};
+
 class Mesh
 {
 public:
@@ -21,12 +41,69 @@ public:
     ~Mesh();
 
     bool load(const char* fileName);
-    void setInstances(int numMeshes, std::vector<glm::mat4> models);
+    void setInstances(int numMeshes, std::vector<InstanceTransform> instances);
+    /**
+     * Keep the instance transforms on the CPU. Every frame render(camera) culls the bounding
+     * spheres of the instances on the pool and streams the transforms of the visible ones.
+     */
+    void setDynamicInstances(const std::vector<InstanceTransform>& instances, JobPool* pool);
+    /**
+     * Move a dynamic instance, nothing is uploaded until it is drawn
+     */
+    void setInstance(int i, const InstanceTransform& instance);
 
     void render();
+    /**
+     * Draw the dynamic instances that the camera can see
+     */
+    void render(Camera* camera);
+    int getNumVisible() const;
+    /**
+     * Instances that were drawn with a level of detail by the last render(camera)
+     */
+    int getNumVisible(int lod) const;
+
+    /**
+     * Pick the simplest level of detail that moves the surface of an instance less than
+     * maxError pixels on a viewport of the given height
+     */
+    void setLodError(float maxError, float viewportHeight);
+    int getNumLods() const;
+    const MeshLod& getLod(int lod) const;
+    /**
+     * The vertex array and index type, to draw the levels of detail with other instance attributes
+     */
+    GLuint getVertexArray() const;
+    GLenum getIndexType() const;
+    void printLods() const;
+
+    static const int MAX_LODS = 4;
 private:
-    int numIndices, numMeshes;
+    // Simplify the mesh from its mapped vertices and indices (of indexType) and replace the index
+    // buffer of the bound vertex array with one that has every level of detail after each other
+    GLuint generateLods(const GLfloat* vertices, size_t numVertices, const void* indices);
+    void updateLodThresholds();
+
+    int numMeshes;
+    GLenum indexType;
     GLuint vao;
+    // Distance from the origin of the mesh to its furthest vertex
+    float radius;
+    std::vector<MeshLod> lods;
+    float lodError, lodViewportHeight;
+
+    // Dynamic instances: the transforms, their bounding spheres split per coordinate for
+    // Frustum::cullSpheres, and the indices of the visible ones, per chunk of the pool
+    std::vector<InstanceTransform> instances;
+    std::vector<float> x, y, z, radii;
+    std::vector<unsigned int> visible;
+    std::vector<size_t> chunkVisible;
+    // The level of detail of every visible instance, and how many there are of each per chunk
+    std::vector<unsigned char> visibleLods;
+    std::vector<size_t> chunkLods;
+    int numVisible, numLodVisible[MAX_LODS];
+    JobPool* pool;
+    StreamBuffer* stream;
 };
 
 #endif
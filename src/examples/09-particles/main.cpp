@@ -1,8 +1,73 @@
 #include "../common/util.h"
 #include "particle.h"
+#include <chrono>
+#include <cstring>
+#include <thread>
 
-int main(void)
+// Nanoseconds per particle to update count particles on the pool (or the calling thread without one)
+static double timeUpdate(int count, JobPool* pool, bool simd)
 {
+    // The particles live longer than the benchmark, so every update moves all of them
+    ParticleEmitter emitter(count, 1.0f, glm::vec2(0.0f, 0.0f), 1000000.0f, pool, PARTICLES_CPU_ONLY);
+    emitter.setSimd(simd);
+    const float deltaTime = 1.0f / 60.0f;
+    emitter.burst(count);
+    emitter.update(deltaTime);
+    emitter.finish();
+
+    // Enough frames to take about the same time for every count
+    int frames = std::max(5, 50000000 / count);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for(int i = 0; i < frames; ++i)
+    {
+        emitter.update(deltaTime);
+        emitter.finish();
+    }
+    std::chrono::duration<double, std::nano> duration = std::chrono::steady_clock::now() - start;
+    return duration.count() / ((double)frames * count);
+}
+
+// Time the CPU update for 10 thousand to 10 million particles, and on 1 to maxThreads threads, without a window
+static void benchmarkUpdate(int maxThreads)
+{
+    JobPool pool;
+    const int counts[4] = { 10000, 100000, 1000000, 10000000 };
+    for(int i = 0; i < 4; ++i)
+    {
+        std::cout << counts[i] << " particles on " << pool.getNumThreads() << " threads: ";
+#ifdef __SSE2__
+        std::cout << "SSE2 " << timeUpdate(counts[i], &pool, true) << " ns, ";
+#endif
+        std::cout << "scalar " << timeUpdate(counts[i], &pool, false) << " ns per particle" << std::endl;
+    }
+
+    // The calling thread helps the pool while it waits, so n threads are n - 1 workers and the caller
+    const int scalingCount = 1000000;
+    double single = 0.0;
+    for(int threads = 1; threads <= maxThreads; ++threads)
+    {
+        JobPool* scalingPool = threads > 1 ? new JobPool(threads - 1) : NULL;
+        double time = timeUpdate(scalingCount, scalingPool, true);
+        delete scalingPool;
+        if(threads == 1)
+        {
+            single = time;
+        }
+        std::cout << scalingCount << " particles on " << threads << " threads: " << time << " ns per particle, "
+            << single / time << "x one thread" << std::endl;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    // Pass a number of threads after bench to scale further than the cores
+    if(argc > 1 && strcmp(argv[1], "bench") == 0)
+    {
+        int maxThreads = argc > 2 ? atoi(argv[2]) : std::thread::hardware_concurrency();
+        benchmarkUpdate(std::max(maxThreads, 1));
+        return 0;
+    }
+
     GLFWwindow* window;
 
     window = init("Particles", 640, 480);
@@ -14,16 +79,58 @@ int main(void)
     glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 
     // Maximum of 10000 particles, spawn every one hundredth of a second at (0,0), last for 5 seconds
-    ParticleEmitter emitter(10000, 0.01f, glm::vec2(0.0f, 0.0f), 5.0f);
+    int maxCount = 10000;
+    float interval = 0.01f;
+    int numThreads = 0;
+    if(argc > 1)
+    {
+        // To measure the update, pass a number of particles: they are spawned fast
+        // enough to keep that many alive, and the time per particle is printed.
+        // Pass a number of threads as well to see how it scales.
+        maxCount = atoi(argv[1]);
+        interval = 5.0f / maxCount;
+    }
+    if(argc > 2)
+    {
+        numThreads = atoi(argv[2]);
+    }
+    // Or simulate on the GPU with transform feedback
+    ParticleBackend backend = PARTICLES_CPU;
+    if(argc > 3 && strcmp(argv[3], "gpu") == 0)
+    {
+        backend = PARTICLES_GPU;
+    }
+    else if(argc > 3 && strcmp(argv[3], "cpu") != 0)
+    {
+        numThreads = -1;
+    }
+    if(maxCount <= 0 || numThreads < 0)
+    {
+        std::cerr << "Usage: " << argv[0] << " [particles] [threads] [cpu|gpu]" << std::endl;
+        return -1;
+    }
+    // The particles are simulated on a pool of worker threads (../common/jobpool.h),
+    // one thread per core by default
+    JobPool pool(numThreads);
+    ParticleEmitter emitter(maxCount, interval, glm::vec2(0.0f, 0.0f), 5.0f, &pool, backend);
 
     glClearColor(0.75f, 0.75f, 0.75f, 1.0f);
 
     emitter.start();
+    bool spaceDown = false;
 
     while(!glfwWindowShouldClose(window))
     {
         glClear(GL_COLOR_BUFFER_BIT);
 
+        // Press space to emit a burst of particles
+        bool space = glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS;
+        if(space && !spaceDown)
+        {
+            emitter.burst(maxCount / 10);
+        }
+        spaceDown = space;
+
         // particle.cpp
         emitter.update((float)glfwGetTime());
         emitter.render();
@@ -1,5 +1,10 @@
 #include "particle.h"
 #include "../common/shader.h"
+#include <algorithm>
+#include <chrono>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 const char* VERTEX_SRC = "#version 330 core\n"
                          "layout(location=0) in vec2 position;"
@@ -18,11 +23,104 @@ const char* FRAGMENT_SRC = "#version 330 core\n"
                            "    outColor = vec4(1.0f);"
                            "}";
 
-ParticleEmitter::ParticleEmitter(int max, float ivl, const glm::vec2& pos, float pLife)
-    : vao(0), program(0), lastIndex(0), interval(ivl), lastEmission(0.0f), particleLife(pLife), position(pos), emitting(false)
+// Simulates one particle per vertex, the outputs are captured with transform feedback
+const char* SIMULATION_SRC = "#version 330 core\n"
+                             "layout(location=0) in vec3 transform;" // x, y, size
+                             "layout(location=1) in vec2 speed;"
+                             "layout(location=2) in float life;"
+                             "uniform float deltaTime;"
+                             "uniform float gravity;"
+                             "uniform float particleSize;"
+                             "uniform float particleLife;"
+                             "uniform vec2 emitPosition;"
+                             "uniform int emitStart;" // New particles are emitted into [emitStart, emitStart + emitCount)
+                             "uniform int emitCount;" // of the ring of maxCount particles
+                             "uniform int maxCount;"
+                             "uniform uint seed;"
+                             "out vec3 outTransform;"
+                             "out vec2 outSpeed;"
+                             "out float outLife;"
+                             "uint hash(uint x)"
+                             "{"
+                             "    x ^= x >> 16u;"
+                             "    x *= 0x7feb352du;"
+                             "    x ^= x >> 15u;"
+                             "    x *= 0x846ca68bu;"
+                             "    x ^= x >> 16u;"
+                             "    return x;"
+                             "}"
+                             "void main()"
+                             "{"
+                             "    vec2 p = transform.xy;"
+                             "    vec2 s = speed;"
+                             "    float l = life;"
+                             "    if((gl_VertexID - emitStart + maxCount) % maxCount < emitCount)"
+                             "    {"
+                             "        p = emitPosition;"
+                             "        s = vec2(0.0);"
+                             "        l = particleLife;"
+                             "    }"
+                             "    if(l > 0.0)"
+                             "    {"
+                             "        float random = float(hash(uint(gl_VertexID) ^ seed) >> 8u) / 16777216.0;"
+                             "        s += vec2(random * 4.0 - 2.0, gravity) * deltaTime;"
+                             "        p += s * deltaTime;"
+                             "        l -= deltaTime;"
+                             "    }"
+                             "    outTransform = vec3(p, l > 0.0 ? particleSize : 0.0);"
+                             "    outSpeed = s;"
+                             "    outLife = l;"
+                             "}";
+
+// Right now, all particles have the same size.
+// You can easily change the size of the particles based on life, distance from origin, etc.
+static const float PARTICLE_SIZE = 0.05f;
+static const float GRAVITY = -0.981f;
+#define STATS_INTERVAL 5.0
+// Particles per job, a multiple of 4 so the SIMD blocks line up
+#define CHUNK_SIZE 16384
+
+ParticleEmitter::ParticleEmitter(int max, float ivl, const glm::vec2& pos, float pLife, JobPool* pool,
+        ParticleBackend backend)
+    : backend(backend), maxCount(max), pool(pool), vao(0), program(0), writeBuffer(0), drawBuffer(-1), mappedOffset(0),
+    drawOffset(0), mappedTransforms(NULL),
+    simulating(false), simd(true), emitChunk(0), pendingBurst(0), simulationProgram(0), simulationVao(0), stateBuffer(0),
+    emitCursor(0), usedSlots(0), frame(0), interval(ivl), lastEmission(0.0f), particleLife(pLife), position(pos),
+    emitting(false), updateTime(0.0), statsTime(0.0), updatedParticles(0)
 {
-    particles.resize(max);
-    particleBuffer.resize(max * 3); // x, y, size (layout(location=1) in vec3 transform)
+    stateBuffers[0] = stateBuffers[1] = 0;
+    transforms[0] = transforms[1] = NULL;
+    if(backend != PARTICLES_GPU)
+    {
+        positionX.resize(max);
+        positionY.resize(max);
+        speedX.resize(max);
+        speedY.resize(max);
+        life.resize(max);
+    }
+    for(int first = 0; backend != PARTICLES_GPU && first < max; first += CHUNK_SIZE)
+    {
+        Chunk chunk;
+        chunk.first = first;
+        chunk.capacity = std::min(CHUNK_SIZE, max - first);
+        chunk.count = 0;
+        chunk.used = 0;
+        chunk.drawCount = 0;
+        // Any seed but 0 works for xorshift
+        for(int i = 0; i < 4; ++i)
+        {
+            chunk.randomState[i] = 2463534242u + (chunks.size() * 4 + i) * 7919u;
+        }
+        chunks.push_back(chunk);
+    }
+    stats.spawned = 0;
+    stats.dropped = 0;
+    stats.recycled = 0;
+    if(backend == PARTICLES_CPU_ONLY)
+    {
+        transformMemory.resize(max * 3);
+        return;
+    }
 
     // Shader
     GLuint vertex = createShader(VERTEX_SRC, GL_VERTEX_SHADER);
@@ -43,7 +141,6 @@ ParticleEmitter::ParticleEmitter(int max, float ivl, const glm::vec2& pos, float
     GLuint buffers[2]; // vbo, ebo
     glGenBuffers(2, buffers);
 
-    glGenBuffers(1, &transformBuffer);
 
     float vertices[] =
     {
@@ -67,35 +164,54 @@ ParticleEmitter::ParticleEmitter(int max, float ivl, const glm::vec2& pos, float
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
 
-    // Bind the third buffer. We will use this buffer to set positions of the
-    // active particles each frame. Because we update the buffer each frame, we use
-    // GL_STREAM_DRAW, which lets OpenGL optimize the buffer
-    glBindBuffer(GL_ARRAY_BUFFER, transformBuffer);
-    glBufferData(GL_ARRAY_BUFFER, particles.size() * 3 * sizeof(float), NULL, GL_STREAM_DRAW);
+    // The transforms hold x, y, size of the live particles (layout(location=1) in vec3 transform).
+    // They are streamed through two rings that take turns: one is written while the other is drawn.
+    // Each fits two frames, the one written and the one the GPU may still be busy with.
+    // The attribute is pointed at the ring when drawing
+    if(backend == PARTICLES_CPU)
+    {
+        transforms[0] = new StreamBuffer(2 * life.size() * 3 * sizeof(float));
+        transforms[1] = new StreamBuffer(2 * life.size() * 3 * sizeof(float));
+    }
     glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
 
     glVertexAttribDivisor(0, 0);
     glVertexAttribDivisor(1, 1);
 
     glBindVertexArray(0);
     glDeleteBuffers(2, buffers);
+
+    if(backend == PARTICLES_GPU)
+    {
+        createGpuSimulation();
+    }
 }
 
 ParticleEmitter::~ParticleEmitter()
 {
+    finishSimulation();
     if(vao)
     {
         glDeleteVertexArrays(1, &vao);
     }
-    if(transformBuffer)
-    {
-        glDeleteBuffers(1, &transformBuffer);
-    }
+    delete transforms[0];
+    delete transforms[1];
     if(program)
     {
         glDeleteProgram(program);
     }
+    if(simulationVao)
+    {
+        glDeleteVertexArrays(1, &simulationVao);
+    }
+    if(stateBuffers[0])
+    {
+        glDeleteBuffers(2, stateBuffers);
+    }
+    if(simulationProgram)
+    {
+        glDeleteProgram(simulationProgram);
+    }
 }
 
 void ParticleEmitter::start()
@@ -108,83 +224,486 @@ void ParticleEmitter::stop()
     emitting = false;
 }
 
+static unsigned int xorshift(unsigned int x)
+{
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return x;
+}
+
+static float toUnitFloat(unsigned int random)
+{
+    // 23 random bits as the mantissa of a float in [1, 2)
+    union { unsigned int i; float f; } u;
+    u.i = (random >> 9) | 0x3f800000u;
+    return u.f - 1.0f;
+}
+
 void ParticleEmitter::update(float deltaTime)
 {
+    finishSimulation();
+
+    int emitCount = pendingBurst;
+    pendingBurst = 0;
     if(emitting)
     {
         lastEmission += deltaTime;
-        if(lastEmission >= interval)
+        int due = (int)(lastEmission / interval);
+        emitCount += due;
+        lastEmission -= due * interval;
+    }
+
+    // The GPU simulation is only timed once per stats interval, see simulateOnGpu
+    bool timed = backend == PARTICLES_CPU || statsTime + deltaTime >= STATS_INTERVAL;
+    int liveCount;
+    if(backend == PARTICLES_GPU)
+    {
+        liveCount = simulateOnGpu(emitCount, deltaTime, timed);
+    }
+    else
+    {
+        emit(emitCount);
+        liveCount = startSimulation(deltaTime);
+        if(liveCount < 0)
         {
-            emit();
-            lastEmission -= interval;
+            return;
         }
     }
 
-    for(int i = 0; i < particles.size(); ++i)
+    if(timed)
     {
-        particles.at(i).life -= deltaTime;
-        // Gravity and a random horizontal offset
-        particles.at(i).speed += glm::vec2((rand() % 100) / 25.0f - 2.0f, -0.981f) * deltaTime;
-        particles.at(i).position += particles.at(i).speed * deltaTime;
+        updatedParticles += liveCount;
+    }
+    statsTime += deltaTime;
+    // Without drawing, the update is timed by whoever runs it
+    if(statsTime >= STATS_INTERVAL && updatedParticles > 0 && backend != PARTICLES_CPU_ONLY)
+    {
+        // With a pool this is the wall clock time, so it goes down with more threads
+        std::cout << "Updated " << liveCount << " particles ";
+        if(backend == PARTICLES_GPU)
+        {
+            std::cout << "on the GPU";
+        }
+        else
+        {
+            std::cout << "on " << (pool ? pool->getNumThreads() : 1) << " threads";
+        }
+        std::cout << ", " << updateTime / updatedParticles << " ns per particle. " << stats.spawned
+            << " spawned, " << stats.dropped << " dropped, " << stats.recycled << " recycled";
+        if(transforms[0])
+        {
+            const StreamBufferStats& first = transforms[0]->getStats();
+            const StreamBufferStats& second = transforms[1]->getStats();
+            std::cout << ". Streamed " << (first.bytes + second.bytes) / (1024 * 1024) << " MB, " << first.stalls + second.stalls
+                << " stalls, " << first.wraps + second.wraps << " wraps";
+        }
+        std::cout << std::endl;
+        updateTime = 0.0;
+        statsTime = 0.0;
+        updatedParticles = 0;
     }
 }
 
-void ParticleEmitter::render()
+int ParticleEmitter::startSimulation(float deltaTime)
 {
-    glUseProgram(program);
-    glBindVertexArray(vao);
+    // Map the next range of the ring that is not drawn, the chunks write their transforms into it
+    mappedTransforms = transforms[writeBuffer] ? (float*)transforms[writeBuffer]->map(life.size() * 3 * sizeof(float),
+            &mappedOffset) : &transformMemory[0];
+    if(!mappedTransforms)
+    {
+        return -1;
+    }
 
     int liveCount = 0;
+    for(size_t i = 0; i < chunks.size(); ++i)
+    {
+        liveCount += chunks[i].count;
+    }
+    simulating = true;
+    if(pool)
+    {
+        pool->start([this, deltaTime](int chunk) { simulate(chunk, deltaTime); }, chunks.size());
+    }
+    else
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for(size_t i = 0; i < chunks.size(); ++i)
+        {
+            simulate(i, deltaTime);
+        }
+        std::chrono::duration<double, std::nano> duration = std::chrono::steady_clock::now() - start;
+        updateTime += duration.count();
+    }
+    return liveCount;
+}
 
-    for(int i = 0; i < particles.size(); ++i)
+void ParticleEmitter::finishSimulation()
+{
+    if(!simulating)
+    {
+        return;
+    }
+    if(pool)
+    {
+        pool->wait();
+        updateTime += pool->getDuration() * 1000000.0;
+    }
+
+    if(transforms[writeBuffer])
+    {
+        transforms[writeBuffer]->unmap(life.size() * 3 * sizeof(float));
+    }
+    mappedTransforms = NULL;
+    drawOffset = mappedOffset;
+    drawBuffer = writeBuffer;
+    writeBuffer = 1 - writeBuffer;
+    // Dead particles left room, emit into the first chunk that has some
+    emitChunk = chunks.size();
+    for(size_t i = 0; i < chunks.size(); ++i)
+    {
+        chunks[i].drawCount = chunks[i].count;
+        if(chunks[i].count < chunks[i].capacity && emitChunk == (int)chunks.size())
+        {
+            emitChunk = i;
+        }
+    }
+    simulating = false;
+}
+
+void ParticleEmitter::simulate(int chunkIndex, float deltaTime)
+{
+    Chunk& chunk = chunks[chunkIndex];
+    float* positionX = &this->positionX[chunk.first];
+    float* positionY = &this->positionY[chunk.first];
+    float* speedX = &this->speedX[chunk.first];
+    float* speedY = &this->speedY[chunk.first];
+    float* life = &this->life[chunk.first];
+    float* transforms = mappedTransforms + 3 * chunk.first;
+    unsigned int* randomState = chunk.randomState;
+    int count = chunk.count;
+
+    // Age, apply gravity and a random horizontal offset, and move every live particle.
+    // In the same pass the survivors are packed to the front again and their
+    // transforms written for render(): live never passes i, so this is safe in place.
+    int live = 0;
+    int i = 0;
+#ifdef __SSE2__
+    const __m128 dt = _mm_set1_ps(deltaTime);
+    const __m128 gravity = _mm_set1_ps(GRAVITY * deltaTime);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 four = _mm_set1_ps(4.0f);
+    const __m128 two = _mm_set1_ps(2.0f);
+    __m128i state = _mm_loadu_si128((const __m128i*)randomState);
+    for(; simd && i + 4 <= count; i += 4)
     {
-        // Only render live particles
-        if(particles.at(i).life > 0.0f)
+        // xorshift in every lane
+        state = _mm_xor_si128(state, _mm_slli_epi32(state, 13));
+        state = _mm_xor_si128(state, _mm_srli_epi32(state, 17));
+        state = _mm_xor_si128(state, _mm_slli_epi32(state, 5));
+        __m128 random = _mm_sub_ps(_mm_castsi128_ps(_mm_or_si128(_mm_srli_epi32(state, 9),
+                        _mm_set1_epi32(0x3f800000))), one);
+        __m128 offset = _mm_sub_ps(_mm_mul_ps(random, four), two);
+
+        __m128 sx = _mm_add_ps(_mm_loadu_ps(&speedX[i]), _mm_mul_ps(offset, dt));
+        __m128 sy = _mm_add_ps(_mm_loadu_ps(&speedY[i]), gravity);
+        __m128 px = _mm_add_ps(_mm_loadu_ps(&positionX[i]), _mm_mul_ps(sx, dt));
+        __m128 py = _mm_add_ps(_mm_loadu_ps(&positionY[i]), _mm_mul_ps(sy, dt));
+        __m128 l = _mm_sub_ps(_mm_loadu_ps(&life[i]), dt);
+        int alive = _mm_movemask_ps(_mm_cmpgt_ps(l, _mm_setzero_ps()));
+
+        if(alive == 0xf)
         {
-            particleBuffer[3 * liveCount] = particles.at(i).position.x;
-            particleBuffer[3 * liveCount + 1] = particles.at(i).position.y;
-            particleBuffer[3 * liveCount + 2] = 0.05f; // Right now, all particles have the same size
-            // You can easily change the size of the particles based on life, distance from origin, etc.
-            ++liveCount;
+            // The common case: all 4 stay, so they can be stored as they are
+            _mm_storeu_ps(&positionX[live], px);
+            _mm_storeu_ps(&positionY[live], py);
+            _mm_storeu_ps(&speedX[live], sx);
+            _mm_storeu_ps(&speedY[live], sy);
+            _mm_storeu_ps(&life[live], l);
+            // Interleave to x0 y0 s x1 | y1 s x2 y2 | s x3 y3 s
+            __m128 size = _mm_set1_ps(PARTICLE_SIZE);
+            __m128 xy01 = _mm_unpacklo_ps(px, py);
+            __m128 xy23 = _mm_unpackhi_ps(px, py);
+            __m128 s1 = _mm_shuffle_ps(size, xy01, _MM_SHUFFLE(3, 2, 0, 0)); // s s x1 y1
+            __m128 s2 = _mm_shuffle_ps(s1, xy23, _MM_SHUFFLE(1, 0, 3, 0));   // s y1 x2 y2
+            __m128 s3 = _mm_shuffle_ps(xy23, size, _MM_SHUFFLE(0, 0, 3, 2)); // x3 y3 s s
+            float* transform = &transforms[3 * live];
+            _mm_storeu_ps(transform, _mm_shuffle_ps(xy01, s1, _MM_SHUFFLE(2, 0, 1, 0)));
+            _mm_storeu_ps(transform + 4, _mm_shuffle_ps(s2, s2, _MM_SHUFFLE(3, 2, 0, 1)));
+            _mm_storeu_ps(transform + 8, _mm_shuffle_ps(s3, s3, _MM_SHUFFLE(2, 1, 0, 2)));
+            live += 4;
+            continue;
         }
+
+        float lanes[5][4];
+        _mm_storeu_ps(lanes[0], px);
+        _mm_storeu_ps(lanes[1], py);
+        _mm_storeu_ps(lanes[2], sx);
+        _mm_storeu_ps(lanes[3], sy);
+        _mm_storeu_ps(lanes[4], l);
+        for(int j = 0; j < 4; ++j)
+        {
+            // Always write, but only keep the slot when the particle is alive
+            positionX[live] = lanes[0][j];
+            positionY[live] = lanes[1][j];
+            speedX[live] = lanes[2][j];
+            speedY[live] = lanes[3][j];
+            life[live] = lanes[4][j];
+            transforms[3 * live] = lanes[0][j];
+            transforms[3 * live + 1] = lanes[1][j];
+            transforms[3 * live + 2] = PARTICLE_SIZE;
+            live += (alive >> j) & 1;
+        }
+    }
+    _mm_storeu_si128((__m128i*)randomState, state);
+#endif
+    for(; i < count; ++i)
+    {
+        unsigned int& state = randomState[i & 3];
+        state = xorshift(state);
+        float sx = speedX[i] + (toUnitFloat(state) * 4.0f - 2.0f) * deltaTime;
+        float sy = speedY[i] + GRAVITY * deltaTime;
+        float px = positionX[i] + sx * deltaTime;
+        float py = positionY[i] + sy * deltaTime;
+        float l = life[i] - deltaTime;
+
+        positionX[live] = px;
+        positionY[live] = py;
+        speedX[live] = sx;
+        speedY[live] = sy;
+        life[live] = l;
+        transforms[3 * live] = px;
+        transforms[3 * live + 1] = py;
+        transforms[3 * live + 2] = PARTICLE_SIZE;
+        live += l > 0.0f;
+    }
+
+    chunk.count = live;
+}
+
+void ParticleEmitter::createGpuSimulation()
+{
+    GLuint vertex = createShader(SIMULATION_SRC, GL_VERTEX_SHADER);
+    simulationProgram = glCreateProgram();
+    glAttachShader(simulationProgram, vertex);
+    // The outputs are written interleaved, in the same layout as the inputs
+    const char* varyings[] = { "outTransform", "outSpeed", "outLife" };
+    glTransformFeedbackVaryings(simulationProgram, 3, varyings, GL_INTERLEAVED_ATTRIBS);
+    linkShader(simulationProgram);
+    glDetachShader(simulationProgram, vertex);
+    glDeleteShader(vertex);
+
+    // Everything starts dead: life 0
+    std::vector<float> particles(maxCount * 6, 0.0f);
+    glGenBuffers(2, stateBuffers);
+    for(int i = 0; i < 2; ++i)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, stateBuffers[i]);
+        glBufferData(GL_ARRAY_BUFFER, particles.size() * sizeof(float), &particles[0], GL_DYNAMIC_COPY);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    // The attributes are pointed at the input buffer when simulating
+    glGenVertexArrays(1, &simulationVao);
+    glBindVertexArray(simulationVao);
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
+    glEnableVertexAttribArray(2);
+    glBindVertexArray(0);
+}
+
+int ParticleEmitter::simulateOnGpu(int emitCount, float deltaTime, bool timed)
+{
+    // New particles replace the oldest ones in the ring
+    int spawned = std::min(emitCount, maxCount);
+    int emitStart = emitCursor;
+    emitCursor = (emitCursor + spawned) % maxCount;
+    int newSlots = std::min(spawned, maxCount - usedSlots);
+    usedSlots += newSlots;
+    stats.spawned += spawned;
+    stats.dropped += emitCount - spawned;
+    stats.recycled += spawned - newSlots;
+
+    glUseProgram(simulationProgram);
+    glUniform1f(glGetUniformLocation(simulationProgram, "deltaTime"), deltaTime);
+    glUniform1f(glGetUniformLocation(simulationProgram, "gravity"), GRAVITY);
+    glUniform1f(glGetUniformLocation(simulationProgram, "particleSize"), PARTICLE_SIZE);
+    glUniform1f(glGetUniformLocation(simulationProgram, "particleLife"), particleLife);
+    glUniform2f(glGetUniformLocation(simulationProgram, "emitPosition"), position.x, position.y);
+    glUniform1i(glGetUniformLocation(simulationProgram, "emitStart"), emitStart);
+    glUniform1i(glGetUniformLocation(simulationProgram, "emitCount"), spawned);
+    glUniform1i(glGetUniformLocation(simulationProgram, "maxCount"), maxCount);
+    glUniform1ui(glGetUniformLocation(simulationProgram, "seed"), xorshift(frame + 1));
+
+    glBindVertexArray(simulationVao);
+    glBindBuffer(GL_ARRAY_BUFFER, stateBuffers[stateBuffer]);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
+    glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(5 * sizeof(float)));
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, stateBuffers[1 - stateBuffer]);
+
+    // Timer queries are not reliable on every driver (llvmpipe times when the
+    // commands are queued), so a timed simulation waits for the GPU around it
+    std::chrono::steady_clock::time_point start;
+    if(timed)
+    {
+        glFinish();
+        start = std::chrono::steady_clock::now();
     }
 
-    glBindBuffer(GL_ARRAY_BUFFER, transformBuffer);
-    // Remap storage (optimization. Google "buffer orphaning opengl" for more information)
-    glBufferData(GL_ARRAY_BUFFER, particles.size() * 3 * sizeof(float), NULL, GL_STREAM_DRAW);
-    // Update the position data. Note that we only pass liveCount * 3 * sizeof(float)
-    // elements to the buffer. The first liveCount * 3 * sizeof(float) are the only live
-    // particles' data
-    glBufferSubData(GL_ARRAY_BUFFER, 0, liveCount * 3 * sizeof(float), &particleBuffer[0]);
+    // Only the transform feedback output is needed, nothing is drawn
+    glEnable(GL_RASTERIZER_DISCARD);
+    glBeginTransformFeedback(GL_POINTS);
+    glDrawArrays(GL_POINTS, 0, maxCount);
+    glEndTransformFeedback();
+    glDisable(GL_RASTERIZER_DISCARD);
 
-    // Do instanced rendering. Only render liveCount particles
-    glDrawElementsInstanced(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0, liveCount);
+    if(timed)
+    {
+        glFinish();
+        std::chrono::duration<double, std::nano> duration = std::chrono::steady_clock::now() - start;
+        updateTime += duration.count();
+    }
 
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindVertexArray(0);
     glUseProgram(0);
+    stateBuffer = 1 - stateBuffer;
+    frame++;
+
+    // Mirror the lives on the CPU to know how many particles are alive
+    if(spawned > 0)
+    {
+        EmissionBatch batch = { particleLife, spawned };
+        batches.push_back(batch);
+    }
+    int liveCount = 0;
+    for(size_t i = 0; i < batches.size(); ++i)
+    {
+        batches[i].life -= deltaTime;
+        liveCount += batches[i].count;
+    }
+    while(!batches.empty() && (batches.front().life <= 0.0f || liveCount > maxCount))
+    {
+        // Dead, or replaced by newer particles
+        int removed = batches.front().life <= 0.0f ? batches.front().count
+            : std::min(batches.front().count, liveCount - maxCount);
+        batches.front().count -= removed;
+        liveCount -= removed;
+        if(batches.front().count == 0)
+        {
+            batches.pop_front();
+        }
+    }
+    return liveCount;
 }
 
-void ParticleEmitter::emit()
+void ParticleEmitter::render()
 {
-    // Find the first particle that we can replace
-    int i;
-    for(i = lastIndex; i < particles.size(); ++i)
+    if(backend == PARTICLES_CPU_ONLY)
+    {
+        return;
+    }
+    glUseProgram(program);
+    glBindVertexArray(vao);
+
+    if(backend == PARTICLES_GPU)
     {
-        // If the particle is almost dead
-        if(particles.at(i).life < 0.001f)
+        // Draw every particle straight from the simulation output,
+        // dead particles have size 0 so their triangles are empty
+        glBindBuffer(GL_ARRAY_BUFFER, stateBuffers[stateBuffer]);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
+        glDrawElementsInstanced(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0, maxCount);
+        glBindVertexArray(0);
+        glUseProgram(0);
+        return;
+    }
+
+    // Draw the transforms written by the previous simulation, while the next one runs.
+    // Every chunk has its own region in the buffer, so draw them one by one.
+    if(drawBuffer < 0)
+    {
+        glBindVertexArray(0);
+        glUseProgram(0);
+        return;
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, transforms[drawBuffer]->getBuffer());
+    for(size_t i = 0; i < chunks.size(); ++i)
+    {
+        if(chunks[i].drawCount > 0)
         {
-            lastIndex = i;
-            break;
+            glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, (void*)(drawOffset + chunks[i].first * 3 * sizeof(float)));
+            // Do instanced rendering. Only render the live particles
+            glDrawElementsInstanced(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0, chunks[i].drawCount);
         }
     }
+    transforms[drawBuffer]->fence();
+
+    glBindVertexArray(0);
+    glUseProgram(0);
+}
 
-    if(i == particles.size() - 1)
+int ParticleEmitter::getLiveCount() const
+{
+    int count = 0;
+    for(size_t i = 0; i < batches.size(); ++i)
+    {
+        count += batches[i].count;
+    }
+    for(size_t i = 0; i < chunks.size(); ++i)
     {
-        // We passed the end of the vector without finding a suitable
-        // particle. The particle at 0 is in this case the oldest.
-        lastIndex = 0;
+        count += chunks[i].drawCount;
     }
+    return count;
+}
 
-    particles.at(lastIndex).position = position;
-    particles.at(lastIndex).life = particleLife;
+const ParticleStats& ParticleEmitter::getStats() const
+{
+    return stats;
+}
+
+void ParticleEmitter::finish()
+{
+    finishSimulation();
+}
+
+void ParticleEmitter::setSimd(bool simd)
+{
+    this->simd = simd;
+}
+
+void ParticleEmitter::burst(int count)
+{
+    pendingBurst += count;
+}
+
+void ParticleEmitter::emit(int count)
+{
+    // Fill the free slots of one chunk after another, starting at the first
+    // one that may have room, so this is O(count) and not O(particles)
+    while(count > 0 && emitChunk < (int)chunks.size())
+    {
+        Chunk& chunk = chunks[emitChunk];
+        int n = std::min(count, chunk.capacity - chunk.count);
+        int first = chunk.first + chunk.count;
+        std::fill(positionX.begin() + first, positionX.begin() + first + n, position.x);
+        std::fill(positionY.begin() + first, positionY.begin() + first + n, position.y);
+        std::fill(speedX.begin() + first, speedX.begin() + first + n, 0.0f);
+        std::fill(speedY.begin() + first, speedY.begin() + first + n, 0.0f);
+        std::fill(life.begin() + first, life.begin() + first + n, particleLife);
+
+        // Slots below used held a particle before
+        stats.recycled += std::max(0, std::min(chunk.count + n, chunk.used) - chunk.count);
+        chunk.count += n;
+        chunk.used = std::max(chunk.used, chunk.count);
+        stats.spawned += n;
+        count -= n;
+        if(chunk.count == chunk.capacity)
+        {
+            emitChunk++;
+        }
+    }
+    // Full, particles are only emitted again when others die
+    stats.dropped += count;
 }
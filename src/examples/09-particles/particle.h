@@ -2,16 +2,38 @@
 #define PARTICLE_HEADER
 
 #include "../common/util.h"
+#include "../common/jobpool.h"
+#include "../common/streambuffer.h"
 #include <glm/glm.hpp>
+#include <deque>
 #include <vector>
 
-struct Particle
+/**
+ * Counters of a ParticleEmitter since it was created
+ */
+struct ParticleStats
 {
-    Particle() : life(0.0f) {};
+    // Particles that were emitted
+    long long spawned;
+    // Particles that could not be emitted because the emitter was full
+    long long dropped;
+    // Spawned particles that took the slot of a dead particle
+    long long recycled;
+};
 
-    glm::vec2 position, speed;
-    glm::vec4 color;
-    float life; // When this goes below zero, the particle is considered dead
+/**
+ * Where a ParticleEmitter simulates its particles
+ */
+enum ParticleBackend
+{
+    // Simulated on the CPU and uploaded every frame
+    PARTICLES_CPU,
+    // Simulated with transform feedback, the particles never leave the GPU.
+    // When it is full, new particles replace the oldest instead of being dropped.
+    PARTICLES_GPU,
+    // Simulated on the CPU like PARTICLES_CPU but never drawn, so no OpenGL context is needed.
+    // The transforms are written to memory instead of a buffer, to benchmark the update.
+    PARTICLES_CPU_ONLY
 };
 
 class ParticleEmitter
@@ -23,25 +45,112 @@ public:
      * interval: interval between emissions
      * position: where new particles are emitted
      * particleLife: time in milliseconds before particles die
+     * pool: worker threads that simulate the particles, NULL to simulate on the calling thread
+     * backend: simulate on the CPU or the GPU, the pool is not used for the GPU
      */
-    ParticleEmitter(int maxCount, float interval, const glm::vec2& position, float particleLife);
+    ParticleEmitter(int maxCount, float interval, const glm::vec2& position, float particleLife, JobPool* pool = NULL,
+            ParticleBackend backend = PARTICLES_CPU);
     ~ParticleEmitter();
 
     void start();
     void stop();
+    /**
+     * Finish the simulation started by the previous update, emit and start
+     * simulating deltaTime on the pool. The result is drawn by the next
+     * render(), so this frame is drawn while the next one is simulated.
+     */
     void update(float deltaTime);
     void render();
+    /**
+     * Emit a number of particles at once, on top of the regular interval.
+     * They are emitted by the next update, in O(count).
+     */
+    void burst(int count);
+    /**
+     * Wait for the simulation started by the last update, to time it
+     */
+    void finish();
+    /**
+     * Update 4 particles at once with SSE2 when it is available (the default),
+     * or one at a time to compare
+     */
+    void setSimd(bool simd);
+
+    int getLiveCount() const;
+    const ParticleStats& getStats() const;
 private:
-    std::vector<Particle> particles;
-    std::vector<float> particleBuffer;
-    GLuint vao, program, transformBuffer;
-    int lastIndex; // Index of the last accessed particle. We use this to find a spot
-    // in the particles vector to create a new particle
+    /**
+     * A range of particles that is simulated by one job
+     */
+    struct Chunk
+    {
+        int first, capacity;
+        // Live particles are packed at the front of the chunk, the dead ones behind them
+        // are free. That makes the free slots a stack: emitting pushes at count.
+        int count;
+        // Slots that have ever held a particle
+        int used;
+        // Live particles in the transform buffer that is drawn
+        int drawCount;
+        // One random number generator per SIMD lane
+        unsigned int randomState[4];
+    };
+
+    /**
+     * Particles emitted together on the GPU, they all die at the same time
+     */
+    struct EmissionBatch
+    {
+        float life;
+        int count;
+    };
+
+    ParticleBackend backend;
+    int maxCount;
+
+    // Particles as a structure of arrays, so the update works on 4 particles at once
+    std::vector<float> positionX, positionY, speedX, speedY, life;
+    std::vector<Chunk> chunks;
+    JobPool* pool;
+    GLuint vao, program;
+    // Each chunk writes the transforms of its live particles straight into its own
+    // region of a range mapped from one ring, while the previous range is drawn from the other.
+    // A buffer cannot be drawn from while a range of it is mapped, so the rings take turns.
+    StreamBuffer* transforms[2];
+    // PARTICLES_CPU_ONLY writes the transforms here instead
+    std::vector<float> transformMemory;
+    int writeBuffer, drawBuffer;
+    GLsizeiptr mappedOffset, drawOffset;
+    float* mappedTransforms;
+    bool simulating;
+    bool simd;
+    // The first chunk that may have free slots
+    int emitChunk;
+    int pendingBurst;
+    ParticleStats stats;
+    // GPU backend: the particles (x, y, size, speed x, speed y, life) are in two buffers,
+    // and transform feedback simulates from one into the other
+    GLuint simulationProgram, simulationVao, stateBuffers[2];
+    int stateBuffer;
+    // New particles go into the buffers as a ring
+    int emitCursor, usedSlots;
+    unsigned int frame;
+    // To count the live particles without reading them back
+    std::deque<EmissionBatch> batches;
+
     float interval, lastEmission, particleLife;
     glm::vec2 position;
     bool emitting;
+    // Time spent simulating, printed every few seconds
+    double updateTime, statsTime;
+    long long updatedParticles;
 
-    void emit();
+    void emit(int count);
+    void simulate(int chunk, float deltaTime);
+    int startSimulation(float deltaTime);
+    void finishSimulation();
+    void createGpuSimulation();
+    int simulateOnGpu(int emitCount, float deltaTime, bool timed);
 };
 
 #endif
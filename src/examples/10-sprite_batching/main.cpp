@@ -1,11 +1,133 @@
 #include "spritebatcher.h"
 #include "sprite.h"
+#include "textureatlas.h"
 #include "../common/util.h"
 #include "../common/camera.h"
+#include "../common/jobpool.h"
+#include <chrono>
+#include <cstring>
 
 #define SQRT_NUM_SPRITES 40
+#define NUM_TEXTURES 4
+// Frames the benchmark draws after warming up
+#define BENCH_FRAMES 100
 
-int main(void)
+// The sprites take turns using the textures of the regions, the worst case for batching in order
+static std::vector<Sprite> createSprites(int numSprites, const AtlasRegion* regions, int numTextures = NUM_TEXTURES)
+{
+    std::vector<Sprite> sprites;
+    for(int i = 0; i < numSprites; ++i)
+    {
+        const AtlasRegion& region = regions[i % numTextures];
+        Sprite s(region.texture, region.pageWidth, region.pageHeight);
+        s.setPosition(rand() % 640, rand() % 480, 0.0f);
+        s.setScale(50.0f, 50.0f);
+        s.setAngle((float)(rand() % 360));
+        s.setTextureRectangle(region.x, region.y, region.w, region.h);
+        sprites.push_back(s);
+    }
+    return sprites;
+}
+
+// Record the sprites in bulk, on the pool with one arena per thread when there is one
+static void recordSprites(SpriteBatcher& spritebatch, const std::vector<Sprite>& sprites, JobPool* pool)
+{
+    if(pool && !sprites.empty())
+    {
+        int numArenas = pool->getNumThreads();
+        pool->start([&](int arena)
+        {
+            size_t first = sprites.size() * arena / numArenas;
+            size_t last = sprites.size() * (arena + 1) / numArenas;
+            spritebatch.draw(arena, &sprites[first], last - first);
+        }, numArenas);
+        pool->wait();
+    }
+    else if(!sprites.empty())
+    {
+        spritebatch.draw(&sprites[0], sprites.size());
+    }
+}
+
+static void drawSprites(SpriteBatcher& spritebatch, const std::vector<Sprite>& sprites, JobPool* pool)
+{
+    spritebatch.begin();
+    recordSprites(spritebatch, sprites, pool);
+    spritebatch.end();
+}
+
+// Draw a fixed number of frames of 10000 sprites in order and sorted, and of 100000 sorted on 4 threads,
+// and print what the batcher uploaded and how long it took per 10000 sprites
+static void benchmarkBatcher(Camera* camera, const AtlasRegion* regions)
+{
+    const int counts[3] = { 10000, 10000, 100000 };
+    const bool sortedRuns[3] = { false, true, true };
+    const int threads[3] = { 0, 0, 4 };
+    for(int run = 0; run < 3; ++run)
+    {
+        std::vector<Sprite> sprites = createSprites(counts[run], regions);
+        JobPool* pool = threads[run] > 0 ? new JobPool(threads[run]) : NULL;
+        SpriteBatcher spritebatch(sortedRuns[run] ? SPRITES_SORTED : SPRITES_IMMEDIATE, threads[run]);
+        spritebatch.setCamera(camera);
+        // The first frames allocate, they are not counted
+        for(int frame = 0; frame < 5; ++frame)
+        {
+            drawSprites(spritebatch, sprites, pool);
+        }
+        glFinish();
+        SpriteBatcherStats before = spritebatch.getStats();
+        long long bytesBefore = spritebatch.getStreamStats().bytes;
+        for(int frame = 0; frame < BENCH_FRAMES; ++frame)
+        {
+            drawSprites(spritebatch, sprites, pool);
+        }
+        glFinish();
+        delete pool;
+
+        // Stalls and wraps are counted from the first frame on
+        const SpriteBatcherStats& stats = spritebatch.getStats();
+        const StreamBufferStats& streamed = spritebatch.getStreamStats();
+        double per10k = 10000.0 / (stats.sprites - before.sprites);
+        std::cout << sprites.size() << " sprites " << (sortedRuns[run] ? "sorted" : "in order") << " on "
+            << std::max(threads[run], 1) << " threads: " << (stats.batches - before.batches) / BENCH_FRAMES
+            << " batches per frame, per 10k sprites " << (streamed.bytes - bytesBefore) * per10k / 1024 << " KB uploaded, "
+            << (stats.flushTime - before.flushTime) * per10k << " ms flushing, " << streamed.stalls << " stalls, "
+            << streamed.wraps << " wraps" << std::endl;
+    }
+
+    // Generating the vertices of 4 sprites at once only works on runs of the same texture,
+    // so these all use one, as in an atlas
+    std::vector<Sprite> atlased = createSprites(10000, regions, 1);
+    for(int simd = 1; simd >= 0; --simd)
+    {
+#ifndef __SSE2__
+        if(simd)
+        {
+            continue;
+        }
+#endif
+        SpriteBatcher spritebatch(SPRITES_IMMEDIATE);
+        spritebatch.setCamera(camera);
+        spritebatch.setSimd(simd);
+        for(int frame = 0; frame < 5; ++frame)
+        {
+            drawSprites(spritebatch, atlased, NULL);
+        }
+        SpriteBatcherStats before = spritebatch.getStats();
+        for(int frame = 0; frame < BENCH_FRAMES; ++frame)
+        {
+            drawSprites(spritebatch, atlased, NULL);
+        }
+        glFinish();
+
+        const SpriteBatcherStats& stats = spritebatch.getStats();
+        std::cout << atlased.size() << " sprites of one texture, " << (simd ? "SSE2" : "scalar") << ": "
+            << (stats.sprites - before.sprites) / (stats.generateTime - before.generateTime)
+            << " sprites per ms generated" << std::endl;
+    }
+}
+
+int main(int argc, char** argv)
 { 
     GLFWwindow* window;
 
@@ -17,33 +139,71 @@ int main(void)
 
     Camera camera(CAMERA_ORTHOGONAL, 45.0f, -1.0f, 10000.0f, 640.0f, 480.0f);
 
-    int w, h;
-    GLuint texture = loadImage("spritesheet.png", &w, &h, 0, true);
-    if(!texture)
+    // The number of sprites can be given on the command line, to compare the batcher under load.
+    // After it, sorted sorts the sprites by texture, and atlas also packs the textures into one page.
+    // A number of threads after that records the sprites from worker threads
+    // Or pass bench to time the batcher on a fixed number of frames
+    bool bench = argc > 1 && strcmp(argv[1], "bench") == 0;
+    int numSprites = SQRT_NUM_SPRITES * SQRT_NUM_SPRITES;
+    if(argc > 1 && !bench)
     {
-        std::cerr << "Could not load texture" << std::endl;
-        return -1;
+        numSprites = atoi(argv[1]);
     }
+    bool atlased = argc > 2 && strcmp(argv[2], "atlas") == 0;
+    bool sorted = atlased || (argc > 2 && strcmp(argv[2], "sorted") == 0);
+    int numThreads = argc > 3 ? atoi(argv[3]) : 0;
 
-    SpriteBatcher spritebatch;
-    spritebatch.setCamera(&camera);
-
-    std::vector<Sprite*> sprites;
-    for(int i = 0; i < SQRT_NUM_SPRITES; ++i)
+    // The sprites take turns using a few textures, the worst case for batching in order.
+    // Here they are all the sprite sheet, in a game they would be different images
+    TextureAtlas atlas;
+    std::vector<GLuint> textures;
+    AtlasRegion regions[NUM_TEXTURES];
+    for(int i = 0; i < NUM_TEXTURES; ++i)
     {
-        for(int j = 0; j < SQRT_NUM_SPRITES; ++j)
+        AtlasRegion& region = regions[i];
+        if(atlased)
+        {
+            if(!atlas.addImage("spritesheet.png", &region))
+            {
+                std::cerr << "Could not add texture to the atlas" << std::endl;
+                return -1;
+            }
+            continue;
+        }
+
+        region.texture = loadImage("spritesheet.png", &region.w, &region.h, 0, true);
+        if(!region.texture)
         {
-            Sprite* s = new Sprite(texture, w, h);
-            s->setPosition(rand() % 640, rand() % 480, 0.0f);
-            s->setScale(50.0f, 50.0f);
-            s->setAngle((float)(rand() % 360));
-            s->setTextureRectangle(0, 0, w, h);
-            sprites.push_back(s);
+            std::cerr << "Could not load texture" << std::endl;
+            return -1;
         }
+        region.x = region.y = 0;
+        region.pageWidth = region.w;
+        region.pageHeight = region.h;
+        textures.push_back(region.texture);
+    }
+
+    if(bench)
+    {
+        benchmarkBatcher(&camera, regions);
+        glDeleteTextures(textures.size(), &textures[0]);
+        glfwTerminate();
+        return 0;
     }
 
+    // Every thread draws a range of the sprites into its own arena
+    JobPool* pool = numThreads > 0 ? new JobPool(numThreads) : NULL;
+    int numArenas = pool ? pool->getNumThreads() : 0;
+    SpriteBatcher spritebatch(sorted ? SPRITES_SORTED : SPRITES_IMMEDIATE, numArenas);
+    spritebatch.setCamera(&camera);
+
+    // Stored one after the other, so they can be drawn in bulk
+    std::vector<Sprite> sprites = createSprites(numSprites, regions);
+
     glClearColor(0.75f, 0.75f, 0.75f, 1.0f);
 
+    double recordTime = 0.0;
+    long long frames = 0;
     while(!glfwWindowShouldClose(window))
     {
         if(glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
@@ -53,25 +213,40 @@ int main(void)
 
         glClear(GL_COLOR_BUFFER_BIT);
 
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
         spritebatch.begin();
-        
-        for(auto it = sprites.begin(); it != sprites.end(); ++it)
-        {
-            spritebatch.draw(*it);
-        }
-
+        recordSprites(spritebatch, sprites, pool);
+        std::chrono::duration<double, std::milli> duration = std::chrono::steady_clock::now() - start;
+        recordTime += duration.count();
+        frames++;
         spritebatch.end();
 
         glfwSwapBuffers(window);
         glfwPollEvents();
     }
 
+    const SpriteBatcherStats& stats = spritebatch.getStats();
+    const StreamBufferStats& streamed = spritebatch.getStreamStats();
+    if(stats.sprites > 0)
+    {
+        std::cout << "Drew " << stats.sprites << " sprites in " << stats.batches << " batches. Per 10k sprites: "
+            << streamed.bytes * 10000 / stats.sprites << " bytes uploaded, " << stats.flushTime * 10000 / stats.sprites
+            << " ms flushing, " << stats.sprites / stats.generateTime << " sprites per ms generated" << std::endl;
+    }
+    if(frames > 0)
+    {
+        std::cout << "Recording took " << recordTime / frames << " ms per frame on "
+            << std::max(numArenas, 1) << " threads" << std::endl;
+    }
+    std::cout << "Streamed " << streamed.bytes / 1024 << " KB, " << streamed.stalls << " stalls, "
+        << streamed.wraps << " wraps" << std::endl;
+
     // Cleanup
-    for(auto it = sprites.begin(); it != sprites.end(); ++it)
+    delete pool;
+    if(!textures.empty())
     {
-        delete *it;
+        glDeleteTextures(textures.size(), &textures[0]);
     }
-    glDeleteTextures(1, &texture);
 
     glfwTerminate();
     return 0;
@@ -3,9 +3,11 @@
 #include <cmath>
 
 Sprite::Sprite(GLuint texture, int tW, int tH)
-    : dirty(true), texture(texture), scale(1.0f, 1.0f), angle(0.0f), position(0.0f, 0.0f, 0.0f),
-    r(255), g(255), b(255), a(255), textureWidth(tW), textureHeight(tH)
+    : dirty(true), texture(texture), scale(1.0f, 1.0f), angle(0.0f), cosAngle(1.0f), sinAngle(0.0f),
+    position(0.0f, 0.0f, 0.0f), r(255), g(255), b(255), a(255), layer(0), x(0), y(0), w(tW), h(tH),
+    textureWidth(tW), textureHeight(tH)
 {
+    updateTextureCoordinates();
 }
 
 Sprite::~Sprite()
@@ -30,6 +32,8 @@ void Sprite::setScale(float x, float y)
 void Sprite::setAngle(float a)
 {
     angle = a;
+    cosAngle = cosf(glm::radians(a));
+    sinAngle = sinf(glm::radians(a));
     dirty = true;
 }
 
@@ -39,6 +43,7 @@ void Sprite::setTextureRectangle(int x_, int y_, int w_, int h_)
     y = y_;
     w = w_;
     h = h_;
+    updateTextureCoordinates();
 }
 
 void Sprite::setColor(unsigned char r_, unsigned char g_, unsigned char b_, unsigned char a_)
@@ -49,6 +54,11 @@ void Sprite::setColor(unsigned char r_, unsigned char g_, unsigned char b_, unsi
     a = a_;
 }
 
+void Sprite::setLayer(int l)
+{
+    layer = l;
+}
+
 GLuint Sprite::getTexture() const
 {
     return texture;
@@ -84,6 +94,10 @@ void Sprite::getTextureRectangle(int* x_, int* y_, int* w_, int* h_) const
 
 bool Sprite::compare(const Sprite& other) const
 {
+    if(layer != other.layer)
+    {
+        return layer < other.layer;
+    }
     if(texture == other.texture)
     {
         return position.z < other.position.z;
@@ -100,8 +114,31 @@ void Sprite::getColor(unsigned char* r_, unsigned char* g_, unsigned char* b_, u
     *a_ = a;
 }
 
-void Sprite::getTextureDimensions(int* tW, int* tH)
+void Sprite::getTextureDimensions(int* tW, int* tH) const
 {
     *tW = textureWidth;
     *tH = textureHeight;
 }
+
+int Sprite::getLayer() const
+{
+    return layer;
+}
+
+float Sprite::getDepth() const
+{
+    return position.z;
+}
+
+void Sprite::updateTextureCoordinates()
+{
+    GLuint u0 = (GLuint)(x / (float)textureWidth * 65535.0f + 0.5f);
+    GLuint v0 = (GLuint)(y / (float)textureHeight * 65535.0f + 0.5f);
+    GLuint u1 = (GLuint)((x + w) / (float)textureWidth * 65535.0f + 0.5f);
+    GLuint v1 = (GLuint)((y + h) / (float)textureHeight * 65535.0f + 0.5f);
+    // Same corner order as the quad: 0, 0 then 1, 0 then 0, 1 then 1, 1
+    texCoords[0] = u0 | (v0 << 16);
+    texCoords[1] = u1 | (v0 << 16);
+    texCoords[2] = u0 | (v1 << 16);
+    texCoords[3] = u1 | (v1 << 16);
+}
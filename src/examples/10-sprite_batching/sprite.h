@@ -15,24 +15,39 @@ public:
     void setAngle(float angle);
     void setTextureRectangle(int x, int y, int w, int h);
     void setColor(unsigned char r, unsigned char g, unsigned char b, unsigned char a);
+    /**
+     * Sprites on a higher layer are drawn on top, when the batcher sorts
+     */
+    void setLayer(int layer);
 
     GLuint getTexture() const;
     const glm::mat4& getModelMatrix();
     void getTextureRectangle(int* x, int* y, int* w, int* h) const;
     void getColor(unsigned char* r, unsigned char* g, unsigned char* b, unsigned char* a) const;
-    void getTextureDimensions(int* tW, int* tH);
+    void getTextureDimensions(int* tW, int* tH) const;
+    int getLayer() const;
+    float getDepth() const;
 
     bool compare(const Sprite& other) const;
 private:
+    // Reads the cached values below when it generates vertices in bulk
+    friend class SpriteBatcher;
+
     bool dirty;
     GLuint texture;
     glm::vec2 scale;
     float angle;
+    float cosAngle, sinAngle;
     glm::vec3 position;
     unsigned char r, g, b, a;
+    int layer;
     glm::mat4 model;
     int x, y, w, h; // Texture rectangle
     int textureWidth, textureHeight;
+    // Normalized 16 bit u and v of each corner, packed like the vertices of the batcher
+    GLuint texCoords[4];
+
+    void updateTextureCoordinates();
 };
 
 #endif
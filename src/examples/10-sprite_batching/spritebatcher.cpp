@@ -2,7 +2,12 @@
 #include "../common/shader.h"
 #include <cassert>
 #include <algorithm>
+#include <chrono>
+#include <cstring>
 #include <glm/gtc/type_ptr.hpp>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
                              
 const char* VERTEX_SRC = "#version 330 core\n"
                          "layout(location=0) in vec2 position;"
@@ -28,14 +33,61 @@ const char* FRAGMENT_SRC = "#version 330 core\n"
                            "    outputColor = texture(tex, fTexCoord) * fColor;"
                            "}";
 
+// 4 vertices per sprite, so the indices of a full batch fit in 16 bits
 const int MAX_SPRITES = 5000;
+// The arenas are uploaded in pieces of this many sprites, each drawn in one or more batches
+const int MAX_UPLOAD = 4 * MAX_SPRITES;
+
+// Least significant digit radix sort on the 64 bit keys, 8 bits at a time. It is stable,
+// so sprites with the same key keep the order they were drawn in.
+// The result ends up in entries, scratch is only room to sort in.
+template<class Entry>
+static void radixSort(std::vector<Entry>& entries, std::vector<Entry>& scratch)
+{
+    scratch.resize(entries.size());
+    if(entries.empty())
+    {
+        return;
+    }
+    for(int shift = 0; shift < 64; shift += 8)
+    {
+        size_t counts[256] = { 0 };
+        for(size_t i = 0; i < entries.size(); ++i)
+        {
+            counts[(entries[i].key >> shift) & 0xff]++;
+        }
+        // Usually the layer and most of the depth are the same for every sprite
+        if(counts[(entries[0].key >> shift) & 0xff] == entries.size())
+        {
+            continue;
+        }
+
+        size_t offset = 0;
+        for(int d = 0; d < 256; ++d)
+        {
+            size_t count = counts[d];
+            counts[d] = offset;
+            offset += count;
+        }
+        for(size_t i = 0; i < entries.size(); ++i)
+        {
+            scratch[counts[(entries[i].key >> shift) & 0xff]++] = entries[i];
+        }
+        entries.swap(scratch);
+    }
+}
 
-#define VCTBO 0   // vertices, colour, texture coordinates buffer object
-#define EBO   1     // element buffer object
-
-SpriteBatcher::SpriteBatcher()
-    : camera(NULL), vao(0), program(0), lastTexture(0), drawn(0)
+SpriteBatcher::SpriteBatcher(SpriteSortMode m, int numArenas)
+    : mode(m), camera(NULL), cameraVersion(0), vao(0), program(0), indexBuffer(0),
+    // Room for a few full uploads, so one is not written over while it is drawn
+    stream(3 * MAX_UPLOAD * 4 * sizeof(SpriteVertex)), frameBytes(0),
+    vertices(MAX_SPRITES * 4), lastTexture(0), drawn(0), simd(true), arenas(std::max(numArenas, 0))
 {
+    stats.sprites = 0;
+    stats.batches = 0;
+    stats.flushTime = 0.0;
+    stats.generateTime = 0.0;
+
     // Create shader program
     GLuint vertex = createShader(VERTEX_SRC, GL_VERTEX_SHADER);
     GLuint fragment = createShader(FRAGMENT_SRC, GL_FRAGMENT_SHADER);
@@ -48,54 +100,73 @@ SpriteBatcher::SpriteBatcher()
     glDetachShader(program, fragment);
     glDeleteShader(fragment);
 
-    // Create vertex array and prepare buffers for being updated >= once per frame
-    glGenVertexArrays(1, &vao);
-    glGenBuffers(2, buffers);
+    // Every sprite is two triangles of its 4 vertices: 0, 1, 2 and 2, 1, 3
+    std::vector<GLushort> indices(MAX_SPRITES * 6);
+    for(int i = 0; i < MAX_SPRITES; ++i)
+    {
+        GLushort first = 4 * i;
+        GLushort quad[] = { first, (GLushort)(first + 1), (GLushort)(first + 2),
+            (GLushort)(first + 2), (GLushort)(first + 1), (GLushort)(first + 3) };
+        std::copy(quad, quad + 6, &indices[6 * i]);
+    }
 
+    // Create vertex array, the attributes are pointed at the stream buffer for each batch
+    glGenVertexArrays(1, &vao);
     glBindVertexArray(vao);
-
-    glBindBuffer(GL_ARRAY_BUFFER, buffers[VCTBO]);
-    glBufferData(GL_ARRAY_BUFFER, 0, NULL, GL_DYNAMIC_DRAW);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers[EBO]);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, 0, NULL, GL_DYNAMIC_DRAW);
-    
-    // Attributes
-    glBindBuffer(GL_ARRAY_BUFFER, buffers[VCTBO]);
+    glGenBuffers(1, &indexBuffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLushort), &indices[0], GL_STATIC_DRAW);
     glEnableVertexAttribArray(0); // position
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
     glEnableVertexAttribArray(1); // color
-    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(2 * sizeof(float)));
     glEnableVertexAttribArray(2); // texture coordinates
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
-
     glBindVertexArray(0);
 
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 }
 
 SpriteBatcher::~SpriteBatcher()
 {
     glDeleteVertexArrays(1, &vao);
-    glDeleteBuffers(2, buffers);
+    glDeleteBuffers(1, &indexBuffer);
     glDeleteProgram(program);
 }
 
 void SpriteBatcher::begin()
 {
+    frameBytes = 0;
     glUseProgram(program);
     glBindVertexArray(vao);
 
-    // Clearing the buffers makes OpenGL happier
-    glBindBuffer(GL_ARRAY_BUFFER, buffers[VCTBO]);
-    glBufferData(GL_ARRAY_BUFFER, 0, NULL, GL_DYNAMIC_DRAW);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers[EBO]);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, 0, NULL, GL_DYNAMIC_DRAW);
+    // The program keeps the projection, so it is only set again when the camera moved
+    if(camera->getVersion() != cameraVersion)
+    {
+        glUniformMatrix4fv(glGetUniformLocation(program, "projection"), 1, GL_FALSE, glm::value_ptr(camera->getProjection()));
+        cameraVersion = camera->getVersion();
+    }
 }
 
 void SpriteBatcher::end()
 {
+    if(mode == SPRITES_SORTED)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        double flushTime = stats.flushTime;
+
+        radixSort(queue, sorted);
+        append([this](size_t i) -> const Sprite& { return *queue[i].sprite; }, queue.size());
+        queue.clear();
+        textureRanks.clear();
+
+        std::chrono::duration<double, std::milli> duration = std::chrono::steady_clock::now() - start;
+        stats.generateTime += duration.count() - (stats.flushTime - flushTime);
+    }
     render();
+    renderArenas();
+    // The batches of this frame can be written over once the GPU has drawn them
+    stream.fence();
+    // Wrapping around within a frame would wait for the draws just issued, so make room for
+    // three frames like this one. Sprites drawn without arenas only stall on the first of them.
+    stream.reserve(3 * frameBytes);
 
     glBindVertexArray(0);
     glUseProgram(0);
@@ -103,106 +174,338 @@ void SpriteBatcher::end()
 
 void SpriteBatcher::draw(Sprite* sprite)
 {
-    if(drawn > MAX_SPRITES || lastTexture != sprite->getTexture())
+    if(mode == SPRITES_SORTED)
+    {
+        queueSprite(sprite);
+    }
+    else
     {
-        render();
+        append([sprite](size_t) -> const Sprite& { return *sprite; }, 1);
     }
+}
 
-    // We first set up the vertex data as interleaved
-    // positions, colors and texture coordinates.
-    // We also set up the element buffer data.
-    unsigned char r, g, b, a;
-    sprite->getColor(&r, &g, &b, &a);
-    float rf = r / 255.f, gf = g / 255.f, bf = b / 255.f, af = a / 255.f;
-    int x, y, w, h, tW, tH;
-    sprite->getTextureRectangle(&x, &y, &w, &h);
-    sprite->getTextureDimensions(&tW, &tH);
+void SpriteBatcher::draw(const Sprite* sprites, size_t n)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    double flushTime = stats.flushTime;
 
-    // Transform the vertices
-    glm::mat4 model = sprite->getModelMatrix();
-    static const glm::vec2 positions[] =
+    if(mode == SPRITES_SORTED)
     {
-        { 0.0f, 0.0f },
-        { 1.0f, 0.0f },
-        { 0.0f, 1.0f },
-        { 1.0f, 1.0f }
-    };
-
-    float xv[4];
-    float yv[4];
-    for(int i = 0; i < 4; ++i)
+        for(size_t i = 0; i < n; ++i)
+        {
+            queueSprite(&sprites[i]);
+        }
+    }
+    else
     {
-        glm::vec4 p(positions[i], 0.0f, 1.0f);
-        p = model * p;
-        xv[i] = p.x;
-        yv[i] = p.y;
+        append([sprites](size_t i) -> const Sprite& { return sprites[i]; }, n);
     }
 
-    float _vertices[] =
-    {
-        // x   y      r   g   b   a   u                      v
-        xv[0], yv[0], rf, gf, bf, af,  x / (float)tW,        y / (float)tH,
-        xv[1], yv[1], rf, gf, bf, af, (x + w) / (float)tW,   y / (float)tH,
-        xv[2], yv[2], rf, gf, bf, af,  x / (float)tW,       (y + h) / (float)tH,
-        xv[3], yv[3], rf, gf, bf, af, (x + w) / (float)tW,  (y + h) / (float)tH
-    };
+    // Batches that filled up were flushed in between, that is counted as flush time
+    std::chrono::duration<double, std::milli> duration = std::chrono::steady_clock::now() - start;
+    stats.generateTime += duration.count() - (stats.flushTime - flushTime);
+}
 
-    static const GLuint _indices[] = // Always the same
+void SpriteBatcher::draw(int arenaIndex, const Sprite* sprites, size_t n)
+{
+    if(arenaIndex < 0 || arenaIndex >= (int)arenas.size())
+    {
+        std::cerr << "Sprite batcher has no arena " << arenaIndex << std::endl;
+        return;
+    }
+    Arena& arena = arenas[arenaIndex];
+    size_t first = arena.count;
+    if(arena.keys.size() < first + n)
     {
-        0, 1, 2,
-        2, 1, 3
-    };
+        // Only grows, so the arenas stop allocating after the first frames
+        arena.vertices.resize(4 * (first + n));
+        arena.keys.resize(first + n);
+        arena.textures.resize(first + n);
+    }
+    generate([sprites](size_t i) -> const Sprite& { return sprites[i]; }, 0, n, &arena.vertices[4 * first]);
 
-    for(int v = 0; v < 32; ++v)
+    // The texture ranks are only known once all arenas are in, end() fills them in
+    for(size_t i = 0; i < n; ++i)
     {
-        vertices.push_back(_vertices[v]);
+        arena.keys[first + i] = sortKey(sprites[i], 0);
+        arena.textures[first + i] = sprites[i].texture;
     }
+    arena.count += n;
+}
+
+unsigned long long SpriteBatcher::sortKey(const Sprite& sprite, unsigned int rank)
+{
+    // Flip the sign bit of positive depths and every bit of negative ones,
+    // then the bits sort like the floats
+    float depth = sprite.getDepth();
+    unsigned int depthBits;
+    memcpy(&depthBits, &depth, sizeof(depthBits));
+    depthBits ^= (depthBits & 0x80000000u) ? 0xffffffffu : 0x80000000u;
+
+    int layer = std::min(std::max(sprite.getLayer(), -32768), 32767) + 32768;
+    return ((unsigned long long)layer << 48) | ((unsigned long long)std::min(rank, 0xffffu) << 32) | depthBits;
+}
 
-    for(int e = 0; e < 6; ++e)
+void SpriteBatcher::queueSprite(const Sprite* sprite)
+{
+    unsigned int rank = textureRanks.insert(std::make_pair(sprite->getTexture(), (unsigned int)textureRanks.size())).first->second;
+
+    SortEntry entry;
+    entry.key = sortKey(*sprite, rank);
+    entry.sprite = sprite;
+    queue.push_back(entry);
+}
+
+template<class SpriteAt>
+void SpriteBatcher::append(SpriteAt spriteAt, size_t n)
+{
+    size_t i = 0;
+    while(i < n)
     {
-        // Note the sum: 4 * drawn indicates the number of vertices that we have
-        // already added to the vertices vector. If we do not add this sum,
-        // we would just draw the first sprite over and over again
-        indices.push_back(_indices[e] + 4 * drawn);
+        GLuint texture = spriteAt(i).texture;
+        if(drawn == MAX_SPRITES || lastTexture != texture)
+        {
+            render();
+        }
+        lastTexture = texture;
+
+        // The following sprites with the same texture go into the batch together
+        size_t last = std::min(n, i + (MAX_SPRITES - drawn));
+        size_t end = i + 1;
+        while(end < last && spriteAt(end).texture == texture)
+        {
+            ++end;
+        }
+        generate(spriteAt, i, end, &vertices[4 * drawn]);
+        drawn += end - i;
+        i = end;
     }
+}
 
-    ++drawn;
-    lastTexture = sprite->getTexture();
+static GLuint packColor(const Sprite& sprite)
+{
+    unsigned char r, g, b, a;
+    sprite.getColor(&r, &g, &b, &a);
+    return r | (g << 8) | (b << 16) | ((GLuint)a << 24);
+}
+
+template<class SpriteAt>
+void SpriteBatcher::generate(SpriteAt spriteAt, size_t first, size_t last, SpriteVertex* out) const
+{
+    // The quad of a sprite is scaled, then rotated around its center, then moved to its
+    // position (see Sprite::getModelMatrix). So the corners are the center plus or minus
+    // the half axes a = (cos, sin) * scale.x / 2 and b = (-sin, cos) * scale.y / 2.
+    size_t i = first;
+#ifdef __SSE2__
+    for(; simd && i + 4 <= last; i += 4, out += 16)
+    {
+        // Gather 4 sprites into the lanes
+        float cx[4], cy[4], hx[4], hy[4], cosines[4], sines[4];
+        GLuint colors[4], texCoords[4][4];
+        for(int k = 0; k < 4; ++k)
+        {
+            const Sprite& sprite = spriteAt(i + k);
+            hx[k] = 0.5f * sprite.scale.x;
+            hy[k] = 0.5f * sprite.scale.y;
+            cx[k] = sprite.position.x + hx[k];
+            cy[k] = sprite.position.y + hy[k];
+            cosines[k] = sprite.cosAngle;
+            sines[k] = sprite.sinAngle;
+            colors[k] = packColor(sprite);
+            for(int c = 0; c < 4; ++c)
+            {
+                texCoords[c][k] = sprite.texCoords[c];
+            }
+        }
+
+        __m128 c = _mm_loadu_ps(cosines), s = _mm_loadu_ps(sines);
+        __m128 halfX = _mm_loadu_ps(hx), halfY = _mm_loadu_ps(hy);
+        __m128 ax = _mm_mul_ps(c, halfX), ay = _mm_mul_ps(s, halfX);
+        __m128 bx = _mm_mul_ps(s, halfY), by = _mm_mul_ps(c, halfY);
+        __m128 centerX = _mm_loadu_ps(cx), centerY = _mm_loadu_ps(cy);
+        __m128 xm = _mm_sub_ps(centerX, ax), xp = _mm_add_ps(centerX, ax);
+        __m128 ym = _mm_sub_ps(centerY, ay), yp = _mm_add_ps(centerY, ay);
+        __m128 x[4] = { _mm_add_ps(xm, bx), _mm_add_ps(xp, bx), _mm_sub_ps(xm, bx), _mm_sub_ps(xp, bx) };
+        __m128 y[4] = { _mm_sub_ps(ym, by), _mm_sub_ps(yp, by), _mm_add_ps(ym, by), _mm_add_ps(yp, by) };
+        __m128 color = _mm_castsi128_ps(_mm_loadu_si128((const __m128i*)colors));
+
+        // A vertex is 4 floats, so it is built in a register from the lanes of one sprite:
+        // x, y interleaved with color, uv interleaved gives two vertices per half
+        for(int corner = 0; corner < 4; ++corner)
+        {
+            __m128 uv = _mm_castsi128_ps(_mm_loadu_si128((const __m128i*)texCoords[corner]));
+            __m128 xyLo = _mm_unpacklo_ps(x[corner], y[corner]), xyHi = _mm_unpackhi_ps(x[corner], y[corner]);
+            __m128 cuvLo = _mm_unpacklo_ps(color, uv), cuvHi = _mm_unpackhi_ps(color, uv);
+            _mm_storeu_ps((float*)&out[corner], _mm_movelh_ps(xyLo, cuvLo));
+            _mm_storeu_ps((float*)&out[4 + corner], _mm_movehl_ps(cuvLo, xyLo));
+            _mm_storeu_ps((float*)&out[8 + corner], _mm_movelh_ps(xyHi, cuvHi));
+            _mm_storeu_ps((float*)&out[12 + corner], _mm_movehl_ps(cuvHi, xyHi));
+        }
+    }
+#endif
+    for(; i < last; ++i, out += 4)
+    {
+        const Sprite& sprite = spriteAt(i);
+        float hx = 0.5f * sprite.scale.x, hy = 0.5f * sprite.scale.y;
+        float cx = sprite.position.x + hx, cy = sprite.position.y + hy;
+        float ax = sprite.cosAngle * hx, ay = sprite.sinAngle * hx;
+        float bx = sprite.sinAngle * hy, by = sprite.cosAngle * hy;
+        float xm = cx - ax, xp = cx + ax, ym = cy - ay, yp = cy + ay;
+        float x[4] = { xm + bx, xp + bx, xm - bx, xp - bx };
+        float y[4] = { ym - by, yp - by, ym + by, yp + by };
+        GLuint color = packColor(sprite);
+        for(int corner = 0; corner < 4; ++corner)
+        {
+            out[corner].x = x[corner];
+            out[corner].y = y[corner];
+            out[corner].color = color;
+            out[corner].texCoord = sprite.texCoords[corner];
+        }
+    }
 }
 
 void SpriteBatcher::setCamera(Camera* c)
 {
     camera = c;
+    cameraVersion = 0;
 }
 
-void SpriteBatcher::render()
+void SpriteBatcher::setSimd(bool simd)
 {
-    if(vertices.empty())
+    this->simd = simd;
+}
+
+const SpriteBatcherStats& SpriteBatcher::getStats() const
+{
+    return stats;
+}
+
+const StreamBufferStats& SpriteBatcher::getStreamStats() const
+{
+    return stream.getStats();
+}
+
+void SpriteBatcher::renderArenas()
+{
+    size_t total = 0;
+    for(size_t a = 0; a < arenas.size(); ++a)
+    {
+        total += arenas[a].count;
+    }
+    if(total == 0)
     {
         return;
     }
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
 
-    // Send the vertices
-    glBindBuffer(GL_ARRAY_BUFFER, buffers[VCTBO]);
-    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), &vertices[0], GL_DYNAMIC_DRAW);
+    // Merge the arenas in order, numbering the textures like queueSprite does
+    merged.resize(total);
+    size_t m = 0;
+    for(size_t a = 0; a < arenas.size(); ++a)
+    {
+        Arena& arena = arenas[a];
+        for(size_t i = 0; i < arena.count; ++i, ++m)
+        {
+            GLuint texture = arena.textures[i];
+            unsigned int rank = textureRanks.insert(std::make_pair(texture, (unsigned int)textureRanks.size())).first->second;
+            merged[m].key = arena.keys[i] | ((unsigned long long)std::min(rank, 0xffffu) << 32);
+            merged[m].texture = texture;
+            merged[m].vertices = &arena.vertices[4 * i];
+        }
+        arena.count = 0;
+    }
+    textureRanks.clear();
+    if(mode == SPRITES_SORTED)
+    {
+        radixSort(merged, mergedSorted);
+    }
+
+    std::chrono::steady_clock::time_point generated = std::chrono::steady_clock::now();
+    std::chrono::duration<double, std::milli> duration = generated - start;
+    stats.generateTime += duration.count();
+
+    // The size of the arenas is known up front, so the ring can grow before it is written
+    frameBytes += total * 4 * sizeof(SpriteVertex);
+    stream.reserve(3 * frameBytes);
+
+    glUniform1i(glGetUniformLocation(program, "tex"), 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindBuffer(GL_ARRAY_BUFFER, stream.getBuffer());
+
+    for(size_t first = 0; first < total; first += MAX_UPLOAD)
+    {
+        size_t count = std::min(total - first, (size_t)MAX_UPLOAD);
+        GLsizeiptr vertexOffset;
+        SpriteVertex* out = (SpriteVertex*)stream.map(count * 4 * sizeof(SpriteVertex), &vertexOffset);
+        if(!out)
+        {
+            break;
+        }
+        for(size_t i = 0; i < count; ++i)
+        {
+            memcpy(&out[4 * i], merged[first + i].vertices, 4 * sizeof(SpriteVertex));
+        }
+        stream.unmap(count * 4 * sizeof(SpriteVertex));
+
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(SpriteVertex), (void*)vertexOffset);
+        glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(SpriteVertex), (void*)(vertexOffset + 2 * sizeof(float)));
+        glVertexAttribPointer(2, 2, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(SpriteVertex), (void*)(vertexOffset + 3 * sizeof(float)));
+
+        // Runs of the same texture are drawn from the upload, the base vertex
+        // keeps their indices within the 16 bit index buffer
+        size_t i = 0;
+        while(i < count)
+        {
+            GLuint texture = merged[first + i].texture;
+            size_t end = i + 1;
+            while(end < count && end - i < (size_t)MAX_SPRITES && merged[first + end].texture == texture)
+            {
+                ++end;
+            }
+            glBindTexture(GL_TEXTURE_2D, texture);
+            glDrawElementsBaseVertex(GL_TRIANGLES, (end - i) * 6, GL_UNSIGNED_SHORT, 0, 4 * i);
+            stats.batches++;
+            i = end;
+        }
+    }
+
+    duration = std::chrono::steady_clock::now() - generated;
+    stats.flushTime += duration.count();
+    stats.sprites += total;
+}
 
-    // Send the indices
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers[EBO]);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), &indices[0], GL_DYNAMIC_DRAW);
+void SpriteBatcher::render()
+{
+    if(drawn == 0)
+    {
+        return;
+    }
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
 
-    // Set the projection uniform
-    glUniformMatrix4fv(glGetUniformLocation(program, "projection"), 1, GL_FALSE, glm::value_ptr(camera->getProjection()));
+    // Send the vertices, the indices are already on the GPU
+    GLsizeiptr vertexOffset = stream.write(&vertices[0], drawn * 4 * sizeof(SpriteVertex));
+    if(vertexOffset < 0)
+    {
+        drawn = 0;
+        return;
+    }
+    frameBytes += drawn * 4 * sizeof(SpriteVertex);
+
+    glBindBuffer(GL_ARRAY_BUFFER, stream.getBuffer());
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(SpriteVertex), (void*)vertexOffset);
+    glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(SpriteVertex), (void*)(vertexOffset + 2 * sizeof(float)));
+    glVertexAttribPointer(2, 2, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(SpriteVertex), (void*)(vertexOffset + 3 * sizeof(float)));
 
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, lastTexture);
     glUniform1i(glGetUniformLocation(program, "tex"), 0);
 
     // Draw
-    glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
+    glDrawElements(GL_TRIANGLES, drawn * 6, GL_UNSIGNED_SHORT, 0);
 
+    std::chrono::duration<double, std::milli> duration = std::chrono::steady_clock::now() - start;
+    stats.flushTime += duration.count();
+    stats.sprites += drawn;
+    stats.batches++;
     drawn = 0;
-
-    // Clear
-    vertices.clear();
-    indices.clear();
 }
@@ -3,29 +3,133 @@
 
 #include "sprite.h"
 #include "../common/camera.h"
+#include "../common/streambuffer.h"
 #include "../common/util.h"
+#include <unordered_map>
 #include <vector>
 
+/**
+ * Counters of a SpriteBatcher since it was created
+ */
+struct SpriteBatcherStats
+{
+    long long sprites, batches;
+    // Milliseconds spent uploading and drawing the batches
+    double flushTime;
+    // Milliseconds spent generating vertices (and sorting) in end() and bulk draws
+    double generateTime;
+};
+
+enum SpriteSortMode
+{
+    // Draw the sprites in the order they come, a new texture starts a new batch
+    SPRITES_IMMEDIATE,
+    // Collect the sprites until end() and sort them by layer, texture and depth,
+    // so every texture of a layer is one batch
+    SPRITES_SORTED
+};
+
 class SpriteBatcher
 {
 public:
-    SpriteBatcher();
+    /**
+     * @param numArenas Number of arenas that threads can draw into, see draw(int, const Sprite*, size_t)
+     */
+    SpriteBatcher(SpriteSortMode mode = SPRITES_IMMEDIATE, int numArenas = 0);
     ~SpriteBatcher();
 
     void begin();
     void end();
     void draw(Sprite* sprite);
+    /**
+     * Draw n sprites stored one after the other.
+     * This generates their vertices 4 at a time, which is much faster than drawing them one by one.
+     */
+    void draw(const Sprite* sprites, size_t n);
+    /**
+     * Generate the vertices of n sprites into an arena. Several threads can do this at once,
+     * as long as each uses its own arena, between begin() and end() and without OpenGL.
+     * end() merges the arenas in order (sorting them in SPRITES_SORTED) and uploads them together,
+     * after the sprites that were drawn without an arena.
+     */
+    void draw(int arena, const Sprite* sprites, size_t n);
 
     void setCamera(Camera* camera);
+    /**
+     * Generate the vertices of 4 sprites at once with SSE2 when it is available (the default),
+     * or one at a time to compare
+     */
+    void setSimd(bool simd);
+    const SpriteBatcherStats& getStats() const;
+    const StreamBufferStats& getStreamStats() const;
 private:
+    struct SortEntry
+    {
+        // Layer, texture and depth, in that order of importance
+        unsigned long long key;
+        const Sprite* sprite;
+    };
+    // Position, normalized 8 bit color and normalized 16 bit texture coordinates, 16 bytes
+    struct SpriteVertex
+    {
+        float x, y;
+        GLuint color;
+        GLuint texCoord;
+    };
+
+    // A sprite in an arena, merged into one list at end()
+    struct ArenaEntry
+    {
+        unsigned long long key;
+        GLuint texture;
+        const SpriteVertex* vertices;
+    };
+    struct Arena
+    {
+        std::vector<SpriteVertex> vertices;
+        std::vector<unsigned long long> keys;
+        std::vector<GLuint> textures;
+        // Sprites drawn this frame, the vectors keep their size between frames
+        size_t count;
+        Arena() : count(0) {}
+        // Keeps the arenas that different threads write on different cache lines
+        char padding[64];
+    };
+
+    SpriteSortMode mode;
     Camera* camera;
+    // Version of the camera the projection uniform was set for
+    unsigned long long cameraVersion;
     GLuint vao, program;
-    GLuint buffers[3];
-    std::vector<float> vertices;
-    std::vector<GLuint> indices;
+    // The indices of every quad never change, so only the vertices are streamed
+    GLuint indexBuffer;
+    StreamBuffer stream;
+    // Bytes streamed since begin(), the ring grows to hold three frames of them
+    GLsizeiptr frameBytes;
+    // Room for a full batch, drawn counts the sprites in it
+    std::vector<SpriteVertex> vertices;
     GLuint lastTexture;
     int drawn;
+    bool simd;
+    SpriteBatcherStats stats;
+    // The sprites of the frame and room to sort them, for SPRITES_SORTED
+    std::vector<SortEntry> queue, sorted;
+    // Textures numbered in the order they first came this frame
+    std::unordered_map<GLuint, unsigned int> textureRanks;
+    std::vector<Arena> arenas;
+    std::vector<ArenaEntry> merged, mergedSorted;
 
+    // Layer, texture rank and depth packed so they sort in that order
+    static unsigned long long sortKey(const Sprite& sprite, unsigned int rank);
+    void queueSprite(const Sprite* sprite);
+    void renderArenas();
+    // Generate the vertices of n sprites, starting a new batch when needed.
+    // spriteAt(i) returns the ith sprite, so arrays and the sorted queue work alike
+    template<class SpriteAt>
+    void append(SpriteAt spriteAt, size_t n);
+    // Write the vertices of the sprites first to last to out
+    template<class SpriteAt>
+    void generate(SpriteAt spriteAt, size_t first, size_t last, SpriteVertex* out) const;
     void render();
 };
 
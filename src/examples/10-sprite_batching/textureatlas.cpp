@@ -0,0 +1,108 @@
+#include "textureatlas.h"
+#include <algorithm>
+
+// imgui_draw.cpp keeps its copy of stb_rect_pack static, so the atlas compiles its own
+#define STB_RECT_PACK_IMPLEMENTATION
+#include "imgui/stb_rect_pack.h"
+
+TextureAtlas::TextureAtlas(int size, int pad)
+    : pageSize(size), padding(pad)
+{
+}
+
+TextureAtlas::~TextureAtlas()
+{
+    for(size_t i = 0; i < pages.size(); ++i)
+    {
+        glDeleteTextures(1, &pages[i]->texture);
+        delete pages[i];
+    }
+}
+
+bool TextureAtlas::add(const unsigned char* pixels, int w, int h, AtlasRegion* region)
+{
+    stbrp_rect rect;
+    rect.id = 0;
+    rect.w = w + 2 * padding;
+    rect.h = h + 2 * padding;
+    if(w <= 0 || h <= 0 || rect.w > pageSize || rect.h > pageSize)
+    {
+        std::cerr << "Image of " << w << "x" << h << " does not fit in an atlas page of " << pageSize << std::endl;
+        return false;
+    }
+
+    // Packing again continues where the previous images left off
+    Page* page = NULL;
+    for(size_t i = 0; i < pages.size() && !page; ++i)
+    {
+        stbrp_pack_rects(&pages[i]->context, &rect, 1);
+        if(rect.was_packed)
+        {
+            page = pages[i];
+        }
+    }
+    if(!page)
+    {
+        page = new Page;
+        page->nodes.resize(pageSize);
+        stbrp_init_target(&page->context, pageSize, pageSize, &page->nodes[0], pageSize);
+
+        // Start out transparent, so unused space does not show garbage
+        std::vector<unsigned char> clear(pageSize * pageSize * 4, 0);
+        glGenTextures(1, &page->texture);
+        glBindTexture(GL_TEXTURE_2D, page->texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, pageSize, pageSize, 0, GL_RGBA, GL_UNSIGNED_BYTE, &clear[0]);
+        pages.push_back(page);
+
+        stbrp_pack_rects(&page->context, &rect, 1);
+    }
+
+    // Copy the image with its edges repeated into the padding
+    std::vector<unsigned char> padded(rect.w * rect.h * 4);
+    for(int y = 0; y < rect.h; ++y)
+    {
+        int sy = std::min(std::max(y - padding, 0), h - 1);
+        for(int x = 0; x < rect.w; ++x)
+        {
+            int sx = std::min(std::max(x - padding, 0), w - 1);
+            std::copy(pixels + (sy * w + sx) * 4, pixels + (sy * w + sx) * 4 + 4, &padded[(y * rect.w + x) * 4]);
+        }
+    }
+    glBindTexture(GL_TEXTURE_2D, page->texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, rect.x, rect.y, rect.w, rect.h, GL_RGBA, GL_UNSIGNED_BYTE, &padded[0]);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    region->texture = page->texture;
+    region->x = rect.x + padding;
+    region->y = rect.y + padding;
+    region->w = w;
+    region->h = h;
+    region->pageWidth = pageSize;
+    region->pageHeight = pageSize;
+    return true;
+}
+
+bool TextureAtlas::addImage(const char* fileName, AtlasRegion* region)
+{
+    int w, h;
+    unsigned char* img = SOIL_load_image(fileName, &w, &h, NULL, SOIL_LOAD_RGBA);
+    if(!img)
+    {
+        std::cerr << "Error loading image " << fileName << ": " << SOIL_last_result() << std::endl;
+        return false;
+    }
+    bool added = add(img, w, h, region);
+    SOIL_free_image_data(img);
+    return added;
+}
+
+int TextureAtlas::getPageCount() const
+{
+    return pages.size();
+}
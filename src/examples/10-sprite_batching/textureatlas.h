@@ -0,0 +1,58 @@
+#ifndef TEXTURE_ATLAS_HEADER
+#define TEXTURE_ATLAS_HEADER
+
+#include "../common/util.h"
+#include "imgui/stb_rect_pack.h"
+#include <vector>
+
+/**
+ * Where an image ended up in an atlas, in pixels of the page texture
+ */
+struct AtlasRegion
+{
+    GLuint texture;
+    int x, y, w, h;
+    int pageWidth, pageHeight;
+};
+
+/**
+ * Packs small RGBA images into shared page textures at runtime, so sprites
+ * that used different textures can be drawn in one batch.
+ * The pages belong to the atlas and are deleted with it.
+ */
+class TextureAtlas
+{
+public:
+    /**
+     * @param pageSize Width and height of every page
+     * @param padding Pixels around every image, filled with its edges so
+     *        linear filtering does not pick up the neighbours
+     */
+    TextureAtlas(int pageSize = 1024, int padding = 1);
+    ~TextureAtlas();
+
+    /**
+     * Add an image to the first page with room, or a new page
+     * @return false if the image does not fit in a page
+     */
+    bool add(const unsigned char* pixels, int w, int h, AtlasRegion* region);
+    /**
+     * Load an image like loadImage in util.h and add it
+     */
+    bool addImage(const char* fileName, AtlasRegion* region);
+
+    int getPageCount() const;
+private:
+    struct Page
+    {
+        GLuint texture;
+        stbrp_context context;
+        std::vector<stbrp_node> nodes;
+    };
+
+    // The packer keeps pointers into the nodes, so pages never move
+    std::vector<Page*> pages;
+    int pageSize, padding;
+};
+
+#endif
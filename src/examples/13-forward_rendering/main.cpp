@@ -1,9 +1,14 @@
 #include "../common/util.h"
 #include "../common/shader.h"
 #include "../common/camera.h"
+#include "../common/clusteredlights.h"
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <cstdlib>
+
+#define NUM_POINT_LIGHTS 3
+#define SEED 1993
 
 const char* VERTEX_SRC = "#version 330 core\n"
                          "layout(location=0) in vec3 position;"
@@ -27,7 +32,6 @@ const char* VERTEX_SRC = "#version 330 core\n"
                          "}";
 
 const char* FRAGMENT_SRC = "#version 330 core\n"
-                           "#define NUM_POINT_LIGHTS 3\n"
                            "struct Sun"
                            "{"
                            "    vec3 dir;"
@@ -35,14 +39,6 @@ const char* FRAGMENT_SRC = "#version 330 core\n"
                            "    vec3 diffuse;"
                            "    vec3 specular;"
                            "};"
-                           "struct PointLight"
-                           "{"
-                           "    vec3 position;"
-                           "    vec3 att;" // x = constant, y = linear, z = quadratic
-                           "    vec3 ambient;"
-                           "    vec3 diffuse;"
-                           "    vec3 specular;"
-                           "};"
                            "in vec3 fNormal;"
                            "in vec3 fPosition;"
                            "in vec2 fTexCoords;"
@@ -50,8 +46,9 @@ const char* FRAGMENT_SRC = "#version 330 core\n"
                            "layout(std140) uniform Light"
                            "{"
                            "    Sun sun;"
-                           "    PointLight pointLights[NUM_POINT_LIGHTS];"
                            "};"
+                           // The point lights are looked up in the cluster of the fragment, see ../common/clusteredlights.h
+                           CLUSTERED_LIGHTS_GLSL
                            "uniform vec3 eye;"
                            "uniform sampler2D matDiffuse;"
                            "uniform sampler2D matSpecular;"
@@ -85,14 +82,22 @@ const char* FRAGMENT_SRC = "#version 330 core\n"
                            "    vec3 normal = normalize(fNormal);"
                            "    vec3 eyeDir = normalize(eye - fPosition);"
                            "    vec3 result = dirLight(sun, normal, eyeDir);"
-                           "    for(int i = 0; i < NUM_POINT_LIGHTS; ++i)"
+                           "    uvec2 range = clusterRange(fPosition);"
+                           "    for(uint i = 0u; i < range.y; ++i)"
                            "    {"
-                           "        result += pointLight(pointLights[i], normal, fPosition, eyeDir);"
+                           "        result += pointLight(clusterLight(range, i), normal, fPosition, eyeDir);"
                            "    }"
                            "    outputColor = vec4(result, 1.0);"
                            "}";
 
-int main(void)
+ClusterLight makeLight(const glm::vec3& position, const glm::vec3& att, const glm::vec3& ambient,
+        const glm::vec3& diffuse, const glm::vec3& specular)
+{
+    ClusterLight light = { position, att, ambient, diffuse, specular };
+    return light;
+}
+
+int main(int argc, char** argv)
 {
     GLFWwindow* window;
     window = init("Forward Rendering", 640, 480);
@@ -201,17 +206,11 @@ int main(void)
     GLuint lightUbo;
     glGenBuffers(1, &lightUbo);
     glBindBuffer(GL_UNIFORM_BUFFER, lightUbo);
-    // We have static lights in this example so we can fill the uniform buffer once and be done with it
+    // We have a static sun in this example so we can fill the uniform buffer once and be done with it
     float bufferData[] =
     {
         // sunlight
-        /* dir */ -0.5f, -0.5f, -0.5f, 0.0f, /* ambient */ 0.2f, 0.2f, 0.2f, 0.0f, /* diffuse */ 0.7f, 0.2f, 0.2f, 0.0f, /* specular */ 0.5f, 0.5f, 0.5f, 0.0f,
-        // pointlight 0
-        /* pos */ 0.0f, 5.0f, 0.0f, 0.0f, /* attenuation */ 1.0f, 0.7f, 1.8f, 0.0f, /* ambient */ 0.3f, 0.1f, 0.1f, 0.0f, /* diffuse */ 0.5f, 1.0f, 0.5f, 0.0f, /* specular */ 0.8f, 0.6f, 0.3f, 0.0f,
-        // pointlight 1
-        /* pos */ 5.0f, 0.0f, 0.0f, 0.0f, /* attenuation */ 1.0f, 0.35f, 0.44f, 0.0f, /* ambient */ 0.3f, 0.1f, 0.1f, 0.0f, /* diffuse */ 0.7f, 0.5f, 0.2f, 0.0f, /* specular */ 0.8f, 0.6f, 0.3f, 0.0f,
-        // pointlight 2
-        /* pos */ 0.0f, -5.0f, 5.0f, 0.0f, /* attenuation */ 1.0f, 0.35f, 0.44f, 0.0f, /* ambient */ 0.3f, 0.1f, 0.1f, 0.0f, /* diffuse */ 0.7f, 0.5f, 0.2f, 0.0f,/* specular */ 0.8f, 0.6f, 0.3f, 0.0f
+        /* dir */ -0.5f, -0.5f, -0.5f, 0.0f, /* ambient */ 0.2f, 0.2f, 0.2f, 0.0f, /* diffuse */ 0.7f, 0.2f, 0.2f, 0.0f, /* specular */ 0.5f, 0.5f, 0.5f, 0.0f
     }; // Vec3: we add a padding float after each vec3
     glBufferData(GL_UNIFORM_BUFFER, sizeof(bufferData), bufferData, GL_STATIC_DRAW);
     glBindBufferBase(GL_UNIFORM_BUFFER, 1, lightUbo);
@@ -219,6 +218,35 @@ int main(void)
     GLuint light_index = glGetUniformBlockIndex(program, "Light");
     glUniformBlockBinding(program, light_index, 1);
 
+    // The point lights no longer fit in a uniform buffer once there are thousands of them.
+    // Every frame they are sorted into clusters of the view on a job pool, and every fragment
+    // only shades the lights of its own cluster.
+    // Give the number of lights (./13-forward_rendering.out 4000) to add small ones around the cube.
+    int numLights = argc > 1 ? std::max(atoi(argv[1]), NUM_POINT_LIGHTS) : NUM_POINT_LIGHTS;
+    std::vector<ClusterLight> lights;
+    lights.push_back(makeLight(glm::vec3(0.0f, 5.0f, 0.0f), glm::vec3(1.0f, 0.7f, 1.8f), glm::vec3(0.3f, 0.1f, 0.1f),
+            glm::vec3(0.5f, 1.0f, 0.5f), glm::vec3(0.8f, 0.6f, 0.3f)));
+    lights.push_back(makeLight(glm::vec3(5.0f, 0.0f, 0.0f), glm::vec3(1.0f, 0.35f, 0.44f), glm::vec3(0.3f, 0.1f, 0.1f),
+            glm::vec3(0.7f, 0.5f, 0.2f), glm::vec3(0.8f, 0.6f, 0.3f)));
+    lights.push_back(makeLight(glm::vec3(0.0f, -5.0f, 5.0f), glm::vec3(1.0f, 0.35f, 0.44f), glm::vec3(0.3f, 0.1f, 0.1f),
+            glm::vec3(0.7f, 0.5f, 0.2f), glm::vec3(0.8f, 0.6f, 0.3f)));
+    srand(SEED);
+    // The more lights there are, the smaller they get, so about 3 of them overlap anywhere around the cube
+    float range = std::cbrt(48.0f / (numLights - NUM_POINT_LIGHTS + 1));
+    for(int i = NUM_POINT_LIGHTS; i < numLights; ++i)
+    {
+        glm::vec3 position((rand() % 400) / 100.0f - 2.0f, (rand() % 400) / 100.0f - 2.0f, (rand() % 400) / 100.0f - 2.0f);
+        glm::vec3 color((rand() % 10) / 25.0f + 0.2f, (rand() % 10) / 25.0f + 0.2f, (rand() % 10) / 25.0f + 0.2f);
+        // Fade out to 2 / 256 of the brightest channel at the range
+        float brightest = 2.0f * std::max(std::max(color.x, color.y), color.z);
+        glm::vec3 att(1.0f, 0.0f, ((256.0f / 2.0f) * brightest - 1.0f) / (range * range));
+        lights.push_back(makeLight(position, att, glm::vec3(0.0f), color, color));
+    }
+
+    JobPool pool;
+    ClusteredLights* clusters = new ClusteredLights(16, 8, 24, 1 << 18, &pool);
+    clusters->setLights(lights);
+
     int w, h;
     GLuint diffuse = loadImage("diffuseCube.png", &w, &h, 0, false);
     if(!diffuse)
@@ -238,6 +266,10 @@ int main(void)
 
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 
+    double clusterTime = 0.0;
+    long long frames = 0, lightIndices = 0, visibleLights = 0;
+    int maxPerCluster = 0;
+
     // Fill the Projection matrix in the P/V ubo
     glBindBuffer(GL_UNIFORM_BUFFER, ubo);
     glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(glm::mat4), glm::value_ptr(camera.getProjection()));
@@ -262,6 +294,15 @@ int main(void)
 
         glUseProgram(program);
 
+        clusters->update(&camera);
+        clusters->bind(program, 2);
+        const ClusterStats& stats = clusters->getStats();
+        clusterTime += stats.duration;
+        lightIndices += stats.indices;
+        visibleLights += stats.visibleLights;
+        maxPerCluster = std::max(maxPerCluster, stats.maxPerCluster);
+        frames++;
+
         glUniform3fv(glGetUniformLocation(program, "eye"), 1, glm::value_ptr(camera.getPosition()));
         glUniformMatrix4fv(glGetUniformLocation(program, "model"), 1, GL_FALSE, glm::value_ptr(model));
         glDrawArrays(GL_TRIANGLES, 0, 36);
@@ -272,13 +313,23 @@ int main(void)
         glfwPollEvents();
     }
 
+    if(frames > 0)
+    {
+        std::cout << visibleLights / frames << " of " << numLights << " lights visible per frame, "
+            << (double)lightIndices / frames / clusters->getNumClusters() << " per cluster on average, " << maxPerCluster << " at most, "
+            << clusterTime / frames << " ms to assign them on " << pool.getNumThreads() << " threads, "
+            << clusters->getGpuBytes() / 1024 << " KB of buffers" << std::endl;
+    }
+
     // Clean up
     glDeleteBuffers(1, &vbo);
     glDeleteBuffers(1, &ubo);
+    glDeleteBuffers(1, &lightUbo);
     glDeleteVertexArrays(1, &vao);
     glDeleteTextures(1, &diffuse);
     glDeleteTextures(1, &specular);
     glDeleteProgram(program);
+    delete clusters;
 
     glfwTerminate();
     return 0;
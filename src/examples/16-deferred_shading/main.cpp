@@ -1,6 +1,10 @@
 #include "../common/util.h"
 #include "../common/shader.h"
+#include "../common/programcache.h"
+#include "../common/texturecache.h"
 #include "../common/camera.h"
+#include "../common/clusteredlights.h"
+#include "../common/instancetransform.h"
 #include "mesh.h"
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -16,7 +20,8 @@ const char* VERTEX_GEOM_SRC = "#version 330 core\n"
                               "layout(location=0) in vec3 position;"
                               "layout(location=1) in vec3 normal;"
                               "layout(location=2) in vec2 texCoord;"
-                              "layout(location=3) in mat4 model_inst;"
+                              "layout(location=3) in vec4 inst_position_scale;"
+                              "layout(location=4) in vec4 inst_rotation;"
                               "uniform mat4 view;"
                               "uniform mat4 projection;"
                               "uniform float specularPower;"
@@ -24,12 +29,14 @@ const char* VERTEX_GEOM_SRC = "#version 330 core\n"
                               "out vec3 fNormal;"
                               "out vec2 fTexCoord;"
                               "out float fSpecularPower;"
+                              INSTANCE_TRANSFORM_GLSL
                               "void main()"
                               "{"
-                              "    vec4 wP = model_inst * vec4(position, 1.0);"
-                              "    fPosition = wP.xyz;"
-                              "    gl_Position = projection * view * wP;"
-                              "    fNormal = transpose(inverse(mat3(model_inst))) * normal;"
+                              "    vec3 wP = instanceTransform(inst_position_scale, inst_rotation, position);"
+                              "    fPosition = wP;"
+                              "    gl_Position = projection * view * vec4(wP, 1.0);"
+                              // The scale is uniform, so the rotation alone turns the normals
+                              "    fNormal = instanceRotate(inst_rotation, normal);"
                               "    fTexCoord = texCoord;"
                               "    fSpecularPower = specularPower;"
                               "}";
@@ -64,17 +71,9 @@ const char* VERTEX_LIGHT_SRC = "#version 330 core\n"
                                "}";
 
 const char* FRAGMENT_LIGHT_SRC = "#version 330 core\n"
-                                 "#define NUM_POINT_LIGHTS 32\n"
-                                 "struct PointLight"
-                                 "{"
-                                 "    vec3 position;"
-                                 "    vec3 att;" // x = constant, y = linear, z = quadratic
-                                 "    vec3 ambient;"
-                                 "    vec3 diffuse;"
-                                 "    vec3 specular;"
-                                 "};"
                                  "in vec2 fTexCoord;"
-                                 "uniform PointLight lights[NUM_POINT_LIGHTS];"
+                                 // Every pixel only shades the lights of its cluster, see ../common/clusteredlights.h
+                                 CLUSTERED_LIGHTS_GLSL
                                  "uniform vec3 eye;"
                                  "uniform sampler2D g_position;"
                                  "uniform sampler2D g_normal_spec_pow;"
@@ -101,9 +100,10 @@ const char* FRAGMENT_LIGHT_SRC = "#version 330 core\n"
                                  "    float specular = texture(g_albedo_spec, fTexCoord).a;"
                                  "    vec3 eyeDir = normalize(eye - fPosition);"
                                  "    vec3 result = vec3(0.0);"
-                                 "    for(int i = 0; i < NUM_POINT_LIGHTS; ++i)"
+                                 "    uvec2 range = clusterRange(fPosition);"
+                                 "    for(uint i = 0u; i < range.y; ++i)"
                                  "    {"
-                                 "       result += pointLight(lights[i], fNormal, fPosition, eyeDir, albedo, specular, specularPower);"
+                                 "       result += pointLight(clusterLight(range, i), fNormal, fPosition, eyeDir, albedo, specular, specularPower);"
                                  "    }"
                                  "    outputColor = vec4(result, 1.0);"
                                  "}";
@@ -188,37 +188,7 @@ struct GBuffer
     GLuint buffer, position, normal, color, depth;
 };
 
-struct PointLight
-{
-    void set(const glm::vec3& position, const glm::vec3& att, const glm::vec3& ambient,
-            const glm::vec3& diffuse, const glm::vec3& specular)
-    {
-        this->position = position;
-        this->att = att;
-        this->ambient = ambient;
-        this->diffuse = diffuse;
-        this->specular = specular;
-    };
-
-    void setUniforms(int index, GLuint program)
-    {
-        std::string array = "lights[" + std::to_string(index) + "].";
-        glUniform3fv(glGetUniformLocation(program, (array + "position").c_str()), 1, glm::value_ptr(position));
-        glUniform3fv(glGetUniformLocation(program, (array + "att").c_str()), 1, glm::value_ptr(att));
-        glUniform3fv(glGetUniformLocation(program, (array + "ambient").c_str()), 1, glm::value_ptr(ambient));
-        glUniform3fv(glGetUniformLocation(program, (array + "diffuse").c_str()), 1, glm::value_ptr(diffuse));
-        glUniform3fv(glGetUniformLocation(program, (array + "specular").c_str()), 1, glm::value_ptr(specular));
-    };
-
-private:
-    glm::vec3 position;
-    glm::vec3 att;
-    glm::vec3 ambient;
-    glm::vec3 diffuse;
-    glm::vec3 specular;
-};
-
-int main(void)
+int main(int argc, char** argv)
 {
     GLFWwindow* window;
     window = init("Deferred Shading", WIDTH / 2, HEIGHT / 2);
@@ -234,31 +204,16 @@ int main(void)
     Camera camera(CAMERA_PERSPECTIVE, 45.0f, 0.1f, 1000.0f, (float)WIDTH, (float)HEIGHT);
     setCamera(&camera);
 
-    GLuint geomProgram, lightProgram;
+    // Linked programs are cached on disk, see ../common/programcache.h
+    // Geometry pass program
+    GLuint geomProgram = createCachedProgram(VERTEX_GEOM_SRC, FRAGMENT_GEOM_SRC);
+    // Light pass program
+    GLuint lightProgram = createCachedProgram(VERTEX_LIGHT_SRC, FRAGMENT_LIGHT_SRC);
+    if(!geomProgram || !lightProgram)
     {
-        // Geometry pass program
-        GLuint vertex = createShader(VERTEX_GEOM_SRC, GL_VERTEX_SHADER);
-        GLuint fragment = createShader(FRAGMENT_GEOM_SRC, GL_FRAGMENT_SHADER);
-        geomProgram = createShaderProgram(vertex, fragment);
-        linkShader(geomProgram);
-        validateShader(geomProgram);
-        glDetachShader(geomProgram, vertex);
-        glDeleteShader(vertex);
-        glDetachShader(geomProgram, fragment);
-        glDeleteShader(fragment);
-    }
-    {
-        // Light pass program
-        GLuint vertex = createShader(VERTEX_LIGHT_SRC, GL_VERTEX_SHADER);
-        GLuint fragment = createShader(FRAGMENT_LIGHT_SRC, GL_FRAGMENT_SHADER);
-        lightProgram = createShaderProgram(vertex, fragment);
-        linkShader(lightProgram);
-        validateShader(lightProgram);
-        glDetachShader(lightProgram, vertex);
-        glDeleteShader(vertex);
-        glDetachShader(lightProgram, fragment);
-        glDeleteShader(fragment);
+        return -1;
     }
+    printProgramCacheStats();
 
     // Create quad VAO
     GLuint vao;
@@ -304,19 +259,22 @@ int main(void)
     // Load the diffuse and specular texture
     // TODO: seperate specular texture
     glUseProgram(geomProgram);
+    // Both are the same image, the cache makes sure it is only loaded once
+    TextureCache textures;
     int w, h;
-    GLuint textureDiff = loadImage("asteroid.png", &w, &h, 0, false); // GL_TEXTURE0
+    GLuint textureDiff = textures.acquire("asteroid.png", &w, &h, 0, false); // GL_TEXTURE0
     if(!textureDiff)
     {
         return -1;
     }
     glUniform1i(glGetUniformLocation(geomProgram, "diffuse"), 0); // GL_TEXTURE0
-    GLuint textureSpec = loadImage("asteroid.png", &w, &h, 1, false); // GL_TEXTURE1
+    GLuint textureSpec = textures.acquire("asteroid.png", &w, &h, 1, false); // GL_TEXTURE1
     if(!textureSpec)
     {
         return -1;
     }
     glUniform1i(glGetUniformLocation(geomProgram, "specular"), 1); // GL_TEXTURE1
+    textures.printStats();
 
     Mesh mesh;
     if(!mesh.load("asteroid.obj"))
@@ -326,31 +284,32 @@ int main(void)
     }
 
     // Set random positions for the asteroids
-    std::vector<glm::mat4> models;
-    models.resize(NUM_ASTEROIDS);
+    std::vector<InstanceTransform> instances;
+    instances.resize(NUM_ASTEROIDS);
     srand(SEED);
     for(int i = 0; i < NUM_ASTEROIDS; ++i)
     {
-        glm::mat4 model;
-
         // Translate
-        model = glm::translate(model, glm::vec3(rand() % 100 - 50.0f, rand() % 100 - 50.0f, rand() % 100));
+        glm::vec3 position(rand() % 100 - 50.0f, rand() % 100 - 50.0f, rand() % 100);
 
         // Scale
         float scale = (rand() % 200) / 100.0f + 0.1f;
-        model = glm::scale(model, glm::vec3(scale, scale, scale));
 
         // Rotate
-        model = glm::rotate(model, glm::radians((float)(rand() % 100)), glm::vec3(1.0f, 1.0f, 1.0f));
+        glm::quat rotation = glm::angleAxis(glm::radians((float)(rand() % 100)), glm::normalize(glm::vec3(1.0f, 1.0f, 1.0f)));
 
-        models[i] = model;
+        instances[i] = makeInstanceTransform(position, scale, rotation);
     }
 
-    mesh.setInstances(NUM_ASTEROIDS, models);
+    mesh.setInstances(NUM_ASTEROIDS, instances);
 
-    // Set positions and more for the lights
-    PointLight lights[NUM_POINT_LIGHTS];
-    for(int i = 0; i < NUM_POINT_LIGHTS; ++i)
+    // Set positions and more for the lights.
+    // Give the number of lights (./16-deferred_shading.out 4000) to try more of them, they get smaller
+    // as there are more, so about as many of them light every asteroid
+    int numLights = argc > 1 ? std::max(atoi(argv[1]), 1) : NUM_POINT_LIGHTS;
+    float shrink = std::cbrt((float)numLights / NUM_POINT_LIGHTS);
+    std::vector<ClusterLight> lights(numLights);
+    for(int i = 0; i < numLights; ++i)
     {
         float x, y, z;
         x = rand() % 100 - 50.0f;
@@ -364,13 +323,19 @@ int main(void)
 
         float con, lin, qua;
         con = 1.0f;
-        lin = 0.09f;
-        qua = 0.032f;
+        lin = 0.09f * shrink;
+        qua = 0.032f * shrink * shrink;
 
-        lights[i].set(glm::vec3(x, y, z), glm::vec3(con, lin, qua), glm::vec3(r, g, b),
-                glm::vec3(r, g, b), glm::vec3(r, g, b));
+        ClusterLight light = { glm::vec3(x, y, z), glm::vec3(con, lin, qua), glm::vec3(r, g, b),
+                glm::vec3(r, g, b), glm::vec3(r, g, b) };
+        lights[i] = light;
     }
 
+    // The lights are sorted into clusters of the view every frame, on a job pool
+    JobPool pool;
+    ClusteredLights* clusters = new ClusteredLights(16, 8, 24, 1 << 20, &pool);
+    clusters->setLights(lights);
+
     GBuffer gBuffer;
 
     glUseProgram(lightProgram);
@@ -386,6 +351,10 @@ int main(void)
 
     glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
 
+    double clusterTime = 0.0;
+    long long frames = 0, lightIndices = 0, visibleLights = 0;
+    int maxPerCluster = 0;
+
     while(!glfwWindowShouldClose(window))
     {
         if(glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
@@ -422,10 +391,14 @@ int main(void)
         glActiveTexture(GL_TEXTURE2);
         glBindTexture(GL_TEXTURE_2D, gBuffer.color);
         glUniform3fv(glGetUniformLocation(lightProgram, "eye"), 1, glm::value_ptr(camera.getPosition()));
-        for(int i = 0; i < NUM_POINT_LIGHTS; ++i)
-        {
-            lights[i].setUniforms(i, lightProgram);
-        }
+        clusters->update(&camera);
+        clusters->bind(lightProgram, 3);
+        const ClusterStats& stats = clusters->getStats();
+        clusterTime += stats.duration;
+        lightIndices += stats.indices;
+        visibleLights += stats.visibleLights;
+        maxPerCluster = std::max(maxPerCluster, stats.maxPerCluster);
+        frames++;
         glBindVertexArray(vao);
         glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
         glBindVertexArray(0);
@@ -434,9 +407,18 @@ int main(void)
         glfwPollEvents();
     }
 
+    if(frames > 0)
+    {
+        std::cout << visibleLights / frames << " of " << numLights << " lights visible per frame, "
+            << (double)lightIndices / frames / clusters->getNumClusters() << " per cluster on average, " << maxPerCluster << " at most, "
+            << clusterTime / frames << " ms to assign them on " << pool.getNumThreads() << " threads, "
+            << clusters->getGpuBytes() / 1024 << " KB of buffers" << std::endl;
+    }
+
     // Clean up
-    glDeleteTextures(1, &textureDiff);
-    glDeleteTextures(1, &textureSpec);
+    delete clusters;
+    textures.release(textureDiff);
+    textures.release(textureSpec);
     glDeleteProgram(geomProgram);
     glDeleteProgram(lightProgram);
     glDeleteVertexArrays(1, &vao);
@@ -1,12 +1,16 @@
 #include "mesh.h"
+#include "../common/meshfile.h"
+#include "../common/meshoptimizer.h"
 #include <glm/gtc/matrix_transform.hpp>
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
+#include <chrono>
+#include <string>
 #include <vector>
 
 Mesh::Mesh()
-    : numMeshes(1)
+    : numMeshes(1), vao(0)
 {
 }
 
@@ -18,14 +22,22 @@ Mesh::~Mesh()
     }
 }
 
-bool Mesh::load(const char* fileName)
+// position (x, y, z), normal (x, y, z) and texture coordinates (u, v): 8 floats per vertex
+static const VertexLayout LAYOUT =
 {
-    if(vao)
+    8 * sizeof(GLfloat), 3,
     {
-        // Already loaded
-        return false;
+        { 0, 3, GL_FLOAT, GL_FALSE, 0 },                    // position
+        { 1, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat) },  // normal
+        { 2, 2, GL_FLOAT, GL_FALSE, 6 * sizeof(GLfloat) }   // texture coordinates
     }
+};
 
+/**
+ * Import a mesh with Assimp and write it to a binary mesh file
+ */
+static bool convert(const char* fileName, const char* meshFileName)
+{
     Assimp::Importer importer; 
     const aiScene* scene = importer.ReadFile(fileName,
             aiProcess_Triangulate |
@@ -38,10 +50,12 @@ bool Mesh::load(const char* fileName)
     }
 
     // We only load the first mesh from the Assimp scene here
+    const aiMesh* mesh = scene->mMeshes[0];
     std::vector<float> vertices;
     std::vector<GLuint> indices;
-    const aiMesh* mesh = scene->mMeshes[0];
-    for(int  i = 0; i < mesh->mNumVertices; ++i)
+    vertices.reserve(mesh->mNumVertices * 8);
+    indices.reserve(mesh->mNumFaces * 3);
+    for(unsigned int i = 0; i < mesh->mNumVertices; ++i)
     {
         const aiVector3D* pos = &(mesh->mVertices[i]);
         const aiVector3D* texCoord = &(mesh->mTextureCoords[0][i]);
@@ -56,78 +70,82 @@ bool Mesh::load(const char* fileName)
         vertices.push_back(texCoord->x);
         vertices.push_back(texCoord->y);
     }
-    for(int i = 0; i < mesh->mNumFaces; ++i)
+    for(unsigned int i = 0; i < mesh->mNumFaces; ++i)
     {
         const aiFace* face = &(mesh->mFaces[i]);
         indices.push_back(face->mIndices[0]);
         indices.push_back(face->mIndices[1]);
         indices.push_back(face->mIndices[2]);
     }
-    numIndices = indices.size();
 
-    glGenVertexArrays(1, &vao);
-    glBindVertexArray(vao);
+    // Reorder for the post-transform cache and overdraw once, at conversion time
+    size_t numVertices = optimizeMesh(fileName, &vertices[0], 8 * sizeof(GLfloat), mesh->mNumVertices,
+            &indices[0], indices.size(), true);
 
-    GLuint vbo;
-    glGenBuffers(1, &vbo);
+    MeshData data = { &vertices[0], (GLuint)numVertices, &indices[0], (GLuint)indices.size() };
+    return writeMeshFile(meshFileName, fileName, LAYOUT, std::vector<MeshData>(1, data));
+}
 
-    GLuint ebo;
-    glGenBuffers(1, &ebo);
+bool Mesh::load(const char* fileName)
+{
+    if(vao)
+    {
+        // Already loaded
+        return false;
+    }
 
-    // Upload the vertices to the buffer
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * vertices.size(), &vertices[0], GL_STATIC_DRAW);
+    // Importing with Assimp is slow, so the first run converts the mesh to
+    // a binary mesh file that later runs map and upload directly (see ../common/meshfile.h)
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::string meshFileName = std::string(fileName) + ".mesh";
+    MeshFile file;
+    bool converted = false;
+    if(!file.open(meshFileName.c_str(), fileName, LAYOUT))
+    {
+        if(!convert(fileName, meshFileName.c_str()) || !file.open(meshFileName.c_str(), fileName, LAYOUT))
+        {
+            return false;
+        }
+        converted = true;
+    }
+    numIndices = file.getNumIndices(0);
+    indexType = file.getIndexType(0);
 
-    // Upload the indices to the buffer
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * indices.size(), &indices[0], GL_STATIC_DRAW);
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
 
-    glEnableVertexAttribArray(0); // position
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat), 0);
-    glEnableVertexAttribArray(1); // normal
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat), (void*)(3 * sizeof(GLfloat)));
-    glEnableVertexAttribArray(2); // texture coordinates
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat), (void*)(6 * sizeof(GLfloat)));
+    // Upload the vertices and indices to new buffers straight from the file,
+    // and enable the vertex attributes (see: layout(location=x))
+    GLuint vbo, ebo;
+    file.upload(0, &vbo, &ebo);
 
     // We have now successfully created a drawable Vertex Array Object
     glBindVertexArray(0);
-    // We no longer need the buffers
+    // We no longer need vbo and ebo
     glDeleteBuffers(1, &vbo);
     glDeleteBuffers(1, &ebo);
 
+    std::chrono::duration<double, std::milli> duration = std::chrono::steady_clock::now() - start;
+    std::cout << (converted ? "Converted " : "Mapped ") << fileName << " in " << duration.count() << " ms" << std::endl;
     return true;
 }
 
-void Mesh::setInstances(int numMeshes, std::vector<glm::mat4> models)
+void Mesh::setInstances(int numMeshes, std::vector<InstanceTransform> instances)
 {
     this->numMeshes = numMeshes;
 
     glBindVertexArray(vao);
 
-    // Create a buffer for the model matrices
+    // Create a buffer for the instance transforms
     GLuint mbo;
     glGenBuffers(1, &mbo);
     glBindBuffer(GL_ARRAY_BUFFER, mbo);
-    // Send all the model matrices to the GPU
-    glBufferData(GL_ARRAY_BUFFER, numMeshes * sizeof(glm::mat4), &models[0], GL_STATIC_DRAW);
-    // If you look at the shader, you will see "layout(location=3) in mat4 model_inst"
-    // OpenGL only allows a maximum of vec4 passing through glVertexAttribPointer,
-    // so we have to pass 4 vec4s to pass a matrix
-    glEnableVertexAttribArray(3);
-    glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)0);
-    glEnableVertexAttribArray(4); 
-    glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(sizeof(glm::vec4)));
-    glEnableVertexAttribArray(5); 
-    glVertexAttribPointer(5, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(2 * sizeof(glm::vec4)));
-    glEnableVertexAttribArray(6); 
-    glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(3 * sizeof(glm::vec4)));
-    
-    // Update the matrix (3, 4, , 65) for every 1 instance
-    glVertexAttribDivisor(3, 1);
-    glVertexAttribDivisor(4, 1);                                          
-    glVertexAttribDivisor(5, 1);
-    glVertexAttribDivisor(6, 1);
-    
+    // Send all the instance transforms to the GPU
+    glBufferData(GL_ARRAY_BUFFER, numMeshes * sizeof(InstanceTransform), &instances[0], GL_STATIC_DRAW);
+    // If you look at the shader, you will see "layout(location=3) in vec4 inst_position_scale"
+    // and "layout(location=4) in vec4 inst_rotation", updated for every 1 instance
+    setInstanceTransformLayout(3, 0);
+
     glBindVertexArray(0);
     glDeleteBuffers(1, &mbo);
 }
@@ -135,6 +153,6 @@ void Mesh::setInstances(int numMeshes, std::vector<glm::mat4> models)
 void Mesh::render()
 {
     glBindVertexArray(vao);
-    glDrawElementsInstanced(GL_TRIANGLES, numIndices, GL_UNSIGNED_INT, 0, numMeshes);
+    glDrawElementsInstanced(GL_TRIANGLES, numIndices, indexType, 0, numMeshes);
     glBindVertexArray(0);
 }
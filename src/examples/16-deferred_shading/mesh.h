@@ -2,6 +2,7 @@
 #define MESH_HEADER
 
 #include "../common/util.h"
+#include "../common/instancetransform.h"
 #include <glm/glm.hpp>
 #include <vector>
 
@@ -12,11 +13,12 @@ public:
     ~Mesh();
 
     bool load(const char* fileName);
-    void setInstances(int numMeshes, std::vector<glm::mat4> models);
+    void setInstances(int numMeshes, std::vector<InstanceTransform> instances);
 
     void render();
 private:
     int numIndices, numMeshes;
+    GLenum indexType;
     GLuint vao;
 };
 
@@ -1,5 +1,7 @@
 #include "../common/util.h"
 #include "../common/shader.h"
+#include "../common/programcache.h"
+#include "../common/texturecache.h"
 #include "../common/camera.h"
 #include "mesh.h"
 #include <glm/glm.hpp>
@@ -248,43 +250,18 @@ int main(void)
     Camera camera(CAMERA_PERSPECTIVE, 45.0f, 0.1f, 1000.0f, (float)WIDTH, (float)HEIGHT);
     setCamera(&camera);
 
-    GLuint geomProgram, lightProgram, hdrProgram;
+    // Linked programs are cached on disk, see ../common/programcache.h
+    // Geometry pass program
+    GLuint geomProgram = createCachedProgram(VERTEX_GEOM_SRC, FRAGMENT_GEOM_SRC);
+    // Light pass program
+    GLuint lightProgram = createCachedProgram(VERTEX_LIGHT_SRC, FRAGMENT_LIGHT_SRC);
+    // HDR program
+    GLuint hdrProgram = createCachedProgram(VERTEX_HDR_SRC, FRAGMENT_HDR_SRC);
+    if(!geomProgram || !lightProgram || !hdrProgram)
     {
-        // Geometry pass program
-        GLuint vertex = createShader(VERTEX_GEOM_SRC, GL_VERTEX_SHADER);
-        GLuint fragment = createShader(FRAGMENT_GEOM_SRC, GL_FRAGMENT_SHADER);
-        geomProgram = createShaderProgram(vertex, fragment);
-        linkShader(geomProgram);
-        validateShader(geomProgram);
-        glDetachShader(geomProgram, vertex);
-        glDeleteShader(vertex);
-        glDetachShader(geomProgram, fragment);
-        glDeleteShader(fragment);
-    }
-    {
-        // Light pass program
-        GLuint vertex = createShader(VERTEX_LIGHT_SRC, GL_VERTEX_SHADER);
-        GLuint fragment = createShader(FRAGMENT_LIGHT_SRC, GL_FRAGMENT_SHADER);
-        lightProgram = createShaderProgram(vertex, fragment);
-        linkShader(lightProgram);
-        validateShader(lightProgram);
-        glDetachShader(lightProgram, vertex);
-        glDeleteShader(vertex);
-        glDetachShader(lightProgram, fragment);
-        glDeleteShader(fragment);
-    }
-    {
-        // HDR program
-        GLuint vertex = createShader(VERTEX_HDR_SRC, GL_VERTEX_SHADER);
-        GLuint fragment = createShader(FRAGMENT_HDR_SRC, GL_FRAGMENT_SHADER);
-        hdrProgram = createShaderProgram(vertex, fragment);
-        linkShader(hdrProgram);
-        validateShader(hdrProgram);
-        glDetachShader(hdrProgram, vertex);
-        glDeleteShader(vertex);
-        glDetachShader(hdrProgram, fragment);
-        glDeleteShader(fragment);
+        return -1;
     }
+    printProgramCacheStats();
 
     // Create quad VAO
     GLuint vao;
@@ -329,19 +306,22 @@ int main(void)
 
     // Load the diffuse and specular texture
     glUseProgram(geomProgram);
+    // Both are the same image, the cache makes sure it is only loaded once
+    TextureCache textures;
     int w, h;
-    GLuint textureDiff = loadImage("asteroid.png", &w, &h, 0, false); // GL_TEXTURE0
+    GLuint textureDiff = textures.acquire("asteroid.png", &w, &h, 0, false); // GL_TEXTURE0
     if(!textureDiff)
     {
         return -1;
     }
     glUniform1i(glGetUniformLocation(geomProgram, "diffuse"), 0); // GL_TEXTURE0
-    GLuint textureSpec = loadImage("asteroid.png", &w, &h, 1, false); // GL_TEXTURE1
+    GLuint textureSpec = textures.acquire("asteroid.png", &w, &h, 1, false); // GL_TEXTURE1
     if(!textureSpec)
     {
         return -1;
     }
     glUniform1i(glGetUniformLocation(geomProgram, "specular"), 1); // GL_TEXTURE1
+    textures.printStats();
 
     Mesh mesh;
     if(!mesh.load("asteroid.obj"))
@@ -508,8 +488,8 @@ int main(void)
     }
 
     // Clean up
-    glDeleteTextures(1, &textureDiff);
-    glDeleteTextures(1, &textureSpec);
+    textures.release(textureDiff);
+    textures.release(textureSpec);
     glDeleteProgram(geomProgram);
     glDeleteProgram(lightProgram);
     glDeleteVertexArrays(1, &vao);
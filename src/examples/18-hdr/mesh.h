@@ -17,6 +17,7 @@ public:
     void render();
 private:
     int numIndices, numMeshes;
+    GLenum indexType;
     GLuint vao;
 };
 
@@ -1,5 +1,6 @@
 #include "../common/util.h"
 #include "../common/shader.h"
+#include "../common/programcache.h"
 #include "../common/camera.h"
 #include "util.h"
 #include <glm/glm.hpp>
@@ -166,43 +167,15 @@ int main(void)
     camera.setPosition(0.0f, 1.0f, 0.0f);
     setCamera(&camera);
 
-    GLuint zPassProgram, lightPassProgram, shadowProgram;
-    { // zPassProgram
-        GLuint vertex = createShader(VERTEX_Z_PASS_SRC, GL_VERTEX_SHADER);
-        GLuint fragment = createShader(FRAGMENT_Z_PASS_SRC, GL_FRAGMENT_SHADER);
-        zPassProgram = createShaderProgram(vertex, fragment);
-        linkShader(zPassProgram);
-        validateShader(zPassProgram);
-        glDetachShader(zPassProgram, vertex);
-        glDeleteShader(vertex);
-        glDetachShader(zPassProgram, fragment);
-        glDeleteShader(fragment);
-    }
-    { // lightPassProgram
-        GLuint vertex = createShader(VERTEX_LIGHT_SRC, GL_VERTEX_SHADER);
-        GLuint fragment = createShader(FRAGMENT_LIGHT_SRC, GL_FRAGMENT_SHADER);
-        lightPassProgram = createShaderProgram(vertex, fragment);
-        linkShader(lightPassProgram);
-        validateShader(lightPassProgram);
-        glDetachShader(lightPassProgram, vertex);
-        glDeleteShader(vertex);
-        glDetachShader(lightPassProgram, fragment);
-        glDeleteShader(fragment);
-    }
-    { // shadowProgram
-        GLuint vertex = createShader(VERTEX_SHADOW_SRC, GL_VERTEX_SHADER);
-        GLuint fragment = createShader(FRAGMENT_SHADOW_SRC, GL_FRAGMENT_SHADER);
-        GLuint geometry = createShader(GEOM_SHADOW_SRC, GL_GEOMETRY_SHADER);
-        shadowProgram = createShaderProgram(vertex, geometry, fragment);
-        linkShader(shadowProgram);
-        validateShader(shadowProgram);
-        glDetachShader(shadowProgram, vertex);
-        glDeleteShader(vertex);
-        glDetachShader(shadowProgram, geometry);
-        glDeleteShader(geometry);
-        glDetachShader(shadowProgram, fragment);
-        glDeleteShader(fragment);
+    // Linked programs are cached on disk, see ../common/programcache.h
+    GLuint zPassProgram = createCachedProgram(VERTEX_Z_PASS_SRC, FRAGMENT_Z_PASS_SRC);
+    GLuint lightPassProgram = createCachedProgram(VERTEX_LIGHT_SRC, FRAGMENT_LIGHT_SRC);
+    GLuint shadowProgram = createCachedProgram(VERTEX_SHADOW_SRC, GEOM_SHADOW_SRC, FRAGMENT_SHADOW_SRC);
+    if(!zPassProgram || !lightPassProgram || !shadowProgram)
+    {
+        return -1;
     }
+    printProgramCacheStats();
 
     GLuint vao;
     glGenVertexArrays(1, &vao);
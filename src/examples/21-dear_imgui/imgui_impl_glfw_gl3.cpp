@@ -10,6 +10,7 @@
 #include "imgui_impl_glfw_gl3.h"
 
 #include "../common/util.h" // [*] GLFW includes
+#include "../common/streambuffer.h" // [*] Stream buffer
 
 // Data
 static GLFWwindow*  g_Window = NULL;
@@ -20,7 +21,10 @@ static GLuint       g_FontTexture = 0;
 static int          g_ShaderHandle = 0, g_VertHandle = 0, g_FragHandle = 0;
 static int          g_AttribLocationTex = 0, g_AttribLocationProjMtx = 0;
 static int          g_AttribLocationPosition = 0, g_AttribLocationUV = 0, g_AttribLocationColor = 0;
-static unsigned int g_VboHandle = 0, g_VaoHandle = 0, g_ElementsHandle = 0;
+static unsigned int g_VaoHandle = 0;
+static StreamBuffer* g_Stream = NULL; // [*] Vertices and indices go through a ring instead of two buffers
+
+#define OFFSETOF(TYPE, ELEMENT) ((size_t)&(((TYPE *)0)->ELEMENT))
 
 // This is the main rendering function that you have to implement and provide to ImGui (via setting up 'RenderDrawListsFn' in the ImGuiIO structure)
 // If text or lines are blurry when integrating ImGui in your engine:
@@ -75,13 +79,20 @@ void ImGui_ImplGlfwGL3_RenderDrawLists(ImDrawData* draw_data)
     for (int n = 0; n < draw_data->CmdListsCount; n++)
     {
         const ImDrawList* cmd_list = draw_data->CmdLists[n];
-        const ImDrawIdx* idx_buffer_offset = 0;
 
-        glBindBuffer(GL_ARRAY_BUFFER, g_VboHandle);
-        glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)cmd_list->VtxBuffer.size() * sizeof(ImDrawVert), (GLvoid*)&cmd_list->VtxBuffer.front(), GL_STREAM_DRAW);
+        // [*] Write the vertices and indices into the ring, and point the attributes at them
+        if (cmd_list->VtxBuffer.empty() || cmd_list->IdxBuffer.empty())
+            continue;
+        GLsizeiptr vtx_offset = g_Stream->write(&cmd_list->VtxBuffer.front(), (GLsizeiptr)cmd_list->VtxBuffer.size() * sizeof(ImDrawVert));
+        GLsizeiptr idx_offset = g_Stream->write(&cmd_list->IdxBuffer.front(), (GLsizeiptr)cmd_list->IdxBuffer.size() * sizeof(ImDrawIdx));
+        if (vtx_offset < 0 || idx_offset < 0)
+            continue;
+        const ImDrawIdx* idx_buffer_offset = (const ImDrawIdx*)idx_offset;
 
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g_ElementsHandle);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, (GLsizeiptr)cmd_list->IdxBuffer.size() * sizeof(ImDrawIdx), (GLvoid*)&cmd_list->IdxBuffer.front(), GL_STREAM_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, g_Stream->getBuffer());
+        glVertexAttribPointer(g_AttribLocationPosition, 2, GL_FLOAT, GL_FALSE, sizeof(ImDrawVert), (GLvoid*)(vtx_offset + OFFSETOF(ImDrawVert, pos)));
+        glVertexAttribPointer(g_AttribLocationUV, 2, GL_FLOAT, GL_FALSE, sizeof(ImDrawVert), (GLvoid*)(vtx_offset + OFFSETOF(ImDrawVert, uv)));
+        glVertexAttribPointer(g_AttribLocationColor, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(ImDrawVert), (GLvoid*)(vtx_offset + OFFSETOF(ImDrawVert, col)));
 
         for (const ImDrawCmd* pcmd = cmd_list->CmdBuffer.begin(); pcmd != cmd_list->CmdBuffer.end(); pcmd++)
         {
@@ -98,6 +109,7 @@ void ImGui_ImplGlfwGL3_RenderDrawLists(ImDrawData* draw_data)
             idx_buffer_offset += pcmd->ElemCount;
         }
     }
+    g_Stream->fence(); // [*]
 
     // Restore modified GL state
     glUseProgram(last_program);
@@ -233,22 +245,15 @@ bool ImGui_ImplGlfwGL3_CreateDeviceObjects()
     g_AttribLocationUV = glGetAttribLocation(g_ShaderHandle, "UV");
     g_AttribLocationColor = glGetAttribLocation(g_ShaderHandle, "Color");
 
-    glGenBuffers(1, &g_VboHandle);
-    glGenBuffers(1, &g_ElementsHandle);
+    g_Stream = new StreamBuffer(4 * 1024 * 1024); // [*] The attributes are pointed at it when rendering
 
     glGenVertexArrays(1, &g_VaoHandle);
     glBindVertexArray(g_VaoHandle);
-    glBindBuffer(GL_ARRAY_BUFFER, g_VboHandle);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g_Stream->getBuffer());
     glEnableVertexAttribArray(g_AttribLocationPosition);
     glEnableVertexAttribArray(g_AttribLocationUV);
     glEnableVertexAttribArray(g_AttribLocationColor);
 
-#define OFFSETOF(TYPE, ELEMENT) ((size_t)&(((TYPE *)0)->ELEMENT))
-    glVertexAttribPointer(g_AttribLocationPosition, 2, GL_FLOAT, GL_FALSE, sizeof(ImDrawVert), (GLvoid*)OFFSETOF(ImDrawVert, pos));
-    glVertexAttribPointer(g_AttribLocationUV, 2, GL_FLOAT, GL_FALSE, sizeof(ImDrawVert), (GLvoid*)OFFSETOF(ImDrawVert, uv));
-    glVertexAttribPointer(g_AttribLocationColor, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(ImDrawVert), (GLvoid*)OFFSETOF(ImDrawVert, col));
-#undef OFFSETOF
-
     ImGui_ImplGlfwGL3_CreateFontsTexture();
 
     // Restore modified GL state
@@ -262,9 +267,9 @@ bool ImGui_ImplGlfwGL3_CreateDeviceObjects()
 void    ImGui_ImplGlfwGL3_InvalidateDeviceObjects()
 {
     if (g_VaoHandle) glDeleteVertexArrays(1, &g_VaoHandle);
-    if (g_VboHandle) glDeleteBuffers(1, &g_VboHandle);
-    if (g_ElementsHandle) glDeleteBuffers(1, &g_ElementsHandle);
-    g_VaoHandle = g_VboHandle = g_ElementsHandle = 0;
+    g_VaoHandle = 0;
+    delete g_Stream; // [*]
+    g_Stream = NULL;
 
     glDetachShader(g_ShaderHandle, g_VertHandle);
     glDeleteShader(g_VertHandle);
@@ -285,6 +290,12 @@ void    ImGui_ImplGlfwGL3_InvalidateDeviceObjects()
     }
 }
 
+// [*]
+const StreamBufferStats* ImGui_ImplGlfwGL3_GetStreamStats()
+{
+    return g_Stream ? &g_Stream->getStats() : NULL;
+}
+
 bool    ImGui_ImplGlfwGL3_Init(GLFWwindow* window, bool install_callbacks)
 {
     g_Window = window;
@@ -5,6 +5,7 @@
 // https://github.com/ocornut/imgui
 
 struct GLFWwindow;
+struct StreamBufferStats; // [*]
 
 // glExamples note: IMGUI_API is defined normally in src/libs/imconfig.h
 // However, we don't need it on OS X.
@@ -19,6 +20,9 @@ IMGUI_API void        ImGui_ImplGlfwGL3_NewFrame();
 IMGUI_API void        ImGui_ImplGlfwGL3_InvalidateDeviceObjects();
 IMGUI_API bool        ImGui_ImplGlfwGL3_CreateDeviceObjects();
 
+// [*] How the vertices and indices were streamed, NULL before the first frame
+IMGUI_API const StreamBufferStats* ImGui_ImplGlfwGL3_GetStreamStats();
+
 // GLFW callbacks (installed by default if you enable 'install_callbacks' during initialization)
 // Provided here if you want to chain callbacks.
 // You can also handle inputs yourself and use those as a reference.
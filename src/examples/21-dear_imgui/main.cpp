@@ -1,5 +1,6 @@
 #include "../common/util.h"
 #include "../common/shader.h"
+#include "../common/streambuffer.h"
 #include "imgui_impl_glfw_gl3.h" // Provided by imgui
 #include "imgui/imgui.h"
 
@@ -29,6 +30,11 @@ int main(void)
         ImGui::Begin("MyWindow");
         // Create a label and a button
         ImGui::Text("Hello, ImGui!");
+        const StreamBufferStats* stats = ImGui_ImplGlfwGL3_GetStreamStats();
+        if(stats)
+        {
+            ImGui::Text("Streamed %lld KB, %lld stalls, %lld wraps", stats->bytes / 1024, stats->stalls, stats->wraps);
+        }
         if (ImGui::Button("Quit"))
         {
             break;
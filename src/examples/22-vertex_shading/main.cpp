@@ -11,6 +11,7 @@ const char* VERTEX_SRC_0 = "#version 330 core\n"
                          "layout(location=0) in vec3 position;"
                          "layout(location=1) in vec3 normal;"
                          "layout(location=2) in vec2 texcoord;"
+                         "uniform mat4 dequantize;"
                          "uniform mat4 model;"
                          "uniform mat4 view;"
                          "uniform mat4 projection;"
@@ -23,11 +24,12 @@ const char* VERTEX_SRC_0 = "#version 330 core\n"
                          "{"
                          "    fTexcoord = texcoord;"
                          "    vec3 normal_v = normalize(mat3(transpose(inverse(model))) * normal);"
-                         "    vec3 ms_position = vec3(model * vec4(position, 1.0));"
+                         "    vec4 p = dequantize * vec4(position, 1.0);"
+                         "    vec3 ms_position = vec3(model * p);"
                          "    vec3 lightDir = normalize(ms_position - lightPos);"
                          "    float diff = max(dot(normal_v, lightDir), 0.0);"
                          "    fColor = ambientLight + diff * lightColor;"
-                         "    gl_Position = projection * view * model * vec4(position, 1.0);"
+                         "    gl_Position = projection * view * model * p;"
                          "}"
                          ;
 
@@ -47,6 +49,7 @@ const char* VERTEX_SRC_1 = "#version 330 core\n"
                          "layout(location=0) in vec3 position;"
                          "layout(location=1) in vec3 normal;"
                          "layout(location=2) in vec2 texcoord;"
+                         "uniform mat4 dequantize;"
                          "uniform mat4 model;"
                          "uniform mat4 view;"
                          "uniform mat4 projection;"
@@ -57,8 +60,9 @@ const char* VERTEX_SRC_1 = "#version 330 core\n"
                          "{"
                          "    fTexcoord = texcoord;"
                          "    fNormal = normalize(mat3(transpose(inverse(model))) * normal);"
-                         "    fPosition = vec3(model * vec4(position, 1.0));"
-                         "    gl_Position = projection * view * model * vec4(position, 1.0);"
+                         "    vec4 p = dequantize * vec4(position, 1.0);"
+                         "    fPosition = vec3(model * p);"
+                         "    gl_Position = projection * view * model * p;"
                          "}"
                          ;
 
@@ -1,9 +1,6 @@
 #include "mesh.h"
+#include "../common/meshfile.h"
 #include <glm/gtc/matrix_transform.hpp>
-#include <assimp/Importer.hpp>
-#include <assimp/scene.h>
-#include <assimp/postprocess.h>
-#include <vector>
 
 Mesh::Mesh()
     : scale(1.0f, 1.0f, 1.0f), vao(0)
@@ -18,7 +15,7 @@ Mesh::~Mesh()
     }
 }
 
-bool Mesh::load(const aiMesh* mesh)
+bool Mesh::load(const MeshFile& file, GLuint mesh)
 {
     if(vao)
     {
@@ -26,54 +23,16 @@ bool Mesh::load(const aiMesh* mesh)
         return false;
     }
 
-    // We only load the first mesh from the Assimp scene here
-    std::vector<float> vertices;
-    std::vector<GLuint> indices;
-    for(int  i = 0; i < mesh->mNumVertices; ++i)
-    {
-        const aiVector3D* pos = &(mesh->mVertices[i]);
-        const aiVector3D* texCoord = &(mesh->mTextureCoords[0][i]);
-        const aiVector3D* normal = &(mesh->mNormals[i]);
-        
-        vertices.push_back(pos->x);
-        vertices.push_back(pos->y);
-        vertices.push_back(pos->z);
-        vertices.push_back(normal->x);
-        vertices.push_back(normal->y);
-        vertices.push_back(normal->z);
-        vertices.push_back(texCoord->x);
-        vertices.push_back(1.0-texCoord->y);
-    }
-    for(int i = 0; i < mesh->mNumFaces; ++i)
-    {
-        const aiFace* face = &(mesh->mFaces[i]);
-        indices.push_back(face->mIndices[0]);
-        indices.push_back(face->mIndices[1]);
-        indices.push_back(face->mIndices[2]);
-    }
-    numIndices = indices.size();
+    numIndices = file.getNumIndices(mesh);
+    indexType = file.getIndexType(mesh);
+    file.getBounds(mesh, &boundsMin, &boundsSize);
 
     glGenVertexArrays(1, &vao);
     glBindVertexArray(vao);
 
-    GLuint vbo;
-    glGenBuffers(1, &vbo);
-
-    GLuint ebo;
-    glGenBuffers(1, &ebo);
-
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * vertices.size(), &vertices[0], GL_STATIC_DRAW);
-
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * indices.size(), &indices[0], GL_STATIC_DRAW);
-
-    glEnableVertexAttribArray(0); // position
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat), 0);
-    glEnableVertexAttribArray(1); // normal
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat), (void*)(3 * sizeof(GLfloat)));
-    glEnableVertexAttribArray(2); // texture coordinates
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat), (void*)(6 * sizeof(GLfloat)));
+    // Upload straight from the mapped file and set the vertex attributes
+    GLuint vbo, ebo;
+    file.upload(mesh, &vbo, &ebo);
 
     glBindVertexArray(0);
     glDeleteBuffers(1, &vbo);
@@ -107,8 +66,16 @@ glm::mat4 Mesh::getModelMatrix()
     return m;
 }
 
+glm::mat4 Mesh::getDequantizeMatrix()
+{
+    glm::mat4 m;
+    m = glm::translate(m, boundsMin);
+    m = glm::scale(m, boundsSize);
+    return m;
+}
+
 void Mesh::render()
 {
     glBindVertexArray(vao);
-    glDrawElements(GL_TRIANGLES, numIndices, GL_UNSIGNED_INT, 0);
+    glDrawElements(GL_TRIANGLES, numIndices, indexType, 0);
 }
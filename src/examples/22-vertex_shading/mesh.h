@@ -4,7 +4,7 @@
 #include "../common/util.h"
 #include <glm/glm.hpp>
 
-struct aiMesh;
+class MeshFile;
 
 class Mesh
 {
@@ -12,7 +12,10 @@ public:
     Mesh();
     ~Mesh();
 
-    bool load(const aiMesh* aiM);
+    /**
+     * Load one of the meshes in a mesh file
+     */
+    bool load(const MeshFile& file, GLuint mesh);
 
     void setPosition(float x, float y, float z);
     void setScale(float x, float y, float z);
@@ -21,8 +24,14 @@ public:
     void render();
 
     glm::mat4 getModelMatrix();
+    /**
+     * Scales the quantized positions in the vertex buffer back to the mesh
+     */
+    glm::mat4 getDequantizeMatrix();
 private:
     int numIndices;
+    GLenum indexType;
+    glm::vec3 boundsMin, boundsSize;
     glm::vec3 position, scale, angle;
     GLuint vao;
 };
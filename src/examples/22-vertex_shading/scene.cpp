@@ -1,10 +1,15 @@
 #include "scene.h"
 #include "mesh.h"
 #include "material.h"
+#include "../common/meshfile.h"
+#include "../common/meshoptimizer.h"
+#include "../common/vertexformat.h"
 #include <glm/gtc/matrix_transform.hpp>
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
+#include <chrono>
+#include <string>
 
 Scene::Scene()
 {
@@ -19,7 +24,23 @@ Scene::~Scene()
     }
 }
 
-bool Scene::load(const char* fileName)
+// Positions are 16 bit relative to the bounding box of each mesh, normals 10 bits
+// per component and texture coordinates half floats: 16 bytes instead of 32 per vertex
+static const VertexFormat FORMAT =
+{
+    3,
+    {
+        { 0, 3, ENCODE_BOUNDS16 },    // position
+        { 1, 3, ENCODE_10_10_10_2 },  // normal
+        { 2, 2, ENCODE_HALF }         // texture coordinates
+    }
+};
+static const VertexLayout LAYOUT = getVertexLayout(FORMAT);
+
+/**
+ * Import all meshes of a scene with Assimp and write them to a binary mesh file
+ */
+static bool convert(const char* fileName, const char* meshFileName)
 {
     Assimp::Importer importer; 
     const aiScene* scene = importer.ReadFile(fileName,
@@ -32,11 +53,74 @@ bool Scene::load(const char* fileName)
         return false;
     }
 
-    for (int m = 0; m < scene->mNumMeshes; ++m) {
-        const aiMesh* aiM = scene->mMeshes[m];
+    std::vector<std::vector<float> > vertices(scene->mNumMeshes);
+    std::vector<std::vector<unsigned char> > packed(scene->mNumMeshes);
+    std::vector<std::vector<GLuint> > indices(scene->mNumMeshes);
+    std::vector<MeshData> meshes(scene->mNumMeshes);
+    for(unsigned int m = 0; m < scene->mNumMeshes; ++m)
+    {
+        const aiMesh* mesh = scene->mMeshes[m];
+        vertices[m].reserve(mesh->mNumVertices * 8);
+        indices[m].reserve(mesh->mNumFaces * 3);
+        for(unsigned int i = 0; i < mesh->mNumVertices; ++i)
+        {
+            const aiVector3D* pos = &(mesh->mVertices[i]);
+            const aiVector3D* texCoord = &(mesh->mTextureCoords[0][i]);
+            const aiVector3D* normal = &(mesh->mNormals[i]);
 
+            vertices[m].push_back(pos->x);
+            vertices[m].push_back(pos->y);
+            vertices[m].push_back(pos->z);
+            vertices[m].push_back(normal->x);
+            vertices[m].push_back(normal->y);
+            vertices[m].push_back(normal->z);
+            vertices[m].push_back(texCoord->x);
+            vertices[m].push_back(1.0-texCoord->y);
+        }
+        for(unsigned int i = 0; i < mesh->mNumFaces; ++i)
+        {
+            const aiFace* face = &(mesh->mFaces[i]);
+            indices[m].push_back(face->mIndices[0]);
+            indices[m].push_back(face->mIndices[1]);
+            indices[m].push_back(face->mIndices[2]);
+        }
+
+        // Reorder for the post-transform cache once, at conversion time
+        size_t numVertices = optimizeMesh(mesh->mName.C_Str(), &vertices[m][0], 8 * sizeof(GLfloat),
+                mesh->mNumVertices, &indices[m][0], indices[m].size(), false);
+
+        MeshData data = { NULL, (GLuint)numVertices, &indices[m][0], (GLuint)indices[m].size() };
+        packVertices(FORMAT, &vertices[m][0], numVertices, packed[m], data.boundsMin, data.boundsSize);
+        printQuantizationError(mesh->mName.C_Str(), FORMAT, &vertices[m][0], numVertices, packed[m],
+                data.boundsMin, data.boundsSize);
+        data.vertices = &packed[m][0];
+        meshes[m] = data;
+    }
+
+    return writeMeshFile(meshFileName, fileName, LAYOUT, meshes);
+}
+
+bool Scene::load(const char* fileName)
+{
+    // Importing with Assimp is slow, so the first run converts the scene to
+    // a binary mesh file that later runs map and upload directly (see ../common/meshfile.h)
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::string meshFileName = std::string(fileName) + ".mesh";
+    MeshFile file;
+    bool converted = false;
+    if(!file.open(meshFileName.c_str(), fileName, LAYOUT))
+    {
+        if(!convert(fileName, meshFileName.c_str()) || !file.open(meshFileName.c_str(), fileName, LAYOUT))
+        {
+            return false;
+        }
+        converted = true;
+    }
+
+    for(GLuint m = 0; m < file.getNumMeshes(); ++m)
+    {
         Mesh* mesh = new Mesh();
-        if (!mesh->load(aiM))
+        if (!mesh->load(file, m))
         {
             delete mesh;
             return false;
@@ -44,6 +128,8 @@ bool Scene::load(const char* fileName)
         m_meshes.push_back(mesh);
     }
 
+    std::chrono::duration<double, std::milli> duration = std::chrono::steady_clock::now() - start;
+    std::cout << (converted ? "Converted " : "Mapped ") << fileName << " in " << duration.count() << " ms" << std::endl;
     return true;
 }
 
@@ -52,6 +138,7 @@ void Scene::render(Material* mat)
     for (auto it = m_meshes.begin(); it != m_meshes.end(); ++it)
     {
         mat->setUniform("model", (*it)->getModelMatrix());
+        mat->setUniform("dequantize", (*it)->getDequantizeMatrix());
         (*it)->render();
     }
 }
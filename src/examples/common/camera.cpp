@@ -2,17 +2,10 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 Camera::Camera(CameraType type, float fov, float zNear, float zFar, float width, float height)
-    : type(type), position(0.0f, 0.0f, 0.0f), width(width), height(height), zNear(zNear), zFar(zFar), fov(fov)
+    : type(type), viewDirty(true), projectionDirty(true), version(1), position(0.0f, 0.0f, 0.0f),
+    width(width), height(height), zNear(zNear), zFar(zFar), fov(fov)
 {
     angle = glm::vec2(0.0f, 0.0f);
-    if(type == CAMERA_ORTHOGONAL)
-    {
-        projection = glm::ortho(0.0f, width, 0.0f, height);
-    }
-    else
-    {
-        projection = glm::perspective(glm::radians(fov), width / height, zNear, zFar);
-    }
 }
 
 Camera::~Camera()
@@ -21,59 +14,148 @@ Camera::~Camera()
 
 void Camera::setPosition(float x, float y, float z)
 {
-    position = glm::vec3(x, y, z);
+    glm::vec3 p(x, y, z);
+    if(p != position)
+    {
+        position = p;
+        viewDirty = true;
+        // The orthogonal projection moves with the position instead of the view
+        projectionDirty |= type == CAMERA_ORTHOGONAL;
+        version++;
+    }
 }
 
 void Camera::setFov(float fov)
 {
-    this->fov = fov;
+    if(fov != this->fov)
+    {
+        this->fov = fov;
+        projectionDirty = true;
+        version++;
+    }
 }
 
 void Camera::setZnear(float znear)
 {
-    zNear = znear;
+    if(znear != zNear)
+    {
+        zNear = znear;
+        projectionDirty = true;
+        version++;
+    }
 }
 
 void Camera::setZfar(float zfar)
 {
-    zFar = zfar;
+    if(zfar != zFar)
+    {
+        zFar = zfar;
+        projectionDirty = true;
+        version++;
+    }
 }
 
 void Camera::setHorizontalAngle(float angle)
 {
-    this->angle.x = angle;
+    if(angle != this->angle.x)
+    {
+        this->angle.x = angle;
+        viewDirty = true;
+        version++;
+    }
 }
 
 void Camera::setVerticalAngle(float angle)
 {
-    this->angle.y = angle;
+    if(angle != this->angle.y)
+    {
+        this->angle.y = angle;
+        viewDirty = true;
+        version++;
+    }
 }
 
 const glm::mat4& Camera::getView()
 {
-    // Recalculate the view matrix and return it
-    glm::vec3 direction = getDirectionVector();
-    glm::vec3 up = getUpVector();
-    view = glm::lookAt(position, position + direction, up);
+    update();
     return view;
 }
 
 const glm::mat4& Camera::getProjection()
 {
-    // Recalculate the projection matrix and return it
-    if(type == CAMERA_ORTHOGONAL)
+    update();
+    return projection;
+}
+
+const glm::mat4& Camera::getViewProjection()
+{
+    update();
+    return viewProjection;
+}
+
+const glm::mat4& Camera::getInverseView()
+{
+    update();
+    return inverseView;
+}
+
+const glm::mat4& Camera::getInverseProjection()
+{
+    update();
+    return inverseProjection;
+}
+
+const glm::mat4& Camera::getInverseViewProjection()
+{
+    update();
+    return inverseViewProjection;
+}
+
+const Frustum& Camera::getFrustum()
+{
+    update();
+    return frustum;
+}
+
+unsigned long long Camera::getVersion() const
+{
+    return version;
+}
+
+void Camera::update()
+{
+    if(!viewDirty && !projectionDirty)
     {
-        float left = position.x;
-        float right = position.x + width;
-        float bottom = position.y + height;
-        float top = position.y;
-        projection = glm::ortho(left, right, bottom, top, zNear, zFar);
+        return;
     }
-    else
+    if(viewDirty)
     {
-        projection = glm::perspective(glm::radians(fov), width / height, zNear, zFar);
+        glm::vec3 direction = getDirectionVector();
+        glm::vec3 up = getUpVector();
+        view = glm::lookAt(position, position + direction, up);
+        inverseView = glm::inverse(view);
     }
-    return projection;
+    if(projectionDirty)
+    {
+        if(type == CAMERA_ORTHOGONAL)
+        {
+            float left = position.x;
+            float right = position.x + width;
+            float bottom = position.y + height;
+            float top = position.y;
+            projection = glm::ortho(left, right, bottom, top, zNear, zFar);
+        }
+        else
+        {
+            projection = glm::perspective(glm::radians(fov), width / height, zNear, zFar);
+        }
+        inverseProjection = glm::inverse(projection);
+    }
+    viewProjection = projection * view;
+    inverseViewProjection = inverseView * inverseProjection;
+    frustum = Frustum(viewProjection);
+    viewDirty = false;
+    projectionDirty = false;
 }
 
 glm::vec3 Camera::getUpVector() const
@@ -101,6 +183,16 @@ const glm::vec3& Camera::getPosition() const
     return position;
 }
 
+float Camera::getZnear() const
+{
+    return zNear;
+}
+
+float Camera::getZfar() const
+{
+    return zFar;
+}
+
 float Camera::getHorizontalAngle() const
 {
     return angle.x;
@@ -1,6 +1,7 @@
 #ifndef CAMERA_HEADER
 #define CAMERA_HEADER
 
+#include "frustum.h"
 #include <glm/glm.hpp>
 
 enum CameraType
@@ -31,10 +32,28 @@ public:
     void setHorizontalAngle(float angle);
     void setVerticalAngle(float angle);
 
+    /**
+     * The matrices are only recalculated after the camera changed
+     */
     const glm::mat4& getView();
     const glm::mat4& getProjection();
+    const glm::mat4& getViewProjection();
+    const glm::mat4& getInverseView();
+    const glm::mat4& getInverseProjection();
+    const glm::mat4& getInverseViewProjection();
+    /**
+     * The planes of what the camera sees, for culling
+     */
+    const Frustum& getFrustum();
+    /**
+     * Goes up every time a setter changes the camera, so users can
+     * skip uploading or culling again if it is the same as last time
+     */
+    unsigned long long getVersion() const;
 
     const glm::vec3& getPosition() const;
+    float getZnear() const;
+    float getZfar() const;
     float getHorizontalAngle() const;
     float getVerticalAngle() const;
 
@@ -48,9 +67,16 @@ public:
     glm::vec3 getRightVector() const;
     glm::vec3 getUpVector() const;
 private:
+    // Recalculate what the changes since the last call affect
+    void update();
+
     CameraType type;
-    glm::mat4 projection;
-    glm::mat4 view;
+    glm::mat4 projection, inverseProjection;
+    glm::mat4 view, inverseView;
+    glm::mat4 viewProjection, inverseViewProjection;
+    Frustum frustum;
+    bool viewDirty, projectionDirty;
+    unsigned long long version;
     glm::vec3 position;
     glm::vec2 angle;
     float width, height, zNear, zFar, fov;
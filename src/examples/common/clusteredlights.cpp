@@ -0,0 +1,348 @@
+#include "clusteredlights.h"
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+// Lights per chunk when their bounds are computed on the pool
+#define LIGHTS_PER_CHUNK 256
+// Texels of a light in the light buffer
+#define LIGHT_TEXELS 5
+
+ClusteredLights::ClusteredLights(int tilesX, int tilesY, int slices, int maxIndices, JobPool* pool)
+    : tilesX(tilesX), tilesY(tilesY), slices(slices), maxIndices(maxIndices), pool(pool),
+    scaleX(1.0f), scaleY(1.0f), zNear(0.1f), zFar(1000.0f), offset(0)
+{
+    memset(&stats, 0, sizeof(stats));
+    sliceLights.resize(slices);
+    sliceHits.resize(slices);
+    sliceIndices.resize(slices);
+    counts.resize(getNumClusters());
+
+    // The buffer only exists once it was bound, before that a texture cannot use it
+    glGenBuffers(1, &lightBuffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, lightBuffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    glGenTextures(1, &lightTexture);
+    glBindTexture(GL_TEXTURE_BUFFER, lightTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, lightBuffer);
+
+    // The ranges and indices of a frame are one piece of a ring of a few frames, a texture buffer
+    // always covers the whole buffer so the shader gets told where the piece starts.
+    // The ring has to fit in the texels a texture buffer can address, which can be as few as 65536.
+    GLint maxTexels = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+    int fit = std::max(maxTexels / 3 - 2 * getNumClusters(), 0);
+    if(this->maxIndices > fit)
+    {
+        std::cerr << "A texture buffer holds " << maxTexels << " texels at most, the clusters keep " << fit
+            << " light indices per frame instead of " << this->maxIndices << std::endl;
+        this->maxIndices = fit;
+    }
+    stream = new StreamBuffer(3 * (2 * getNumClusters() + this->maxIndices) * sizeof(GLuint));
+    glGenTextures(1, &dataTexture);
+    glBindTexture(GL_TEXTURE_BUFFER, dataTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, stream->getBuffer());
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+}
+
+ClusteredLights::~ClusteredLights()
+{
+    glDeleteTextures(1, &lightTexture);
+    glDeleteTextures(1, &dataTexture);
+    glDeleteBuffers(1, &lightBuffer);
+    delete stream;
+}
+
+void ClusteredLights::setLights(const std::vector<ClusterLight>& lights)
+{
+    this->lights = lights;
+    radii.resize(lights.size());
+    std::vector<glm::vec4> texels(lights.size() * LIGHT_TEXELS);
+    for(size_t i = 0; i < lights.size(); ++i)
+    {
+        const ClusterLight& light = lights[i];
+        radii[i] = radius(light);
+        glm::vec4* t = &texels[i * LIGHT_TEXELS];
+        t[0] = glm::vec4(light.position, radii[i]);
+        t[1] = glm::vec4(light.attenuation, 0.0f);
+        t[2] = glm::vec4(light.ambient, 0.0f);
+        t[3] = glm::vec4(light.diffuse, 0.0f);
+        t[4] = glm::vec4(light.specular, 0.0f);
+    }
+
+    glBindBuffer(GL_TEXTURE_BUFFER, lightBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, texels.size() * sizeof(glm::vec4), texels.empty() ? NULL : &texels[0], GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+float ClusteredLights::radius(const ClusterLight& light)
+{
+    glm::vec3 color = light.ambient + light.diffuse + light.specular;
+    float maxComponent = std::max(std::max(color.x, color.y), color.z);
+    float constant = light.attenuation.x - (256.0f / 2.0f) * maxComponent;
+    float linear = light.attenuation.y;
+    float quadratic = light.attenuation.z;
+    if(constant >= 0.0f)
+    {
+        return 0.0f;
+    }
+    if(quadratic > 0.0f)
+    {
+        return (-linear + std::sqrt(linear * linear - 4.0f * quadratic * constant)) / (2.0f * quadratic);
+    }
+    return linear > 0.0f ? -constant / linear : FLT_MAX;
+}
+
+int ClusteredLights::sliceOf(float depth) const
+{
+    int slice = (int)std::floor(std::log(depth / zNear) / std::log(zFar / zNear) * slices);
+    return std::min(std::max(slice, 0), slices - 1);
+}
+
+void ClusteredLights::update(Camera* camera)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    view = camera->getView();
+    const glm::mat4& projection = camera->getProjection();
+    scaleX = projection[0][0];
+    scaleY = projection[1][1];
+    zNear = camera->getZnear();
+    zFar = camera->getZfar();
+
+    // First find the slices and tiles every light may touch, then let every slice test its
+    // clusters against the lights that reach into it. The slices write to their own lists,
+    // so nothing is shared between the threads.
+    int numLights = lights.size();
+    bounds.resize(numLights);
+    int numChunks = (numLights + LIGHTS_PER_CHUNK - 1) / LIGHTS_PER_CHUNK;
+    run([&](int chunk)
+    {
+        computeBounds(view, chunk * LIGHTS_PER_CHUNK, std::min((chunk + 1) * LIGHTS_PER_CHUNK, numLights));
+    }, numChunks);
+
+    for(int i = 0; i < slices; ++i)
+    {
+        sliceLights[i].clear();
+    }
+    stats.visibleLights = 0;
+    for(int i = 0; i < numLights; ++i)
+    {
+        for(int j = bounds[i].minSlice; j <= bounds[i].maxSlice; ++j)
+        {
+            sliceLights[j].push_back(i);
+        }
+        stats.visibleLights += bounds[i].minSlice <= bounds[i].maxSlice;
+    }
+
+    run([&](int slice)
+    {
+        assignSlice(slice);
+    }, slices);
+
+    // Stream the ranges of the clusters, followed by the indices in cluster order.
+    // The draws of the last frame were issued by now, so they are fenced first.
+    stream->fence();
+    int numClusters = getNumClusters();
+    int total = 0;
+    for(int i = 0; i < slices; ++i)
+    {
+        total += sliceIndices[i].size();
+    }
+    int kept = std::min(total, maxIndices);
+    GLsizeiptr bytes = (2 * numClusters + kept) * sizeof(GLuint);
+    GLsizeiptr byteOffset;
+    GLuint* data = (GLuint*)stream->map(bytes, &byteOffset, sizeof(GLuint));
+    if(!data)
+    {
+        offset = 0;
+        return;
+    }
+    offset = byteOffset / sizeof(GLuint);
+    GLuint* ranges = data;
+    GLuint* indices = data + 2 * numClusters;
+    GLuint next = offset + 2 * numClusters;
+    int written = 0;
+    stats.maxPerCluster = 0;
+    for(int i = 0; i < slices; ++i)
+    {
+        const std::vector<GLuint>& list = sliceIndices[i];
+        size_t read = 0;
+        for(int j = i * tilesX * tilesY; j < (i + 1) * tilesX * tilesY; ++j)
+        {
+            int count = std::min((int)counts[j], kept - written);
+            ranges[2 * j] = next;
+            ranges[2 * j + 1] = count;
+            std::copy(list.begin() + read, list.begin() + read + count, indices + written);
+            read += counts[j];
+            written += count;
+            next += count;
+            stats.maxPerCluster = std::max(stats.maxPerCluster, count);
+        }
+    }
+    stream->unmap(bytes);
+
+    stats.indices = written;
+    stats.dropped = total - written;
+    std::chrono::duration<double, std::milli> duration = std::chrono::steady_clock::now() - start;
+    stats.duration = duration.count();
+}
+
+void ClusteredLights::computeBounds(const glm::mat4& view, int first, int last)
+{
+    for(int i = first; i < last; ++i)
+    {
+        Bounds& b = bounds[i];
+        b.center = glm::vec3(view * glm::vec4(lights[i].position, 1.0f));
+        b.radius = radii[i];
+        b.minSlice = 1;
+        b.maxSlice = 0;
+
+        float depth = -b.center.z;
+        float nearDepth = std::max(depth - b.radius, zNear);
+        float farDepth = std::min(depth + b.radius, zFar);
+        if(nearDepth > farDepth || b.radius <= 0.0f)
+        {
+            continue;
+        }
+
+        // The box around the sphere covers the least of the screen at the far depth
+        // and the most at the near depth, or the other way around
+        float x0 = std::min((b.center.x - b.radius) / nearDepth, (b.center.x - b.radius) / farDepth) * scaleX;
+        float x1 = std::max((b.center.x + b.radius) / nearDepth, (b.center.x + b.radius) / farDepth) * scaleX;
+        float y0 = std::min((b.center.y - b.radius) / nearDepth, (b.center.y - b.radius) / farDepth) * scaleY;
+        float y1 = std::max((b.center.y + b.radius) / nearDepth, (b.center.y + b.radius) / farDepth) * scaleY;
+        if(x1 < -1.0f || x0 > 1.0f || y1 < -1.0f || y0 > 1.0f)
+        {
+            continue;
+        }
+        b.minX = std::max((int)std::floor((x0 * 0.5f + 0.5f) * tilesX), 0);
+        b.maxX = std::min((int)std::floor((x1 * 0.5f + 0.5f) * tilesX), tilesX - 1);
+        b.minY = std::max((int)std::floor((y0 * 0.5f + 0.5f) * tilesY), 0);
+        b.maxY = std::min((int)std::floor((y1 * 0.5f + 0.5f) * tilesY), tilesY - 1);
+        b.minSlice = sliceOf(nearDepth);
+        b.maxSlice = sliceOf(farDepth);
+    }
+}
+
+void ClusteredLights::assignSlice(int slice)
+{
+    // The froxels of the slice are boxes in view space, the same for every column and row
+    float nearDepth = zNear * std::pow(zFar / zNear, (float)slice / slices);
+    float farDepth = zNear * std::pow(zFar / zNear, (float)(slice + 1) / slices);
+    std::vector<glm::vec2> columns(tilesX), rows(tilesY);
+    for(int x = 0; x < tilesX; ++x)
+    {
+        float x0 = (2.0f * x / tilesX - 1.0f) / scaleX;
+        float x1 = (2.0f * (x + 1) / tilesX - 1.0f) / scaleX;
+        columns[x] = glm::vec2(std::min(x0 * nearDepth, x0 * farDepth), std::max(x1 * nearDepth, x1 * farDepth));
+    }
+    for(int y = 0; y < tilesY; ++y)
+    {
+        float y0 = (2.0f * y / tilesY - 1.0f) / scaleY;
+        float y1 = (2.0f * (y + 1) / tilesY - 1.0f) / scaleY;
+        rows[y] = glm::vec2(std::min(y0 * nearDepth, y0 * farDepth), std::max(y1 * nearDepth, y1 * farDepth));
+    }
+
+    // Every light that reaches into the slice is tested against the froxels of its tiles
+    int numTiles = tilesX * tilesY;
+    GLuint* sliceCounts = &counts[slice * numTiles];
+    std::fill(sliceCounts, sliceCounts + numTiles, 0);
+    const std::vector<int>& candidates = sliceLights[slice];
+    std::vector<Hit>& hits = sliceHits[slice];
+    hits.clear();
+    for(size_t i = 0; i < candidates.size(); ++i)
+    {
+        const Bounds& b = bounds[candidates[i]];
+        float dz = b.center.z - glm::clamp(b.center.z, -farDepth, -nearDepth);
+        float radius2 = b.radius * b.radius - dz * dz;
+        if(radius2 < 0.0f)
+        {
+            continue;
+        }
+        for(int y = b.minY; y <= b.maxY; ++y)
+        {
+            float dy = b.center.y - glm::clamp(b.center.y, rows[y].x, rows[y].y);
+            if(dy * dy > radius2)
+            {
+                continue;
+            }
+            for(int x = b.minX; x <= b.maxX; ++x)
+            {
+                float dx = b.center.x - glm::clamp(b.center.x, columns[x].x, columns[x].y);
+                if(dx * dx + dy * dy <= radius2)
+                {
+                    Hit hit = { (GLuint)(y * tilesX + x), (GLuint)candidates[i] };
+                    hits.push_back(hit);
+                    sliceCounts[hit.tile]++;
+                }
+            }
+        }
+    }
+
+    // Sort the hits by froxel, the lights stay in order within a froxel
+    std::vector<GLuint> starts(numTiles);
+    for(int i = 1; i < numTiles; ++i)
+    {
+        starts[i] = starts[i - 1] + sliceCounts[i - 1];
+    }
+    std::vector<GLuint>& list = sliceIndices[slice];
+    list.resize(hits.size());
+    for(size_t i = 0; i < hits.size(); ++i)
+    {
+        list[starts[hits[i].tile]++] = hits[i].light;
+    }
+}
+
+void ClusteredLights::run(const std::function<void(int)>& job, int numChunks)
+{
+    if(pool)
+    {
+        pool->start(job, numChunks);
+        pool->wait();
+        return;
+    }
+    for(int i = 0; i < numChunks; ++i)
+    {
+        job(i);
+    }
+}
+
+void ClusteredLights::bind(GLuint program, int firstUnit)
+{
+    glActiveTexture(GL_TEXTURE0 + firstUnit);
+    glBindTexture(GL_TEXTURE_BUFFER, lightTexture);
+    glActiveTexture(GL_TEXTURE0 + firstUnit + 1);
+    glBindTexture(GL_TEXTURE_BUFFER, dataTexture);
+
+    float logRatio = std::log(zFar / zNear);
+    glm::vec4 grid(scaleX, scaleY, slices / logRatio, -slices * std::log(zNear) / logRatio);
+    glUniform1i(glGetUniformLocation(program, "clusterLights"), firstUnit);
+    glUniform1i(glGetUniformLocation(program, "clusterData"), firstUnit + 1);
+    glUniformMatrix4fv(glGetUniformLocation(program, "clusterView"), 1, GL_FALSE, &view[0][0]);
+    glUniform4fv(glGetUniformLocation(program, "clusterGrid"), 1, &grid[0]);
+    glUniform3i(glGetUniformLocation(program, "clusterSize"), tilesX, tilesY, slices);
+    glUniform1i(glGetUniformLocation(program, "clusterOffset"), offset);
+}
+
+int ClusteredLights::getNumLights() const
+{
+    return lights.size();
+}
+
+int ClusteredLights::getNumClusters() const
+{
+    return tilesX * tilesY * slices;
+}
+
+size_t ClusteredLights::getGpuBytes() const
+{
+    return lights.size() * LIGHT_TEXELS * sizeof(glm::vec4) + 3 * (2 * getNumClusters() + maxIndices) * sizeof(GLuint);
+}
+
+const ClusterStats& ClusteredLights::getStats() const
+{
+    return stats;
+}
@@ -0,0 +1,169 @@
+#ifndef CLUSTERED_LIGHTS_HEADER
+#define CLUSTERED_LIGHTS_HEADER
+
+#include "util.h"
+#include "camera.h"
+#include "jobpool.h"
+#include "streambuffer.h"
+#include <glm/glm.hpp>
+#include <vector>
+
+/**
+ * A point light with the attenuation and colours of the Blinn-Phong examples
+ */
+struct ClusterLight
+{
+    glm::vec3 position;
+    // x = constant, y = linear, z = quadratic
+    glm::vec3 attenuation;
+    glm::vec3 ambient;
+    glm::vec3 diffuse;
+    glm::vec3 specular;
+};
+
+struct ClusterStats
+{
+    // Lights that touch at least one cluster
+    int visibleLights;
+    // Light indices in all clusters together, and in the fullest one
+    int indices, maxPerCluster;
+    // Indices that did not fit in the buffer
+    int dropped;
+    // Milliseconds to assign and upload on the CPU
+    double duration;
+};
+
+/**
+ * Clustered shading: the view of a perspective camera is cut into a grid of froxels, tiles on the screen
+ * that are sliced exponentially in depth. Every frame the lights are assigned to the froxels their
+ * spheres touch, on a job pool, and the compact lists are streamed to the GPU. A shader finds the
+ * froxel of its fragment and only loops over the lights in it, so thousands of lights cost about
+ * as much per pixel as the few that are close.
+ * The light lists are read in the shader through texture buffers, see CLUSTERED_LIGHTS_GLSL.
+ */
+class ClusteredLights
+{
+public:
+    /**
+     * @param tilesX Columns of the grid on the screen
+     * @param tilesY Rows of the grid on the screen
+     * @param slices Depth slices from the near to the far plane
+     * @param maxIndices Light indices that fit in the clusters per frame, the rest is dropped.
+     *        It is lowered, with an error, if three frames would not fit in GL_MAX_TEXTURE_BUFFER_SIZE
+     * @param pool Assigns the slices on its threads when given
+     */
+    ClusteredLights(int tilesX = 16, int tilesY = 8, int slices = 24, int maxIndices = 1 << 18, JobPool* pool = NULL);
+    ~ClusteredLights();
+
+    /**
+     * Upload the lights and compute their radii, call it again when they change
+     */
+    void setLights(const std::vector<ClusterLight>& lights);
+    /**
+     * Build the grid from the camera and assign the lights to it
+     */
+    void update(Camera* camera);
+    /**
+     * Bind the texture buffers to units firstUnit and firstUnit + 1 and set the uniforms
+     * of CLUSTERED_LIGHTS_GLSL in the program, which has to be in use
+     */
+    void bind(GLuint program, int firstUnit);
+
+    int getNumLights() const;
+    int getNumClusters() const;
+    size_t getGpuBytes() const;
+    const ClusterStats& getStats() const;
+
+    /**
+     * Distance at which the light gets darker than 2 / 256 in its brightest channel,
+     * like lightRadius() in 19-additive_lights
+     */
+    static float radius(const ClusterLight& light);
+private:
+    // Where a light is in the grid, in view space, tiles and slices
+    struct Bounds
+    {
+        glm::vec3 center;
+        float radius;
+        int minX, maxX, minY, maxY, minSlice, maxSlice;
+    };
+    // A light that touches the froxel of a tile in a slice
+    struct Hit
+    {
+        GLuint tile, light;
+    };
+
+    int sliceOf(float depth) const;
+    void computeBounds(const glm::mat4& view, int first, int last);
+    void assignSlice(int slice);
+    void run(const std::function<void(int)>& job, int numChunks);
+
+    int tilesX, tilesY, slices;
+    int maxIndices;
+    JobPool* pool;
+    std::vector<ClusterLight> lights;
+    std::vector<float> radii;
+    std::vector<Bounds> bounds;
+    // Lights that reach into a slice, and the froxels they touch
+    std::vector<std::vector<int> > sliceLights;
+    std::vector<std::vector<Hit> > sliceHits;
+    // Indices of the lights in the clusters of a slice, in cluster order, and the count of every cluster
+    std::vector<std::vector<GLuint> > sliceIndices;
+    std::vector<GLuint> counts;
+    // Projection scale, near and far plane of the last update
+    float scaleX, scaleY, zNear, zFar;
+    glm::mat4 view;
+    GLuint lightBuffer, lightTexture;
+    GLuint dataTexture;
+    StreamBuffer* stream;
+    // First texel of the cluster ranges of this frame in the stream
+    GLint offset;
+    ClusterStats stats;
+};
+
+/**
+ * GLSL to read the clusters, put it in a fragment shader before main and loop over the lights like this:
+ *     uvec2 range = clusterRange(worldPosition);
+ *     for(uint i = 0u; i < range.y; ++i)
+ *     {
+ *         PointLight light = clusterLight(range, i);
+ *         ...
+ *     }
+ */
+#define CLUSTERED_LIGHTS_GLSL "struct PointLight" \
+                              "{" \
+                              "    vec3 position;" \
+                              "    vec3 att;" \
+                              "    vec3 ambient;" \
+                              "    vec3 diffuse;" \
+                              "    vec3 specular;" \
+                              "};" \
+                              "uniform samplerBuffer clusterLights;" \
+                              "uniform usamplerBuffer clusterData;" \
+                              "uniform mat4 clusterView;" \
+                              "uniform vec4 clusterGrid;" /* xy: projection scale, z: slice scale, w: slice bias */ \
+                              "uniform ivec3 clusterSize;" \
+                              "uniform int clusterOffset;" \
+                              "uvec2 clusterRange(vec3 position)" \
+                              "{" \
+                              "    vec3 v = (clusterView * vec4(position, 1.0)).xyz;" \
+                              "    float depth = max(-v.z, 1e-4);" \
+                              "    vec2 ndc = v.xy * clusterGrid.xy / depth;" \
+                              "    ivec2 tile = clamp(ivec2(floor((ndc * 0.5 + 0.5) * vec2(clusterSize.xy))), ivec2(0), clusterSize.xy - 1);" \
+                              "    int slice = clamp(int(floor(log(depth) * clusterGrid.z + clusterGrid.w)), 0, clusterSize.z - 1);" \
+                              "    int cluster = clusterOffset + 2 * ((slice * clusterSize.y + tile.y) * clusterSize.x + tile.x);" \
+                              "    return uvec2(texelFetch(clusterData, cluster).r, texelFetch(clusterData, cluster + 1).r);" \
+                              "}" \
+                              "PointLight clusterLight(uvec2 range, uint i)" \
+                              "{" \
+                              "    int index = 5 * int(texelFetch(clusterData, int(range.x + i)).r);" \
+                              "    PointLight light;" \
+                              "    light.position = texelFetch(clusterLights, index).xyz;" \
+                              "    light.att = texelFetch(clusterLights, index + 1).xyz;" \
+                              "    light.ambient = texelFetch(clusterLights, index + 2).xyz;" \
+                              "    light.diffuse = texelFetch(clusterLights, index + 3).xyz;" \
+                              "    light.specular = texelFetch(clusterLights, index + 4).xyz;" \
+                              "    return light;" \
+                              "}"
+
+#endif
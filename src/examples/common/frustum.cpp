@@ -0,0 +1,204 @@
+#include "frustum.h"
+#include <cmath>
+#include <cstring>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+Frustum::Frustum()
+{
+    // Without a matrix nothing is outside
+    for(int i = 0; i < FRUSTUM_PLANES; ++i)
+    {
+        planes[i] = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+    }
+}
+
+Frustum::Frustum(const glm::mat4& m)
+{
+    // A point is inside if -w <= x, y, z <= w after the projection, every
+    // comparison is the dot product of the point with a sum of two rows
+    glm::vec4 rows[4];
+    for(int i = 0; i < 4; ++i)
+    {
+        rows[i] = glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+    }
+    planes[FRUSTUM_LEFT] = rows[3] + rows[0];
+    planes[FRUSTUM_RIGHT] = rows[3] - rows[0];
+    planes[FRUSTUM_BOTTOM] = rows[3] + rows[1];
+    planes[FRUSTUM_TOP] = rows[3] - rows[1];
+    planes[FRUSTUM_NEAR] = rows[3] + rows[2];
+    planes[FRUSTUM_FAR] = rows[3] - rows[2];
+
+    // With unit normals the plane equation is the distance, which a radius can be compared to
+    for(int i = 0; i < FRUSTUM_PLANES; ++i)
+    {
+        planes[i] /= glm::length(glm::vec3(planes[i]));
+    }
+}
+
+const glm::vec4& Frustum::getPlane(FrustumPlane plane) const
+{
+    return planes[plane];
+}
+
+bool Frustum::containsPoint(const glm::vec3& point) const
+{
+    return containsSphere(point, 0.0f);
+}
+
+bool Frustum::containsSphere(const glm::vec3& center, float radius) const
+{
+    for(int i = 0; i < FRUSTUM_PLANES; ++i)
+    {
+        if(glm::dot(glm::vec3(planes[i]), center) + planes[i].w < -radius)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Frustum::containsBox(const glm::vec3& min, const glm::vec3& max) const
+{
+    glm::vec3 center = 0.5f * (min + max);
+    glm::vec3 half = 0.5f * (max - min);
+    return cullBoxes(&center.x, &center.y, &center.z, &half.x, &half.y, &half.z, 1, NULL) == 1;
+}
+
+size_t Frustum::cullSpheres(const float* x, const float* y, const float* z, const float* radius,
+        size_t n, unsigned int* visible, unsigned int* mask) const
+{
+    if(mask)
+    {
+        memset(mask, 0, (n + 31) / 32 * sizeof(unsigned int));
+    }
+    size_t count = 0;
+    size_t i = 0;
+#ifdef __SSE2__
+    for(; i + 4 <= n; i += 4)
+    {
+        __m128 px = _mm_loadu_ps(x + i), py = _mm_loadu_ps(y + i), pz = _mm_loadu_ps(z + i);
+        __m128 minusRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(radius + i));
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for(int p = 0; p < FRUSTUM_PLANES; ++p)
+        {
+            const glm::vec4& plane = planes[p];
+            // Summed in the same order as the scalar tests, so both give the same result
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(plane.x)), _mm_mul_ps(py, _mm_set1_ps(plane.y))),
+                    _mm_mul_ps(pz, _mm_set1_ps(plane.z)));
+            distance = _mm_add_ps(distance, _mm_set1_ps(plane.w));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, minusRadius));
+        }
+        // One bit per sphere, append the indices of the set ones
+        int bits = _mm_movemask_ps(inside);
+        if(mask)
+        {
+            // i is a multiple of 4, so the 4 bits never cross a word
+            mask[i / 32] |= (unsigned int)bits << (i % 32);
+        }
+        for(int k = 0; k < 4; ++k)
+        {
+            if(visible && (bits & (1 << k)))
+            {
+                visible[count] = i + k;
+            }
+            count += (bits >> k) & 1;
+        }
+    }
+#endif
+    for(; i < n; ++i)
+    {
+        if(containsSphere(glm::vec3(x[i], y[i], z[i]), radius[i]))
+        {
+            if(visible)
+            {
+                visible[count] = i;
+            }
+            if(mask)
+            {
+                mask[i / 32] |= 1u << (i % 32);
+            }
+            count++;
+        }
+    }
+    return count;
+}
+
+size_t Frustum::cullBoxes(const float* x, const float* y, const float* z,
+        const float* halfX, const float* halfY, const float* halfZ,
+        size_t n, unsigned int* visible, unsigned int* mask) const
+{
+    if(mask)
+    {
+        memset(mask, 0, (n + 31) / 32 * sizeof(unsigned int));
+    }
+    // A box is outside a plane if its center is further away than the
+    // projection of the half sizes onto the normal
+    glm::vec3 absNormals[FRUSTUM_PLANES];
+    for(int p = 0; p < FRUSTUM_PLANES; ++p)
+    {
+        absNormals[p] = glm::abs(glm::vec3(planes[p]));
+    }
+
+    size_t count = 0;
+    size_t i = 0;
+#ifdef __SSE2__
+    for(; i + 4 <= n; i += 4)
+    {
+        __m128 px = _mm_loadu_ps(x + i), py = _mm_loadu_ps(y + i), pz = _mm_loadu_ps(z + i);
+        __m128 hx = _mm_loadu_ps(halfX + i), hy = _mm_loadu_ps(halfY + i), hz = _mm_loadu_ps(halfZ + i);
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for(int p = 0; p < FRUSTUM_PLANES; ++p)
+        {
+            const glm::vec4& plane = planes[p];
+            const glm::vec3& absNormal = absNormals[p];
+            // Summed in the same order as the scalar tests, so both give the same result
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(plane.x)), _mm_mul_ps(py, _mm_set1_ps(plane.y))),
+                    _mm_mul_ps(pz, _mm_set1_ps(plane.z)));
+            distance = _mm_add_ps(distance, _mm_set1_ps(plane.w));
+            __m128 extent = _mm_add_ps(_mm_add_ps(_mm_mul_ps(hx, _mm_set1_ps(absNormal.x)), _mm_mul_ps(hy, _mm_set1_ps(absNormal.y))),
+                    _mm_mul_ps(hz, _mm_set1_ps(absNormal.z)));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(distance, extent), _mm_setzero_ps()));
+        }
+        int bits = _mm_movemask_ps(inside);
+        if(mask)
+        {
+            // i is a multiple of 4, so the 4 bits never cross a word
+            mask[i / 32] |= (unsigned int)bits << (i % 32);
+        }
+        for(int k = 0; k < 4; ++k)
+        {
+            if(visible && (bits & (1 << k)))
+            {
+                visible[count] = i + k;
+            }
+            count += (bits >> k) & 1;
+        }
+    }
+#endif
+    for(; i < n; ++i)
+    {
+        bool inside = true;
+        for(int p = 0; p < FRUSTUM_PLANES && inside; ++p)
+        {
+            const glm::vec4& plane = planes[p];
+            float distance = plane.x * x[i] + plane.y * y[i] + plane.z * z[i] + plane.w;
+            float extent = absNormals[p].x * halfX[i] + absNormals[p].y * halfY[i] + absNormals[p].z * halfZ[i];
+            inside = distance + extent >= 0.0f;
+        }
+        if(inside)
+        {
+            if(visible)
+            {
+                visible[count] = i;
+            }
+            if(mask)
+            {
+                mask[i / 32] |= 1u << (i % 32);
+            }
+            count++;
+        }
+    }
+    return count;
+}
@@ -0,0 +1,65 @@
+#ifndef FRUSTUM_HEADER
+#define FRUSTUM_HEADER
+
+#include <glm/glm.hpp>
+#include <cstddef>
+
+enum FrustumPlane
+{
+    FRUSTUM_LEFT,
+    FRUSTUM_RIGHT,
+    FRUSTUM_BOTTOM,
+    FRUSTUM_TOP,
+    FRUSTUM_NEAR,
+    FRUSTUM_FAR,
+    FRUSTUM_PLANES
+};
+
+/**
+ * The 6 planes around what a view projection matrix can see.
+ * The planes face inwards: a point p is on the inside of plane (n, d) if dot(n, p) + d >= 0.
+ * The culling functions take objects as separate arrays per coordinate, so they
+ * can test 4 objects against a plane at once. They give the visible objects as
+ * compacted indices, as a bitmask, or both.
+ */
+class Frustum
+{
+public:
+    Frustum();
+    /**
+     * Extract the planes from a view projection matrix, they are normalized
+     */
+    explicit Frustum(const glm::mat4& viewProjection);
+
+    const glm::vec4& getPlane(FrustumPlane plane) const;
+
+    bool containsPoint(const glm::vec3& point) const;
+    /**
+     * @return false if the sphere is entirely outside
+     */
+    bool containsSphere(const glm::vec3& center, float radius) const;
+    /**
+     * @return false if the axis aligned box is entirely outside
+     */
+    bool containsBox(const glm::vec3& min, const glm::vec3& max) const;
+
+    /**
+     * Test n spheres and write the indices of those that are not entirely outside to visible
+     * @param visible Room for n indices, or NULL to only count them
+     * @param mask Room for (n + 31) / 32 words, bit i % 32 of word i / 32 is set if sphere i is visible.
+     *             NULL to leave it out
+     * @return The number of visible spheres
+     */
+    size_t cullSpheres(const float* x, const float* y, const float* z, const float* radius,
+            size_t n, unsigned int* visible, unsigned int* mask = NULL) const;
+    /**
+     * Like cullSpheres for axis aligned boxes, given by their centers and half sizes
+     */
+    size_t cullBoxes(const float* x, const float* y, const float* z,
+            const float* halfX, const float* halfY, const float* halfZ,
+            size_t n, unsigned int* visible, unsigned int* mask = NULL) const;
+private:
+    glm::vec4 planes[FRUSTUM_PLANES];
+};
+
+#endif
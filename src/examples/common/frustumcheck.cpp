@@ -0,0 +1,166 @@
+#include "frustum.h"
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+/**
+ * Checks that culling spheres and boxes in batches (Frustum::cullSpheres and cullBoxes, as indices
+ * and as a bitmask) finds exactly the objects that containsSphere and containsBox find one by one,
+ * and times both for large numbers of objects. Returns non-zero if they disagree.
+ */
+
+// Objects as separate arrays per coordinate, like the culling functions take them
+struct Objects
+{
+    std::vector<float> x, y, z, radius, halfX, halfY, halfZ;
+};
+
+static Objects createObjects(size_t n)
+{
+    Objects objects;
+    objects.x.resize(n);
+    objects.y.resize(n);
+    objects.z.resize(n);
+    objects.radius.resize(n);
+    objects.halfX.resize(n);
+    objects.halfY.resize(n);
+    objects.halfZ.resize(n);
+    // In quarter units, so the corners containsBox takes give back exactly the same centers and half sizes
+    for(size_t i = 0; i < n; ++i)
+    {
+        objects.x[i] = rand() % 800 / 4.0f - 100.0f;
+        objects.y[i] = rand() % 800 / 4.0f - 100.0f;
+        objects.z[i] = rand() % 800 / 4.0f - 100.0f;
+        objects.radius[i] = rand() % 40 / 4.0f;
+        objects.halfX[i] = rand() % 40 / 4.0f;
+        objects.halfY[i] = rand() % 40 / 4.0f;
+        objects.halfZ[i] = rand() % 40 / 4.0f;
+    }
+    return objects;
+}
+
+// Milliseconds since start
+static double elapsed(const std::chrono::steady_clock::time_point& start)
+{
+    std::chrono::duration<double, std::milli> duration = std::chrono::steady_clock::now() - start;
+    return duration.count();
+}
+
+static size_t cull(const Frustum& frustum, const Objects& o, bool boxes, unsigned int* visible, unsigned int* mask)
+{
+    size_t n = o.x.size();
+    if(boxes)
+    {
+        return frustum.cullBoxes(o.x.data(), o.y.data(), o.z.data(), o.halfX.data(), o.halfY.data(), o.halfZ.data(),
+                n, visible, mask);
+    }
+    return frustum.cullSpheres(o.x.data(), o.y.data(), o.z.data(), o.radius.data(), n, visible, mask);
+}
+
+/**
+ * Cull the objects one by one and in batches, with indices and a mask, only a mask and only counting
+ * @return false if any of them disagree
+ */
+static bool check(const Frustum& frustum, const Objects& o, bool boxes, const char* name, bool timed)
+{
+    size_t n = o.x.size();
+    const char* shape = boxes ? "boxes" : "spheres";
+    std::vector<unsigned int> single(n + 1), batch(n + 1), mask((n + 31) / 32 + 1), maskOnly((n + 31) / 32 + 1);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    size_t singleCount = 0;
+    for(size_t i = 0; i < n; ++i)
+    {
+        glm::vec3 center(o.x[i], o.y[i], o.z[i]);
+        glm::vec3 half(o.halfX[i], o.halfY[i], o.halfZ[i]);
+        if(boxes ? frustum.containsBox(center - half, center + half) : frustum.containsSphere(center, o.radius[i]))
+        {
+            single[singleCount++] = i;
+        }
+    }
+    double singleTime = elapsed(start);
+
+    start = std::chrono::steady_clock::now();
+    size_t batchCount = cull(frustum, o, boxes, &batch[0], &mask[0]);
+    double batchTime = elapsed(start);
+
+    start = std::chrono::steady_clock::now();
+    size_t maskCount = cull(frustum, o, boxes, NULL, &maskOnly[0]);
+    double maskTime = elapsed(start);
+
+    size_t count = cull(frustum, o, boxes, NULL, NULL);
+
+    // The batches have to find exactly the same objects, in the same order, and set exactly their bits
+    bool same = batchCount == singleCount && maskCount == singleCount && count == singleCount &&
+        std::equal(single.begin(), single.begin() + singleCount, batch.begin());
+    size_t next = 0;
+    for(size_t i = 0; i < n && same; ++i)
+    {
+        bool listed = next < singleCount && single[next] == i;
+        same = ((mask[i / 32] >> (i % 32)) & 1) == listed && ((maskOnly[i / 32] >> (i % 32)) & 1) == listed;
+        next += listed;
+    }
+    // Bits past the last object stay clear
+    for(size_t i = n; i < (n + 31) / 32 * 32 && same; ++i)
+    {
+        same = ((mask[i / 32] >> (i % 32)) & 1) == 0;
+    }
+    if(!same)
+    {
+        std::cerr << "Culling " << n << " " << shape << " in a batch (" << name << ") does not match culling them one by one: "
+            << singleCount << " one by one, " << batchCount << " in a batch, " << maskCount << " in the mask" << std::endl;
+        return false;
+    }
+
+    if(timed)
+    {
+        std::cout << n << " " << shape << " (" << name << "), " << singleCount << " visible: one by one " << singleTime
+            << " ms, batch " << batchTime << " ms (" << n / batchTime / 1000.0 << " M/s), bitmask " << maskTime << " ms"
+            << std::endl;
+    }
+    return true;
+}
+
+int main()
+{
+#ifdef __SSE2__
+    std::cout << "Frustum culling with SSE2" << std::endl;
+#else
+    std::cout << "Frustum culling without SIMD" << std::endl;
+#endif
+    glm::mat4 view = glm::rotate(glm::mat4(), 0.3f, glm::vec3(0.0f, 1.0f, 0.0f)) *
+        glm::translate(glm::mat4(), glm::vec3(0.0f, 0.0f, 50.0f));
+    Frustum frusta[2] =
+    {
+        Frustum(glm::perspective(glm::radians(45.0f), 640.0f / 480.0f, 0.1f, 1000.0f) * view),
+        Frustum(glm::ortho(-40.0f, 40.0f, -30.0f, 30.0f, -60.0f, 60.0f) * view)
+    };
+    const char* names[2] = { "perspective", "orthographic" };
+
+    // Counts around the 4 objects the SIMD path takes at once and the 32 bits of a mask word
+    const size_t small[] = { 0, 1, 3, 4, 5, 7, 31, 32, 33, 1000 };
+    const size_t large[] = { 100000, 1000000 };
+    bool passed = true;
+    srand(1993);
+    for(int f = 0; f < 2; ++f)
+    {
+        for(size_t s = 0; s < sizeof(small) / sizeof(small[0]); ++s)
+        {
+            Objects objects = createObjects(small[s]);
+            passed = check(frusta[f], objects, false, names[f], false) && passed;
+            passed = check(frusta[f], objects, true, names[f], false) && passed;
+        }
+        for(size_t s = 0; s < sizeof(large) / sizeof(large[0]); ++s)
+        {
+            Objects objects = createObjects(large[s]);
+            passed = check(frusta[f], objects, false, names[f], true) && passed;
+            passed = check(frusta[f], objects, true, names[f], true) && passed;
+        }
+    }
+
+    std::cout << (passed ? "All culling checks passed" : "Culling checks FAILED") << std::endl;
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,20 @@
+#include "instancetransform.h"
+
+InstanceTransform makeInstanceTransform(const glm::vec3& position, float scale, const glm::quat& rotation)
+{
+    InstanceTransform t;
+    t.position = position;
+    t.scale = scale;
+    t.rotation = glm::vec4(rotation.x, rotation.y, rotation.z, rotation.w);
+    return t;
+}
+
+void setInstanceTransformLayout(GLuint location, GLintptr offset)
+{
+    glEnableVertexAttribArray(location);
+    glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceTransform), (void*)offset);
+    glVertexAttribDivisor(location, 1);
+    glEnableVertexAttribArray(location + 1);
+    glVertexAttribPointer(location + 1, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceTransform), (void*)(offset + sizeof(glm::vec4)));
+    glVertexAttribDivisor(location + 1, 1);
+}
@@ -0,0 +1,48 @@
+#ifndef INSTANCE_TRANSFORM_HEADER
+#define INSTANCE_TRANSFORM_HEADER
+
+#include "util.h"
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+/**
+ * Translation, uniform scale and rotation of an instance in 32 bytes instead of a 64 byte mat4.
+ * Since the scale is uniform, the rotation is also the normal matrix.
+ */
+struct InstanceTransform
+{
+    glm::vec3 position;
+    float scale;
+    // Unit quaternion (x, y, z, w)
+    glm::vec4 rotation;
+};
+
+/**
+ * The transform that does the same as translate(position) * scale(scale) * rotate(rotation)
+ */
+InstanceTransform makeInstanceTransform(const glm::vec3& position, float scale, const glm::quat& rotation);
+
+/**
+ * Point two vec4 attributes at instance transforms in the bound GL_ARRAY_BUFFER, advancing once
+ * per instance: position and scale at location and the rotation at location + 1
+ */
+void setInstanceTransformLayout(GLuint location, GLintptr offset);
+
+/**
+ * GLSL functions to apply an instance transform, put them in a vertex shader before main:
+ *     layout(location=2) in vec4 inst_position_scale;
+ *     layout(location=3) in vec4 inst_rotation;
+ *     ...
+ *     vec3 wP = instanceTransform(inst_position_scale, inst_rotation, position);
+ *     vec3 wN = instanceRotate(inst_rotation, normal);
+ */
+#define INSTANCE_TRANSFORM_GLSL "vec3 instanceRotate(vec4 q, vec3 v)" \
+                                "{" \
+                                "    return v + 2.0 * cross(q.xyz, cross(q.xyz, v) + q.w * v);" \
+                                "}" \
+                                "vec3 instanceTransform(vec4 positionScale, vec4 rotation, vec3 p)" \
+                                "{" \
+                                "    return positionScale.xyz + positionScale.w * instanceRotate(rotation, p);" \
+                                "}"
+
+#endif
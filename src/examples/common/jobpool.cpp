@@ -0,0 +1,92 @@
+#include "jobpool.h"
+#include <algorithm>
+
+JobPool::JobPool(int numThreads)
+    : numChunks(0), nextChunk(0), finishedChunks(0), duration(0.0), stopping(false)
+{
+    if(numThreads <= 0)
+    {
+        // hardware_concurrency may return 0 if it does not know
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for(int i = 0; i < numThreads; ++i)
+    {
+        threads.push_back(std::thread(&JobPool::work, this));
+    }
+}
+
+JobPool::~JobPool()
+{
+    wait();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    jobAvailable.notify_all();
+    for(size_t i = 0; i < threads.size(); ++i)
+    {
+        threads[i].join();
+    }
+}
+
+void JobPool::start(const std::function<void(int)>& job, int numChunks)
+{
+    wait();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        this->job = job;
+        this->numChunks = numChunks;
+        nextChunk = 0;
+        finishedChunks = 0;
+        startTime = std::chrono::steady_clock::now();
+    }
+    jobAvailable.notify_all();
+}
+
+void JobPool::wait()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    runChunks(lock);
+    while(finishedChunks < numChunks)
+    {
+        jobFinished.wait(lock);
+    }
+}
+
+int JobPool::getNumThreads() const
+{
+    return threads.size();
+}
+
+double JobPool::getDuration() const
+{
+    return duration;
+}
+
+void JobPool::work()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while(!stopping)
+    {
+        runChunks(lock);
+        jobAvailable.wait(lock);
+    }
+}
+
+void JobPool::runChunks(std::unique_lock<std::mutex>& lock)
+{
+    while(nextChunk < numChunks)
+    {
+        int chunk = nextChunk++;
+        lock.unlock();
+        job(chunk);
+        lock.lock();
+
+        if(++finishedChunks == numChunks)
+        {
+            std::chrono::duration<double, std::milli> d = std::chrono::steady_clock::now() - startTime;
+            duration = d.count();
+            jobFinished.notify_all();
+        }
+    }
+}
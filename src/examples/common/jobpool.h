@@ -0,0 +1,56 @@
+#ifndef JOB_POOL_HEADER
+#define JOB_POOL_HEADER
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * A pool of worker threads that runs a job split into chunks.
+ * One job runs at a time. start() returns right away, so the calling
+ * thread can do other work (like submitting a frame) until wait().
+ */
+class JobPool
+{
+public:
+    /**
+     * @param numThreads Number of worker threads, 0 to use one per core
+     */
+    JobPool(int numThreads = 0);
+    ~JobPool();
+
+    /**
+     * Run job(chunk) for every chunk in [0, numChunks) on the workers.
+     * Waits for the previous job first.
+     */
+    void start(const std::function<void(int)>& job, int numChunks);
+    /**
+     * Block until every chunk of the job has run.
+     * The calling thread runs chunks that have not been picked up yet.
+     */
+    void wait();
+
+    int getNumThreads() const;
+    /**
+     * Milliseconds from start() until the last chunk of the last job finished
+     */
+    double getDuration() const;
+private:
+    void work();
+    // Run chunks until there are none left, with the mutex locked
+    void runChunks(std::unique_lock<std::mutex>& lock);
+
+    std::vector<std::thread> threads;
+    std::function<void(int)> job;
+    int numChunks, nextChunk, finishedChunks;
+    std::chrono::steady_clock::time_point startTime;
+    double duration;
+    std::mutex mutex;
+    std::condition_variable jobAvailable, jobFinished;
+    bool stopping;
+};
+
+#endif
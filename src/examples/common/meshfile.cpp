@@ -0,0 +1,323 @@
+#include "meshfile.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Bump the version whenever the layout of the file changes
+static const char MESH_FILE_MAGIC[4] = { 'G', 'L', 'X', 'M' };
+static const uint32_t MESH_FILE_VERSION = 3;
+// Vertex and index data start on a cache line
+static const uint64_t MESH_FILE_ALIGNMENT = 64;
+
+struct MeshFileHeader
+{
+    char magic[4];
+    uint32_t version;
+    // Size and modification time of the source file, to notice when it changes
+    uint64_t sourceSize;
+    int64_t sourceTime;
+    uint32_t numMeshes;
+    uint32_t stride;
+    uint32_t numAttributes;
+    uint32_t padding;
+    struct
+    {
+        uint32_t location;
+        int32_t size;
+        uint32_t type;
+        uint32_t normalized;
+        uint32_t offset;
+    } attributes[MAX_VERTEX_ATTRIBUTES];
+};
+
+struct MeshFileEntry
+{
+    uint32_t numVertices;
+    uint32_t numIndices;
+    uint32_t indexType;
+    uint32_t padding;
+    float boundsMin[3];
+    float boundsSize[3];
+    uint64_t vertexOffset;
+    uint64_t vertexBytes;
+    uint64_t indexOffset;
+    uint64_t indexBytes;
+};
+
+static uint64_t align(uint64_t offset)
+{
+    return (offset + MESH_FILE_ALIGNMENT - 1) & ~(MESH_FILE_ALIGNMENT - 1);
+}
+
+static void getSourceInfo(const char* sourceFileName, uint64_t* size, int64_t* time)
+{
+    struct stat s;
+    if(stat(sourceFileName, &s) == 0)
+    {
+        *size = s.st_size;
+        *time = s.st_mtime;
+    }
+    else
+    {
+        *size = 0;
+        *time = 0;
+    }
+}
+
+static void writeZeros(FILE* f, uint64_t count)
+{
+    static const char zeros[MESH_FILE_ALIGNMENT] = {};
+    fwrite(zeros, 1, count, f);
+}
+
+void setVertexLayout(const VertexLayout& layout)
+{
+    for(GLuint i = 0; i < layout.numAttributes; ++i)
+    {
+        const VertexAttribute& a = layout.attributes[i];
+        glEnableVertexAttribArray(a.location);
+        glVertexAttribPointer(a.location, a.size, a.type, a.normalized, layout.stride, (void*)(size_t)a.offset);
+    }
+}
+
+bool writeMeshFile(const char* fileName, const char* sourceFileName, const VertexLayout& layout,
+        const std::vector<MeshData>& meshes)
+{
+    MeshFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MESH_FILE_MAGIC, sizeof(header.magic));
+    header.version = MESH_FILE_VERSION;
+    getSourceInfo(sourceFileName, &header.sourceSize, &header.sourceTime);
+    header.numMeshes = meshes.size();
+    header.stride = layout.stride;
+    header.numAttributes = layout.numAttributes;
+    for(GLuint i = 0; i < layout.numAttributes; ++i)
+    {
+        header.attributes[i].location = layout.attributes[i].location;
+        header.attributes[i].size = layout.attributes[i].size;
+        header.attributes[i].type = layout.attributes[i].type;
+        header.attributes[i].normalized = layout.attributes[i].normalized;
+        header.attributes[i].offset = layout.attributes[i].offset;
+    }
+
+    // Lay out the blobs after the header and the mesh table
+    std::vector<MeshFileEntry> entries(meshes.size());
+    uint64_t offset = sizeof(MeshFileHeader) + sizeof(MeshFileEntry) * meshes.size();
+    for(size_t i = 0; i < meshes.size(); ++i)
+    {
+        MeshFileEntry& entry = entries[i];
+        memset(&entry, 0, sizeof(entry));
+        entry.numVertices = meshes[i].numVertices;
+        entry.numIndices = meshes[i].numIndices;
+        // Meshes that fit store 16 bit indices, which halves the index bandwidth
+        entry.indexType = meshes[i].numVertices <= 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+        memcpy(entry.boundsMin, meshes[i].boundsMin, sizeof(entry.boundsMin));
+        memcpy(entry.boundsSize, meshes[i].boundsSize, sizeof(entry.boundsSize));
+        entry.vertexOffset = align(offset);
+        entry.vertexBytes = (uint64_t)layout.stride * meshes[i].numVertices;
+        entry.indexOffset = align(entry.vertexOffset + entry.vertexBytes);
+        entry.indexBytes = (entry.indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint))
+            * meshes[i].numIndices;
+        offset = entry.indexOffset + entry.indexBytes;
+    }
+
+    // Write to a temporary file first, so a crash never leaves a half written mesh file behind
+    std::string tmpName = std::string(fileName) + ".tmp";
+    FILE* f = fopen(tmpName.c_str(), "wb");
+    if(!f)
+    {
+        std::cerr << "Could not write mesh file " << fileName << std::endl;
+        return false;
+    }
+    fwrite(&header, sizeof(header), 1, f);
+    if(!entries.empty())
+    {
+        fwrite(&entries[0], sizeof(MeshFileEntry), entries.size(), f);
+    }
+    offset = sizeof(MeshFileHeader) + sizeof(MeshFileEntry) * meshes.size();
+    for(size_t i = 0; i < meshes.size(); ++i)
+    {
+        writeZeros(f, entries[i].vertexOffset - offset);
+        fwrite(meshes[i].vertices, 1, entries[i].vertexBytes, f);
+        writeZeros(f, entries[i].indexOffset - entries[i].vertexOffset - entries[i].vertexBytes);
+        if(entries[i].indexType == GL_UNSIGNED_SHORT && meshes[i].numIndices > 0)
+        {
+            std::vector<GLushort> shortIndices(meshes[i].indices, meshes[i].indices + meshes[i].numIndices);
+            fwrite(&shortIndices[0], 1, entries[i].indexBytes, f);
+        }
+        else
+        {
+            fwrite(meshes[i].indices, 1, entries[i].indexBytes, f);
+        }
+        offset = entries[i].indexOffset + entries[i].indexBytes;
+    }
+    bool result = !ferror(f);
+    fclose(f);
+
+    if(!result || rename(tmpName.c_str(), fileName) != 0)
+    {
+        std::cerr << "Could not write mesh file " << fileName << std::endl;
+        remove(tmpName.c_str());
+        return false;
+    }
+    return true;
+}
+
+MeshFile::MeshFile()
+    : data(NULL), size(0)
+{
+}
+
+MeshFile::~MeshFile()
+{
+    close();
+}
+
+bool MeshFile::open(const char* fileName, const char* sourceFileName, const VertexLayout& layout)
+{
+    close();
+
+    int fd = ::open(fileName, O_RDONLY);
+    if(fd == -1)
+    {
+        return false;
+    }
+    struct stat s;
+    if(fstat(fd, &s) != 0 || (size_t)s.st_size < sizeof(MeshFileHeader))
+    {
+        ::close(fd);
+        return false;
+    }
+    size = s.st_size;
+    data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping stays valid after closing the file descriptor
+    ::close(fd);
+    if(data == MAP_FAILED)
+    {
+        data = NULL;
+        size = 0;
+        return false;
+    }
+
+    const MeshFileHeader* header = (const MeshFileHeader*)data;
+    bool valid = memcmp(header->magic, MESH_FILE_MAGIC, sizeof(header->magic)) == 0
+        && header->version == MESH_FILE_VERSION
+        && header->stride == layout.stride
+        && header->numAttributes == layout.numAttributes
+        && sizeof(MeshFileHeader) + (uint64_t)header->numMeshes * sizeof(MeshFileEntry) <= size;
+    for(GLuint i = 0; valid && i < layout.numAttributes; ++i)
+    {
+        const VertexAttribute& a = layout.attributes[i];
+        valid = header->attributes[i].location == a.location
+            && header->attributes[i].size == a.size
+            && header->attributes[i].type == a.type
+            && header->attributes[i].normalized == a.normalized
+            && header->attributes[i].offset == a.offset;
+    }
+
+    uint64_t sourceSize;
+    int64_t sourceTime;
+    getSourceInfo(sourceFileName, &sourceSize, &sourceTime);
+    if(valid && sourceTime != 0)
+    {
+        valid = header->sourceSize == sourceSize && header->sourceTime == sourceTime;
+    }
+
+    const MeshFileEntry* entries = (const MeshFileEntry*)(header + 1);
+    for(GLuint i = 0; valid && i < header->numMeshes; ++i)
+    {
+        valid = entries[i].vertexOffset + entries[i].vertexBytes <= size
+            && entries[i].indexOffset + entries[i].indexBytes <= size;
+    }
+
+    if(!valid)
+    {
+        close();
+    }
+    return valid;
+}
+
+void MeshFile::close()
+{
+    if(data)
+    {
+        munmap(data, size);
+        data = NULL;
+        size = 0;
+    }
+}
+
+GLuint MeshFile::getNumMeshes() const
+{
+    return ((const MeshFileHeader*)data)->numMeshes;
+}
+
+static const MeshFileEntry* getEntry(const void* data, GLuint mesh)
+{
+    return (const MeshFileEntry*)((const MeshFileHeader*)data + 1) + mesh;
+}
+
+GLuint MeshFile::getNumVertices(GLuint mesh) const
+{
+    return getEntry(data, mesh)->numVertices;
+}
+
+GLuint MeshFile::getNumIndices(GLuint mesh) const
+{
+    return getEntry(data, mesh)->numIndices;
+}
+
+GLenum MeshFile::getIndexType(GLuint mesh) const
+{
+    return getEntry(data, mesh)->indexType;
+}
+
+void MeshFile::getBounds(GLuint mesh, glm::vec3* boundsMin, glm::vec3* boundsSize) const
+{
+    const MeshFileEntry* entry = getEntry(data, mesh);
+    *boundsMin = glm::vec3(entry->boundsMin[0], entry->boundsMin[1], entry->boundsMin[2]);
+    *boundsSize = glm::vec3(entry->boundsSize[0], entry->boundsSize[1], entry->boundsSize[2]);
+}
+
+const void* MeshFile::getVertices(GLuint mesh) const
+{
+    return (const char*)data + getEntry(data, mesh)->vertexOffset;
+}
+
+const void* MeshFile::getIndices(GLuint mesh) const
+{
+    return (const char*)data + getEntry(data, mesh)->indexOffset;
+}
+
+void MeshFile::upload(GLuint mesh, GLuint* vbo, GLuint* ebo) const
+{
+    const MeshFileEntry* entry = getEntry(data, mesh);
+    const char* bytes = (const char*)data;
+
+    glGenBuffers(1, vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, *vbo);
+    glBufferData(GL_ARRAY_BUFFER, entry->vertexBytes, bytes + entry->vertexOffset, GL_STATIC_DRAW);
+
+    glGenBuffers(1, ebo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, *ebo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, entry->indexBytes, bytes + entry->indexOffset, GL_STATIC_DRAW);
+
+    const MeshFileHeader* header = (const MeshFileHeader*)data;
+    VertexLayout layout;
+    layout.stride = header->stride;
+    layout.numAttributes = header->numAttributes;
+    for(GLuint i = 0; i < layout.numAttributes; ++i)
+    {
+        layout.attributes[i].location = header->attributes[i].location;
+        layout.attributes[i].size = header->attributes[i].size;
+        layout.attributes[i].type = header->attributes[i].type;
+        layout.attributes[i].normalized = header->attributes[i].normalized;
+        layout.attributes[i].offset = header->attributes[i].offset;
+    }
+    setVertexLayout(layout);
+}
@@ -0,0 +1,107 @@
+#ifndef MESH_FILE_HEADER
+#define MESH_FILE_HEADER
+
+#include "util.h"
+#include <glm/glm.hpp>
+#include <vector>
+
+#define MAX_VERTEX_ATTRIBUTES 8
+
+/**
+ * One attribute of an interleaved vertex, the arguments to glVertexAttribPointer
+ */
+struct VertexAttribute
+{
+    GLuint location;
+    GLint size;
+    GLenum type;
+    GLboolean normalized;
+    GLuint offset;
+};
+
+/**
+ * Describes the vertices in a vertex buffer
+ */
+struct VertexLayout
+{
+    GLuint stride;
+    GLuint numAttributes;
+    VertexAttribute attributes[MAX_VERTEX_ATTRIBUTES];
+};
+
+/**
+ * Enable and point the attributes of a layout to the bound GL_ARRAY_BUFFER
+ */
+void setVertexLayout(const VertexLayout& layout);
+
+/**
+ * The data of one mesh in a mesh file, in the layout of the file
+ */
+struct MeshData
+{
+    const void* vertices;
+    GLuint numVertices;
+    const GLuint* indices;
+    GLuint numIndices;
+    // Bounding box that quantized positions are relative to (see vertexformat.h)
+    float boundsMin[3];
+    float boundsSize[3];
+};
+
+/**
+ * Write meshes to a binary mesh file, which can later be opened with MeshFile.
+ * The file starts with a header and the vertex layout, followed by a table
+ * of meshes and their vertex and index data, aligned so it can be mapped.
+ * Indices are stored as GL_UNSIGNED_SHORT when a mesh has few enough vertices,
+ * so draw with getIndexType.
+ * @param sourceFileName The file the meshes were converted from
+ */
+bool writeMeshFile(const char* fileName, const char* sourceFileName, const VertexLayout& layout,
+        const std::vector<MeshData>& meshes);
+
+/**
+ * A memory mapped binary mesh file.
+ * Meshes are uploaded straight from the mapping, without any parsing.
+ */
+class MeshFile
+{
+public:
+    MeshFile();
+    ~MeshFile();
+
+    /**
+     * Map a mesh file written by writeMeshFile.
+     * This fails if the file does not exist, was written by another version,
+     * has a different layout, or if its source file has changed since.
+     * A missing source file is fine: the mesh file may have been converted offline.
+     */
+    bool open(const char* fileName, const char* sourceFileName, const VertexLayout& layout);
+    void close();
+
+    GLuint getNumMeshes() const;
+    GLuint getNumVertices(GLuint mesh) const;
+    GLuint getNumIndices(GLuint mesh) const;
+    GLenum getIndexType(GLuint mesh) const;
+    /**
+     * The bounding box of a mesh with quantized positions:
+     * position = boundsMin + quantized * boundsSize
+     */
+    void getBounds(GLuint mesh, glm::vec3* boundsMin, glm::vec3* boundsSize) const;
+    /**
+     * The vertices of a mesh in the layout of the file, and its indices of getIndexType.
+     * They point into the mapping and are valid until the file is closed.
+     */
+    const void* getVertices(GLuint mesh) const;
+    const void* getIndices(GLuint mesh) const;
+
+    /**
+     * Create a vertex and an index buffer for a mesh, upload the mesh and
+     * set the vertex layout. Call this with the vertex array object bound.
+     */
+    void upload(GLuint mesh, GLuint* vbo, GLuint* ebo) const;
+private:
+    void* data;
+    size_t size;
+};
+
+#endif
@@ -0,0 +1,335 @@
+#include "meshoptimizer.h"
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+// Size of the cache modelled by the Forsyth scoring function
+static const int SCORE_CACHE_SIZE = 32;
+
+static float vertexScore(int cachePosition, unsigned int remainingTriangles)
+{
+    if(remainingTriangles == 0)
+    {
+        // Nothing left to draw with this vertex
+        return -1.0f;
+    }
+
+    float score = 0.0f;
+    if(cachePosition >= 0)
+    {
+        if(cachePosition < 3)
+        {
+            // Used by the last triangle: a fixed score, so we do not favour
+            // finishing a strip over continuing it
+            score = 0.75f;
+        }
+        else
+        {
+            float s = 1.0f - (cachePosition - 3) * (1.0f / (SCORE_CACHE_SIZE - 3));
+            score = powf(s, 1.5f);
+        }
+    }
+    // Boost vertices with few triangles left, so they do not get left behind
+    score += 2.0f / sqrtf((float)remainingTriangles);
+    return score;
+}
+
+VertexCacheStats analyzeVertexCache(const GLuint* indices, size_t numIndices, size_t numVertices,
+        unsigned int cacheSize)
+{
+    // A FIFO cache: a vertex is in the cache if it was transformed less than cacheSize misses ago
+    std::vector<size_t> timestamps(numVertices, 0);
+    size_t time = cacheSize + 1;
+    size_t misses = 0;
+    for(size_t i = 0; i < numIndices; ++i)
+    {
+        GLuint v = indices[i];
+        if(time - timestamps[v] > cacheSize)
+        {
+            timestamps[v] = time++;
+            misses++;
+        }
+    }
+
+    VertexCacheStats stats;
+    stats.acmr = numIndices ? (float)misses / (numIndices / 3) : 0.0f;
+    stats.atvr = numVertices ? (float)misses / numVertices : 0.0f;
+    return stats;
+}
+
+void optimizeVertexCache(GLuint* indices, size_t numIndices, size_t numVertices)
+{
+    size_t numTriangles = numIndices / 3;
+    if(numTriangles == 0)
+    {
+        return;
+    }
+
+    // Build the list of triangles using each vertex
+    std::vector<unsigned int> remaining(numVertices, 0);
+    for(size_t i = 0; i < numIndices; ++i)
+    {
+        remaining[indices[i]]++;
+    }
+    std::vector<unsigned int> offsets(numVertices + 1, 0);
+    for(size_t v = 0; v < numVertices; ++v)
+    {
+        offsets[v + 1] = offsets[v] + remaining[v];
+    }
+    std::vector<unsigned int> adjacency(numIndices);
+    std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+    for(size_t i = 0; i < numIndices; ++i)
+    {
+        adjacency[fill[indices[i]]++] = i / 3;
+    }
+
+    std::vector<int> cachePositions(numVertices, -1);
+    std::vector<float> vertexScores(numVertices);
+    for(size_t v = 0; v < numVertices; ++v)
+    {
+        vertexScores[v] = vertexScore(-1, remaining[v]);
+    }
+    std::vector<float> triangleScores(numTriangles);
+    std::vector<bool> emitted(numTriangles, false);
+    int best = 0;
+    for(size_t t = 0; t < numTriangles; ++t)
+    {
+        triangleScores[t] = vertexScores[indices[t * 3]] + vertexScores[indices[t * 3 + 1]]
+            + vertexScores[indices[t * 3 + 2]];
+        if(triangleScores[t] > triangleScores[best])
+        {
+            best = t;
+        }
+    }
+
+    std::vector<GLuint> result;
+    result.reserve(numIndices);
+    // Room for the three new vertices on top of a full cache
+    GLuint cache[SCORE_CACHE_SIZE + 3];
+    int cacheCount = 0;
+    size_t scanCursor = 0;
+
+    while(result.size() < numIndices)
+    {
+        if(best < 0)
+        {
+            // Dead end: nothing in the cache has triangles left,
+            // so continue with the next triangle that was not emitted
+            while(emitted[scanCursor])
+            {
+                scanCursor++;
+            }
+            best = scanCursor;
+        }
+
+        const GLuint* triangle = &indices[best * 3];
+        emitted[best] = true;
+        result.insert(result.end(), triangle, triangle + 3);
+
+        // Remove the triangle from the adjacency of its vertices
+        for(int i = 0; i < 3; ++i)
+        {
+            GLuint v = triangle[i];
+            unsigned int* begin = &adjacency[offsets[v]];
+            unsigned int* end = begin + remaining[v];
+            *std::find(begin, end, (unsigned int)best) = *(end - 1);
+            remaining[v]--;
+        }
+
+        // The vertices of the triangle move to the front of the cache
+        GLuint newCache[SCORE_CACHE_SIZE + 3];
+        int newCount = 0;
+        for(int i = 0; i < 3; ++i)
+        {
+            newCache[newCount++] = triangle[i];
+        }
+        for(int i = 0; i < cacheCount; ++i)
+        {
+            GLuint v = cache[i];
+            if(v != triangle[0] && v != triangle[1] && v != triangle[2])
+            {
+                newCache[newCount++] = v;
+            }
+        }
+
+        // Update the scores of everything that moved in or out of the cache
+        // and look for the best triangle among their neighbours
+        best = -1;
+        float bestScore = -1.0f;
+        for(int i = 0; i < newCount; ++i)
+        {
+            GLuint v = newCache[i];
+            cachePositions[v] = i < SCORE_CACHE_SIZE ? i : -1;
+            vertexScores[v] = vertexScore(cachePositions[v], remaining[v]);
+        }
+        for(int i = 0; i < newCount; ++i)
+        {
+            GLuint v = newCache[i];
+            for(unsigned int j = 0; j < remaining[v]; ++j)
+            {
+                unsigned int t = adjacency[offsets[v] + j];
+                float score = vertexScores[indices[t * 3]] + vertexScores[indices[t * 3 + 1]]
+                    + vertexScores[indices[t * 3 + 2]];
+                triangleScores[t] = score;
+                if(score > bestScore)
+                {
+                    bestScore = score;
+                    best = t;
+                }
+            }
+        }
+
+        cacheCount = std::min(newCount, SCORE_CACHE_SIZE);
+        memcpy(cache, newCache, cacheCount * sizeof(GLuint));
+    }
+
+    memcpy(indices, &result[0], numIndices * sizeof(GLuint));
+}
+
+struct Cluster
+{
+    size_t begin, end; // Triangles
+    float sortKey;
+};
+
+static bool compareClusters(const Cluster& a, const Cluster& b)
+{
+    return a.sortKey > b.sortKey;
+}
+
+void optimizeOverdraw(GLuint* indices, size_t numIndices, const void* positions, size_t stride)
+{
+    size_t numTriangles = numIndices / 3;
+    if(numTriangles == 0)
+    {
+        return;
+    }
+
+    GLuint numVertices = *std::max_element(indices, indices + numIndices) + 1;
+    const char* bytes = (const char*)positions;
+    std::vector<glm::vec3> vertexPositions(numVertices);
+    for(GLuint v = 0; v < numVertices; ++v)
+    {
+        const float* p = (const float*)(bytes + v * stride);
+        vertexPositions[v] = glm::vec3(p[0], p[1], p[2]);
+    }
+
+    // A triangle that misses the cache with all three vertices is where the
+    // cache optimized order jumped to another part of the mesh: start a cluster there.
+    // Keeping clusters in one piece keeps the cache hit rate.
+    std::vector<Cluster> clusters;
+    std::vector<size_t> timestamps(numVertices, 0);
+    const size_t cacheSize = 16;
+    size_t time = cacheSize + 1;
+    for(size_t t = 0; t < numTriangles; ++t)
+    {
+        int misses = 0;
+        for(int i = 0; i < 3; ++i)
+        {
+            GLuint v = indices[t * 3 + i];
+            if(time - timestamps[v] > cacheSize)
+            {
+                timestamps[v] = time++;
+                misses++;
+            }
+        }
+        if(misses == 3 || clusters.empty())
+        {
+            Cluster c = { t, t, 0.0f };
+            clusters.push_back(c);
+        }
+        clusters.back().end = t + 1;
+    }
+
+    glm::vec3 meshCenter(0.0f);
+    for(GLuint v = 0; v < numVertices; ++v)
+    {
+        meshCenter += vertexPositions[v];
+    }
+    meshCenter /= (float)numVertices;
+
+    for(size_t c = 0; c < clusters.size(); ++c)
+    {
+        // Area weighted center and normal of the cluster
+        glm::vec3 center(0.0f), normal(0.0f);
+        float area = 0.0f;
+        for(size_t t = clusters[c].begin; t < clusters[c].end; ++t)
+        {
+            const glm::vec3& p0 = vertexPositions[indices[t * 3]];
+            const glm::vec3& p1 = vertexPositions[indices[t * 3 + 1]];
+            const glm::vec3& p2 = vertexPositions[indices[t * 3 + 2]];
+            glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+            float a = glm::length(n);
+            center += (p0 + p1 + p2) * (a / 3.0f);
+            normal += n;
+            area += a;
+        }
+        if(area > 0.0f)
+        {
+            center /= area;
+        }
+        float length = glm::length(normal);
+        clusters[c].sortKey = length > 0.0f ? glm::dot(center - meshCenter, normal / length) : 0.0f;
+    }
+
+    std::stable_sort(clusters.begin(), clusters.end(), compareClusters);
+
+    std::vector<GLuint> result;
+    result.reserve(numIndices);
+    for(size_t c = 0; c < clusters.size(); ++c)
+    {
+        result.insert(result.end(), indices + clusters[c].begin * 3, indices + clusters[c].end * 3);
+    }
+    memcpy(indices, &result[0], numIndices * sizeof(GLuint));
+}
+
+size_t optimizeVertexFetch(void* vertices, size_t stride, GLuint* indices, size_t numIndices, size_t numVertices)
+{
+    const GLuint unused = ~0u;
+    std::vector<GLuint> remap(numVertices, unused);
+    GLuint next = 0;
+    for(size_t i = 0; i < numIndices; ++i)
+    {
+        GLuint& r = remap[indices[i]];
+        if(r == unused)
+        {
+            r = next++;
+        }
+        indices[i] = r;
+    }
+
+    char* bytes = (char*)vertices;
+    std::vector<char> reordered((size_t)next * stride);
+    for(size_t v = 0; v < numVertices; ++v)
+    {
+        if(remap[v] != unused)
+        {
+            memcpy(&reordered[remap[v] * stride], bytes + v * stride, stride);
+        }
+    }
+    if(next > 0)
+    {
+        memcpy(bytes, &reordered[0], reordered.size());
+    }
+    return next;
+}
+
+size_t optimizeMesh(const char* name, void* vertices, size_t stride, size_t numVertices,
+        GLuint* indices, size_t numIndices, bool overdraw)
+{
+    VertexCacheStats before = analyzeVertexCache(indices, numIndices, numVertices);
+
+    optimizeVertexCache(indices, numIndices, numVertices);
+    if(overdraw)
+    {
+        optimizeOverdraw(indices, numIndices, vertices, stride);
+    }
+    size_t newNumVertices = optimizeVertexFetch(vertices, stride, indices, numIndices, numVertices);
+
+    VertexCacheStats after = analyzeVertexCache(indices, numIndices, newNumVertices);
+    std::cout << "Optimized " << name << ": ACMR " << before.acmr << " -> " << after.acmr
+        << ", ATVR " << before.atvr << " -> " << after.atvr << std::endl;
+    return newNumVertices;
+}
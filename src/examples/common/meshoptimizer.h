@@ -0,0 +1,52 @@
+#ifndef MESH_OPTIMIZER_HEADER
+#define MESH_OPTIMIZER_HEADER
+
+#include "util.h"
+
+/**
+ * Post-transform vertex cache efficiency of an index buffer,
+ * measured by simulating a FIFO cache
+ */
+struct VertexCacheStats
+{
+    // Average cache miss ratio: transformed vertices per triangle (0.5 - 3, lower is better)
+    float acmr;
+    // Average transform to vertex ratio: transformed vertices per vertex (1 is optimal)
+    float atvr;
+};
+
+VertexCacheStats analyzeVertexCache(const GLuint* indices, size_t numIndices, size_t numVertices,
+        unsigned int cacheSize = 16);
+
+/**
+ * Reorder triangles so vertices are reused while they are still in the
+ * post-transform cache, using Tom Forsyth's linear-speed algorithm.
+ */
+void optimizeVertexCache(GLuint* indices, size_t numIndices, size_t numVertices);
+
+/**
+ * Reorder triangles in clusters so that triangles facing away from the center
+ * of the mesh come first. They are the most likely to occlude the rest, so less
+ * fragments are shaded and then overwritten. Run this after optimizeVertexCache:
+ * clusters are split where the cache order starts over, so the cache hit rate stays.
+ * @param positions Pointer to the position (3 floats) of the first vertex
+ * @param stride Bytes between two vertices
+ */
+void optimizeOverdraw(GLuint* indices, size_t numIndices, const void* positions, size_t stride);
+
+/**
+ * Reorder vertices in the order the indices first use them, so vertex fetch
+ * reads memory linearly. Vertices that are not used are removed.
+ * @return The new number of vertices
+ */
+size_t optimizeVertexFetch(void* vertices, size_t stride, GLuint* indices, size_t numIndices, size_t numVertices);
+
+/**
+ * Run all of the above on an interleaved mesh whose first attribute is
+ * the position, and print the cache statistics before and after.
+ * @return The new number of vertices
+ */
+size_t optimizeMesh(const char* name, void* vertices, size_t stride, size_t numVertices,
+        GLuint* indices, size_t numIndices, bool overdraw);
+
+#endif
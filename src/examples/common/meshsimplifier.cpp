@@ -0,0 +1,308 @@
+#include "meshsimplifier.h"
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unordered_set>
+#include <vector>
+
+/**
+ * Sum of squared distances to a set of planes, as the symmetric matrix Q
+ * in error(p) = (p, 1)^T Q (p, 1), and the sum of the weights of the planes
+ */
+struct Quadric
+{
+    double xx, xy, xz, xw, yy, yz, yw, zz, zw, ww;
+    double weight;
+};
+
+static void addPlane(Quadric& q, const glm::dvec3& n, double d, double weight)
+{
+    q.xx += weight * n.x * n.x;
+    q.xy += weight * n.x * n.y;
+    q.xz += weight * n.x * n.z;
+    q.xw += weight * n.x * d;
+    q.yy += weight * n.y * n.y;
+    q.yz += weight * n.y * n.z;
+    q.yw += weight * n.y * d;
+    q.zz += weight * n.z * n.z;
+    q.zw += weight * n.z * d;
+    q.ww += weight * d * d;
+    q.weight += weight;
+}
+
+static void addQuadric(Quadric& q, const Quadric& r)
+{
+    q.xx += r.xx;
+    q.xy += r.xy;
+    q.xz += r.xz;
+    q.xw += r.xw;
+    q.yy += r.yy;
+    q.yz += r.yz;
+    q.yw += r.yw;
+    q.zz += r.zz;
+    q.zw += r.zw;
+    q.ww += r.ww;
+    q.weight += r.weight;
+}
+
+static double evaluate(const Quadric& q, const glm::vec3& p)
+{
+    double x = p.x, y = p.y, z = p.z;
+    double error = q.xx * x * x + q.yy * y * y + q.zz * z * z + q.ww
+        + 2.0 * (q.xy * x * y + q.xz * x * z + q.yz * y * z + q.xw * x + q.yw * y + q.zw * z);
+    // The mean squared distance to the planes, rounding can make it slightly negative
+    return q.weight > 0.0 ? std::max(error / q.weight, 0.0) : 0.0;
+}
+
+struct Collapse
+{
+    GLuint from, to;
+    double cost;
+
+    bool operator<(const Collapse& other) const
+    {
+        return cost < other.cost;
+    }
+};
+
+static unsigned long long edgeKey(GLuint a, GLuint b)
+{
+    return ((unsigned long long)a << 32) | b;
+}
+
+size_t simplifyMesh(GLuint* destination, const GLuint* indices, size_t numIndices,
+        const void* positions, size_t stride, size_t numVertices,
+        size_t targetIndices, float maxError, float* resultError)
+{
+    std::vector<glm::vec3> points(numVertices);
+    for(size_t i = 0; i < numVertices; ++i)
+    {
+        const float* position = (const float*)((const char*)positions + i * stride);
+        points[i] = glm::vec3(position[0], position[1], position[2]);
+    }
+
+    // Vertices at the same position (wedges) are one corner of the surface. Sorted by position,
+    // the wedges of a corner are next to each other, and welded points to the first of them
+    std::vector<GLuint> wedges(numVertices), welded(numVertices), firstWedge(numVertices), numWedges(numVertices, 0);
+    for(size_t i = 0; i < numVertices; ++i)
+    {
+        wedges[i] = i;
+    }
+    std::sort(wedges.begin(), wedges.end(), [&points](GLuint a, GLuint b)
+    {
+        const glm::vec3& p = points[a];
+        const glm::vec3& q = points[b];
+        return p.x < q.x || (p.x == q.x && (p.y < q.y || (p.y == q.y && p.z < q.z)));
+    });
+    for(size_t i = 0; i < numVertices; ++i)
+    {
+        bool same = i > 0 && points[wedges[i]] == points[wedges[i - 1]];
+        welded[wedges[i]] = same ? welded[wedges[i - 1]] : wedges[i];
+        if(!same)
+        {
+            firstWedge[wedges[i]] = i;
+        }
+        numWedges[welded[wedges[i]]]++;
+    }
+
+    // Every corner starts out with the planes of the triangles around it, weighted by their area
+    std::vector<Quadric> quadrics(numVertices);
+    memset(&quadrics[0], 0, numVertices * sizeof(Quadric));
+    std::unordered_set<unsigned long long> edges;
+    for(size_t i = 0; i < numIndices; i += 3)
+    {
+        GLuint w[3] = { welded[indices[i]], welded[indices[i + 1]], welded[indices[i + 2]] };
+        glm::dvec3 p0(points[w[0]]), p1(points[w[1]]), p2(points[w[2]]);
+        glm::dvec3 normal = glm::cross(p1 - p0, p2 - p0);
+        double length = glm::length(normal);
+        for(int k = 0; k < 3; ++k)
+        {
+            edges.insert(edgeKey(w[k], w[(k + 1) % 3]));
+            if(length > 0.0)
+            {
+                addPlane(quadrics[w[k]], normal / length, -glm::dot(normal / length, p0), 0.5 * length);
+            }
+        }
+    }
+
+    // Corners on a border, or where more than two wedges meet, stay where they are.
+    // A corner with two wedges is on a seam, it can only move along the seam.
+    std::vector<bool> locked(numVertices, false);
+    for(std::unordered_set<unsigned long long>::const_iterator it = edges.begin(); it != edges.end(); ++it)
+    {
+        // An edge that is only used in one direction is on a border
+        GLuint a = *it >> 32, b = *it & 0xffffffffu;
+        if(!edges.count(edgeKey(b, a)))
+        {
+            locked[a] = locked[b] = true;
+        }
+    }
+    for(size_t v = 0; v < numVertices; ++v)
+    {
+        locked[v] = locked[v] || numWedges[v] > 2;
+    }
+
+    memcpy(destination, indices, numIndices * sizeof(GLuint));
+    size_t count = numIndices;
+    double error = 0.0;
+    double maxCost = (double)maxError * maxError;
+    std::vector<GLuint> remap(numVertices), offsets(numVertices + 1), fill(numVertices), triangles;
+    std::vector<bool> touched(numVertices);
+    std::vector<Collapse> collapses;
+
+    // Every pass collapses edges that are far enough apart not to affect each other
+    while(count > targetIndices)
+    {
+        // The triangles around every wedge
+        std::fill(offsets.begin(), offsets.end(), 0);
+        for(size_t i = 0; i < count; ++i)
+        {
+            offsets[destination[i] + 1]++;
+        }
+        for(size_t v = 0; v < numVertices; ++v)
+        {
+            offsets[v + 1] += offsets[v];
+        }
+        triangles.resize(count);
+        std::copy(offsets.begin(), offsets.end() - 1, fill.begin());
+        for(size_t i = 0; i < count; ++i)
+        {
+            triangles[fill[destination[i]]++] = i / 3;
+        }
+
+        // Collapsing an edge moves the corner at one end onto the other
+        collapses.clear();
+        for(size_t i = 0; i < count; ++i)
+        {
+            GLuint from = welded[destination[i]];
+            GLuint to = welded[destination[i - i % 3 + (i + 1) % 3]];
+            if(!locked[from])
+            {
+                Quadric q = quadrics[from];
+                addQuadric(q, quadrics[to]);
+                Collapse collapse = { from, to, evaluate(q, points[to]) };
+                collapses.push_back(collapse);
+            }
+        }
+        std::sort(collapses.begin(), collapses.end());
+
+        for(size_t v = 0; v < numVertices; ++v)
+        {
+            remap[v] = v;
+        }
+        std::fill(touched.begin(), touched.end(), false);
+        size_t removed = 0;
+        bool collapsed = false;
+        for(size_t c = 0; c < collapses.size() && count - removed > targetIndices; ++c)
+        {
+            const Collapse& collapse = collapses[c];
+            if(collapse.cost > maxCost)
+            {
+                break;
+            }
+            GLuint from = collapse.from, to = collapse.to;
+            if(touched[from] || touched[to])
+            {
+                continue;
+            }
+
+            // Every wedge of the corner moves to the wedge it shares an edge with. If one has
+            // none, the edge crosses a seam instead of following it.
+            GLuint targets[2];
+            bool valid = true;
+            for(GLuint w = 0; w < numWedges[from] && valid; ++w)
+            {
+                GLuint wedge = wedges[firstWedge[from] + w];
+                valid = false;
+                for(GLuint t = offsets[wedge]; t < offsets[wedge + 1] && !valid; ++t)
+                {
+                    for(int k = 0; k < 3; ++k)
+                    {
+                        GLuint other = destination[triangles[t] * 3 + k];
+                        if(welded[other] == to)
+                        {
+                            targets[w] = other;
+                            valid = true;
+                        }
+                    }
+                }
+            }
+
+            // Moving the corner must not turn any remaining triangle around
+            size_t edgeTriangles = 0;
+            for(GLuint w = 0; w < numWedges[from] && valid; ++w)
+            {
+                GLuint wedge = wedges[firstWedge[from] + w];
+                for(GLuint t = offsets[wedge]; t < offsets[wedge + 1] && valid; ++t)
+                {
+                    const GLuint* triangle = &destination[triangles[t] * 3];
+                    glm::vec3 before[3], after[3];
+                    bool onEdge = false;
+                    for(int k = 0; k < 3; ++k)
+                    {
+                        before[k] = after[k] = points[triangle[k]];
+                        if(triangle[k] == wedge)
+                        {
+                            after[k] = points[to];
+                        }
+                        onEdge |= welded[triangle[k]] == to;
+                    }
+                    if(onEdge)
+                    {
+                        edgeTriangles++;
+                        continue;
+                    }
+                    glm::vec3 n0 = glm::cross(before[1] - before[0], before[2] - before[0]);
+                    glm::vec3 n1 = glm::cross(after[1] - after[0], after[2] - after[0]);
+                    valid = glm::dot(n0, n1) > 0.0f;
+                }
+            }
+            if(!valid)
+            {
+                continue;
+            }
+
+            for(GLuint w = 0; w < numWedges[from]; ++w)
+            {
+                GLuint wedge = wedges[firstWedge[from] + w];
+                remap[wedge] = targets[w];
+                for(GLuint t = offsets[wedge]; t < offsets[wedge + 1]; ++t)
+                {
+                    for(int k = 0; k < 3; ++k)
+                    {
+                        touched[welded[destination[triangles[t] * 3 + k]]] = true;
+                    }
+                }
+            }
+            addQuadric(quadrics[to], quadrics[from]);
+            error = std::max(error, collapse.cost);
+            removed += edgeTriangles * 3;
+            collapsed = true;
+        }
+        if(!collapsed)
+        {
+            break;
+        }
+
+        // Move the collapsed wedges and drop the triangles that became lines
+        size_t write = 0;
+        for(size_t i = 0; i < count; i += 3)
+        {
+            GLuint a = remap[destination[i]], b = remap[destination[i + 1]], c = remap[destination[i + 2]];
+            if(welded[a] != welded[b] && welded[b] != welded[c] && welded[a] != welded[c])
+            {
+                destination[write++] = a;
+                destination[write++] = b;
+                destination[write++] = c;
+            }
+        }
+        count = write;
+    }
+
+    if(resultError)
+    {
+        *resultError = (float)sqrt(error);
+    }
+    return count;
+}
@@ -0,0 +1,26 @@
+#ifndef MESH_SIMPLIFIER_HEADER
+#define MESH_SIMPLIFIER_HEADER
+
+#include "util.h"
+
+/**
+ * Simplify a triangle mesh by collapsing edges, cheapest first by the quadric error
+ * metric of Garland and Heckbert. The vertices are not changed: the result is a new
+ * index buffer that uses fewer of them, so every level of detail can share one vertex buffer.
+ * Vertices on borders, and where more than two vertices share a position (with other
+ * attributes), are kept. A vertex on a seam between two such copies can only slide along
+ * the seam, both copies together, so the result has no cracks or stretched texture coordinates.
+ * @param destination Receives the indices, it needs room for numIndices
+ * @param positions Pointer to the position (3 floats) of the first vertex
+ * @param stride Bytes between two vertices
+ * @param targetIndices Stop once the mesh has this many indices or less
+ * @param maxError Do not collapse edges that move the surface further than this,
+ *        measured as the root mean square distance to the planes of the original triangles
+ * @param resultError Receives how far the surface moved at most, can be NULL
+ * @return The number of indices written to destination
+ */
+size_t simplifyMesh(GLuint* destination, const GLuint* indices, size_t numIndices,
+        const void* positions, size_t stride, size_t numVertices,
+        size_t targetIndices, float maxError, float* resultError);
+
+#endif
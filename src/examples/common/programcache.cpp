@@ -0,0 +1,250 @@
+#include "programcache.h"
+#include "shader.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Bump this whenever the layout of the cache file changes
+static const unsigned int CACHE_MAGIC = 0x42504c47; // "GLPB"
+static const unsigned int CACHE_VERSION = 1;
+
+struct CacheHeader
+{
+    unsigned int magic;
+    unsigned int version;
+    unsigned long long key;
+    unsigned int format;
+    unsigned int length;
+    // How long it took to compile and link the program the first time
+    double compileTime;
+};
+
+static std::string cacheDirectory = ".";
+static ProgramCacheStats stats = { 0, 0, 0.0, 0.0, 0.0 };
+
+static double secondsSince(const std::chrono::steady_clock::time_point& start)
+{
+    std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+    return d.count();
+}
+
+static unsigned long long hashString(unsigned long long hash, const char* str)
+{
+    // Hash the terminating zero too, so "ab" + "c" differs from "a" + "bc"
+    return hashBytes(str ? str : "", str ? strlen(str) + 1 : 1, hash);
+}
+
+static unsigned long long programKey(const char** sources, const GLenum* stages, int count)
+{
+    unsigned long long hash = hashBytes(&CACHE_VERSION, sizeof(CACHE_VERSION));
+    hash = hashString(hash, (const char*)glGetString(GL_VENDOR));
+    hash = hashString(hash, (const char*)glGetString(GL_RENDERER));
+    hash = hashString(hash, (const char*)glGetString(GL_VERSION));
+    for(int i = 0; i < count; ++i)
+    {
+        unsigned int stage = stages[i];
+        hash = hashBytes(&stage, sizeof(stage), hash);
+        hash = hashString(hash, sources[i]);
+    }
+    return hash;
+}
+
+static std::string cacheFileName(unsigned long long key)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "program_%016llx.bin", key);
+    return cacheDirectory + "/" + name;
+}
+
+static bool binariesSupported()
+{
+    GLint numFormats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+    return numFormats > 0;
+}
+
+static GLuint loadProgram(unsigned long long key)
+{
+    FILE* f = fopen(cacheFileName(key).c_str(), "rb");
+    if(!f)
+    {
+        return 0;
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    CacheHeader header;
+    std::vector<char> binary;
+    bool valid = fread(&header, sizeof(header), 1, f) == 1
+        && header.magic == CACHE_MAGIC
+        && header.version == CACHE_VERSION
+        && header.key == key
+        && header.length > 0;
+    if(valid)
+    {
+        binary.resize(header.length);
+        valid = fread(&binary[0], 1, binary.size(), f) == binary.size();
+    }
+    fclose(f);
+    if(!valid)
+    {
+        return 0;
+    }
+
+    GLuint program = glCreateProgram();
+    glProgramBinary(program, header.format, &binary[0], header.length);
+    // The driver is allowed to reject a binary, for example after an update
+    GLint status;
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    if(!status)
+    {
+        glDeleteProgram(program);
+        return 0;
+    }
+
+    double loadTime = secondsSince(start);
+    stats.hits++;
+    stats.loadTime += loadTime;
+    stats.timeSaved += header.compileTime - loadTime;
+    return program;
+}
+
+static void storeProgram(GLuint program, unsigned long long key, double compileTime)
+{
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if(length <= 0)
+    {
+        return;
+    }
+
+    std::vector<char> binary(length);
+    GLenum format;
+    glGetProgramBinary(program, length, NULL, &format, &binary[0]);
+
+    CacheHeader header;
+    header.magic = CACHE_MAGIC;
+    header.version = CACHE_VERSION;
+    header.key = key;
+    header.format = format;
+    header.length = length;
+    header.compileTime = compileTime;
+
+    std::string fileName = cacheFileName(key);
+    FILE* f = fopen(fileName.c_str(), "wb");
+    if(!f)
+    {
+        std::cerr << "Could not write program cache file " << fileName << std::endl;
+        return;
+    }
+    fwrite(&header, sizeof(header), 1, f);
+    fwrite(&binary[0], 1, binary.size(), f);
+    fclose(f);
+}
+
+static GLuint compileProgram(const char** sources, const GLenum* stages, int count, bool retrievable)
+{
+    GLuint shaders[3];
+    for(int i = 0; i < count; ++i)
+    {
+        shaders[i] = createShader(sources[i], stages[i]);
+        if(!shaders[i])
+        {
+            for(int j = 0; j < i; ++j)
+            {
+                glDeleteShader(shaders[j]);
+            }
+            return 0;
+        }
+    }
+
+    GLuint program = glCreateProgram();
+    for(int i = 0; i < count; ++i)
+    {
+        glAttachShader(program, shaders[i]);
+    }
+    if(retrievable)
+    {
+        // Has to be set before linking, or there will be no binary to retrieve
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+    bool result = linkShader(program);
+
+    // Detach and delete the shaders, because we no longer need them
+    for(int i = 0; i < count; ++i)
+    {
+        glDetachShader(program, shaders[i]);
+        glDeleteShader(shaders[i]);
+    }
+
+    if(!result)
+    {
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+static GLuint createCachedProgram(const char** sources, const GLenum* stages, int count)
+{
+    bool supported = binariesSupported();
+    unsigned long long key = programKey(sources, stages, count);
+
+    if(supported)
+    {
+        GLuint program = loadProgram(key);
+        if(program)
+        {
+            return program;
+        }
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    GLuint program = compileProgram(sources, stages, count, supported);
+    if(!program)
+    {
+        return 0;
+    }
+    double compileTime = secondsSince(start);
+    stats.misses++;
+    stats.compileTime += compileTime;
+
+    if(supported)
+    {
+        storeProgram(program, key, compileTime);
+    }
+    return program;
+}
+
+void setProgramCacheDirectory(const char* directory)
+{
+    cacheDirectory = directory;
+}
+
+GLuint createCachedProgram(const char* vertexSrc, const char* fragmentSrc)
+{
+    const char* sources[] = { vertexSrc, fragmentSrc };
+    const GLenum stages[] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER };
+    return createCachedProgram(sources, stages, 2);
+}
+
+GLuint createCachedProgram(const char* vertexSrc, const char* geometrySrc, const char* fragmentSrc)
+{
+    const char* sources[] = { vertexSrc, geometrySrc, fragmentSrc };
+    const GLenum stages[] = { GL_VERTEX_SHADER, GL_GEOMETRY_SHADER, GL_FRAGMENT_SHADER };
+    return createCachedProgram(sources, stages, 3);
+}
+
+const ProgramCacheStats& getProgramCacheStats()
+{
+    return stats;
+}
+
+void printProgramCacheStats()
+{
+    std::cout << "Program cache: " << stats.hits << " hits, " << stats.misses << " misses, "
+        << stats.compileTime * 1000.0 << " ms compiling, " << stats.loadTime * 1000.0 << " ms loading, "
+        << stats.timeSaved * 1000.0 << " ms saved" << std::endl;
+}
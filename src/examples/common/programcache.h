@@ -0,0 +1,41 @@
+#ifndef PROGRAM_CACHE_HEADER
+#define PROGRAM_CACHE_HEADER
+
+#include "util.h"
+
+/**
+ * Statistics gathered by the program cache since startup.
+ * Times are in seconds.
+ */
+struct ProgramCacheStats
+{
+    int hits;
+    int misses;
+    // Time spent compiling and linking programs that were not cached
+    double compileTime;
+    // Time spent loading programs from their binary
+    double loadTime;
+    // Compile time that cached programs originally took, minus loadTime
+    double timeSaved;
+};
+
+/**
+ * Set the directory in which linked program binaries are stored.
+ * The default is the working directory.
+ */
+void setProgramCacheDirectory(const char* directory);
+
+/**
+ * Create and link a shader program, or load it from its cached binary.
+ * The key of the cache is a hash of the sources, the shader stages and
+ * the vendor, renderer and version strings of the driver, so a driver update
+ * or a change to a shader results in a recompile.
+ * @return The linked program, or 0 if compilation or linking failed
+ */
+GLuint createCachedProgram(const char* vertexSrc, const char* fragmentSrc);
+GLuint createCachedProgram(const char* vertexSrc, const char* geometrySrc, const char* fragmentSrc);
+
+const ProgramCacheStats& getProgramCacheStats();
+void printProgramCacheStats();
+
+#endif
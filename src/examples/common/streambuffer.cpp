@@ -0,0 +1,193 @@
+#include "streambuffer.h"
+#include <algorithm>
+#include <cstring>
+
+StreamBuffer::StreamBuffer(GLsizeiptr s)
+    : buffer(0), size(s), head(0), committed(0), retired(0), mappedSize(0)
+{
+    memset(&stats, 0, sizeof(stats));
+
+    // Mapping through GL_COPY_WRITE_BUFFER leaves the bindings of the vertex arrays alone
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, size, NULL, GL_STREAM_DRAW);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+StreamBuffer::~StreamBuffer()
+{
+    for(size_t i = 0; i < segments.size(); ++i)
+    {
+        glDeleteSync(segments[i].sync);
+    }
+    glDeleteBuffers(1, &buffer);
+}
+
+void* StreamBuffer::map(GLsizeiptr bytes, GLsizeiptr* offset, GLsizeiptr alignment)
+{
+    if(mappedSize > 0)
+    {
+        std::cerr << "Stream buffer is already mapped" << std::endl;
+        return NULL;
+    }
+    if(bytes <= 0 || bytes > size)
+    {
+        std::cerr << "Cannot stream " << bytes << " bytes through a buffer of " << size << std::endl;
+        return NULL;
+    }
+
+    // A range never crosses the end of the buffer, it starts over at 0 instead
+    GLsizeiptr start = head % size;
+    GLsizeiptr aligned = (start + alignment - 1) / alignment * alignment;
+    if(aligned + bytes > size)
+    {
+        head += size - start;
+        aligned = 0;
+    }
+    else
+    {
+        head += aligned - start;
+    }
+    if(aligned == 0 && head > 0)
+    {
+        stats.wraps++;
+    }
+    retire(head + bytes - size);
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    void* data = glMapBufferRange(GL_COPY_WRITE_BUFFER, aligned, bytes,
+            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_FLUSH_EXPLICIT_BIT);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    if(!data)
+    {
+        std::cerr << "Could not map stream buffer" << std::endl;
+        return NULL;
+    }
+    mappedSize = bytes;
+    *offset = aligned;
+    return data;
+}
+
+void StreamBuffer::unmap(GLsizeiptr used)
+{
+    if(mappedSize == 0)
+    {
+        return;
+    }
+    used = std::min(used, mappedSize);
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    if(used > 0)
+    {
+        glFlushMappedBufferRange(GL_COPY_WRITE_BUFFER, 0, used);
+    }
+    glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    head += used;
+    committed = head;
+    mappedSize = 0;
+    stats.bytes += used;
+}
+
+GLsizeiptr StreamBuffer::write(const void* data, GLsizeiptr bytes, GLsizeiptr alignment)
+{
+    GLsizeiptr offset;
+    void* target = map(bytes, &offset, alignment);
+    if(!target)
+    {
+        return -1;
+    }
+    memcpy(target, data, bytes);
+    unmap(bytes);
+    return offset;
+}
+
+void StreamBuffer::fence()
+{
+    long long fenced = segments.empty() ? retired : segments.back().end;
+    if(committed > fenced)
+    {
+        Segment segment = { glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), committed };
+        segments.push_back(segment);
+    }
+
+    // Forget the segments the GPU is already done with, without waiting
+    while(!segments.empty() && glClientWaitSync(segments.front().sync, 0, 0) != GL_TIMEOUT_EXPIRED)
+    {
+        glDeleteSync(segments.front().sync);
+        retired = segments.front().end;
+        segments.pop_front();
+    }
+}
+
+void StreamBuffer::reserve(GLsizeiptr bytes)
+{
+    if(bytes <= size)
+    {
+        return;
+    }
+    if(mappedSize > 0)
+    {
+        std::cerr << "Cannot grow a mapped stream buffer" << std::endl;
+        return;
+    }
+
+    // OpenGL keeps the old buffer until the draws that read it are done, so nothing waits
+    for(size_t i = 0; i < segments.size(); ++i)
+    {
+        glDeleteSync(segments[i].sync);
+    }
+    segments.clear();
+    glDeleteBuffers(1, &buffer);
+
+    size = bytes;
+    head = committed = retired = 0;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, size, NULL, GL_STREAM_DRAW);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+GLuint StreamBuffer::getBuffer() const
+{
+    return buffer;
+}
+
+const StreamBufferStats& StreamBuffer::getStats() const
+{
+    return stats;
+}
+
+void StreamBuffer::retire(long long position)
+{
+    bool stalled = false;
+    while(retired < position)
+    {
+        if(segments.empty())
+        {
+            if(committed <= retired)
+            {
+                break;
+            }
+            // More than a whole ring was written since the last fence
+            fence();
+            continue;
+        }
+
+        Segment& segment = segments.front();
+        GLenum status = glClientWaitSync(segment.sync, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+        while(status == GL_TIMEOUT_EXPIRED)
+        {
+            stalled = true;
+            status = glClientWaitSync(segment.sync, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+        }
+        glDeleteSync(segment.sync);
+        retired = segment.end;
+        segments.pop_front();
+    }
+    if(stalled)
+    {
+        stats.stalls++;
+    }
+}
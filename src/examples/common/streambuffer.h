@@ -0,0 +1,82 @@
+#ifndef STREAM_BUFFER_HEADER
+#define STREAM_BUFFER_HEADER
+
+#include "util.h"
+#include <deque>
+
+struct StreamBufferStats
+{
+    long long bytes;
+    // Times map() had to wait for the GPU to finish reading
+    long long stalls;
+    // Times writing went back to the start of the buffer
+    long long wraps;
+};
+
+/**
+ * A ring buffer for data that is written by the CPU every frame.
+ * Ranges are mapped unsynchronized, so the driver never reallocates or waits.
+ * Instead, fence() marks the data that draws were issued for, and map() only
+ * waits for those fences when the ring comes around to data still in use.
+ * The buffer can be bound to any target, so vertices and indices can share it.
+ */
+class StreamBuffer
+{
+public:
+    /**
+     * @param size Size of the ring in bytes, it should hold a few frames of data
+     */
+    StreamBuffer(GLsizeiptr size);
+    ~StreamBuffer();
+
+    /**
+     * Map size bytes for writing. Only one range can be mapped at a time.
+     * @param offset Receives where the range starts in the buffer
+     * @return The mapped memory, or NULL if it is larger than the buffer or mapping failed
+     */
+    void* map(GLsizeiptr size, GLsizeiptr* offset, GLsizeiptr alignment = 16);
+    /**
+     * Unmap the range again
+     * @param used The bytes that were written, from the start of the range
+     */
+    void unmap(GLsizeiptr used);
+    /**
+     * map(), copy and unmap()
+     * @return The offset of the data in the buffer, or -1 if it could not be mapped
+     */
+    GLsizeiptr write(const void* data, GLsizeiptr size, GLsizeiptr alignment = 16);
+    /**
+     * Put a fence after the draws that read the unmapped ranges,
+     * usually once per frame
+     */
+    void fence();
+    /**
+     * Grow the ring to at least size bytes, for when frames stream more than it was made for.
+     * Draws that were already issued keep reading the old buffer, so getBuffer() changes.
+     * It cannot be called while a range is mapped.
+     */
+    void reserve(GLsizeiptr size);
+
+    GLuint getBuffer() const;
+    const StreamBufferStats& getStats() const;
+private:
+    struct Segment
+    {
+        GLsync sync;
+        // Positions only grow, the offset in the buffer is position % size
+        long long end;
+    };
+
+    // Wait until the GPU is done with everything before the position
+    void retire(long long position);
+
+    GLuint buffer;
+    GLsizeiptr size;
+    // Next free position, end of the last unmapped range and end of the data the GPU is done with
+    long long head, committed, retired;
+    GLsizeiptr mappedSize;
+    std::deque<Segment> segments;
+    StreamBufferStats stats;
+};
+
+#endif
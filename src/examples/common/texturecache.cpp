@@ -0,0 +1,183 @@
+#include "texturecache.h"
+#include <fstream>
+#include <sstream>
+
+static bool isMipmapFilter(GLenum filter)
+{
+    return filter == GL_NEAREST_MIPMAP_NEAREST || filter == GL_LINEAR_MIPMAP_NEAREST
+        || filter == GL_NEAREST_MIPMAP_LINEAR || filter == GL_LINEAR_MIPMAP_LINEAR;
+}
+
+static bool readFile(const char* fileName, std::vector<unsigned char>& contents)
+{
+    std::ifstream file(fileName, std::ios::binary);
+    if(!file)
+    {
+        return false;
+    }
+    contents.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return !contents.empty();
+}
+
+TextureCache::TextureCache(size_t budget)
+    : budget(budget)
+{
+    stats.residentBytes = 0;
+    stats.hits = 0;
+    stats.misses = 0;
+    stats.evictions = 0;
+}
+
+TextureCache::~TextureCache()
+{
+    for(EntryIterator it = entries.begin(); it != entries.end(); ++it)
+    {
+        glDeleteTextures(1, &it->texture);
+    }
+}
+
+GLuint TextureCache::acquire(const char* fileName, int* w, int* h, int index, bool alphaChannel,
+        GLenum wrap, GLenum filter)
+{
+    std::ostringstream pathKey;
+    pathKey << fileName << '|' << alphaChannel << '|' << wrap << '|' << filter;
+    std::map<std::string, EntryIterator>::iterator path = byPath.find(pathKey.str());
+    if(path != byPath.end())
+    {
+        stats.hits++;
+        return use(path->second, w, h, index);
+    }
+
+    // Reading the file is cheap compared to decoding and uploading it
+    std::vector<unsigned char> contents;
+    if(!readFile(fileName, contents))
+    {
+        std::cerr << "Error loading image " << fileName << ": could not read file" << std::endl;
+        return 0;
+    }
+    unsigned long long contentKey = hashBytes(&contents[0], contents.size());
+    contentKey = hashBytes(&alphaChannel, sizeof(alphaChannel), contentKey);
+    contentKey = hashBytes(&wrap, sizeof(wrap), contentKey);
+    contentKey = hashBytes(&filter, sizeof(filter), contentKey);
+
+    std::map<unsigned long long, EntryIterator>::iterator content = byContent.find(contentKey);
+    if(content != byContent.end())
+    {
+        // Same image under another name
+        content->second->pathKeys.push_back(pathKey.str());
+        byPath[pathKey.str()] = content->second;
+        stats.hits++;
+        return use(content->second, w, h, index);
+    }
+
+    Entry entry;
+    unsigned char* img = SOIL_load_image_from_memory(&contents[0], contents.size(), &entry.width, &entry.height,
+            NULL, alphaChannel ? SOIL_LOAD_RGBA : SOIL_LOAD_RGB);
+    if(!img)
+    {
+        std::cerr << "Error loading image " << fileName << ": " << SOIL_last_result() << std::endl;
+        return 0;
+    }
+
+    GLenum magFilter = filter == GL_NEAREST || filter == GL_NEAREST_MIPMAP_NEAREST
+        || filter == GL_NEAREST_MIPMAP_LINEAR ? GL_NEAREST : GL_LINEAR;
+    glGenTextures(1, &entry.texture);
+    glActiveTexture(GL_TEXTURE0 + index);
+    glBindTexture(GL_TEXTURE_2D, entry.texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, magFilter);
+    glTexImage2D(GL_TEXTURE_2D, 0, alphaChannel ? GL_RGBA : GL_RGB, entry.width, entry.height, 0,
+            alphaChannel ? GL_RGBA : GL_RGB, GL_UNSIGNED_BYTE, img);
+    SOIL_free_image_data(img);
+
+    entry.bytes = (size_t)entry.width * entry.height * (alphaChannel ? 4 : 3);
+    if(isMipmapFilter(filter))
+    {
+        glGenerateMipmap(GL_TEXTURE_2D);
+        // The whole mipmap chain adds a third
+        entry.bytes += entry.bytes / 3;
+    }
+    entry.references = 0;
+    entry.contentKey = contentKey;
+    entry.pathKeys.push_back(pathKey.str());
+
+    entries.push_front(entry);
+    byPath[pathKey.str()] = entries.begin();
+    byContent[contentKey] = entries.begin();
+    byTexture[entry.texture] = entries.begin();
+    stats.misses++;
+    stats.residentBytes += entry.bytes;
+
+    GLuint texture = use(entries.begin(), w, h, index);
+    // The new texture may push us over budget, but it is referenced so it stays
+    evict();
+    return texture;
+}
+
+GLuint TextureCache::use(EntryIterator entry, int* w, int* h, int index)
+{
+    // Move to the front of the LRU list, iterators stay valid
+    entries.splice(entries.begin(), entries, entry);
+    entry->references++;
+    *w = entry->width;
+    *h = entry->height;
+    glActiveTexture(GL_TEXTURE0 + index);
+    glBindTexture(GL_TEXTURE_2D, entry->texture);
+    return entry->texture;
+}
+
+void TextureCache::release(GLuint texture)
+{
+    std::map<GLuint, EntryIterator>::iterator it = byTexture.find(texture);
+    if(it == byTexture.end() || it->second->references == 0)
+    {
+        std::cerr << "Released texture " << texture << " which is not in use" << std::endl;
+        return;
+    }
+    it->second->references--;
+    evict();
+}
+
+void TextureCache::evict()
+{
+    EntryIterator it = entries.end();
+    while(stats.residentBytes > budget && it != entries.begin())
+    {
+        --it;
+        if(it->references > 0)
+        {
+            continue;
+        }
+
+        for(size_t i = 0; i < it->pathKeys.size(); ++i)
+        {
+            byPath.erase(it->pathKeys[i]);
+        }
+        byContent.erase(it->contentKey);
+        byTexture.erase(it->texture);
+        glDeleteTextures(1, &it->texture);
+        stats.residentBytes -= it->bytes;
+        stats.evictions++;
+        it = entries.erase(it);
+    }
+}
+
+void TextureCache::setBudget(size_t budget)
+{
+    this->budget = budget;
+    evict();
+}
+
+const TextureCacheStats& TextureCache::getStats() const
+{
+    return stats;
+}
+
+void TextureCache::printStats() const
+{
+    std::cout << "Texture cache: " << stats.residentBytes / 1024 << " KiB resident of "
+        << budget / 1024 << " KiB, " << stats.hits << " hits, " << stats.misses << " misses, "
+        << stats.evictions << " evictions" << std::endl;
+}
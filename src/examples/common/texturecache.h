@@ -0,0 +1,77 @@
+#ifndef TEXTURE_CACHE_HEADER
+#define TEXTURE_CACHE_HEADER
+
+#include "util.h"
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+struct TextureCacheStats
+{
+    // Bytes of texture memory held by the cache, including unused textures
+    size_t residentBytes;
+    int hits;
+    int misses;
+    int evictions;
+};
+
+/**
+ * Shares textures between everything that loads the same image
+ * with the same parameters, see acquire().
+ * Textures are reference counted. Textures that are no longer referenced
+ * stay resident until the cache goes over its budget, and are then
+ * evicted least recently used first.
+ * Deleting the cache deletes all of its textures.
+ */
+class TextureCache
+{
+public:
+    /**
+     * @param budget Amount of texture memory in bytes that may stay resident
+     */
+    TextureCache(size_t budget = 256 * 1024 * 1024);
+    ~TextureCache();
+
+    /**
+     * Load an image like loadImage does, or reuse a texture that was loaded before.
+     * The key is made up of the contents of the file and the parameters,
+     * so copies of the same image under different names are only loaded once.
+     * The texture unit is not part of the key: the texture is just bound to it.
+     * Every successful acquire must be matched by a release.
+     * @param filter Minification filter. Mipmaps are generated for mipmap filters.
+     * @return The texture, or 0 if the image could not be loaded
+     */
+    GLuint acquire(const char* fileName, int* w, int* h, int index, bool alphaChannel,
+            GLenum wrap = GL_CLAMP_TO_EDGE, GLenum filter = GL_LINEAR);
+    void release(GLuint texture);
+
+    void setBudget(size_t budget);
+    const TextureCacheStats& getStats() const;
+    void printStats() const;
+private:
+    struct Entry
+    {
+        GLuint texture;
+        int width, height;
+        size_t bytes;
+        int references;
+        unsigned long long contentKey;
+        std::vector<std::string> pathKeys;
+    };
+    typedef std::list<Entry>::iterator EntryIterator;
+
+    GLuint use(EntryIterator entry, int* w, int* h, int index);
+    void evict();
+
+    // Most recently used first
+    std::list<Entry> entries;
+    // Shortcut from file name and parameters, so a hit does not read the file
+    std::map<std::string, EntryIterator> byPath;
+    std::map<unsigned long long, EntryIterator> byContent;
+    std::map<GLuint, EntryIterator> byTexture;
+    size_t budget;
+    TextureCacheStats stats;
+};
+
+#endif
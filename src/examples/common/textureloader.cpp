@@ -0,0 +1,245 @@
+#include "textureloader.h"
+#include <algorithm>
+
+TextureLoader::TextureLoader(int numThreads, size_t maxPendingBytes)
+    : pendingBytes(0), maxPendingBytes(maxPendingBytes), outstanding(0), stopping(false)
+{
+    if(numThreads <= 0)
+    {
+        // hardware_concurrency may return 0 if it does not know
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for(int i = 0; i < numThreads; ++i)
+    {
+        threads.push_back(std::thread(&TextureLoader::work, this));
+    }
+}
+
+TextureLoader::~TextureLoader()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        jobs.clear();
+    }
+    jobAvailable.notify_all();
+    spaceAvailable.notify_all();
+    for(size_t i = 0; i < threads.size(); ++i)
+    {
+        threads[i].join();
+    }
+    // Images that were decoded but never uploaded
+    for(size_t i = 0; i < decoded.size(); ++i)
+    {
+        if(decoded[i].img)
+        {
+            SOIL_free_image_data(decoded[i].img);
+        }
+    }
+}
+
+const AsyncTexture* TextureLoader::loadImage(const char* fileName, int index, bool alphaChannel)
+{
+    AsyncTexture texture = { 0, GL_TEXTURE_2D, 0, 0, false, false, 1 };
+    glGenTextures(1, &texture.texture);
+    glActiveTexture(GL_TEXTURE0 + index);
+    glBindTexture(GL_TEXTURE_2D, texture.texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    textures.push_back(texture);
+
+    Job job;
+    job.texture = &textures.back();
+    job.fileName = fileName;
+    job.target = GL_TEXTURE_2D;
+    job.index = index;
+    job.alphaChannel = alphaChannel;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs.push_back(job);
+        outstanding++;
+    }
+    jobAvailable.notify_one();
+
+    return job.texture;
+}
+
+const AsyncTexture* TextureLoader::loadCubeMap(const char* posX, const char* negX, const char* posY,
+        const char* negY, const char* posZ, const char* negZ)
+{
+    static const GLenum textureTypes[] =
+    {
+        GL_TEXTURE_CUBE_MAP_POSITIVE_X,
+        GL_TEXTURE_CUBE_MAP_NEGATIVE_X,
+        GL_TEXTURE_CUBE_MAP_POSITIVE_Y,
+        GL_TEXTURE_CUBE_MAP_NEGATIVE_Y,
+        GL_TEXTURE_CUBE_MAP_POSITIVE_Z,
+        GL_TEXTURE_CUBE_MAP_NEGATIVE_Z
+    };
+    const char* names[] =
+    {
+        posX,
+        negX,
+        posY,
+        negY,
+        posZ,
+        negZ
+    };
+
+    AsyncTexture texture = { 0, GL_TEXTURE_CUBE_MAP, 0, 0, false, false, 6 };
+    glGenTextures(1, &texture.texture);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, texture.texture);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    textures.push_back(texture);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for(int i = 0; i < 6; ++i)
+        {
+            Job job;
+            job.texture = &textures.back();
+            job.fileName = names[i];
+            job.target = textureTypes[i];
+            job.index = 0;
+            job.alphaChannel = true;
+            jobs.push_back(job);
+            outstanding++;
+        }
+    }
+    jobAvailable.notify_all();
+
+    return &textures.back();
+}
+
+void TextureLoader::work()
+{
+    while(true)
+    {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            jobAvailable.wait(lock, [this]() { return stopping || !jobs.empty(); });
+            if(stopping)
+            {
+                return;
+            }
+            job = jobs.front();
+            jobs.pop_front();
+        }
+
+        // This is the expensive part, and the reason the loader exists
+        DecodedImage image;
+        image.job = job;
+        image.img = SOIL_load_image(job.fileName.c_str(), &image.width, &image.height, NULL,
+                job.alphaChannel ? SOIL_LOAD_RGBA : SOIL_LOAD_RGB);
+        image.bytes = image.img ? (size_t)image.width * image.height * (job.alphaChannel ? 4 : 3) : 0;
+        if(!image.img)
+        {
+            std::cerr << "Error loading image " << job.fileName << ": " << SOIL_last_result() << std::endl;
+        }
+
+        {
+            // Wait for the GL thread to catch up when too much is waiting for upload,
+            // but never block when nothing is waiting or we could wait forever
+            std::unique_lock<std::mutex> lock(mutex);
+            spaceAvailable.wait(lock, [this, &image]()
+            {
+                return stopping || decoded.empty() || pendingBytes + image.bytes <= maxPendingBytes;
+            });
+            if(stopping)
+            {
+                if(image.img)
+                {
+                    SOIL_free_image_data(image.img);
+                }
+                return;
+            }
+            decoded.push_back(image);
+            pendingBytes += image.bytes;
+        }
+        imageDecoded.notify_one();
+    }
+}
+
+void TextureLoader::upload(const DecodedImage& image)
+{
+    AsyncTexture* texture = image.job.texture;
+    if(image.img)
+    {
+        GLenum format = image.job.alphaChannel ? GL_RGBA : GL_RGB;
+        // This runs in the render loop, so leave the active unit and its binding like the caller had them
+        GLint activeUnit, previous;
+        glGetIntegerv(GL_ACTIVE_TEXTURE, &activeUnit);
+        glActiveTexture(GL_TEXTURE0 + image.job.index);
+        glGetIntegerv(texture->target == GL_TEXTURE_CUBE_MAP ? GL_TEXTURE_BINDING_CUBE_MAP : GL_TEXTURE_BINDING_2D, &previous);
+        glBindTexture(texture->target, texture->texture);
+        glTexImage2D(image.job.target, 0, format, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, image.img);
+        glBindTexture(texture->target, previous);
+        glActiveTexture(activeUnit);
+        SOIL_free_image_data(image.img);
+        texture->width = image.width;
+        texture->height = image.height;
+    }
+    else
+    {
+        texture->failed = true;
+    }
+    texture->pendingImages--;
+    texture->ready = texture->pendingImages == 0 && !texture->failed;
+}
+
+int TextureLoader::update(size_t byteBudget)
+{
+    int uploaded = 0;
+    size_t bytes = 0;
+    while(uploaded == 0 || bytes < byteBudget)
+    {
+        DecodedImage image;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if(decoded.empty())
+            {
+                break;
+            }
+            image = decoded.front();
+            decoded.pop_front();
+            pendingBytes -= image.bytes;
+            outstanding--;
+        }
+        spaceAvailable.notify_all();
+
+        upload(image);
+        bytes += image.bytes;
+        uploaded++;
+    }
+    return uploaded;
+}
+
+void TextureLoader::finish()
+{
+    while(true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            imageDecoded.wait(lock, [this]() { return outstanding == 0 || !decoded.empty(); });
+            if(outstanding == 0)
+            {
+                return;
+            }
+        }
+        update((size_t)-1);
+    }
+}
+
+bool TextureLoader::isIdle()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return outstanding == 0;
+}
@@ -0,0 +1,108 @@
+#ifndef TEXTURE_LOADER_HEADER
+#define TEXTURE_LOADER_HEADER
+
+#include "util.h"
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * A texture that is being loaded by a TextureLoader.
+ * The texture name is valid as soon as the load is requested,
+ * so it can be handed to materials before the image data is there.
+ */
+struct AsyncTexture
+{
+    GLuint texture;
+    GLenum target; // GL_TEXTURE_2D or GL_TEXTURE_CUBE_MAP
+    int width, height;
+    // Set once every image of the texture has been uploaded
+    bool ready;
+    // Set if any image of the texture could not be decoded
+    bool failed;
+    // Images that still have to be uploaded (6 for a new cube map)
+    int pendingImages;
+};
+
+/**
+ * Decodes images on a pool of worker threads. The thread that owns the
+ * OpenGL context only uploads decoded images, in update().
+ * All public methods must be called from the thread that owns the context.
+ * Deleting the textures is up to the caller, like with loadImage.
+ */
+class TextureLoader
+{
+public:
+    /**
+     * @param numThreads Number of decoding threads, 0 to use one per core
+     * @param maxPendingBytes Maximum amount of decoded image data waiting
+     *        for upload, decoding threads block when it is reached
+     */
+    TextureLoader(int numThreads = 0, size_t maxPendingBytes = 64 * 1024 * 1024);
+    ~TextureLoader();
+
+    /**
+     * Request a 2D texture, see loadImage in util.h.
+     * The returned texture stays valid for the lifetime of the loader.
+     */
+    const AsyncTexture* loadImage(const char* fileName, int index, bool alphaChannel);
+    /**
+     * Request a cube map, see loadCubeMap in util.h.
+     * The six faces are decoded in parallel.
+     */
+    const AsyncTexture* loadCubeMap(const char* posX, const char* negX, const char* posY,
+            const char* negY, const char* posZ, const char* negZ);
+
+    /**
+     * Upload decoded images. Call this once per frame.
+     * The active texture unit and the textures bound to it are left as they were.
+     * @param byteBudget Stop uploading once this many bytes have been uploaded.
+     *        At least one image is uploaded if one is available.
+     * @return The number of images uploaded
+     */
+    int update(size_t byteBudget);
+    /**
+     * Block until every requested texture has been uploaded
+     */
+    void finish();
+    /**
+     * @return true if there are no images left to decode or upload
+     */
+    bool isIdle();
+private:
+    struct Job
+    {
+        AsyncTexture* texture;
+        std::string fileName;
+        GLenum target; // Face for cube maps
+        int index;
+        bool alphaChannel;
+    };
+    struct DecodedImage
+    {
+        Job job;
+        unsigned char* img;
+        int width, height;
+        size_t bytes;
+    };
+
+    void work();
+    void upload(const DecodedImage& image);
+
+    std::vector<std::thread> threads;
+    std::list<AsyncTexture> textures;
+    std::deque<Job> jobs;
+    std::deque<DecodedImage> decoded;
+    std::mutex mutex;
+    std::condition_variable jobAvailable, spaceAvailable, imageDecoded;
+    size_t pendingBytes, maxPendingBytes;
+    // Images that have been requested but not yet uploaded
+    int outstanding;
+    bool stopping;
+};
+
+#endif
@@ -160,3 +160,14 @@ void updateCamera(int width, int height, GLFWwindow* window)
     }
     camera->setPosition(position.x, position.y, position.z);
 }
+
+unsigned long long hashBytes(const void* data, size_t size, unsigned long long hash)
+{
+    const unsigned char* bytes = (const unsigned char*)data;
+    for(size_t i = 0; i < size; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
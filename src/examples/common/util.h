@@ -18,4 +18,11 @@ GLuint loadCubeMap(const char* posX, const char* negX, const char* posY,
 void setCamera(Camera* camera);
 void updateCamera(int width, int height, GLFWwindow* window);
 
+/**
+ * 64 bit FNV-1a hash, used as a cache key for shaders and textures.
+ * Pass the result of a previous call as hash to hash several buffers.
+ */
+unsigned long long hashBytes(const void* data, size_t size,
+        unsigned long long hash = 0xcbf29ce484222325ULL);
+
 #endif
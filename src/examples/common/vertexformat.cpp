@@ -0,0 +1,257 @@
+#include "vertexformat.h"
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+static GLuint getPackedSize(const AttributeFormat& a)
+{
+    switch(a.encoding)
+    {
+        case ENCODE_HALF:
+            return a.components * sizeof(GLushort);
+        case ENCODE_BOUNDS16:
+            return a.components * sizeof(GLushort);
+        case ENCODE_OCT16:
+            return 2 * sizeof(GLshort);
+        case ENCODE_10_10_10_2:
+            return sizeof(GLuint);
+        default:
+            return a.components * sizeof(GLfloat);
+    }
+}
+
+static float signNotZero(float v)
+{
+    return v < 0.0f ? -1.0f : 1.0f;
+}
+
+static glm::vec2 encodeOctahedron(glm::vec3 n)
+{
+    // Project onto the octahedron |x| + |y| + |z| = 1, and fold the lower half over the upper
+    n /= fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+    glm::vec2 e(n.x, n.y);
+    if(n.z < 0.0f)
+    {
+        e.x = (1.0f - fabsf(n.y)) * signNotZero(n.x);
+        e.y = (1.0f - fabsf(n.x)) * signNotZero(n.y);
+    }
+    return e;
+}
+
+static glm::vec3 decodeOctahedron(glm::vec2 e)
+{
+    glm::vec3 n(e.x, e.y, 1.0f - fabsf(e.x) - fabsf(e.y));
+    if(n.z < 0.0f)
+    {
+        n.x = (1.0f - fabsf(e.y)) * signNotZero(e.x);
+        n.y = (1.0f - fabsf(e.x)) * signNotZero(e.y);
+    }
+    return glm::normalize(n);
+}
+
+VertexLayout getVertexLayout(const VertexFormat& format)
+{
+    VertexLayout layout;
+    memset(&layout, 0, sizeof(layout));
+    layout.numAttributes = format.numAttributes;
+    GLuint offset = 0;
+    for(GLuint i = 0; i < format.numAttributes; ++i)
+    {
+        const AttributeFormat& a = format.attributes[i];
+        VertexAttribute& attribute = layout.attributes[i];
+        attribute.location = a.location;
+        attribute.offset = offset;
+        switch(a.encoding)
+        {
+            case ENCODE_HALF:
+                attribute.size = a.components;
+                attribute.type = GL_HALF_FLOAT;
+                attribute.normalized = GL_FALSE;
+                break;
+            case ENCODE_BOUNDS16:
+                attribute.size = a.components;
+                attribute.type = GL_UNSIGNED_SHORT;
+                attribute.normalized = GL_TRUE;
+                break;
+            case ENCODE_OCT16:
+                attribute.size = 2;
+                attribute.type = GL_SHORT;
+                attribute.normalized = GL_TRUE;
+                break;
+            case ENCODE_10_10_10_2:
+                // Packed types always have 4 components, the shader ignores w
+                attribute.size = 4;
+                attribute.type = GL_INT_2_10_10_10_REV;
+                attribute.normalized = GL_TRUE;
+                break;
+            default:
+                attribute.size = a.components;
+                attribute.type = GL_FLOAT;
+                attribute.normalized = GL_FALSE;
+                break;
+        }
+        offset += (getPackedSize(a) + 3) & ~3u;
+    }
+    layout.stride = offset;
+    return layout;
+}
+
+void packVertices(const VertexFormat& format, const float* vertices, size_t numVertices,
+        std::vector<unsigned char>& packed, float boundsMin[3], float boundsSize[3])
+{
+    VertexLayout layout = getVertexLayout(format);
+    GLuint sourceStride = 0;
+    GLuint sourceOffsets[MAX_VERTEX_ATTRIBUTES];
+    for(GLuint i = 0; i < format.numAttributes; ++i)
+    {
+        sourceOffsets[i] = sourceStride;
+        sourceStride += format.attributes[i].components;
+    }
+
+    // Bounding box of the attribute stored relative to it
+    for(int c = 0; c < 3; ++c)
+    {
+        boundsMin[c] = 0.0f;
+        boundsSize[c] = 1.0f;
+    }
+    for(GLuint i = 0; i < format.numAttributes; ++i)
+    {
+        const AttributeFormat& a = format.attributes[i];
+        if(a.encoding != ENCODE_BOUNDS16 || numVertices == 0)
+        {
+            continue;
+        }
+        for(GLuint c = 0; c < a.components && c < 3; ++c)
+        {
+            float lo = FLT_MAX, hi = -FLT_MAX;
+            for(size_t v = 0; v < numVertices; ++v)
+            {
+                float value = vertices[v * sourceStride + sourceOffsets[i] + c];
+                lo = std::min(lo, value);
+                hi = std::max(hi, value);
+            }
+            boundsMin[c] = lo;
+            // A flat box would divide by zero
+            boundsSize[c] = hi > lo ? hi - lo : 1.0f;
+        }
+    }
+
+    packed.assign(layout.stride * numVertices, 0);
+    for(size_t v = 0; v < numVertices; ++v)
+    {
+        unsigned char* vertex = &packed[v * layout.stride];
+        for(GLuint i = 0; i < format.numAttributes; ++i)
+        {
+            const AttributeFormat& a = format.attributes[i];
+            const float* source = &vertices[v * sourceStride + sourceOffsets[i]];
+            unsigned char* target = vertex + layout.attributes[i].offset;
+            switch(a.encoding)
+            {
+                case ENCODE_HALF:
+                    for(GLuint c = 0; c < a.components; ++c)
+                    {
+                        ((GLushort*)target)[c] = glm::packHalf1x16(source[c]);
+                    }
+                    break;
+                case ENCODE_BOUNDS16:
+                    for(GLuint c = 0; c < a.components; ++c)
+                    {
+                        ((GLushort*)target)[c] = glm::packUnorm1x16((source[c] - boundsMin[c]) / boundsSize[c]);
+                    }
+                    break;
+                case ENCODE_OCT16:
+                {
+                    glm::vec2 e = encodeOctahedron(glm::vec3(source[0], source[1], source[2]));
+                    ((GLushort*)target)[0] = glm::packSnorm1x16(e.x);
+                    ((GLushort*)target)[1] = glm::packSnorm1x16(e.y);
+                    break;
+                }
+                case ENCODE_10_10_10_2:
+                    *(GLuint*)target = glm::packSnorm3x10_1x2(glm::vec4(source[0], source[1], source[2], 0.0f));
+                    break;
+                default:
+                    memcpy(target, source, a.components * sizeof(float));
+                    break;
+            }
+        }
+    }
+}
+
+void printQuantizationError(const char* name, const VertexFormat& format, const float* vertices,
+        size_t numVertices, const std::vector<unsigned char>& packed,
+        const float boundsMin[3], const float boundsSize[3])
+{
+    VertexLayout layout = getVertexLayout(format);
+    GLuint sourceStride = 0;
+    for(GLuint i = 0; i < format.numAttributes; ++i)
+    {
+        sourceStride += format.attributes[i].components;
+    }
+
+    std::cout << "Quantized " << name << ": " << sourceStride * sizeof(float) << " -> "
+        << layout.stride << " bytes per vertex";
+    GLuint sourceOffset = 0;
+    for(GLuint i = 0; i < format.numAttributes; ++i)
+    {
+        const AttributeFormat& a = format.attributes[i];
+        float maxError = 0.0f;
+        for(size_t v = 0; v < numVertices; ++v)
+        {
+            const float* source = &vertices[v * sourceStride + sourceOffset];
+            const unsigned char* target = &packed[v * layout.stride + layout.attributes[i].offset];
+            float error = 0.0f;
+            switch(a.encoding)
+            {
+                case ENCODE_HALF:
+                    for(GLuint c = 0; c < a.components; ++c)
+                    {
+                        error = std::max(error, fabsf(glm::unpackHalf1x16(((const GLushort*)target)[c]) - source[c]));
+                    }
+                    break;
+                case ENCODE_BOUNDS16:
+                {
+                    float squared = 0.0f;
+                    for(GLuint c = 0; c < a.components; ++c)
+                    {
+                        float value = boundsMin[c] + glm::unpackUnorm1x16(((const GLushort*)target)[c]) * boundsSize[c];
+                        squared += (value - source[c]) * (value - source[c]);
+                    }
+                    error = sqrtf(squared);
+                    break;
+                }
+                case ENCODE_OCT16:
+                case ENCODE_10_10_10_2:
+                {
+                    glm::vec3 n;
+                    if(a.encoding == ENCODE_OCT16)
+                    {
+                        n = decodeOctahedron(glm::vec2(glm::unpackSnorm1x16(((const GLushort*)target)[0]),
+                                    glm::unpackSnorm1x16(((const GLushort*)target)[1])));
+                    }
+                    else
+                    {
+                        n = glm::normalize(glm::vec3(glm::unpackSnorm3x10_1x2(*(const GLuint*)target)));
+                    }
+                    // acos loses too much precision for small angles
+                    glm::vec3 original = glm::normalize(glm::vec3(source[0], source[1], source[2]));
+                    error = glm::degrees(atan2f(glm::length(glm::cross(n, original)), glm::dot(n, original)));
+                    break;
+                }
+                default:
+                    break;
+            }
+            maxError = std::max(maxError, error);
+        }
+
+        std::cout << ", attribute " << a.location << " error " << maxError;
+        if(a.encoding == ENCODE_OCT16 || a.encoding == ENCODE_10_10_10_2)
+        {
+            std::cout << " degrees";
+        }
+        sourceOffset += a.components;
+    }
+    std::cout << std::endl;
+}
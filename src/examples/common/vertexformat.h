@@ -0,0 +1,70 @@
+#ifndef VERTEX_FORMAT_HEADER
+#define VERTEX_FORMAT_HEADER
+
+#include "meshfile.h"
+#include <vector>
+
+/**
+ * How an attribute is stored in the vertex buffer
+ */
+enum AttributeEncoding
+{
+    // 32 bit floats, unchanged
+    ENCODE_FLOAT,
+    // 16 bit floats, for texture coordinates
+    ENCODE_HALF,
+    // 16 bit normalized relative to the bounding box of the mesh, for positions.
+    // The shader gets 0 - 1 and has to scale it back (see MeshFile::getBounds)
+    ENCODE_BOUNDS16,
+    // Octahedral mapping in 2 x 16 bit signed normalized, for unit vectors.
+    // The shader gets a vec2 and has to unfold it:
+    //     vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    //     if(n.z < 0.0) n.xy = (1.0 - abs(n.yx)) * (step(0.0, n.xy) * 2.0 - 1.0);
+    //     n = normalize(n);
+    ENCODE_OCT16,
+    // 10 bit signed normalized components, for unit vectors
+    ENCODE_10_10_10_2
+};
+
+struct AttributeFormat
+{
+    GLuint location;
+    // Number of floats in the source vertices
+    GLuint components;
+    AttributeEncoding encoding;
+};
+
+/**
+ * Describes how interleaved float vertices are packed into a vertex buffer.
+ * At most one attribute can use ENCODE_BOUNDS16.
+ */
+struct VertexFormat
+{
+    GLuint numAttributes;
+    AttributeFormat attributes[MAX_VERTEX_ATTRIBUTES];
+};
+
+/**
+ * The layout of vertices packed with a format.
+ * Every attribute starts on 4 bytes.
+ */
+VertexLayout getVertexLayout(const VertexFormat& format);
+
+/**
+ * Pack float vertices, with the attributes of the format in order
+ * @param packed Receives the vertices in the layout of getVertexLayout
+ * @param boundsMin, boundsSize Receive the bounding box that ENCODE_BOUNDS16 is relative to
+ */
+void packVertices(const VertexFormat& format, const float* vertices, size_t numVertices,
+        std::vector<unsigned char>& packed, float boundsMin[3], float boundsSize[3]);
+
+/**
+ * Unpack the vertices again and print the largest error of each attribute:
+ * the distance for positions, the angle for unit vectors, and the largest
+ * difference of any component for everything else.
+ */
+void printQuantizationError(const char* name, const VertexFormat& format, const float* vertices,
+        size_t numVertices, const std::vector<unsigned char>& packed,
+        const float boundsMin[3], const float boundsSize[3]);
+
+#endif